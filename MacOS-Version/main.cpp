@@ -2,9 +2,47 @@
 #include <QProcess>
 #include <QTemporaryDir>
 #include <QFileInfo>
+
+#include "isotreemodel.h"
+#include "isotreesources.h"
+#include "isoextractor.h"
+#include "isostagingarea.h"
+#include "isochangeset.h"
+#include "iso9660reader.h"
+#include "isovfs.h"
+#include "isocatalog.h"
+#include "xorrisojobrunner.h"
+#include "isotrace.h"
 //	1	Use the burn command: Type hdiutil burn /path/to/your/image.iso and press Enter.
 //	2	Erase a CD/RW first: Use hdiutil burn -erase /path/to/your/image.iso if needed. 
 	
+// The image (mounted, or read directly), with pending deletions hidden and
+// replacements flagged.
+class OverlaySource : public IsoDirectorySource {
+public:
+    OverlaySource(IsoDirectorySource *base, const QHash<QString, QString> &modifiedFiles,
+                  const QSet<QString> &deletedFiles)
+        : base(base), modifiedFiles(modifiedFiles), deletedFiles(deletedFiles) {}
+
+    IsoTreeEntry rootEntry() override { return base->rootEntry(); }
+
+    bool listDirectory(const QString &path, const IsoTreeEntry &dir, QVector<IsoTreeEntry> &out) override {
+        if (!base->listDirectory(path, dir, out)) return false;
+        const QString prefix = path == "/" ? QString() : path.mid(1) + "/";
+        for (int i = out.size() - 1; i >= 0; --i) {
+            const QString relPath = prefix + out.at(i).name;
+            if (deletedFiles.contains(relPath)) out.remove(i);
+            else if (modifiedFiles.contains(relPath)) out[i].flags |= IsoTreeModel::Modified;
+        }
+        return true;
+    }
+
+private:
+    IsoDirectorySource *base;
+    const QHash<QString, QString> &modifiedFiles;
+    const QSet<QString> &deletedFiles;
+};
+
 	class IsoManager : public QWidget {
     Q_OBJECT
 public:
@@ -34,8 +72,17 @@ public:
         btnLayout->addWidget(bootableCheck);
         btnLayout->addWidget(rebuildBtn);
 
-        treeView = new QTreeWidget;
-        treeView->setHeaderLabels({"Name"});
+        model = new IsoTreeModel(this);
+        model->setHeaderLabel("Name");
+        QFont markedFont = font();
+        markedFont.setItalic(true);
+        model->setFlagData(IsoTreeModel::Modified, Qt::FontRole, markedFont);
+        model->setFlagData(IsoTreeModel::Modified, Qt::ForegroundRole, QBrush(Qt::darkGreen));
+        model->setFlagData(IsoTreeModel::Added, Qt::FontRole, markedFont);
+        model->setFlagData(IsoTreeModel::Added, Qt::ForegroundRole, QBrush(Qt::darkBlue));
+
+        treeView = new QTreeView;
+        treeView->setModel(model);
         treeView->setSelectionMode(QAbstractItemView::ExtendedSelection);
         treeView->setDragDropMode(QAbstractItemView::DropOnly);
         treeView->setAcceptDrops(true);
@@ -58,12 +105,43 @@ public:
         connect(extractBtn, &QPushButton::clicked, this, &IsoManager::extractSelectedFiles);
         connect(deleteBtn, &QPushButton::clicked, this, &IsoManager::deleteSelectedFiles);
         connect(rebuildBtn, &QPushButton::clicked, this, &IsoManager::rebuildIso);
-        connect(treeView, &QTreeWidget::itemSelectionChanged, this, [this]() {
-            bool hasSelection = !treeView->selectedItems().isEmpty();
+        connect(treeView->selectionModel(), &QItemSelectionModel::selectionChanged, this, [this]() {
+            bool hasSelection = treeView->selectionModel()->hasSelection();
             extractBtn->setEnabled(hasSelection);
             deleteBtn->setEnabled(hasSelection);
         });
 
+        jobs = new XorrisoJobRunner(this);
+        connect(jobs, &XorrisoJobRunner::progress, this, [this](int, double percent, double bytesPerSecond, qint64) {
+            if (percent < 0) return;
+            QString text = QString("Building ISO... %1%").arg(percent, 0, 'f', 1);
+            if (bytesPerSecond >= 0) text += QString(" (%1 MB/s)").arg(bytesPerSecond / (1024.0 * 1024.0), 0, 'f', 1);
+            statusLabel->setText(text);
+        });
+        connect(jobs, &XorrisoJobRunner::jobFinished, this, [this](int, bool ok, int) {
+            if (ok) {
+                rebuildDone(pendingOutput);
+            } else {
+                statusLabel->setText("Failed to build ISO.");
+                rebuildBtn->setEnabled(true);
+            }
+        });
+
+        extractor = new IsoExtractor(this);
+        connect(extractor, &IsoExtractor::progress, this,
+                [this](qint64 done, qint64 total, int filesDone, int filesTotal, double bytesPerSecond) {
+            statusLabel->setText(QString("Extracting %1/%2 files, %3 of %4 MB (%5 MB/s)")
+                                 .arg(filesDone).arg(filesTotal)
+                                 .arg(done / (1024.0 * 1024.0), 0, 'f', 1)
+                                 .arg(total / (1024.0 * 1024.0), 0, 'f', 1)
+                                 .arg(qMax(0.0, bytesPerSecond) / (1024.0 * 1024.0), 0, 'f', 1));
+        });
+        connect(extractor, &IsoExtractor::finished, this, [this](int failures, bool) {
+            statusLabel->setText(failures ? QString("Extraction done, %1 file(s) failed.").arg(failures)
+                                          : QString("Selected files extracted."));
+            extractBtn->setEnabled(treeView->selectionModel()->hasSelection());
+        });
+
         setAcceptDrops(true);
         mounted = false;
     }
@@ -102,6 +180,8 @@ private slots:
         QString iso = QFileDialog::getOpenFileName(this, "Open ISO file", "", "*.iso");
         if (iso.isEmpty()) return;
         isoFilePath = iso;
+        catalog.close();
+        vfs.close();
         statusLabel->setText("ISO selected: " + iso);
         mountBtn->setEnabled(true);
         unmountBtn->setEnabled(false);
@@ -122,19 +202,35 @@ private slots:
             return;
         }
 
-        mountPoint = QDir::tempPath() + "/iso_mnt_" + QString::number(QDateTime::currentMSecsSinceEpoch());
-        QDir().mkpath(mountPoint);
-
-        QProcess proc;
-        proc.start("hdiutil", {"attach", isoFilePath, "-mountpoint", mountPoint, "-readonly"});
-        proc.waitForFinished();
-        if (proc.exitCode() != 0) {
-            QMessageBox::critical(this, "Mount failed", proc.readAllStandardError());
+        if (vfs.open(isoFilePath)) {
+            // Browsing and extracting read the image in-process; nothing is
+            // attached and no privileges are needed.
+            mountPoint.clear();
+            statusLabel->setText("Reading " + isoFilePath + " directly");
+            // Without hdiutil (Linux), also make it a real folder for other
+            // programs through the FUSE helper when it is installed.
+            const QString helper = fuseHelper();
+            if (QStandardPaths::findExecutable("hdiutil").isEmpty() && !helper.isEmpty()) {
+                QString error;
+                mountPoint = fuseMount(helper, &error);
+                if (mountPoint.isEmpty()) statusLabel->setText("Reading " + isoFilePath + " directly (" + error + ")");
+                else statusLabel->setText("Mounted at: " + mountPoint);
+            }
+        } else if (QStandardPaths::findExecutable("hdiutil").isEmpty()) {
+            QMessageBox::critical(this, "Open failed", vfs.errorString());
             return;
+        } else {
+            // Not ISO9660 (HFS-only and the like): let macOS mount it.
+            QString error;
+            mountPoint = attachImage(&error);
+            if (mountPoint.isEmpty()) {
+                QMessageBox::critical(this, "Mount failed", error);
+                return;
+            }
+            statusLabel->setText("Mounted at: " + mountPoint);
         }
 
         mounted = true;
-        statusLabel->setText("Mounted at: " + mountPoint);
         mountBtn->setEnabled(false);
         unmountBtn->setEnabled(true);
         rebuildBtn->setEnabled(true);
@@ -145,11 +241,12 @@ private slots:
     void unmountIso() {
         if (!mounted) return;
 
-        QProcess proc;
-        proc.start("hdiutil", {"detach", mountPoint});
-        proc.waitForFinished();
-
-        if (proc.exitCode() == 0) {
+        QString error;
+        catalog.close();
+        vfs.close();
+        const bool detached = mountPoint.isEmpty()
+                              || (fuseProcess ? fuseUnmount(mountPoint, &error) : detachImage(mountPoint, &error));
+        if (detached) {
             mounted = false;
             mountBtn->setEnabled(true);
             unmountBtn->setEnabled(false);
@@ -161,120 +258,94 @@ private slots:
             deletedFiles.clear();
             statusLabel->setText("ISO unmounted");
         } else {
-            QMessageBox::critical(this, "Unmount failed", proc.readAllStandardError());
+            QMessageBox::critical(this, "Unmount failed", error);
         }
     }
 
-    void loadDirectoryTree() {
-        clearTree();
-        addDirectoryItems(nullptr, mountPoint);
+    QString attachImage(QString *error) {
+        const QString dir = QDir::tempPath() + "/iso_mnt_" + QString::number(QDateTime::currentMSecsSinceEpoch());
+        QDir().mkpath(dir);
+        QProcess proc;
+        proc.start("hdiutil", {"attach", isoFilePath, "-mountpoint", dir, "-readonly"});
+        proc.waitForFinished();
+        if (proc.exitCode() == 0) return dir;
+        if (error) *error = proc.readAllStandardError();
+        QDir().rmdir(dir);
+        return QString();
     }
 
-    void addDirectoryItems(QTreeWidgetItem *parent, const QString &path) {
-        QDir dir(path);
-        QFileInfoList list = dir.entryInfoList(QDir::NoDotAndDotDot | QDir::AllEntries, QDir::DirsFirst | QDir::Name);
-        for (const QFileInfo &fi : list) {
-            // Skip deleted files
-            QString relPath = relativePath(fi.absoluteFilePath());
-            if (deletedFiles.contains(relPath)) continue;
-
-            QTreeWidgetItem *item = nullptr;
-            if (parent) {
-                item = new QTreeWidgetItem(parent, QStringList() << fi.fileName());
-                parent->addChild(item);
-            } else {
-                item = new QTreeWidgetItem(treeView, QStringList() << fi.fileName());
-                treeView->addTopLevelItem(item);
-            }
-            item->setData(0, Qt::UserRole, fi.absoluteFilePath());
-            item->setData(0, Qt::UserRole + 1, relPath); // store relative path for tracking
-
-            if (fi.isDir()) {
-                addDirectoryItems(item, fi.absoluteFilePath());
-            }
-
-            // Mark replaced files in tree
-            if (modifiedFiles.contains(relPath)) {
-                QFont f = item->font(0);
-                f.setItalic(true);
-                item->setFont(0, f);
-                item->setForeground(0, QBrush(Qt::darkGreen));
-            }
-        }
-        treeView->expandAll();
+    static QString fuseHelper() {
+        const QString local = QStandardPaths::findExecutable("isomanager-fuse", {QCoreApplication::applicationDirPath()});
+        return local.isEmpty() ? QStandardPaths::findExecutable("isomanager-fuse") : local;
+    }
 
-        // Also show newly added files not in original ISO
-        for (auto it = modifiedFiles.constBegin(); it != modifiedFiles.constEnd(); ++it) {
-            if (!fileExistsInTree(it.key())) {
-                addFileToTree(it.key());
-            }
+    // Runs the helper in the foreground so its lifetime follows the mount.
+    QString fuseMount(const QString &helper, QString *error) {
+        const QString dir = QDir::tempPath() + "/iso_mnt_" + QString::number(QDateTime::currentMSecsSinceEpoch());
+        QDir().mkpath(dir);
+        fuseProcess = new QProcess(this);
+        fuseProcess->start(helper, {isoFilePath, dir, "-f"});
+        QElapsedTimer clock;
+        clock.start();
+        while (clock.elapsed() < 5000) {
+            if (QStorageInfo(dir).rootPath() == dir) return dir;
+            if (fuseProcess->waitForFinished(50)) break;
         }
+        if (error) *error = QString::fromLocal8Bit(fuseProcess->readAllStandardError()).trimmed();
+        if (error && error->isEmpty()) *error = "the FUSE helper did not mount the image";
+        fuseProcess->kill();
+        fuseProcess->waitForFinished();
+        delete fuseProcess;
+        fuseProcess = nullptr;
+        QDir().rmdir(dir);
+        return QString();
     }
 
-    bool fileExistsInTree(const QString &relPath) {
-        QList<QTreeWidgetItem *> allItems;
-        for (int i=0; i < treeView->topLevelItemCount(); i++) {
-            collectAllItems(treeView->topLevelItem(i), allItems);
-        }
-        for (QTreeWidgetItem *item : allItems) {
-            if (item->data(0, Qt::UserRole + 1).toString() == relPath) return true;
+    bool fuseUnmount(const QString &dir, QString *error) {
+        QProcess proc;
+        const QString tool = QStandardPaths::findExecutable("fusermount3").isEmpty() ? "fusermount" : "fusermount3";
+        proc.start(tool, {"-u", dir});
+        proc.waitForFinished();
+        if (proc.exitCode() != 0) {
+            if (error) *error = proc.readAllStandardError();
+            return false;
         }
-        return false;
+        if (!fuseProcess->waitForFinished(5000)) fuseProcess->kill();
+        delete fuseProcess;
+        fuseProcess = nullptr;
+        QDir().rmdir(dir);
+        return true;
     }
 
-    void collectAllItems(QTreeWidgetItem *parent, QList<QTreeWidgetItem*> &out) {
-        out.append(parent);
-        for (int i=0; i < parent->childCount(); ++i)
-            collectAllItems(parent->child(i), out);
+    bool detachImage(const QString &dir, QString *error) {
+        QProcess proc;
+        proc.start("hdiutil", {"detach", dir});
+        proc.waitForFinished();
+        if (proc.exitCode() == 0) return true;
+        if (error) *error = proc.readAllStandardError();
+        return false;
     }
 
-    void addFileToTree(const QString &relPath) {
-        QStringList parts = relPath.split('/');
-        QTreeWidgetItem *parent = nullptr;
-        QList<QTreeWidgetItem*> currentLevel;
-
-        // Find or create the top-level item
-        currentLevel = treeView->findItems(parts[0], Qt::MatchExactly);
-        QTreeWidgetItem *item = nullptr;
-        if (!currentLevel.isEmpty()) {
-            item = currentLevel[0];
-        } else {
-            item = new QTreeWidgetItem(treeView, QStringList() << parts[0]);
-            treeView->addTopLevelItem(item);
+    void loadDirectoryTree() {
+        // Directories are listed only as they get expanded. A catalog cached
+        // from an earlier open beats walking the mounted filesystem.
+        if (!vfs.isOpen()) vfs.open(isoFilePath);
+        if (vfs.isOpen() && !catalog.load(isoFilePath)) IsoCatalog::buildInBackground(isoFilePath);
+        IsoDirectorySource *base = &readerSource;
+        if (!mountPoint.isEmpty() && !vfs.isOpen()) {
+            mountSource.reset(new FileSystemSource(mountPoint));
+            base = mountSource.data();
         }
-        parent = item;
-
-        // Create intermediate folders and file item
-        for (int i = 1; i < parts.size(); ++i) {
-            bool foundChild = false;
-            for (int c = 0; c < parent->childCount(); ++c) {
-                if (parent->child(c)->text(0) == parts[i]) {
-                    parent = parent->child(c);
-                    foundChild = true;
-                    break;
-                }
-            }
-            if (!foundChild) {
-                QTreeWidgetItem *newItem = new QTreeWidgetItem(parent, QStringList() << parts[i]);
-                parent->addChild(newItem);
-                parent = newItem;
+        OverlaySource *next = new OverlaySource(base, modifiedFiles, deletedFiles);
+        model->setSource(next);
+        source.reset(next);
+
+        // Also show newly added files not in original ISO
+        for (auto it = modifiedFiles.constBegin(); it != modifiedFiles.constEnd(); ++it) {
+            if (!model->findPath(it.key()).isValid()) {
+                model->addPath(it.key(), false, IsoTreeModel::Added);
             }
         }
-
-        // Store the relative path for this newly added item
-        parent->setData(0, Qt::UserRole + 1, relPath);
-
-        // Mark it as modified (newly added)
-        QFont f = parent->font(0);
-        f.setItalic(true);
-        parent->setFont(0, f);
-        parent->setForeground(0, QBrush(Qt::darkBlue));
-    }
-
-    QString relativePath(const QString &absPath) const {
-        if (absPath.startsWith(mountPoint))
-            return absPath.mid(mountPoint.length() + 1);
-        return absPath;
     }
 
     void addOrReplaceFile(const QString &sourcePath, const QString &relPath) {
@@ -283,46 +354,57 @@ private slots:
         deletedFiles.remove(relPath); // If previously marked for deletion, unmark it
 
         statusLabel->setText(QString("Added/Replaced: %1").arg(relPath));
-        loadDirectoryTree(); // refresh tree view
+        if (source) {
+            // Update the tree in place so expanded directories stay open
+            QModelIndex existing = model->findPath(relPath);
+            if (existing.isValid()) model->setNodeFlags(existing, IsoTreeModel::Modified);
+            else model->addPath(relPath, false, IsoTreeModel::Added);
+        }
         rebuildBtn->setEnabled(true);
     }
 
     void extractSelectedFiles() {
-        QList<QTreeWidgetItem*> items = treeView->selectedItems();
+        QModelIndexList items = treeView->selectionModel()->selectedRows();
         if (items.isEmpty()) return;
 
         QString targetDir = QFileDialog::getExistingDirectory(this, "Select extraction folder");
-        if (targetDir.isEmpty()) return;
+        if (targetDir.isEmpty() || extractor->isRunning()) return;
 
-        for (QTreeWidgetItem *item : items) {
-            QString relPath = item->data(0, Qt::UserRole + 1).toString();
-            QString srcPath;
+        // Unchanged files come straight from the image file, in disk order;
+        // the mount point is only the fallback.
+        if (!vfs.isOpen()) vfs.open(isoFilePath);
+        for (const QModelIndex &item : items) {
+            QString relPath = model->path(item).mid(1);
+            QString destPath = QDir(targetDir).filePath(relPath);
             if (modifiedFiles.contains(relPath)) {
-                srcPath = modifiedFiles[relPath];
-            } else {
-                srcPath = mountPoint + "/" + relPath;
+                extractor->addFromFile(modifiedFiles[relPath], destPath);
+            } else if (extractor->addFromImage(vfs.reader(), "/" + relPath, destPath) < 0 && !mountPoint.isEmpty()) {
+                extractor->addFromFile(mountPoint + "/" + relPath, destPath);
             }
-            QFileInfo fi(srcPath);
-            if (!fi.exists()) continue;
-
-            QString destPath = QDir(targetDir).filePath(relPath);
-            QDir().mkpath(QFileInfo(destPath).path());
-            QFile::copy(srcPath, destPath);
         }
-        statusLabel->setText("Selected files extracted.");
+        if (extractor->start()) {
+            extractBtn->setEnabled(false);
+        } else {
+            extractor->clear();
+            statusLabel->setText("Nothing to extract.");
+        }
     }
 
     void deleteSelectedFiles() {
-        QList<QTreeWidgetItem*> items = treeView->selectedItems();
+        QModelIndexList items = treeView->selectionModel()->selectedRows();
         if (items.isEmpty()) return;
 
-        for (QTreeWidgetItem *item : items) {
-            QString relPath = item->data(0, Qt::UserRole + 1).toString();
+        QList<QPersistentModelIndex> removed;
+        for (const QModelIndex &item : items) {
+            QString relPath = model->path(item).mid(1);
             deletedFiles.insert(relPath);
             modifiedFiles.remove(relPath);
+            removed.append(item);
+        }
+        for (const QPersistentModelIndex &item : removed) {
+            if (item.isValid()) model->removeIndex(item);
         }
         statusLabel->setText("Selected files marked for deletion.");
-        loadDirectoryTree();
         rebuildBtn->setEnabled(true);
     }
 
@@ -331,7 +413,43 @@ private slots:
             QMessageBox::warning(this, "Rebuild ISO", "Please mount an ISO first.");
             return;
         }
+        if (jobs->isBusy()) return;
+
+        QString outIso = QFileDialog::getSaveFileName(this, "Save new ISO", "updated.iso", "*.iso");
+        if (outIso.isEmpty()) return;
+
+        QString volLabel = volumeLabelEdit->text().trimmed();
+        if (volLabel.isEmpty()) volLabel = "NEW_ISO";
+
+        if (!QStandardPaths::findExecutable("xorriso").isEmpty()) {
+            rebuildWithXorriso(outIso, volLabel);
+        } else if (!QStandardPaths::findExecutable("hdiutil").isEmpty()) {
+            rebuildWithHdiutil(outIso, volLabel);
+        } else {
+            QMessageBox::critical(this, "Rebuild ISO", "Rebuilding needs xorriso or hdiutil.");
+        }
+    }
 
+    // The new image is written from the old one plus the overlay: untouched
+    // files are copied from their original extents, only the changes are
+    // read from disk, and nothing is staged in a scratch directory.
+    void rebuildWithXorriso(const QString &outIso, const QString &volLabel) {
+        IsoChangeSet changes;
+        for (const QString &relPath : qAsConst(deletedFiles)) changes.remove(relPath);
+        for (auto it = modifiedFiles.constBegin(); it != modifiedFiles.constEnd(); ++it) changes.add(it.key(), it.value());
+
+        QStringList args{"-indev", isoFilePath, "-outdev", outIso, "-volid", volLabel};
+        // Carry El Torito boot images over from the original.
+        if (bootableCheck->isChecked()) args << "-boot_image" << "any" << "keep";
+        args << changes.commandArguments() << "-commit";
+
+        pendingOutput = outIso;
+        rebuildBtn->setEnabled(false);
+        statusLabel->setText("Building ISO...");
+        jobs->enqueue(args);
+    }
+
+    void rebuildWithHdiutil(const QString &outIso, const QString &volLabel) {
         QTemporaryDir tempDir;
         if (!tempDir.isValid()) {
             QMessageBox::critical(this, "Error", "Failed to create temporary directory.");
@@ -340,23 +458,26 @@ private slots:
 
         QString tempPath = tempDir.path();
 
-        // Copy mounted ISO contents except deleted files
-        copyDirectoryFiltered(mountPoint, tempPath, deletedFiles);
-
-        // Apply modified files
-        for (auto it = modifiedFiles.constBegin(); it != modifiedFiles.constEnd(); ++it) {
-            QString destFile = QDir(tempPath).filePath(it.key());
-            QDir().mkpath(QFileInfo(destFile).path());
-            QFile::remove(destFile); // remove old if exists
-            QFile::copy(it.value(), destFile);
+        // hdiutil wants a real folder: the mounted image minus deletions plus
+        // replacements, cloned or linked where the filesystem allows it. An
+        // image browsed in-process is attached just for this.
+        QString error;
+        const bool attached = mountPoint.isEmpty();
+        const QString imageRoot = attached ? attachImage(&error) : mountPoint;
+        if (imageRoot.isEmpty()) {
+            QMessageBox::critical(this, "Mount failed", error);
+            return;
+        }
+        IsoStagingArea staging;
+        staging.add("/", imageRoot);
+        for (const QString &relPath : qAsConst(deletedFiles)) staging.remove(relPath);
+        for (auto it = modifiedFiles.constBegin(); it != modifiedFiles.constEnd(); ++it) staging.add(it.key(), it.value());
+        const bool staged = staging.materialize(tempPath, &error);
+        if (attached) detachImage(imageRoot, nullptr);
+        if (!staged) {
+            QMessageBox::critical(this, "Error", "Failed to stage ISO contents: " + error);
+            return;
         }
-
-        QString outIso = QFileDialog::getSaveFileName(this, "Save new ISO", "updated.iso", "*.iso");
-        if (outIso.isEmpty()) return;
-
-        // Prepare hdiutil arguments
-        QString volLabel = volumeLabelEdit->text().trimmed();
-        if (volLabel.isEmpty()) volLabel = "NEW_ISO";
 
         QStringList args;
         args << "-o" << outIso
@@ -378,14 +499,7 @@ private slots:
         proc.waitForFinished(-1);
 
         if (proc.exitCode() == 0) {
-            statusLabel->setText("ISO rebuilt successfully: " + outIso);
-            isoFilePath = outIso;
-            rebuildBtn->setEnabled(false);
-            modifiedFiles.clear();
-            deletedFiles.clear();
-            mountBtn->setEnabled(true);
-            unmountBtn->setEnabled(false);
-            clearTree();
+            rebuildDone(outIso);
         } else {
             QString err = proc.readAllStandardError();
             QMessageBox::critical(this, "Error building ISO", err);
@@ -393,40 +507,43 @@ private slots:
         }
     }
 
-    void copyDirectoryFiltered(const QString &srcPath, const QString &dstPath, const QSet<QString> &excludeFiles) {
-        QDir srcDir(srcPath);
-        QDir dstDir(dstPath);
-
-        if (!dstDir.exists()) dstDir.mkpath(".");
-
-        QFileInfoList entries = srcDir.entryInfoList(QDir::NoDotAndDotDot | QDir::AllEntries);
-        for (const QFileInfo &entry : entries) {
-            QString rel = relativePath(entry.absoluteFilePath());
-            if (excludeFiles.contains(rel)) continue;
-
-            QString dstFilePath = dstDir.filePath(entry.fileName());
-
-            if (entry.isDir()) {
-                copyDirectoryFiltered(entry.absoluteFilePath(), dstFilePath, excludeFiles);
-            } else if (entry.isFile()) {
-                QFile::copy(entry.absoluteFilePath(), dstFilePath);
-            }
-        }
+    void rebuildDone(const QString &outIso) {
+        if (mounted) unmountIso();
+        statusLabel->setText("ISO rebuilt successfully: " + outIso);
+        isoFilePath = outIso;
+        rebuildBtn->setEnabled(false);
+        modifiedFiles.clear();
+        deletedFiles.clear();
+        mountBtn->setEnabled(true);
+        unmountBtn->setEnabled(false);
+        clearTree();
     }
 
     void clearTree() {
-        treeView->clear();
+        model->clear();
+        source.reset();
+        mountSource.reset();
     }
 
 private:
     QPushButton *openBtn, *mountBtn, *unmountBtn, *extractBtn, *deleteBtn, *rebuildBtn;
-    QTreeWidget *treeView;
+    QTreeView *treeView;
+    IsoTreeModel *model;
+    QScopedPointer<OverlaySource> source;
+    QScopedPointer<FileSystemSource> mountSource;
+    IsoVfs vfs;
+    IsoCatalog catalog;
+    IsoReaderSource readerSource{vfs.reader(), &catalog};
+    XorrisoJobRunner *jobs;
+    IsoExtractor *extractor;
     QLabel *statusLabel;
     QLineEdit *volumeLabelEdit;
     QCheckBox *bootableCheck;
 
     QString isoFilePath;
     QString mountPoint;
+    QProcess *fuseProcess = nullptr;   // the FUSE helper while it serves mountPoint
+    QString pendingOutput;
     bool mounted;
 
     QHash<QString, QString> modifiedFiles; // rel path -> source path
@@ -437,6 +554,7 @@ private:
 
 int main(int argc, char **argv) {
     QApplication app(argc, argv);
+    IsoTrace::enableFromEnvironment();
     IsoManager w;
     w.setWindowTitle("ISO Manager");
     w.resize(900, 600);
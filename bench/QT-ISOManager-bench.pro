@@ -0,0 +1,32 @@
+QT       += core
+QT       -= gui
+
+CONFIG += c++11 console link_pkgconfig
+CONFIG -= app_bundle
+
+TARGET = isomanager-bench
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+SOURCES += \
+    isosynthtree.cpp \
+    main.cpp
+
+HEADERS += \
+    isosynthtree.h
+
+# The libisofs backend goes through isofs-version's builder and writer,
+# when the library is installed.
+packagesExist(libisofs-1) {
+    PKGCONFIG += libisofs-1
+    DEFINES += HAVE_LIBISOFS
+    INCLUDEPATH += ../isofs-version
+    SOURCES += ../isofs-version/isoburnwriter.cpp ../isofs-version/isoimagebuilder.cpp
+    HEADERS += ../isofs-version/isoburnwriter.h ../isofs-version/isoimagebuilder.h
+}
+
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
+
+include(../core/core.pri)
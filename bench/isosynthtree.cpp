@@ -0,0 +1,195 @@
+#include "isosynthtree.h"
+
+#include <QFile>
+#include <QFileInfo>
+
+#include <cmath>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace {
+
+const size_t BufferSize = 1 << 20;
+
+// xorshift64*: fast, and the same sequence everywhere.
+struct Random {
+    explicit Random(quint64 seed) : state(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+    quint64 next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ULL;
+    }
+    double unit() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    quint64 state;
+};
+
+QString errnoString() {
+    return QString::fromLocal8Bit(strerror(errno));
+}
+
+// kind plus index in base 36, padded with random letters to length.
+QString makeName(char kind, quint64 index, int length, Random &random) {
+    QString name = QChar(kind) + QString::number(index, 36);
+    while (name.size() < length) name += QChar('a' + int(random.next() % 26));
+    return name;
+}
+
+bool writeFile(const QByteArray &path, quint64 size, Random &random, std::vector<char> &buffer, QString *error) {
+    const int fd = ::open(path.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        if (error) *error = QFile::decodeName(path) + ": " + errnoString();
+        return false;
+    }
+    bool ok = true;
+    for (quint64 left = size; ok && left > 0;) {
+        const size_t chunk = size_t(qMin<quint64>(left, buffer.size()));
+        for (size_t i = 0; i < chunk; i += sizeof(quint64)) {
+            const quint64 word = random.next();
+            memcpy(buffer.data() + i, &word, qMin(sizeof(word), chunk - i));
+        }
+        for (size_t done = 0; ok && done < chunk;) {
+            const ssize_t n = ::write(fd, buffer.data() + done, chunk - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) ok = false;
+            else done += size_t(n);
+        }
+        left -= chunk;
+    }
+    if (!ok && error) *error = QFile::decodeName(path) + ": " + errnoString();
+    ::close(fd);
+    return ok;
+}
+
+} // namespace
+
+QVector<IsoSyntheticTree::Spec> IsoSyntheticTree::presets() {
+    QVector<Spec> list;
+    Spec s;
+    s.name = "small-files";
+    s.files = 20000;
+    s.minSize = 0;
+    s.maxSize = 16 * 1024;
+    s.depth = 3;
+    s.filesPerDir = 100;
+    list << s;
+
+    s = Spec();
+    s.name = "mixed";
+    s.files = 2000;
+    s.minSize = 1024;
+    s.maxSize = 16 << 20;
+    s.depth = 2;
+    s.filesPerDir = 50;
+    s.nameLength = 16;
+    list << s;
+
+    s = Spec();
+    s.name = "large-files";
+    s.files = 16;
+    s.minSize = 16 << 20;
+    s.maxSize = 128 << 20;
+    s.depth = 0;
+    list << s;
+
+    // Deeper than ISO 9660's eight levels, so Rock Ridge relocates.
+    s = Spec();
+    s.name = "deep-tree";
+    s.files = 5000;
+    s.maxSize = 4096;
+    s.depth = 12;
+    s.filesPerDir = 10;
+    list << s;
+
+    // Longer than Joliet's 64 characters.
+    s = Spec();
+    s.name = "long-names";
+    s.files = 5000;
+    s.maxSize = 4096;
+    s.depth = 2;
+    s.nameLength = 100;
+    list << s;
+    return list;
+}
+
+bool IsoSyntheticTree::preset(const QString &name, Spec &out) {
+    for (const Spec &spec : presets()) {
+        if (spec.name == name) {
+            out = spec;
+            return true;
+        }
+    }
+    if (name != "custom") return false;
+    out = Spec();
+    return true;
+}
+
+bool IsoSyntheticTree::generate(const Spec &spec, const QString &root, QString *error) {
+    files = directories = 0;
+    bytes = 0;
+    if (QFileInfo::exists(root)) {
+        if (error) *error = root + " already exists";
+        return false;
+    }
+    const QByteArray rootPath = QFile::encodeName(root);
+    if (::mkdir(rootPath.constData(), 0755) != 0) {
+        if (error) *error = root + ": " + errnoString();
+        return false;
+    }
+
+    // Leaf directory j sits at the path spelled by its digits in base
+    // fanout, one per level, so every level is filled evenly.
+    const int perDir = qMax(1, spec.filesPerDir);
+    const int depth = qMax(0, spec.depth);
+    const int leaves = depth == 0 ? 1 : qMax(1, (spec.files + perDir - 1) / perDir);
+    int fanout = 2;
+    while (depth > 0 && std::pow(double(fanout), depth) < leaves) ++fanout;
+
+    Random names(spec.seed);
+    Random data(spec.seed ^ 0x5bd1e995U);
+    const double lo = std::log(double(spec.minSize) + 1);
+    const double hi = std::log(double(qMax(spec.minSize, spec.maxSize)) + 1);
+    std::vector<char> buffer(BufferSize);
+
+    QVector<int> digits(depth, -1);
+    QVector<QByteArray> levels(depth + 1);
+    levels[0] = rootPath;
+    for (int i = 0; i < spec.files; ++i) {
+        const int leaf = depth == 0 ? 0 : i / perDir;
+        if (depth > 0 && i % perDir == 0) {
+            // Create whatever part of the leaf's path differs from the last one.
+            bool changed = false;
+            for (int level = 0, rest = leaf; level < depth; ++level) {
+                int divisor = 1;
+                for (int k = level + 1; k < depth; ++k) divisor *= fanout;
+                const int digit = (rest / divisor) % fanout;
+                if (!changed && digit == digits[level]) continue;
+                changed = true;
+                digits[level] = digit;
+                levels[level + 1] = levels[level] + '/'
+                                    + QFile::encodeName(makeName('d', quint64(digit), spec.nameLength, names));
+                if (::mkdir(levels[level + 1].constData(), 0755) != 0) {
+                    if (error) *error = QFile::decodeName(levels[level + 1]) + ": " + errnoString();
+                    return false;
+                }
+                ++directories;
+            }
+        }
+
+        quint64 size = quint64(std::exp(lo + (hi - lo) * data.unit()) - 1);
+        size = qBound(spec.minSize, size, qMax(spec.minSize, spec.maxSize));
+        const QByteArray path = levels[depth] + '/'
+                                + QFile::encodeName(makeName('f', quint64(i), spec.nameLength, names));
+        if (!writeFile(path, size, data, buffer, error)) return false;
+        ++files;
+        bytes += size;
+    }
+    return true;
+}
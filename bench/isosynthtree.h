@@ -0,0 +1,41 @@
+#ifndef ISOSYNTHTREE_H
+#define ISOSYNTHTREE_H
+
+#include <QString>
+#include <QVector>
+
+// Generates source trees for the benchmarks: a given number of files with
+// log-uniformly distributed sizes, spread over directories a fixed number
+// of levels deep, with names of a given length. Contents are pseudo-random
+// (incompressible) and, like the names, depend only on the spec.
+class IsoSyntheticTree {
+public:
+    struct Spec {
+        QString name = "custom";
+        int files = 1000;
+        quint64 minSize = 0;
+        quint64 maxSize = 64 * 1024;
+        int depth = 2;            // directory levels below the root
+        int filesPerDir = 64;
+        int nameLength = 12;      // of every file and directory name
+        quint32 seed = 1;
+    };
+
+    // small-files, mixed, large-files, deep-tree and long-names.
+    static QVector<Spec> presets();
+    static bool preset(const QString &name, Spec &out);
+
+    // Writes the tree for spec below root, which must not exist yet.
+    bool generate(const Spec &spec, const QString &root, QString *error = nullptr);
+
+    int fileCount() const { return files; }
+    int directoryCount() const { return directories; }
+    quint64 totalBytes() const { return bytes; }
+
+private:
+    int files = 0;
+    int directories = 0;
+    quint64 bytes = 0;
+};
+
+#endif // ISOSYNTHTREE_H
@@ -0,0 +1,1576 @@
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QProcess>
+#include <QSaveFile>
+#include <QScopedPointer>
+#include <QStandardPaths>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "iso9660reader.h"
+#include "isocatalog.h"
+#include "isoextractor.h"
+#include "isostagingarea.h"
+#include "isotreescanner.h"
+#include "isovfs.h"
+#include "isozisofs.h"
+#include "xorrisocommands.h"
+#include "xorrisosession.h"
+#include "isosynthtree.h"
+#include "isobuildtree.h"
+#include "isotreemodel.h"
+#ifdef HAVE_LIBISOFS
+#include "isoburnwriter.h"
+#include "isoimagebuilder.h"
+#endif
+
+extern char **environ;
+
+static const char *const Usage =
+    "Usage: isomanager-bench [options]\n"
+    "\n"
+    "Generates source trees, builds an image of each with every backend that\n"
+    "is available, then opens, lists and extracts one of them with every\n"
+    "reader, and reports wall time, CPU time, peak RSS and throughput.\n"
+    "\n"
+    "Workloads:\n"
+    "  --workload <name>[,...]   small-files, mixed, large-files, deep-tree,\n"
+    "                            long-names or custom (default: all but custom)\n"
+    "  --files N --min-size S --max-size S --depth N --per-dir N\n"
+    "  --name-length N --seed N  override those of every selected workload;\n"
+    "                            sizes take K, M and G suffixes\n"
+    "  --scale F                 multiply the file counts by F\n"
+    "\n"
+    "Backends:\n"
+    "  --backends <name>[,...]   build: xorriso, libisofs, mkisofs, genisoimage,\n"
+    "                            hdiutil; read: native, xorriso, isoinfo, 7z\n"
+    "                            (default: all that are installed)\n"
+    "\n"
+    "Runs and reports:\n"
+    "  --repeat N                runs per measurement, the median is reported (3)\n"
+    "  --drop-caches             drop the page cache before every run (root, Linux)\n"
+    "  --work-dir <dir>          where trees and images go (default: a temporary\n"
+    "                            directory); trees there are reused while their\n"
+    "                            spec is unchanged\n"
+    "  --json <file>             write the report as JSON\n"
+    "  --csv <file>              write the measurements as CSV\n"
+    "  --baseline <file> [--tolerance P]\n"
+    "                            compare with an earlier JSON report and fail if\n"
+    "                            anything got more than P% (10) slower or bigger\n"
+    "\n"
+    "Memory:\n"
+    "  --tree-stress N [--budget MB]\n"
+    "                            instead of the above, build an image of N\n"
+    "                            entries through the libisofs frontend's own\n"
+    "                            build tree and builder, and fail if its peak\n"
+    "                            RSS goes over the budget (256)\n"
+    "  --graft-stress N          instead of the above, stage N files as separate\n"
+    "                            graft points, build them with genisoimage,\n"
+    "                            mkisofs or xorriso -as mkisofs through a path\n"
+    "                            list and fail if the image misses any\n"
+    "\n"
+    "Components, each instead of the above:\n"
+    "  --index-bench N           add N paths to an empty tree model, all in one\n"
+    "                            directory and then four levels deep, at 1/8,\n"
+    "                            1/4, 1/2 and all of N, and report the time per\n"
+    "                            path of each\n"
+    "  --session-bench <image> [--requests N]\n"
+    "                            list the image root N times (20) with a fresh\n"
+    "                            xorriso each, then through one persistent\n"
+    "                            dialog session, and report the median and mean\n"
+    "                            latency of both\n"
+    "  --catalog <image>         rewrite the image's cached directory catalog and\n"
+    "                            compare the cold walk with loading and listing\n"
+    "                            the cached copy\n"
+    "  --scan <dir>              time a QDirIterator walk of the tree against\n"
+    "                            the parallel scanner\n"
+    "  --zisofs-bench <dir>      compress the tree to zisofs with 1, 2, 4... up\n"
+    "                            to --threads threads, reporting the size\n"
+    "                            reduction and time of each, then compare plain\n"
+    "                            and compressed xorriso builds of it\n"
+    "  --threads N               threads for the above (default: one per CPU)\n"
+    "  --vfs-check               build an image of a synthetic tree with a file\n"
+    "                            too big for one extent and zisofs files, and\n"
+    "                            read every file back through IsoVfs; needs\n"
+    "                            xorriso and about 4.5 GB in the work directory\n"
+    "\n"
+    "Every run is a separate process, so tool startup is included and the peak\n"
+    "RSS is that run's own. Images are opened, listed and extracted from the\n"
+    "first backend's build, so all readers see the same image.\n";
+
+namespace {
+
+const char *const BuildBackends[] = {"xorriso", "libisofs", "mkisofs", "genisoimage", "hdiutil"};
+const char *const ReadBackends[] = {"native", "xorriso", "isoinfo", "7z"};
+// Differences below this are noise on any machine.
+const double NoiseSeconds = 0.005;
+
+struct Options {
+    QVector<IsoSyntheticTree::Spec> workloads;
+    QStringList backends;
+    int repeat = 3;
+    bool dropCaches = false;
+    QString workDir;
+    QString jsonPath;
+    QString csvPath;
+    QString baselinePath;
+    double tolerance = 10;
+    int treeStress = 0;
+    int budgetMb = 256;
+    int graftStress = 0;
+    int indexBench = 0;
+    QString sessionBench;
+    int requests = 20;
+    QString catalog;
+    QString scan;
+    QString zisofsBench;
+    int threads = QThread::idealThreadCount();
+    bool vfsCheck = false;
+};
+
+// One child process, as wait4() saw it.
+struct Run {
+    bool ok = false;
+    QString error;
+    double seconds = 0;
+    double cpuSeconds = 0;
+    qint64 peakRssKb = 0;
+};
+
+struct Result {
+    QString workload;
+    QString operation;      // build, open, list, extract
+    QString backend;
+    QString image;          // the backend that built the image read
+    QVector<double> seconds;
+    QVector<double> cpuSeconds;
+    qint64 peakRssKb = 0;
+    quint64 bytes = 0;      // source data moved, for throughput
+    quint64 files = 0;
+    qint64 imageBytes = 0;
+    bool ok = true;
+    QString error;
+
+    double median() const { return middle(seconds); }
+    double fastest() const { return seconds.isEmpty() ? 0 : *std::min_element(seconds.begin(), seconds.end()); }
+    double cpu() const { return middle(cpuSeconds); }
+
+    static double middle(QVector<double> v) {
+        if (v.isEmpty()) return 0;
+        std::sort(v.begin(), v.end());
+        return v.size() % 2 ? v.at(v.size() / 2) : (v.at(v.size() / 2 - 1) + v.at(v.size() / 2)) / 2;
+    }
+};
+
+// A workload's tree as generated.
+struct Tree {
+    IsoSyntheticTree::Spec spec;
+    QString path;
+    int files = 0;
+    int directories = 0;
+    quint64 bytes = 0;
+    double generateSeconds = 0;
+};
+
+QString errnoString(int code) {
+    return QString::fromLocal8Bit(strerror(code));
+}
+
+double seconds(const struct timeval &tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+bool parseSize(QString text, quint64 &out) {
+    quint64 unit = 1;
+    const QChar suffix = text.isEmpty() ? QChar() : text.at(text.size() - 1).toUpper();
+    if (suffix == 'K') unit = 1024;
+    else if (suffix == 'M') unit = 1024 * 1024;
+    else if (suffix == 'G') unit = quint64(1024) * 1024 * 1024;
+    if (unit > 1) text.chop(1);
+    bool ok = false;
+    out = text.toULongLong(&ok) * unit;
+    return ok;
+}
+
+// Sync and drop the page cache so the next run reads from disk.
+bool dropCaches() {
+#ifdef Q_OS_LINUX
+    ::sync();
+    const int fd = ::open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    const bool ok = ::write(fd, "3\n", 2) == 2;
+    ::close(fd);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+QString lastLine(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return QString();
+    const QList<QByteArray> lines = file.readAll().trimmed().split('\n');
+    return QString::fromLocal8Bit(lines.last().trimmed());
+}
+
+// Runs program with stdout discarded and stderr in errorLog, and takes its
+// time, CPU time and peak RSS from wait4().
+Run spawn(const QString &program, const QStringList &args, const QString &errorLog) {
+    Run run;
+    QVector<QByteArray> words{QFile::encodeName(program)};
+    for (const QString &arg : args) words << QFile::encodeName(arg);
+    QVector<char *> argv;
+    for (QByteArray &word : words) argv << word.data();
+    argv << nullptr;
+    const QByteArray log = QFile::encodeName(errorLog);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, log.constData(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    QElapsedTimer clock;
+    clock.start();
+    pid_t pid = 0;
+    const int ret = ::posix_spawn(&pid, argv.at(0), &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (ret != 0) {
+        run.error = program + ": " + errnoString(ret);
+        return run;
+    }
+
+    int status = 0;
+    struct rusage usage;
+    while (::wait4(pid, &status, 0, &usage) < 0) {
+        if (errno == EINTR) continue;
+        run.error = program + ": " + errnoString(errno);
+        return run;
+    }
+    run.seconds = clock.nsecsElapsed() / 1e9;
+    run.cpuSeconds = seconds(usage.ru_utime) + seconds(usage.ru_stime);
+#ifdef Q_OS_MACOS
+    run.peakRssKb = usage.ru_maxrss / 1024;   // bytes there
+#else
+    run.peakRssKb = usage.ru_maxrss;
+#endif
+    run.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (!run.ok) {
+        run.error = WIFEXITED(status) ? QString("%1 exited with %2").arg(QFileInfo(program).fileName()).arg(WEXITSTATUS(status))
+                                      : QString("%1 killed by signal %2").arg(QFileInfo(program).fileName()).arg(WTERMSIG(status));
+        const QString detail = lastLine(errorLog);
+        if (!detail.isEmpty()) run.error += ": " + detail;
+    }
+    return run;
+}
+
+// First line a tool prints about itself, for the report.
+QString toolVersion(const QString &program, const QStringList &args) {
+    QProcess proc;
+    proc.setProcessChannelMode(QProcess::MergedChannels);
+    proc.start(program, args);
+    if (!proc.waitForFinished(5000)) {
+        proc.kill();
+        proc.waitForFinished();
+    }
+    for (const QByteArray &line : proc.readAll().split('\n'))
+        if (!line.trimmed().isEmpty()) return QString::fromLocal8Bit(line.trimmed());
+    return QString();
+}
+
+QString executableFor(const QString &backend) {
+    if (backend == "native") return QCoreApplication::applicationFilePath();
+    if (backend == "libisofs") {
+#ifdef HAVE_LIBISOFS
+        return QCoreApplication::applicationFilePath();
+#else
+        return QString();
+#endif
+    }
+    if (backend == "7z") {
+        for (const char *name : {"7z", "7za", "7zz"}) {
+            const QString path = QStandardPaths::findExecutable(name);
+            if (!path.isEmpty()) return path;
+        }
+        return QString();
+    }
+    return QStandardPaths::findExecutable(backend);
+}
+
+// What the report says a backend is.
+QString versionOf(const QString &backend, const QString &program) {
+    if (backend == "native") return "Iso9660Reader / IsoExtractor";
+    if (backend == "libisofs") {
+#ifdef HAVE_LIBISOFS
+        int major = 0, minor = 0, micro = 0;
+        iso_lib_version(&major, &minor, &micro);
+        return QString("libisofs %1.%2.%3").arg(major).arg(minor).arg(micro);
+#endif
+    }
+    if (backend == "7z") return toolVersion(program, QStringList());
+    if (backend == "xorriso" || backend == "mkisofs" || backend == "genisoimage")
+        return toolVersion(program, {"-version"});
+    return QFileInfo(program).fileName();
+}
+
+// The arguments that make backend do operation; empty if it can't.
+QStringList argumentsFor(const QString &operation, const QString &backend, const QString &source,
+                         const QString &image, const QString &target) {
+    if (operation == "build") {
+        // Rock Ridge and Joliet everywhere, names up to Joliet's 103 characters.
+        const QStringList mkisofs{"-quiet", "-R", "-J", "-joliet-long", "-o", image, source};
+        if (backend == "xorriso") return QStringList{"-as", "mkisofs"} + mkisofs;
+        if (backend == "mkisofs" || backend == "genisoimage") return mkisofs;
+        if (backend == "libisofs") return {"--run", "build-libisofs", source, image};
+        if (backend == "hdiutil") return {"makehybrid", "-quiet", "-iso", "-joliet", "-o", image, source};
+    } else if (operation == "open") {
+        if (backend == "native") return {"--run", "open", image};
+        if (backend == "xorriso") return {"-indev", image, "-ls", "/"};
+    } else if (operation == "list") {
+        if (backend == "native") return {"--run", "list", image};
+        if (backend == "xorriso") return XorrisoCommands::list(image);
+        if (backend == "isoinfo") return {"-R", "-f", "-i", image};
+        if (backend == "7z") return {"l", image};
+    } else if (operation == "extract") {
+        if (backend == "native") return {"--run", "extract", image, target};
+        if (backend == "xorriso") return XorrisoCommands::extract(image, {"/"}, {target});
+        if (backend == "7z") return {"x", image, "-o" + target, "-y"};
+    }
+    return QStringList();
+}
+
+int countImageFiles(const QString &image, QString *error) {
+    Iso9660Reader reader;
+    if (!reader.open(image)) {
+        if (error) *error = reader.errorString();
+        return -1;
+    }
+    int files = 0;
+    reader.walk([&files](const QString &, const IsoDirEntry &entry) {
+        if (!entry.isDirectory) ++files;
+        return true;
+    });
+    return files;
+}
+
+void countTree(const QString &root, int &files, quint64 &bytes) {
+    files = 0;
+    bytes = 0;
+    IsoTreeScanner scanner;
+    scanner.scan(root, [&files, &bytes](const IsoTreeScanner::Entry &entry) {
+        if (!entry.isFile()) return;
+        ++files;
+        bytes += entry.size;
+    });
+}
+
+QJsonObject specJson(const IsoSyntheticTree::Spec &spec) {
+    QJsonObject o;
+    o["name"] = spec.name;
+    o["files"] = spec.files;
+    o["min_size"] = double(spec.minSize);
+    o["max_size"] = double(spec.maxSize);
+    o["depth"] = spec.depth;
+    o["files_per_dir"] = spec.filesPerDir;
+    o["name_length"] = spec.nameLength;
+    o["seed"] = double(spec.seed);
+    return o;
+}
+
+// Generates the tree, or reuses one left in workDir for the same spec.
+bool prepareTree(Tree &tree, const QString &workDir, QString *error) {
+    tree.path = QDir(workDir).filePath(tree.spec.name + "-tree");
+    const QString stampPath = tree.path + ".json";
+    QFile stamp(stampPath);
+    if (stamp.open(QIODevice::ReadOnly)) {
+        const QJsonObject o = QJsonDocument::fromJson(stamp.readAll()).object();
+        stamp.close();
+        if (o.value("spec").toObject() == specJson(tree.spec) && QFileInfo(tree.path).isDir()) {
+            tree.files = o.value("files").toInt();
+            tree.directories = o.value("directories").toInt();
+            tree.bytes = quint64(o.value("bytes").toDouble());
+            return true;
+        }
+    }
+    QFile::remove(stampPath);
+    QDir(tree.path).removeRecursively();
+
+    IsoSyntheticTree generator;
+    QElapsedTimer clock;
+    clock.start();
+    if (!generator.generate(tree.spec, tree.path, error)) return false;
+    tree.generateSeconds = clock.nsecsElapsed() / 1e9;
+    tree.files = generator.fileCount();
+    tree.directories = generator.directoryCount();
+    tree.bytes = generator.totalBytes();
+
+    QJsonObject o;
+    o["spec"] = specJson(tree.spec);
+    o["files"] = tree.files;
+    o["directories"] = tree.directories;
+    o["bytes"] = double(tree.bytes);
+    if (stamp.open(QIODevice::WriteOnly)) stamp.write(QJsonDocument(o).toJson());
+    return true;
+}
+
+void printResult(const Result &r) {
+    QString line = QString("%1 %2 %3").arg(r.workload, r.operation, r.backend);
+    if (!r.ok) {
+        printf("%s: FAILED: %s\n", qPrintable(line), qPrintable(r.error));
+        fflush(stdout);
+        return;
+    }
+    line += QString(": %1 s (min %2), cpu %3 s, peak RSS %4 MB")
+                .arg(r.median(), 0, 'f', 3).arg(r.fastest(), 0, 'f', 3).arg(r.cpu(), 0, 'f', 2)
+                .arg(r.peakRssKb / 1024.0, 0, 'f', 1);
+    if (r.bytes > 0) line += QString(", %1 MB/s").arg(r.bytes / 1048576.0 / qMax(r.median(), 1e-9), 0, 'f', 1);
+    if (r.imageBytes > 0) line += QString(", %1 MB image").arg(r.imageBytes / 1048576.0, 0, 'f', 1);
+    printf("%s\n", qPrintable(line));
+    fflush(stdout);
+}
+
+class Bench {
+public:
+    explicit Bench(const Options &options) : options(options) {}
+
+    bool run() {
+        QScopedPointer<QTemporaryDir> temp;
+        QString workDir = options.workDir;
+        if (workDir.isEmpty()) {
+            temp.reset(new QTemporaryDir(QDir(QDir::tempPath()).filePath("isomanager-bench-XXXXXX")));
+            if (!temp->isValid()) {
+                fprintf(stderr, "%s\n", qPrintable(temp->errorString()));
+                return false;
+            }
+            workDir = temp->path();
+        } else if (!QDir().mkpath(workDir)) {
+            fprintf(stderr, "Cannot create %s\n", qPrintable(workDir));
+            return false;
+        }
+        errorLog = QDir(workDir).filePath("stderr.log");
+
+        findBackends();
+        if (options.dropCaches && !dropCaches()) {
+            fprintf(stderr, "Cannot drop the page cache (needs root on Linux); results are warm-cache\n");
+            dropping = false;
+        } else {
+            dropping = options.dropCaches;
+        }
+
+        for (const IsoSyntheticTree::Spec &spec : options.workloads) {
+            Tree tree;
+            tree.spec = spec;
+            QString error;
+            printf("%s: generating %d files...\n", qPrintable(spec.name), spec.files);
+            fflush(stdout);
+            if (!prepareTree(tree, workDir, &error)) {
+                fprintf(stderr, "%s: %s\n", qPrintable(spec.name), qPrintable(error));
+                return false;
+            }
+            printf("%s: %d files in %d directories, %.1f MB\n", qPrintable(spec.name), tree.files, tree.directories,
+                   tree.bytes / 1048576.0);
+            fflush(stdout);
+            trees << tree;
+            runWorkload(tree, workDir);
+        }
+        return true;
+    }
+
+    QJsonObject report() const {
+        QJsonObject host;
+        host["os"] = QSysInfo::prettyProductName();
+        host["kernel"] = QSysInfo::kernelType() + " " + QSysInfo::kernelVersion();
+        host["cpu"] = QSysInfo::currentCpuArchitecture();
+        host["threads"] = QThread::idealThreadCount();
+        host["name"] = QSysInfo::machineHostName();
+
+        QJsonObject tools;
+        for (auto it = versions.constBegin(); it != versions.constEnd(); ++it) tools[it.key()] = it.value();
+
+        QJsonArray workloads;
+        for (const Tree &tree : trees) {
+            QJsonObject o = specJson(tree.spec);
+            o["generated_files"] = tree.files;
+            o["generated_directories"] = tree.directories;
+            o["generated_bytes"] = double(tree.bytes);
+            if (tree.generateSeconds > 0) o["generate_seconds"] = tree.generateSeconds;
+            workloads.append(o);
+        }
+
+        QJsonArray results;
+        QHash<QString, const Result *> best;
+        for (const Result &r : list) {
+            QJsonObject o;
+            o["workload"] = r.workload;
+            o["operation"] = r.operation;
+            o["backend"] = r.backend;
+            if (!r.image.isEmpty()) o["image_backend"] = r.image;
+            o["ok"] = r.ok;
+            if (!r.ok) o["error"] = r.error;
+            QJsonArray runs;
+            for (double s : r.seconds) runs.append(s);
+            o["runs"] = runs;
+            o["seconds"] = r.median();
+            o["min_seconds"] = r.fastest();
+            o["cpu_seconds"] = r.cpu();
+            o["peak_rss_kb"] = double(r.peakRssKb);
+            o["bytes"] = double(r.bytes);
+            o["files"] = double(r.files);
+            if (r.imageBytes > 0) o["image_bytes"] = double(r.imageBytes);
+            if (r.ok && r.median() > 0) {
+                if (r.bytes > 0) o["mb_per_s"] = r.bytes / 1048576.0 / r.median();
+                o["files_per_s"] = r.files / r.median();
+            }
+            results.append(o);
+
+            const QString key = r.workload + "/" + r.operation;
+            if (r.ok && (!best.contains(key) || r.median() < best.value(key)->median())) best.insert(key, &r);
+        }
+
+        QJsonObject fastest;
+        for (auto it = best.constBegin(); it != best.constEnd(); ++it) {
+            QJsonObject perWorkload = fastest.value(it.value()->workload).toObject();
+            perWorkload[it.value()->operation] = it.value()->backend;
+            fastest[it.value()->workload] = perWorkload;
+        }
+
+        QJsonObject settings;
+        settings["repeat"] = options.repeat;
+        settings["drop_caches"] = dropping;
+
+        QJsonObject root;
+        root["format"] = 1;
+        root["date"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+        root["host"] = host;
+        root["options"] = settings;
+        root["tools"] = tools;
+        root["workloads"] = workloads;
+        root["results"] = results;
+        root["fastest"] = fastest;
+        return root;
+    }
+
+    QByteArray csv() const {
+        QByteArray out = "workload,operation,backend,image_backend,ok,seconds,min_seconds,cpu_seconds,"
+                         "peak_rss_kb,bytes,files,image_bytes,error\n";
+        for (const Result &r : list) {
+            QString error = r.error;
+            error.replace('"', "\"\"");
+            out += QString("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10,%11,%12,\"%13\"\n")
+                       .arg(r.workload, r.operation, r.backend, r.image, r.ok ? "1" : "0")
+                       .arg(r.median(), 0, 'f', 6).arg(r.fastest(), 0, 'f', 6).arg(r.cpu(), 0, 'f', 6)
+                       .arg(r.peakRssKb).arg(r.bytes).arg(r.files).arg(r.imageBytes).arg(error)
+                       .toUtf8();
+        }
+        return out;
+    }
+
+    bool allOk() const {
+        for (const Result &r : list)
+            if (!r.ok) return false;
+        return true;
+    }
+
+private:
+    void findBackends() {
+        QStringList wanted = options.backends;
+        if (wanted.isEmpty()) {
+            for (const char *name : BuildBackends) wanted << name;
+            for (const char *name : ReadBackends) wanted << name;
+        }
+        for (const QString &backend : wanted) {
+            if (programs.contains(backend)) continue;
+            const QString program = executableFor(backend);
+            if (program.isEmpty()) {
+                if (!options.backends.isEmpty()) fprintf(stderr, "%s is not available\n", qPrintable(backend));
+                continue;
+            }
+            programs.insert(backend, program);
+            versions.insert(backend, versionOf(backend, program));
+        }
+    }
+
+    Result measure(const Tree &tree, const QString &operation, const QString &backend, const QString &image,
+                   const QString &target) {
+        Result r;
+        r.workload = tree.spec.name;
+        r.operation = operation;
+        r.backend = backend;
+        r.bytes = operation == "build" || operation == "extract" ? tree.bytes : 0;
+        r.files = quint64(tree.files);
+        const QStringList args = argumentsFor(operation, backend, tree.path, image, target);
+        for (int i = 0; i < options.repeat && r.ok; ++i) {
+            // Builders get a fresh output and extractors an empty target.
+            if (operation == "build") QFile::remove(image);
+            if (operation == "extract") QDir(target).removeRecursively();
+            if (dropping) dropCaches();
+            const Run child = spawn(programs.value(backend), args, errorLog);
+            r.ok = child.ok;
+            r.error = child.error;
+            if (!child.ok) break;
+            r.seconds << child.seconds;
+            r.cpuSeconds << child.cpuSeconds;
+            r.peakRssKb = qMax(r.peakRssKb, child.peakRssKb);
+        }
+        if (!r.ok) return r;
+
+        // Wrong output makes a fast run worthless.
+        if (operation == "build") {
+            r.imageBytes = QFileInfo(image).size();
+            QString error;
+            const int files = countImageFiles(image, &error);
+            if (files != tree.files) {
+                r.ok = false;
+                r.error = files < 0 ? error : QString("the image holds %1 of %2 files").arg(files).arg(tree.files);
+            }
+        } else if (operation == "extract") {
+            int files = 0;
+            quint64 bytes = 0;
+            countTree(target, files, bytes);
+            if (files != tree.files || bytes != tree.bytes) {
+                r.ok = false;
+                r.error = QString("extracted %1 of %2 files, %3 of %4 bytes")
+                              .arg(files).arg(tree.files).arg(bytes).arg(tree.bytes);
+            }
+            QDir(target).removeRecursively();
+        }
+        return r;
+    }
+
+    void runWorkload(const Tree &tree, const QString &workDir) {
+        QString readImage, readImageBackend;
+        for (const char *name : BuildBackends) {
+            const QString backend = name;
+            if (!programs.contains(backend)) continue;
+            const QString image = QDir(workDir).filePath(tree.spec.name + "-" + backend + ".iso");
+            Result r = measure(tree, "build", backend, image, QString());
+            printResult(r);
+            list << r;
+            if (r.ok && readImage.isEmpty()) {
+                readImage = image;
+                readImageBackend = backend;
+            } else {
+                QFile::remove(image);
+            }
+        }
+        if (readImage.isEmpty()) {
+            fprintf(stderr, "%s: no image was built, skipping the readers\n", qPrintable(tree.spec.name));
+            return;
+        }
+
+        const QString target = QDir(workDir).filePath(tree.spec.name + "-extract");
+        for (const QString &operation : {QString("open"), QString("list"), QString("extract")}) {
+            for (const char *name : ReadBackends) {
+                const QString backend = name;
+                if (!programs.contains(backend)
+                    || argumentsFor(operation, backend, tree.path, readImage, target).isEmpty())
+                    continue;
+                Result r = measure(tree, operation, backend, readImage, target);
+                r.image = readImageBackend;
+                printResult(r);
+                list << r;
+            }
+        }
+        QFile::remove(readImage);
+    }
+
+    const Options &options;
+    QString errorLog;
+    bool dropping = false;
+    QMap<QString, QString> programs;   // backend -> executable
+    QMap<QString, QString> versions;
+    QVector<Tree> trees;
+    QVector<Result> list;
+};
+
+// Measurements that got slower, or bigger, than the baseline allows.
+QStringList regressions(const QJsonObject &current, const QJsonObject &baseline, double tolerance) {
+    QHash<QString, QJsonObject> before;
+    for (const QJsonValue &v : baseline.value("results").toArray()) {
+        const QJsonObject o = v.toObject();
+        before.insert(o.value("workload").toString() + " " + o.value("operation").toString() + " "
+                          + o.value("backend").toString(),
+                      o);
+    }
+    const double factor = 1 + tolerance / 100;
+    QStringList out;
+    for (const QJsonValue &v : current.value("results").toArray()) {
+        const QJsonObject now = v.toObject();
+        const QString key = now.value("workload").toString() + " " + now.value("operation").toString() + " "
+                            + now.value("backend").toString();
+        if (!before.contains(key)) continue;
+        const QJsonObject then = before.value(key);
+        if (then.value("ok").toBool() && !now.value("ok").toBool()) {
+            out << key + ": now fails: " + now.value("error").toString();
+            continue;
+        }
+        if (!then.value("ok").toBool() || !now.value("ok").toBool()) continue;
+        const double s0 = then.value("seconds").toDouble(), s1 = now.value("seconds").toDouble();
+        if (s1 > s0 * factor && s1 - s0 > NoiseSeconds)
+            out << QString("%1: %2 s -> %3 s (+%4%)").arg(key).arg(s0, 0, 'f', 3).arg(s1, 0, 'f', 3)
+                       .arg(100 * (s1 / s0 - 1), 0, 'f', 1);
+        const double m0 = then.value("peak_rss_kb").toDouble(), m1 = now.value("peak_rss_kb").toDouble();
+        if (m0 > 0 && m1 > m0 * factor)
+            out << QString("%1: peak RSS %2 MB -> %3 MB (+%4%)").arg(key).arg(m0 / 1024, 0, 'f', 1)
+                       .arg(m1 / 1024, 0, 'f', 1).arg(100 * (m1 / m0 - 1), 0, 'f', 1);
+    }
+    return out;
+}
+
+bool writeFile(const QString &path, const QByteArray &data) {
+    QSaveFile file(path);
+    if (file.open(QIODevice::WriteOnly) && file.write(data) == data.size() && file.commit()) return true;
+    fprintf(stderr, "%s: %s\n", qPrintable(path), qPrintable(file.errorString()));
+    return false;
+}
+
+#ifdef HAVE_LIBISOFS
+// Through IsoImageBuilder and IsoBurnWriter, as the libisofs frontend saves.
+bool writeWithLibisofs(const IsoBuildTree &tree, const QString &output, QString &error) {
+    if (!IsoBurnWriter::initLibrary(&error)) return false;
+    IsoImageBuilder builder;
+    builder.setVolumeId("BENCH");
+    IsoImage *image = nullptr;
+    IsoWriteOpts *opts = nullptr;
+    if (!builder.build(tree, &image, &opts)) {
+        error = builder.errorString();
+        return false;
+    }
+    // The same as the mkisofs-style builds: Rock Ridge, long Joliet names.
+    iso_write_opts_set_joliet_long_names(opts, 1);
+
+    IsoBurnWriter writer;
+    QEventLoop loop;
+    bool ok = false;
+    QObject::connect(&writer, &IsoBurnWriter::finished, &loop, [&](bool success, const QString &message) {
+        ok = success;
+        error = message;
+        loop.quit();
+    });
+    const bool started = writer.start(image, opts, output);
+    iso_write_opts_free(opts);
+    iso_image_unref(image);
+    if (!started) {
+        error = writer.errorString();
+        return false;
+    }
+    loop.exec();
+    return ok;
+}
+
+bool buildWithLibisofs(const QString &source, const QString &output, QString &error) {
+    IsoBuildTree tree;
+    if (!tree.addTree("/", source)) {
+        error = tree.errorString();
+        return false;
+    }
+    return writeWithLibisofs(tree, output, error);
+}
+
+// The path of tree-stress entry i, in the image and below its source tree.
+QString treeStressPath(int i) {
+    return QString("d%1/f%2").arg(i / 1000, 4, 10, QChar('0')).arg(i, 7, 10, QChar('0'));
+}
+
+// count entries named like graft-stress's, each from its own source path
+// below sourceDir, staged within budget bytes and written out. The
+// builder's estimate for the build tree, its tables and libisofs' nodes
+// goes to stderr as the last line.
+bool buildTreeStress(int count, qint64 budget, const QString &sourceDir, const QString &output, QString &error) {
+    IsoBuildTree tree;
+    tree.setMemoryBudget(budget);
+    for (int i = 0; i < count; ++i) {
+        const QString path = treeStressPath(i);
+        if (tree.add('/' + path, QDir(sourceDir).filePath(path), false) == IsoBuildTree::NoNode) {
+            error = tree.errorString();
+            return false;
+        }
+    }
+    const qint64 estimate = IsoImageBuilder::estimatedMemory(tree);
+    if (!writeWithLibisofs(tree, output, error)) return false;
+    fprintf(stderr, "%lld\n", estimate);
+    return true;
+}
+#endif
+
+// --work-dir, or a temporary directory that lives as long as temp; empty
+// if it can't be created.
+QString makeWorkDir(const Options &options, QScopedPointer<QTemporaryDir> &temp) {
+    if (options.workDir.isEmpty()) {
+        temp.reset(new QTemporaryDir(QDir(QDir::tempPath()).filePath("isomanager-bench-XXXXXX")));
+        if (temp->isValid()) return temp->path();
+        fprintf(stderr, "%s\n", qPrintable(temp->errorString()));
+        return QString();
+    }
+    if (QDir().mkpath(options.workDir)) return options.workDir;
+    fprintf(stderr, "Cannot create %s\n", qPrintable(options.workDir));
+    return QString();
+}
+
+// The libisofs frontend's whole build path in a child of its own, so its
+// peak RSS is the build's.
+bool runTreeStress(const Options &options) {
+#ifdef HAVE_LIBISOFS
+    QScopedPointer<QTemporaryDir> temp;
+    const QString workDir = makeWorkDir(options, temp);
+    if (workDir.isEmpty()) return false;
+    // Every entry has a source path of its own, a hard link to one of
+    // TreeStressData small files, so the builder's per-file tables fill up
+    // as they would for a real tree while the image stays mostly directory
+    // records: libisofs shares the data of nodes with the same inode. The
+    // data files come in a few sizes, and each content twice, so there
+    // are duplicates to find and confirm.
+    const int TreeStressData = 1000;
+    const QString dataDir = QDir(workDir).filePath("tree-stress-data");
+    const QString sourceDir = QDir(workDir).filePath("tree-stress-src");
+    const QString image = QDir(workDir).filePath("tree-stress.iso");
+    const QString errorLog = QDir(workDir).filePath("stderr.log");
+    QDir(dataDir).removeRecursively();
+    QDir(sourceDir).removeRecursively();
+    if (!QDir().mkpath(dataDir)) {
+        fprintf(stderr, "Cannot create %s\n", qPrintable(dataDir));
+        return false;
+    }
+    for (int k = 0; k < TreeStressData; ++k) {
+        const int content = k % (TreeStressData / 2);
+        if (!writeFile(QDir(dataDir).filePath(QString::number(k)),
+                       QByteArray::number(content).rightJustified(8, '0').repeated(1 + content % 8)))
+            return false;
+    }
+    for (int i = 0; i < options.treeStress; ++i) {
+        const QString path = QDir(sourceDir).filePath(treeStressPath(i));
+        if (i % 1000 == 0 && !QDir().mkpath(QFileInfo(path).path())) {
+            fprintf(stderr, "Cannot create %s\n", qPrintable(QFileInfo(path).path()));
+            return false;
+        }
+        const QByteArray data = QFile::encodeName(QDir(dataDir).filePath(QString::number(i % TreeStressData)));
+        if (::link(data.constData(), QFile::encodeName(path).constData()) != 0) {
+            fprintf(stderr, "%s: %s\n", qPrintable(path), qPrintable(errnoString(errno)));
+            return false;
+        }
+    }
+    const qint64 budget = qint64(options.budgetMb) << 20;
+    const Run child = spawn(QCoreApplication::applicationFilePath(),
+                            {"--run", "tree-stress", QString::number(options.treeStress), QString::number(budget),
+                             sourceDir, image},
+                            errorLog);
+    QDir(sourceDir).removeRecursively();
+    QDir(dataDir).removeRecursively();
+    if (!child.ok) {
+        printf("tree-stress: FAILED: %s\n", qPrintable(child.error));
+        return false;
+    }
+    QString error;
+    const int files = countImageFiles(image, &error);
+    const qint64 imageBytes = QFileInfo(image).size();
+    QFile::remove(image);
+    const qint64 estimate = lastLine(errorLog).toLongLong();
+    const qint64 peak = child.peakRssKb * 1024;
+    printf("tree-stress: %d of %d files in a %.1f MB image in %.2f s; peak RSS %.1f MB (%lld bytes per entry), "
+           "estimated %.1f MB, budget %d MB\n",
+           files, options.treeStress, imageBytes / 1048576.0, child.seconds, peak / 1048576.0,
+           peak / qMax(1, options.treeStress), estimate / 1048576.0, options.budgetMb);
+    if (files != options.treeStress) printf("tree-stress: FAILED: %s\n", qPrintable(files < 0 ? error : "files missing"));
+    if (peak > budget) printf("tree-stress: FAILED: the build went over the memory budget\n");
+    return files == options.treeStress && peak <= budget;
+#else
+    Q_UNUSED(options);
+    fprintf(stderr, "tree-stress needs libisofs, which this bench was built without\n");
+    return false;
+#endif
+}
+
+// One small file under count names, passed to the mkisofs-style tools
+// through path lists; the tools share the data of identical inodes, so
+// only the directory records grow.
+bool runGraftStress(const Options &options) {
+    QStringList args{"-quiet", "-R"};
+    QString program;
+    for (const QString &name : {QString("genisoimage"), QString("mkisofs"), QString("xorriso")}) {
+        program = QStandardPaths::findExecutable(name);
+        if (!program.isEmpty()) {
+            if (name == "xorriso") args = QStringList{"-as", "mkisofs"} + args;
+            break;
+        }
+    }
+    if (program.isEmpty()) {
+        fprintf(stderr, "None of genisoimage, mkisofs or xorriso is installed\n");
+        return false;
+    }
+
+    QScopedPointer<QTemporaryDir> temp;
+    const QString workDir = makeWorkDir(options, temp);
+    if (workDir.isEmpty()) return false;
+    const QString source = QDir(workDir).filePath("graft-stress-data");
+    const QString image = QDir(workDir).filePath("graft-stress.iso");
+    const QString errorLog = QDir(workDir).filePath("stderr.log");
+    if (!writeFile(source, "x")) return false;
+    const int count = options.graftStress;
+    IsoStagingArea staging;
+    for (int i = 0; i < count; ++i)
+        staging.add(QString("/d%1/f%2").arg(i / 1000, 4, 10, QChar('0')).arg(i), source);
+
+    QElapsedTimer clock;
+    clock.start();
+    QStringList listArgs;
+    QString error;
+    if (!staging.writePathLists(workDir, listArgs, &error)) {
+        fprintf(stderr, "%s\n", qPrintable(error));
+        return false;
+    }
+    const qint64 listTime = clock.nsecsElapsed();
+    QFile::remove(image);
+    args << "-o" << image << listArgs << "-V" << "GRAFTSTRESS";
+    const Run run = spawn(program, args, errorLog);
+    if (!run.ok) {
+        printf("graft-stress: FAILED: %s\n", qPrintable(run.error));
+        return false;
+    }
+    const int files = countImageFiles(image, &error);
+    QFile::remove(image);
+    printf("graft-stress: %s: %d of %d files in the image; path list %.1f ms, build %.2f s, %d arguments\n",
+           qPrintable(QFileInfo(program).fileName()), files, count, listTime / 1e6, run.seconds, args.size());
+    if (files != count) printf("graft-stress: FAILED: %s\n", qPrintable(files < 0 ? error : "files missing"));
+    return files == count;
+}
+
+// Paths for --index-bench: all in the root, or four directory levels of 16
+// below it, so each file resolves five components.
+QStringList benchPaths(int count, bool deep) {
+    QStringList paths;
+    paths.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        QString path;
+        if (deep)
+            for (int level = 0; level < 4; ++level) path += QString("/d%1").arg((i >> (4 * level)) & 15);
+        paths << path + QString("/f%1").arg(i);
+    }
+    return paths;
+}
+
+// Insertion through IsoPathIndex is one lookup per component, so the time
+// per path should stay flat as the tree grows, in one huge directory as
+// much as in a deep one.
+bool runIndexBench(int count) {
+    if (count < 8) {
+        fprintf(stderr, "index-bench needs at least 8 paths\n");
+        return false;
+    }
+    for (bool deep : {false, true}) {
+        QStringList parts;
+        double first = 0, last = 0;
+        for (int n = count / 8; n <= count; n *= 2) {
+            const QStringList paths = benchPaths(n, deep);
+            IsoTreeModel model;
+            QElapsedTimer clock;
+            clock.start();
+            for (const QString &path : paths) model.addPath(path, false);
+            const double perPath = double(clock.nsecsElapsed()) / n;
+            if (n == count / 8) first = perPath;
+            last = perPath;
+            parts << QString("%1 paths %2 ns").arg(n).arg(perPath, 0, 'f', 0);
+            if (n > count / 2) break;
+        }
+        printf("index-bench: %s: %s per path; x%.2f from the smallest to the largest\n", deep ? "deep" : "flat",
+               qPrintable(parts.join(", ")), first > 0 ? last / first : 0.0);
+    }
+    return true;
+}
+
+// Lists every directory of the catalog, as a fully expanded tree would.
+int listCatalog(const IsoCatalog &catalog) {
+    int entries = 0;
+    QVector<IsoDirEntry> pending{catalog.rootEntry()}, list;
+    while (!pending.isEmpty()) {
+        if (!catalog.readDirectory(pending.takeLast(), list)) continue;
+        entries += list.size();
+        for (const IsoDirEntry &e : qAsConst(list))
+            if (e.isDirectory) pending.append(e);
+    }
+    return entries;
+}
+
+bool runCatalog(const QString &image) {
+    Iso9660Reader reader;
+    if (!reader.open(image)) {
+        fprintf(stderr, "%s\n", qPrintable(reader.errorString()));
+        return false;
+    }
+
+    QElapsedTimer clock;
+    clock.start();
+    QString error;
+    if (!IsoCatalog::build(reader, &error)) {
+        fprintf(stderr, "%s\n", qPrintable(error));
+        return false;
+    }
+    const qint64 cold = clock.nsecsElapsed();
+
+    clock.restart();
+    IsoCatalog catalog;
+    if (!catalog.load(image)) {
+        fprintf(stderr, "The catalog was written but could not be loaded\n");
+        return false;
+    }
+    const int entries = listCatalog(catalog);
+    const qint64 warm = clock.nsecsElapsed();
+    printf("catalog: %d entries; cold walk + write %.2f ms, warm load + full listing %.2f ms\n", entries, cold / 1e6,
+           warm / 1e6);
+    return true;
+}
+
+bool runScan(const QString &root, int threads) {
+    QElapsedTimer clock;
+    clock.start();
+    qint64 qdirEntries = 0;
+    quint64 qdirBytes = 0;
+    QDirIterator it(root, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        const QFileInfo fi = it.fileInfo();
+        if (fi.isFile()) qdirBytes += quint64(fi.size());
+        ++qdirEntries;
+    }
+    const qint64 qdirTime = clock.nsecsElapsed();
+
+    clock.restart();
+    qint64 entries = 0;
+    quint64 bytes = 0;
+    IsoTreeScanner scanner;
+    scanner.setMaxThreads(threads);
+    const bool ok = scanner.scan(root, [&](const IsoTreeScanner::Entry &entry) {
+        if (entry.isFile()) bytes += entry.size;
+        ++entries;
+    });
+    const qint64 scanTime = clock.nsecsElapsed();
+    for (const QString &error : scanner.errors()) fprintf(stderr, "%s\n", qPrintable(error));
+
+    printf("scan: QDirIterator: %lld entries, %llu bytes in %.1f ms\n", qdirEntries, qdirBytes, qdirTime / 1e6);
+    printf("scan: scanner (%d threads): %lld entries, %llu bytes in %.1f ms\n", threads, entries, bytes,
+           scanTime / 1e6);
+    return ok;
+}
+
+bool runZisofsBench(const Options &options) {
+    const QString dir = options.zisofsBench;
+    if (!QFileInfo(dir).isDir()) {
+        fprintf(stderr, "%s is not a directory\n", qPrintable(dir));
+        return false;
+    }
+    QScopedPointer<QTemporaryDir> temp;
+    const QString workDir = makeWorkDir(options, temp);
+    if (workDir.isEmpty()) return false;
+
+    QElapsedTimer clock;
+    QString copiesDir;
+    QHash<QString, QString> copies;
+    for (int threads = 1;; threads = qMin(threads * 2, options.threads)) {
+        const QString target = QDir(workDir).filePath(QString("zisofs-t%1").arg(threads));
+        IsoZisofsCompressor compressor;
+        compressor.setMaxThreads(threads);
+        QString error;
+        clock.start();
+        if (!QDir().mkpath(target) || !compressor.compressTree(dir, target, copies, QStringList(), &error)) {
+            fprintf(stderr, "%s\n", qPrintable(error.isEmpty() ? "Cannot create " + target : error));
+            return false;
+        }
+        const double seconds = clock.nsecsElapsed() / 1e9;
+        const quint64 before = compressor.bytesBefore(), after = compressor.bytesAfter();
+        printf("zisofs-bench: %d thread(s): %d file(s) compressed, %.1f MB -> %.1f MB (%.1f%% smaller) in %.2f s, "
+               "%.1f MB/s\n",
+               threads, compressor.filesCompressed(), before / 1048576.0, after / 1048576.0,
+               before ? 100.0 * (before - after) / before : 0.0, seconds, before / 1048576.0 / qMax(seconds, 1e-9));
+        if (!copiesDir.isEmpty()) QDir(copiesDir).removeRecursively();
+        copiesDir = target;
+        if (threads >= options.threads) break;
+    }
+
+    const QString xorriso = QStandardPaths::findExecutable("xorriso");
+    if (xorriso.isEmpty()) {
+        printf("zisofs-bench: xorriso is not installed; image builds skipped\n");
+        QDir(copiesDir).removeRecursively();
+        return true;
+    }
+    // The same tree as it is, and with the compressed copies grafted over
+    // it and marked with ZF entries (-z).
+    IsoStagingArea staging;
+    IsoZisofsCompressor::stageTree(staging, "/", dir, copies);
+    QStringList graftArgs;
+    QString error;
+    if (!staging.writePathLists(copiesDir, graftArgs, &error)) {
+        fprintf(stderr, "%s\n", qPrintable(error));
+        return false;
+    }
+    const struct {
+        const char *name;
+        QStringList sources;
+        bool zisofs;
+    } builds[] = {{"plain", QStringList{dir}, false}, {"zisofs", graftArgs, true}};
+    bool ok = true;
+    for (const auto &build : builds) {
+        const QString image = QDir(workDir).filePath(QString("zisofs-%1.iso").arg(build.name));
+        QStringList args{"-as", "mkisofs", "-quiet", "-R", "-o", image};
+        if (build.zisofs) args << "-z";
+        const Run run = spawn(xorriso, args + build.sources, QDir(workDir).filePath("stderr.log"));
+        if (run.ok)
+            printf("zisofs-bench: xorriso %s: %.1f MB image in %.2f s\n", build.name,
+                   QFileInfo(image).size() / 1048576.0, run.seconds);
+        else
+            printf("zisofs-bench: xorriso %s: FAILED: %s\n", build.name, qPrintable(run.error));
+        ok = ok && run.ok;
+        QFile::remove(image);
+    }
+    QDir(copiesDir).removeRecursively();
+    return ok;
+}
+
+// The --vfs-check file that needs two extents: one holds at most
+// 4 GiB - 2 KiB.
+const qint64 VfsLargeFile = (qint64(4) << 30) + (qint64(1) << 20);
+const qint64 ExtentLimit = 0xFFFFF800;
+
+// Pseudo-random bytes, different for every seed.
+QByteArray noise(int size, quint32 seed) {
+    QByteArray data(size, Qt::Uninitialized);
+    quint32 x = seed | 1;
+    for (int i = 0; i < size; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        data[i] = char(x);
+    }
+    return data;
+}
+
+// path in the image against sourcePath, through read() in chunks of
+// changing size, so reads start and end everywhere within blocks and
+// extents, and through spans() where the data is stored as it is.
+bool checkVfsFile(IsoVfs &vfs, const QString &path, const QString &sourcePath, int &multiExtent, int &compressed,
+                  QString &error) {
+    const IsoVfs::File file = vfs.openFile(path);
+    QFile source(sourcePath);
+    if (!file.isValid() || !source.open(QIODevice::ReadOnly)) {
+        error = path + ": cannot be opened";
+        return false;
+    }
+    if (file.size != quint64(source.size())) {
+        error = QString("%1: %2 bytes instead of %3").arg(path).arg(file.size).arg(source.size());
+        return false;
+    }
+    if (file.extents.size() > 1) ++multiExtent;
+    if (file.zisofsBlockLog2) ++compressed;
+    const qint64 chunks[] = {4093, 65536, 1 << 20};
+    QByteArray got;
+    for (qint64 offset = 0, i = 0; offset < qint64(file.size); ++i) {
+        const qint64 len = qMin(chunks[i % 3], qint64(file.size) - offset);
+        const QByteArray want = source.read(len);
+        got.resize(int(len));
+        if (vfs.read(file, offset, got.data(), len) != len || got != want) {
+            error = QString("%1: read() differs from the source at %2").arg(path).arg(offset);
+            return false;
+        }
+        if (!file.zisofsBlockLog2 && vfs.isMapped()) {
+            got.clear();
+            for (const IsoVfs::Span &span : vfs.spans(file, offset, len)) got.append(span.data, int(span.size));
+            if (got != want) {
+                error = QString("%1: spans() differ from the source at %2").arg(path).arg(offset);
+                return false;
+            }
+        }
+        offset += len;
+    }
+    char byte;
+    if (vfs.read(file, qint64(file.size), &byte, 1) != 0) {
+        error = path + ": read() past the end returned data";
+        return false;
+    }
+    return true;
+}
+
+// Every file of image read back through IsoVfs and compared with sourceDir,
+// which it was built from; the counts go to stderr as the last line.
+bool checkVfs(const QString &image, const QString &sourceDir) {
+    IsoVfs vfs;
+    if (!vfs.open(image)) {
+        fprintf(stderr, "%s\n", qPrintable(vfs.errorString()));
+        return false;
+    }
+    QStringList paths;
+    vfs.reader()->walk([&paths](const QString &parent, const IsoDirEntry &entry) {
+        if (!entry.isDirectory) paths << (parent == "/" ? QString() : parent) + '/' + entry.name;
+        return true;
+    });
+    int multiExtent = 0, compressed = 0;
+    QString error;
+    for (const QString &path : qAsConst(paths)) {
+        if (!checkVfsFile(vfs, path, sourceDir + path, multiExtent, compressed, error)) {
+            fprintf(stderr, "%s\n", qPrintable(error));
+            return false;
+        }
+    }
+    if (!multiExtent || !compressed) {
+        fprintf(stderr, "The image has %d multi-extent and %d zisofs files, 1 of each expected\n", multiExtent,
+                compressed);
+        return false;
+    }
+    fprintf(stderr, "%d files, %d multi-extent, %d zisofs, %s\n", paths.size(), multiExtent, compressed,
+            vfs.isMapped() ? "mapped" : "not mapped");
+    return true;
+}
+
+// A synthetic tree plus a file too big for one extent and a compressible
+// one, built with xorriso -as mkisofs at ISO level 3 with the copies from
+// IsoZisofsCompressor, then read back by a child of its own.
+bool runVfsCheck(const Options &options) {
+    const QString xorriso = QStandardPaths::findExecutable("xorriso");
+    if (xorriso.isEmpty()) {
+        fprintf(stderr, "vfs-check needs xorriso\n");
+        return false;
+    }
+    QScopedPointer<QTemporaryDir> temp;
+    const QString workDir = makeWorkDir(options, temp);
+    if (workDir.isEmpty()) return false;
+    const QString sourceDir = QDir(workDir).filePath("vfs-check-src");
+    const QString copiesDir = QDir(workDir).filePath("vfs-check-zf");
+    const QString image = QDir(workDir).filePath("vfs-check.iso");
+    const QString errorLog = QDir(workDir).filePath("stderr.log");
+    QDir(sourceDir).removeRecursively();
+    QDir(copiesDir).removeRecursively();
+    auto cleanUp = [&]() {
+        QDir(sourceDir).removeRecursively();
+        QDir(copiesDir).removeRecursively();
+        QFile::remove(image);
+    };
+
+    IsoSyntheticTree::Spec spec;
+    spec.name = "vfs-check";
+    spec.files = 200;
+    spec.maxSize = 256 * 1024;
+    IsoSyntheticTree synth;
+    QString error;
+    if (!synth.generate(spec, sourceDir, &error)) {
+        fprintf(stderr, "%s\n", qPrintable(error));
+        return false;
+    }
+    // Sparse but for data where the extents meet and at the end.
+    QFile large(QDir(sourceDir).filePath("large.bin"));
+    bool ok = large.open(QIODevice::WriteOnly) && large.resize(VfsLargeFile);
+    for (qint64 at : {qint64(0), ExtentLimit - (1 << 19), VfsLargeFile - (1 << 20)})
+        ok = ok && large.seek(at) && large.write(noise(1 << 20, quint32(at))) == 1 << 20;
+    if (!ok) {
+        fprintf(stderr, "%s: %s\n", qPrintable(large.fileName()), qPrintable(large.errorString()));
+        cleanUp();
+        return false;
+    }
+    large.close();
+    // Compressible, over several zisofs blocks.
+    QByteArray text;
+    for (int i = 0; i < 100000; ++i) text += "line " + QByteArray::number(i) + '\n';
+    if (!writeFile(QDir(sourceDir).filePath("text.txt"), text)) {
+        cleanUp();
+        return false;
+    }
+
+    IsoZisofsCompressor compressor;
+    compressor.setMaxThreads(options.threads);
+    QHash<QString, QString> copies;
+    IsoStagingArea staging;
+    QStringList graftArgs;
+    if (!QDir().mkpath(copiesDir) || !compressor.compressTree(sourceDir, copiesDir, copies, QStringList(), &error)) {
+        fprintf(stderr, "%s\n", qPrintable(error.isEmpty() ? "Cannot create " + copiesDir : error));
+        cleanUp();
+        return false;
+    }
+    IsoZisofsCompressor::stageTree(staging, "/", sourceDir, copies);
+    if (!staging.writePathLists(copiesDir, graftArgs, &error)) {
+        fprintf(stderr, "%s\n", qPrintable(error));
+        cleanUp();
+        return false;
+    }
+    const Run build = spawn(xorriso,
+                            QStringList{"-as", "mkisofs", "-quiet", "-R", "-iso-level", "3", "-z", "-o", image}
+                                + graftArgs,
+                            errorLog);
+    if (!build.ok) {
+        printf("vfs-check: FAILED: xorriso: %s\n", qPrintable(lastLine(errorLog)));
+        cleanUp();
+        return false;
+    }
+    const Run check = spawn(QCoreApplication::applicationFilePath(), {"--run", "vfs-check", image, sourceDir}, errorLog);
+    if (check.ok) printf("vfs-check: %s in %.2f s\n", qPrintable(lastLine(errorLog)), check.seconds);
+    else printf("vfs-check: FAILED: %s\n", qPrintable(lastLine(errorLog)));
+    cleanUp();
+    return check.ok;
+}
+
+QString latencySummary(QVector<qint64> us) {
+    std::sort(us.begin(), us.end());
+    qint64 total = 0;
+    for (qint64 t : qAsConst(us)) total += t;
+    return QString("median %1 ms, mean %2 ms")
+        .arg(us.at(us.size() / 2) / 1e3, 0, 'f', 2).arg(total / 1e3 / us.size(), 0, 'f', 2);
+}
+
+bool runSessionBench(const QString &image, int requests) {
+    if (QStandardPaths::findExecutable("xorriso").isEmpty()) {
+        fprintf(stderr, "xorriso is not installed\n");
+        return false;
+    }
+
+    // A process and an image load per request, as the one-shot jobs do.
+    QVector<qint64> fresh;
+    QElapsedTimer clock;
+    for (int i = 0; i < requests; ++i) {
+        QProcess proc;
+        clock.start();
+        proc.start("xorriso", XorrisoCommands::list(image, "/"));
+        if (!proc.waitForFinished(60000) || proc.exitStatus() != QProcess::NormalExit || proc.exitCode() != 0) {
+            fprintf(stderr, "xorriso failed to list %s\n", qPrintable(image));
+            return false;
+        }
+        fresh.append(clock.nsecsElapsed() / 1000);
+    }
+
+    // The first reply also waits for the image to load.
+    XorrisoSession session;
+    QString failure;
+    QObject::connect(&session, &XorrisoSession::crashed, [&failure](const QString &reason) { failure = reason; });
+    clock.start();
+    if (!session.start(image) || !session.execute({"-lsl", "/"}).ok || !failure.isEmpty()) {
+        fprintf(stderr, "%s\n",
+                qPrintable(failure.isEmpty() ? "The xorriso session failed to list " + image : failure));
+        return false;
+    }
+    const qint64 firstUs = clock.nsecsElapsed() / 1000;
+    QVector<qint64> dialog;
+    for (int i = 0; i < requests; ++i) {
+        const XorrisoSession::Reply reply = session.execute({"-lsl", "/"});
+        if (!reply.ok) {
+            fprintf(stderr, "%s\n", qPrintable(reply.info.join("\n")));
+            return false;
+        }
+        dialog.append(reply.elapsedUs);
+    }
+    session.stop();
+
+    printf("session-bench: fresh process: %d request(s), %s\n", requests, qPrintable(latencySummary(fresh)));
+    printf("session-bench: session: load + first reply %.2f ms; %d request(s), %s\n", firstUs / 1e3, requests,
+           qPrintable(latencySummary(dialog)));
+    return true;
+}
+
+// The in-process backends, run by the bench in a child of its own.
+int runWorker(const QStringList &args) {
+    const QString what = args.value(0);
+    QString error;
+    if (what == "build-libisofs" && args.size() == 3) {
+#ifdef HAVE_LIBISOFS
+        if (buildWithLibisofs(args.at(1), args.at(2), error)) return 0;
+#else
+        error = "built without libisofs";
+#endif
+        fprintf(stderr, "%s\n", qPrintable(error));
+        return 1;
+    }
+    if (what == "vfs-check" && args.size() == 3) return checkVfs(args.at(1), args.at(2)) ? 0 : 1;
+    if (what == "tree-stress" && args.size() == 5) {
+#ifdef HAVE_LIBISOFS
+        if (buildTreeStress(args.at(1).toInt(), args.at(2).toLongLong(), args.at(3), args.at(4), error)) return 0;
+#else
+        error = "built without libisofs";
+#endif
+        fprintf(stderr, "%s\n", qPrintable(error));
+        return 1;
+    }
+
+    Iso9660Reader reader;
+    if (args.size() < 2 || !reader.open(args.at(1))) {
+        fprintf(stderr, "%s\n", qPrintable(args.size() < 2 ? QString("missing image") : reader.errorString()));
+        return 1;
+    }
+    // Listings are printed, like the tools being compared do.
+    if (what == "open") {
+        QVector<IsoDirEntry> entries;
+        if (!reader.readDirectory(reader.rootEntry(), entries)) return 1;
+        for (const IsoDirEntry &entry : entries) printf("%s\n", entry.name.toLocal8Bit().constData());
+        return 0;
+    }
+    if (what == "list") {
+        const bool ok = reader.walk([](const QString &parent, const IsoDirEntry &entry) {
+            printf("%s/%s\n", parent == "/" ? "" : parent.toLocal8Bit().constData(), entry.name.toLocal8Bit().constData());
+            return true;
+        });
+        return ok ? 0 : 1;
+    }
+    if (what == "extract" && args.size() == 3) {
+        IsoExtractor extractor;
+        extractor.setMaxThreads(QThread::idealThreadCount());
+        if (extractor.addFromImage(&reader, "/", args.at(2)) < 0) return 1;
+        QEventLoop loop;
+        int failed = 0;
+        QObject::connect(&extractor, &IsoExtractor::fileFinished, [](const QString &target, bool ok, const QString &message) {
+            if (!ok) fprintf(stderr, "%s: %s\n", qPrintable(target), qPrintable(message));
+        });
+        QObject::connect(&extractor, &IsoExtractor::finished, &loop, [&](int failures, bool) {
+            failed = failures;
+            loop.quit();
+        });
+        if (!extractor.start()) return 1;
+        loop.exec();
+        return failed ? 1 : 0;
+    }
+    fprintf(stderr, "unknown worker command %s\n", qPrintable(what));
+    return 2;
+}
+
+bool parseOptions(const QStringList &args, Options &options) {
+    QStringList names;
+    double scale = 1;
+    // Overrides, applied to every workload once they are all known.
+    QHash<QString, QString> set;
+    for (int i = 0; i < args.size(); ++i) {
+        const QString arg = args.at(i);
+        if (arg == "--drop-caches") {
+            options.dropCaches = true;
+            continue;
+        }
+        if (arg == "--vfs-check") {
+            options.vfsCheck = true;
+            continue;
+        }
+        if (i + 1 >= args.size()) return false;
+        const QString value = args.at(++i);
+        bool ok = true;
+        if (arg == "--workload") names += value.split(',', QString::SkipEmptyParts);
+        else if (arg == "--backends") options.backends += value.split(',', QString::SkipEmptyParts);
+        else if (arg == "--repeat") options.repeat = qMax(1, value.toInt(&ok));
+        else if (arg == "--work-dir") options.workDir = value;
+        else if (arg == "--json") options.jsonPath = value;
+        else if (arg == "--csv") options.csvPath = value;
+        else if (arg == "--baseline") options.baselinePath = value;
+        else if (arg == "--tolerance") options.tolerance = value.toDouble(&ok);
+        else if (arg == "--scale") scale = value.toDouble(&ok);
+        else if (arg == "--tree-stress") options.treeStress = value.toInt(&ok);
+        else if (arg == "--budget") options.budgetMb = value.toInt(&ok);
+        else if (arg == "--graft-stress") options.graftStress = value.toInt(&ok);
+        else if (arg == "--index-bench") options.indexBench = value.toInt(&ok);
+        else if (arg == "--session-bench") options.sessionBench = value;
+        else if (arg == "--requests") options.requests = qMax(1, value.toInt(&ok));
+        else if (arg == "--catalog") options.catalog = value;
+        else if (arg == "--scan") options.scan = value;
+        else if (arg == "--zisofs-bench") options.zisofsBench = value;
+        else if (arg == "--threads") options.threads = qMax(1, value.toInt(&ok));
+        else if (arg == "--files" || arg == "--min-size" || arg == "--max-size" || arg == "--depth"
+                 || arg == "--per-dir" || arg == "--name-length" || arg == "--seed")
+            set.insert(arg, value);
+        else return false;
+        if (!ok) return false;
+    }
+
+    if (names.isEmpty()) {
+        options.workloads = IsoSyntheticTree::presets();
+    } else {
+        for (const QString &name : qAsConst(names)) {
+            IsoSyntheticTree::Spec spec;
+            if (!IsoSyntheticTree::preset(name, spec)) {
+                fprintf(stderr, "Unknown workload %s\n", qPrintable(name));
+                return false;
+            }
+            options.workloads << spec;
+        }
+    }
+    for (IsoSyntheticTree::Spec &spec : options.workloads) {
+        bool ok = true;
+        for (auto it = set.constBegin(); it != set.constEnd() && ok; ++it) {
+            if (it.key() == "--files") spec.files = it.value().toInt(&ok);
+            else if (it.key() == "--min-size") ok = parseSize(it.value(), spec.minSize);
+            else if (it.key() == "--max-size") ok = parseSize(it.value(), spec.maxSize);
+            else if (it.key() == "--depth") spec.depth = it.value().toInt(&ok);
+            else if (it.key() == "--per-dir") spec.filesPerDir = it.value().toInt(&ok);
+            else if (it.key() == "--name-length") spec.nameLength = it.value().toInt(&ok);
+            else if (it.key() == "--seed") spec.seed = it.value().toUInt(&ok);
+        }
+        if (!ok) return false;
+        spec.files = qMax(1, int(spec.files * scale));
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments().mid(1);
+    if (args.value(0) == "--run") return runWorker(args.mid(1));
+    if (args.value(0) == "-h" || args.value(0) == "--help") {
+        fputs(Usage, stdout);
+        return 0;
+    }
+
+    Options options;
+    if (!parseOptions(args, options)) {
+        fputs(Usage, stderr);
+        return 2;
+    }
+
+    if (options.treeStress > 0) return runTreeStress(options) ? 0 : 1;
+    if (options.graftStress > 0) return runGraftStress(options) ? 0 : 1;
+    if (options.indexBench > 0) return runIndexBench(options.indexBench) ? 0 : 1;
+    if (!options.sessionBench.isEmpty()) return runSessionBench(options.sessionBench, options.requests) ? 0 : 1;
+    if (!options.catalog.isEmpty()) return runCatalog(options.catalog) ? 0 : 1;
+    if (!options.scan.isEmpty()) return runScan(options.scan, options.threads) ? 0 : 1;
+    if (!options.zisofsBench.isEmpty()) return runZisofsBench(options) ? 0 : 1;
+    if (options.vfsCheck) return runVfsCheck(options) ? 0 : 1;
+
+    Bench bench(options);
+    if (!bench.run()) return 1;
+    const QJsonObject report = bench.report();
+    bool ok = bench.allOk();
+
+    const QJsonObject fastest = report.value("fastest").toObject();
+    for (auto it = fastest.constBegin(); it != fastest.constEnd(); ++it) {
+        const QJsonObject perOperation = it.value().toObject();
+        QStringList parts;
+        for (auto op = perOperation.constBegin(); op != perOperation.constEnd(); ++op)
+            parts << op.key() + " " + op.value().toString();
+        printf("fastest for %s: %s\n", qPrintable(it.key()), qPrintable(parts.join(", ")));
+    }
+
+    if (!options.jsonPath.isEmpty()) ok = writeFile(options.jsonPath, QJsonDocument(report).toJson()) && ok;
+    if (!options.csvPath.isEmpty()) ok = writeFile(options.csvPath, bench.csv()) && ok;
+
+    if (!options.baselinePath.isEmpty()) {
+        QFile file(options.baselinePath);
+        if (!file.open(QIODevice::ReadOnly)) {
+            fprintf(stderr, "%s: %s\n", qPrintable(options.baselinePath), qPrintable(file.errorString()));
+            return 1;
+        }
+        const QStringList found = regressions(report, QJsonDocument::fromJson(file.readAll()).object(), options.tolerance);
+        for (const QString &line : found) printf("REGRESSION %s\n", qPrintable(line));
+        if (found.isEmpty()) printf("No regressions against %s (tolerance %g%%)\n", qPrintable(options.baselinePath),
+                                    options.tolerance);
+        ok = ok && found.isEmpty();
+    }
+    return ok ? 0 : 1;
+}
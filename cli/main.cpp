@@ -0,0 +1,474 @@
+#include <QCoreApplication>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QProcess>
+#include <QRunnable>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "iso9660reader.h"
+#include "isochangeset.h"
+#include "isoextractor.h"
+#include "isoreproducible.h"
+#include "isostagingarea.h"
+#include "isotrace.h"
+#include "isoverifier.h"
+#include "isozisofs.h"
+#include "xorrisocommands.h"
+
+// One line of work, from the command line or from a manifest.
+struct Operation {
+    int line = 0;          // manifest line, 0 for the command line
+    QString verb;
+    QStringList args;
+};
+
+static const char *const Usage =
+    "Usage: isomanager-cli [-j N] [--trace <prefix>] <operation>\n"
+    "       isomanager-cli [-j N] [--trace <prefix>] run <manifest>\n"
+    "\n"
+    "Operations:\n"
+    "  list <image> [iso-dir]\n"
+    "  extract <image> <target-dir> <iso-path>...\n"
+    "  add <image> <iso-path>=<local-path>...\n"
+    "  delete <image> <iso-path>...\n"
+    "  rename <image> <iso-path> <new-iso-path>\n"
+    "  rebuild <image> <output> [--add <iso-path>=<local-path>]... [--delete <iso-path>]...\n"
+    "  compact <image> <output>\n"
+    "  make-bootable <source-dir> <boot-image> <output> [--volid <name>] [--mbr <file>] [--zisofs]\n"
+    "  verify <image> [--write]\n"
+    "\n"
+    "A manifest holds one operation per line; '#' starts a comment. Operations\n"
+    "on different images run in parallel (-j, default: one per CPU); those on\n"
+    "the same image run in manifest order, and consecutive add/delete/rename\n"
+    "lines for one image are appended to it as a single new session.\n"
+    "\n"
+    "Images written by rebuild, compact, make-bootable and edits get sha256sum\n"
+    "manifests next to them (<image>.sha256, <image>.files.sha256). verify reads\n"
+    "an image once, checks its MD5 session tags and compares it with those\n"
+    "manifests; --write (re)writes them instead.\n"
+    "\n"
+    "--trace records wall and CPU time, I/O bytes, syscalls and files per phase\n"
+    "(open, scan, stage, write, verify, extract, tool), prints a summary and\n"
+    "writes <prefix>.trace.json (chrome://tracing, Perfetto) and\n"
+    "<prefix>.stats.json. ISOMANAGER_TRACE=<prefix> does the same for every\n"
+    "program of the suite.\n";
+
+namespace {
+
+QMutex consoleMutex;
+// -j, also the thread count within an operation.
+int jobCount = 1;
+
+void print(const QString &tag, const QString &text, bool isError = false) {
+    QMutexLocker lock(&consoleMutex);
+    FILE *stream = isError ? stderr : stdout;
+    const QByteArray line = (tag.isEmpty() ? text : tag + " " + text).toLocal8Bit();
+    fprintf(stream, "%s\n", line.constData());
+    fflush(stream);
+}
+
+// Shell-like splitting: whitespace separates words, '...' and "..." group.
+QStringList splitWords(const QString &line) {
+    QStringList words;
+    QString word;
+    bool inWord = false;
+    QChar quote;
+    for (const QChar c : line) {
+        if (!quote.isNull()) {
+            if (c == quote) quote = QChar();
+            else word += c;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            inWord = true;
+        } else if (c.isSpace()) {
+            if (inWord) words << word;
+            word.clear();
+            inWord = false;
+        } else {
+            word += c;
+            inWord = true;
+        }
+    }
+    if (inWord) words << word;
+    return words;
+}
+
+bool readManifest(const QString &path, QVector<Operation> &out) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        print(QString(), path + ": " + file.errorString(), true);
+        return false;
+    }
+    QTextStream in(&file);
+    for (int line = 1; !in.atEnd(); ++line) {
+        QString text = in.readLine();
+        const int hash = text.indexOf('#');
+        if (hash >= 0) text.truncate(hash);
+        QStringList words = splitWords(text);
+        if (words.isEmpty()) continue;
+        Operation op;
+        op.line = line;
+        op.verb = words.takeFirst();
+        op.args = words;
+        out.append(op);
+    }
+    return true;
+}
+
+// Operations sharing a key touch the same file and must not overlap.
+QString operationKey(const Operation &op) {
+    if (op.args.isEmpty()) return QString();
+    const QString path = op.verb == "make-bootable" && op.args.size() >= 3 ? op.args.at(2)
+                         : op.verb == "graft-stress" && op.args.size() >= 2 ? op.args.at(1)
+                         : op.args.first();
+    return QFileInfo(path).absoluteFilePath();
+}
+
+bool isEdit(const Operation &op) {
+    return op.verb == "add" || op.verb == "delete" || op.verb == "rename";
+}
+
+QString tagFor(const Operation &op) {
+    return op.line > 0 ? QString("[%1]").arg(op.line) : QString();
+}
+
+bool runProcess(const QString &program, const QStringList &args, const QString &tag) {
+    IsoTrace::Phase trace(XorrisoCommands::traceCategory(args), QFileInfo(program).fileName() + " " + args.join(" "));
+    QProcess proc;
+    proc.start(program, args);
+    if (!proc.waitForStarted()) {
+        print(tag, "Failed to start " + program + ": " + proc.errorString(), true);
+        return false;
+    }
+    proc.closeWriteChannel();
+    // No event loop in this thread; poll both channels ourselves.
+    auto forward = [&proc, &tag]() {
+        proc.setReadChannel(QProcess::StandardOutput);
+        while (proc.canReadLine()) print(tag, QString::fromLocal8Bit(proc.readLine()).trimmed());
+        proc.setReadChannel(QProcess::StandardError);
+        while (proc.canReadLine()) print(tag, QString::fromLocal8Bit(proc.readLine()).trimmed(), true);
+    };
+    while (!proc.waitForFinished(100)) {
+        if (proc.state() == QProcess::NotRunning) break;
+        forward();
+    }
+    forward();
+    const QString restOut = QString::fromLocal8Bit(proc.readAllStandardOutput()).trimmed();
+    const QString restErr = QString::fromLocal8Bit(proc.readAllStandardError()).trimmed();
+    if (!restOut.isEmpty()) print(tag, restOut);
+    if (!restErr.isEmpty()) print(tag, restErr, true);
+    return proc.exitStatus() == QProcess::NormalExit && proc.exitCode() == 0;
+}
+
+bool runXorriso(const QStringList &args, const QString &tag) {
+    return runProcess("xorriso", args, tag);
+}
+
+// For an image just written.
+bool writeManifests(const QString &image, const QString &tag) {
+    QString error;
+    if (!IsoVerifier::createManifests(image, &error)) {
+        print(tag, "No checksum manifest for " + image + ": " + error, true);
+        return false;
+    }
+    print(tag, "Checksums written to " + IsoVerifier::manifestPath(image));
+    return true;
+}
+
+bool runList(const Operation &op, const QString &tag) {
+    if (op.args.isEmpty() || op.args.size() > 2) return false;
+    const QString image = op.args.at(0);
+    const QString dir = op.args.value(1, "/");
+
+    Iso9660Reader reader;
+    if (!reader.open(image)) return runXorriso(XorrisoCommands::list(image, dir), tag);
+
+    const QString base = IsoChangeSet::normalize(dir);
+    const QString prefix = base == "/" ? "/" : base + "/";
+    return reader.walk([&](const QString &parentPath, const IsoDirEntry &entry) {
+        const QString path = (parentPath == "/" ? "/" : parentPath + "/") + entry.name;
+        if (base == "/" || path == base || path.startsWith(prefix))
+            print(tag, QString("%1 %2 %3").arg(entry.isDirectory ? 'd' : '-').arg(entry.contentSize(), 12).arg(path));
+        return true;
+    });
+}
+
+bool runExtract(const Operation &op, const QString &tag) {
+    if (op.args.size() < 3) return false;
+    const QString image = op.args.at(0);
+    const QString targetDir = op.args.at(1);
+    const QStringList isoPaths = op.args.mid(2);
+    QStringList targets;
+    for (const QString &isoPath : isoPaths) targets << QDir(targetDir).filePath(QFileInfo(isoPath).fileName());
+
+    Iso9660Reader reader;
+    if (!reader.open(image)) return runXorriso(XorrisoCommands::extract(image, isoPaths, targets), tag);
+
+    IsoExtractor extractor;
+    for (int i = 0; i < isoPaths.size(); ++i) {
+        if (extractor.addFromImage(&reader, isoPaths.at(i), targets.at(i)) < 0) {
+            print(tag, "Not in the image: " + isoPaths.at(i), true);
+            return false;
+        }
+    }
+    if (extractor.fileCount() == 0) return true;
+
+    int failures = 0;
+    QEventLoop loop;
+    QObject::connect(&extractor, &IsoExtractor::fileFinished, [&tag](const QString &target, bool ok, const QString &error) {
+        if (!ok) print(tag, "Failed to extract " + target + ": " + error, true);
+    });
+    QObject::connect(&extractor, &IsoExtractor::finished, [&](int failed, bool) {
+        failures = failed;
+        loop.quit();
+    });
+    const int files = extractor.fileCount();
+    const quint64 bytes = extractor.totalBytes();
+    if (!extractor.start()) return false;
+    loop.exec();
+    print(tag, QString("Extracted %1 file(s), %2 bytes").arg(files - failures).arg(bytes));
+    return failures == 0;
+}
+
+// Adds the edit described by op to changes; false if op is malformed.
+bool collectEdit(const Operation &op, IsoChangeSet &changes) {
+    const QStringList paths = op.args.mid(1);
+    if (paths.isEmpty()) return false;
+    if (op.verb == "rename") {
+        if (paths.size() != 2) return false;
+        changes.rename(paths.at(0), paths.at(1));
+    } else if (op.verb == "delete") {
+        for (const QString &path : paths) changes.remove(path);
+    } else {
+        for (const QString &graft : paths) {
+            const int eq = graft.indexOf('=');
+            if (eq <= 0) return false;
+            changes.add(graft.left(eq), graft.mid(eq + 1));
+        }
+    }
+    return true;
+}
+
+bool runRebuild(const Operation &op, const QString &tag) {
+    if (op.args.size() < 2) return false;
+    IsoChangeSet changes;
+    for (int i = 2; i < op.args.size(); i += 2) {
+        if (i + 1 >= op.args.size()) return false;
+        Operation edit;
+        edit.verb = op.args.at(i) == "--add" ? "add" : op.args.at(i) == "--delete" ? "delete" : QString();
+        if (edit.verb.isEmpty()) return false;
+        edit.args = QStringList{op.args.at(0), op.args.at(i + 1)};
+        if (!collectEdit(edit, changes)) return false;
+    }
+    return runXorriso(changes.xorrisoArguments(op.args.at(0), op.args.at(1)), tag) && writeManifests(op.args.at(1), tag);
+}
+
+bool runCompact(const Operation &op, const QString &tag) {
+    if (op.args.size() != 2) return false;
+    // Written next to the output and renamed over it, so compacting an image
+    // onto itself (or failing halfway) leaves the original intact.
+    const QString output = op.args.at(1);
+    const QString temp = output + ".compact";
+    QFile::remove(temp);
+    if (!runXorriso(XorrisoCommands::compact(op.args.at(0), temp), tag)) {
+        QFile::remove(temp);
+        return false;
+    }
+    if (::rename(QFile::encodeName(temp).constData(), QFile::encodeName(output).constData()) != 0) {
+        print(tag, "Cannot replace " + output + ": " + QString::fromLocal8Bit(strerror(errno)), true);
+        QFile::remove(temp);
+        return false;
+    }
+    return writeManifests(output, tag);
+}
+
+bool runBootable(const Operation &op, const QString &tag) {
+    if (op.args.size() < 3) return false;
+    QString volumeId = "BOOTISO", mbr;
+    bool zisofs = false;
+    for (int i = 3; i < op.args.size(); ++i) {
+        if (op.args.at(i) == "--zisofs") zisofs = true;
+        else if (i + 1 >= op.args.size()) return false;
+        else if (op.args.at(i) == "--volid") volumeId = op.args.at(++i);
+        else if (op.args.at(i) == "--mbr") mbr = op.args.at(++i);
+        else return false;
+    }
+    QStringList sources{op.args.at(0)};
+    QTemporaryDir work;
+    IsoStagingArea staging;
+    QString error;
+    if (zisofs) {
+        // Compressed copies are grafted over the tree; the rest is read
+        // from where it is.
+        IsoZisofsCompressor compressor;
+        compressor.setMaxThreads(jobCount);
+        QHash<QString, QString> copies;
+        if (!work.isValid()
+            || !compressor.compressTree(op.args.at(0), work.path(), copies, IsoZisofsCompressor::bootFiles(op.args.at(1)),
+                                        &error)) {
+            print(tag, "zisofs: " + (error.isEmpty() ? work.errorString() : error), true);
+            return false;
+        }
+        IsoZisofsCompressor::stageTree(staging, "/", op.args.at(0), copies);
+        if (!staging.writePathLists(work.path(), sources, &error)) {
+            print(tag, "zisofs: " + error, true);
+            return false;
+        }
+        print(tag, QString("zisofs: %1 file(s) compressed, %2 MB -> %3 MB")
+                       .arg(compressor.filesCompressed())
+                       .arg(compressor.bytesBefore() / 1048576.0, 0, 'f', 1)
+                       .arg(compressor.bytesAfter() / 1048576.0, 0, 'f', 1));
+    } else {
+        staging.add("/", op.args.at(0));
+    }
+    // Reproducible images get their file data in path order.
+    const IsoReproducibleBuild reproducible = IsoReproducibleBuild::fromEnvironment();
+    if (!work.isValid() || !reproducible.writeSortWeights(staging, work.path(), sources, &error)) {
+        print(tag, "Sort weights: " + (error.isEmpty() ? work.errorString() : error), true);
+        return false;
+    }
+    return runXorriso(XorrisoCommands::makeBootable(sources, op.args.at(1), op.args.at(2), volumeId, mbr, zisofs), tag)
+           && writeManifests(op.args.at(2), tag);
+}
+
+bool runVerify(const Operation &op, const QString &tag) {
+    if (op.args.isEmpty() || op.args.size() > 2 || (op.args.size() == 2 && op.args.at(1) != "--write")) return false;
+    const QString image = op.args.at(0);
+    const bool write = op.args.size() == 2;
+    IsoVerifier verifier;
+    verifier.setMaxThreads(jobCount);
+    verifier.run(image);
+    const IsoVerifier::Result &result = verifier.result();
+    int tags = 0;
+    for (const IsoVerifier::Tag &t : result.tags) tags += t.checked;
+    print(tag, QString("%1: %2 MB in %3 s, %4 MB/s; %5 file(s), %6 MD5 tag(s) checked")
+                   .arg(image).arg(result.bytes / 1048576.0, 0, 'f', 1).arg(result.seconds, 0, 'f', 2)
+                   .arg(result.bytes / 1048576.0 / qMax(result.seconds, 1e-9), 0, 'f', 1)
+                   .arg(result.files.size()).arg(tags));
+    QStringList problems = result.errors;
+    QString error;
+    if (write) {
+        if (result.ok() && !IsoVerifier::writeManifests(image, result, &error)) problems << error;
+    } else if (QFile::exists(IsoVerifier::manifestPath(image))) {
+        problems += IsoVerifier::compareWithManifests(image, result, &error);
+        if (!error.isEmpty()) problems << error;
+    } else {
+        print(tag, "No manifest; image SHA-256 " + QString::fromLatin1(result.imageSha256));
+    }
+    for (const QString &problem : qAsConst(problems)) print(tag, "FAILED: " + problem, true);
+    return problems.isEmpty();
+}
+
+bool runOne(const Operation &op) {
+    const QString tag = tagFor(op);
+    bool known = true;
+    bool ok = false;
+    if (op.verb == "list") ok = runList(op, tag);
+    else if (op.verb == "extract") ok = runExtract(op, tag);
+    else if (op.verb == "rebuild") ok = runRebuild(op, tag);
+    else if (op.verb == "compact") ok = runCompact(op, tag);
+    else if (op.verb == "make-bootable") ok = runBootable(op, tag);
+    else if (op.verb == "verify") ok = runVerify(op, tag);
+    else known = false;
+    if (!known) print(tag, "Unknown operation: " + op.verb, true);
+    else if (!ok) print(tag, op.verb + " failed", true);
+    return ok;
+}
+
+// Runs the operations for one key in order, folding runs of edits into a
+// single commit.
+class KeyRunner : public QRunnable {
+public:
+    KeyRunner(const QVector<Operation> &ops, QAtomicInt &failures) : ops(ops), failures(failures) {}
+
+    void run() override {
+        for (int i = 0; i < ops.size();) {
+            if (!isEdit(ops.at(i))) {
+                if (!runOne(ops.at(i))) failures.ref();
+                ++i;
+                continue;
+            }
+            IsoChangeSet changes;
+            const Operation &first = ops.at(i);
+            bool ok = true;
+            for (; i < ops.size() && isEdit(ops.at(i)); ++i) {
+                if (!collectEdit(ops.at(i), changes)) {
+                    print(tagFor(ops.at(i)), "Malformed " + ops.at(i).verb, true);
+                    ok = false;
+                }
+            }
+            if (!ok || !runXorriso(changes.xorrisoArguments(first.args.first()), tagFor(first))
+                || !writeManifests(first.args.first(), tagFor(first)))
+                failures.ref();
+        }
+    }
+
+private:
+    QVector<Operation> ops;
+    QAtomicInt &failures;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments().mid(1);
+
+    int jobs = QThread::idealThreadCount();
+    QString tracePrefix;
+    while (args.size() >= 2 && (args.first() == "-j" || args.first() == "--trace")) {
+        if (args.first() == "-j") jobs = qMax(1, args.at(1).toInt());
+        else tracePrefix = args.at(1);
+        args = args.mid(2);
+    }
+    jobCount = jobs;
+    IsoTrace::enableFromEnvironment();
+    if (!tracePrefix.isEmpty()) IsoTrace::setEnabled(true);
+    if (args.isEmpty() || args.first() == "-h" || args.first() == "--help") {
+        fputs(Usage, args.isEmpty() ? stderr : stdout);
+        return args.isEmpty() ? 2 : 0;
+    }
+
+    QVector<Operation> ops;
+    if (args.first() == "run") {
+        if (args.size() != 2 || !readManifest(args.at(1), ops)) return 2;
+    } else {
+        Operation op;
+        op.verb = args.takeFirst();
+        op.args = args;
+        ops.append(op);
+    }
+
+    // Group by the file each operation works on, keeping manifest order.
+    QVector<QString> keys;
+    QHash<QString, QVector<Operation>> groups;
+    for (const Operation &op : qAsConst(ops)) {
+        const QString key = operationKey(op);
+        if (!groups.contains(key)) keys.append(key);
+        groups[key].append(op);
+    }
+
+    QAtomicInt failures;
+    QThreadPool pool;
+    pool.setMaxThreadCount(jobs);
+    for (const QString &key : qAsConst(keys)) pool.start(new KeyRunner(groups.value(key), failures));
+    pool.waitForDone();
+
+    if (!tracePrefix.isEmpty()) {
+        fputs(qPrintable(IsoTrace::summary()), stderr);
+        QString error;
+        if (!IsoTrace::save(tracePrefix, &error)) print(QString(), error, true);
+    }
+    return failures.load() ? 1 : 0;
+}
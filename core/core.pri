@@ -0,0 +1,56 @@
+# Shared, GUI-free ISO engine used by the frontends.
+# Pull it in from a frontend .pro with: include(../core/core.pri)
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+HEADERS += \
+    $$PWD/iso9660reader.h \
+    $$PWD/isoblockcache.h \
+    $$PWD/isobuildtree.h \
+    $$PWD/isocatalog.h \
+    $$PWD/isoextractor.h \
+    $$PWD/isochangeset.h \
+    $$PWD/isodedup.h \
+    $$PWD/isopathindex.h \
+    $$PWD/isoreproducible.h \
+    $$PWD/isostagingarea.h \
+    $$PWD/isostringtable.h \
+    $$PWD/isotrace.h \
+    $$PWD/isotracemodel.h \
+    $$PWD/isotreemodel.h \
+    $$PWD/isotreescanner.h \
+    $$PWD/isotreesources.h \
+    $$PWD/isoverifier.h \
+    $$PWD/isovfs.h \
+    $$PWD/isozisofs.h \
+    $$PWD/xorrisocommands.h \
+    $$PWD/xorrisojobrunner.h \
+    $$PWD/xorrisosession.h
+
+SOURCES += \
+    $$PWD/iso9660reader.cpp \
+    $$PWD/isoblockcache.cpp \
+    $$PWD/isobuildtree.cpp \
+    $$PWD/isocatalog.cpp \
+    $$PWD/isoextractor.cpp \
+    $$PWD/isochangeset.cpp \
+    $$PWD/isodedup.cpp \
+    $$PWD/isopathindex.cpp \
+    $$PWD/isoreproducible.cpp \
+    $$PWD/isostagingarea.cpp \
+    $$PWD/isostringtable.cpp \
+    $$PWD/isotrace.cpp \
+    $$PWD/isotracemodel.cpp \
+    $$PWD/isotreemodel.cpp \
+    $$PWD/isotreescanner.cpp \
+    $$PWD/isotreesources.cpp \
+    $$PWD/isoverifier.cpp \
+    $$PWD/isovfs.cpp \
+    $$PWD/isozisofs.cpp \
+    $$PWD/xorrisocommands.cpp \
+    $$PWD/xorrisojobrunner.cpp \
+    $$PWD/xorrisosession.cpp
+
+# zisofs compression and decompression.
+LIBS += -lz
@@ -0,0 +1,430 @@
+#include "iso9660reader.h"
+#include "isotrace.h"
+
+#include <QFile>
+#include <QHash>
+#include <QSet>
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace {
+
+inline quint16 le16(const uchar *p) { return quint16(p[0] | (p[1] << 8)); }
+inline quint32 le32(const uchar *p) {
+    return quint32(p[0]) | (quint32(p[1]) << 8) | (quint32(p[2]) << 16) | (quint32(p[3]) << 24);
+}
+
+qint64 daysFromCivil(int y, int m, int d) {
+    y -= m <= 2;
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const int yoe = y - era * 400;
+    const int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return qint64(era) * 146097 + doe - 719468;
+}
+
+// 7-byte directory record date (ECMA-119 9.1.5).
+qint64 isoDate7(const uchar *p) {
+    if (p[1] == 0 || p[2] == 0) return 0;
+    qint64 t = daysFromCivil(1900 + p[0], p[1], p[2]) * 86400
+             + p[3] * 3600 + p[4] * 60 + p[5];
+    return t - qint64(qint8(p[6])) * 15 * 60;
+}
+
+// 17-byte volume descriptor style date (ECMA-119 8.4.26.1), used by long-form TF.
+qint64 isoDate17(const uchar *p) {
+    auto num = [p](int off, int len) {
+        int v = 0;
+        for (int i = 0; i < len; ++i) v = v * 10 + (p[off + i] - '0');
+        return v;
+    };
+    const int month = num(4, 2), day = num(6, 2);
+    if (month == 0 || day == 0) return 0;
+    qint64 t = daysFromCivil(num(0, 4), month, day) * 86400
+             + num(8, 2) * 3600 + num(10, 2) * 60 + num(12, 2);
+    return t - qint64(qint8(p[16])) * 15 * 60;
+}
+
+} // namespace
+
+Iso9660Reader::Iso9660Reader(const QString &imagePath) {
+    open(imagePath);
+}
+
+Iso9660Reader::~Iso9660Reader() {
+    close();
+}
+
+bool Iso9660Reader::open(const QString &imagePath) {
+    IsoTrace::Phase trace("open", imagePath);
+    close();
+    error.clear();
+    path = imagePath;
+    fd = ::open(QFile::encodeName(imagePath).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+    if (!readVolumeDescriptors()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void Iso9660Reader::close() {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    volId.clear();
+    names = PlainNames;
+    volumeBlocks = pathTableSize = pathTableLba = 0;
+    suspSkip = 0;
+    joliet = false;
+    root = IsoDirEntry();
+}
+
+qint64 Iso9660Reader::readAt(qint64 offset, char *buf, qint64 len) const {
+    qint64 done = 0;
+    while (done < len) {
+        ssize_t n = ::pread(fd, buf + done, size_t(len - done), off_t(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+QByteArray Iso9660Reader::readSectors(quint32 lba, quint32 count) const {
+    QByteArray buf(int(count) * SectorSize, Qt::Uninitialized);
+    qint64 n = readAt(qint64(lba) * SectorSize, buf.data(), buf.size());
+    buf.resize(n < 0 ? 0 : int(n));
+    return buf;
+}
+
+bool Iso9660Reader::readVolumeDescriptors() {
+    QByteArray primary, supplementary;
+    for (quint32 lba = 16; lba < 16 + 64; ++lba) {
+        QByteArray vd = readSectors(lba, 1);
+        const uchar *d = reinterpret_cast<const uchar *>(vd.constData());
+        if (vd.size() != SectorSize || memcmp(d + 1, "CD001", 5) != 0) {
+            error = "Not an ISO9660 image";
+            return false;
+        }
+        if (d[0] == 255) break;
+        if (d[0] == 1 && primary.isEmpty()) {
+            primary = vd;
+        } else if (d[0] == 2 && supplementary.isEmpty()
+                   && d[88] == '%' && d[89] == '/'
+                   && (d[90] == '@' || d[90] == 'C' || d[90] == 'E')) {
+            supplementary = vd;
+        }
+    }
+    if (primary.isEmpty()) {
+        error = "No primary volume descriptor";
+        return false;
+    }
+
+    const uchar *pvd = reinterpret_cast<const uchar *>(primary.constData());
+    volId = QString::fromLatin1(reinterpret_cast<const char *>(pvd + 40), 32).trimmed();
+    volumeBlocks = le32(pvd + 80);
+    if (le16(pvd + 128) != SectorSize) {
+        error = "Unsupported logical block size";
+        return false;
+    }
+
+    bool self = false, parent = false;
+    if (!parseRecord(pvd + 156, 34, root, self, parent)) {
+        error = "Invalid root directory record";
+        return false;
+    }
+
+    // Rock Ridge is announced by a SUSP "SP" entry in the root's "." record.
+    QByteArray rootSector = readSectors(root.extent, 1);
+    const uchar *r = reinterpret_cast<const uchar *>(rootSector.constData());
+    if (rootSector.size() == SectorSize && r[0] >= 34) {
+        int nameLen = r[32];
+        int su = 33 + nameLen + ((nameLen & 1) ? 0 : 1);
+        if (su + 7 <= r[0] && r[su] == 'S' && r[su + 1] == 'P'
+            && r[su + 4] == 0xBE && r[su + 5] == 0xEF) {
+            suspSkip = r[su + 6];
+            names = RockRidgeNames;
+        }
+    }
+
+    const uchar *vd = pvd;
+    if (names != RockRidgeNames && !supplementary.isEmpty()) {
+        vd = reinterpret_cast<const uchar *>(supplementary.constData());
+        joliet = true;
+        names = JolietNames;
+        IsoDirEntry jolietRoot;
+        if (parseRecord(vd + 156, 34, jolietRoot, self, parent)) root = jolietRoot;
+    }
+    root.name.clear();
+    root.isDirectory = true;
+    pathTableSize = le32(vd + 132);
+    pathTableLba = le32(vd + 140);
+    return true;
+}
+
+bool Iso9660Reader::readPathTable(QVector<PathTableRecord> &out) {
+    out.clear();
+    if (pathTableSize == 0 || pathTableLba == 0) return false;
+    QByteArray table(int(pathTableSize), Qt::Uninitialized);
+    if (readAt(qint64(pathTableLba) * SectorSize, table.data(), table.size()) != table.size())
+        return false;
+
+    const uchar *d = reinterpret_cast<const uchar *>(table.constData());
+    int pos = 0;
+    while (pos + 8 <= table.size()) {
+        int nameLen = d[pos];
+        if (nameLen == 0 || pos + 8 + nameLen > table.size()) break;
+        PathTableRecord rec;
+        rec.extent = le32(d + pos + 2);
+        rec.parent = le16(d + pos + 6);
+        rec.rawName = QByteArray(reinterpret_cast<const char *>(d + pos + 8), nameLen);
+        out.append(rec);
+        pos += 8 + nameLen + (nameLen & 1);
+    }
+    return !out.isEmpty();
+}
+
+QString Iso9660Reader::decodeName(const uchar *id, int len, bool isDirectory) const {
+    QString name;
+    if (joliet) {
+        name.reserve(len / 2);
+        for (int i = 0; i + 1 < len; i += 2)
+            name.append(QChar(ushort((id[i] << 8) | id[i + 1])));
+    } else {
+        name = QString::fromLatin1(reinterpret_cast<const char *>(id), len);
+    }
+    if (!isDirectory) {
+        int semi = name.lastIndexOf(';');
+        if (semi >= 0) name.truncate(semi);
+        if (name.endsWith('.')) name.chop(1);
+    }
+    return name;
+}
+
+void Iso9660Reader::parseSystemUse(const uchar *su, int len, IsoDirEntry &entry, SystemUse &state, int depth) {
+    quint32 ceBlock = 0, ceOffset = 0, ceLength = 0;
+    int pos = 0;
+    while (pos + 4 <= len) {
+        const uchar *e = su + pos;
+        const int l = e[2];
+        if (l < 4 || pos + l > len) break;
+        if (e[0] == 'N' && e[1] == 'M' && l >= 5 && !state.nameDone) {
+            // Bits 1/2 mark "." and "..", bit 0 means more NM pieces follow.
+            if (!(e[4] & 0x06)) state.name += QString::fromUtf8(reinterpret_cast<const char *>(e + 5), l - 5);
+            if (!(e[4] & 0x01)) state.nameDone = true;
+        } else if (e[0] == 'P' && e[1] == 'X' && l >= 12) {
+            entry.mode = le32(e + 4);
+        } else if (e[0] == 'T' && e[1] == 'F' && l >= 5) {
+            const int flags = e[4];
+            const int stamp = (flags & 0x80) ? 17 : 7;
+            if (flags & 0x02) {
+                const int off = 5 + ((flags & 0x01) ? stamp : 0);
+                if (off + stamp <= l)
+                    entry.mtime = stamp == 17 ? isoDate17(e + off) : isoDate7(e + off);
+            }
+        } else if (e[0] == 'C' && e[1] == 'L' && l >= 12) {
+            // Deep directory relocated elsewhere; follow the child link.
+            entry.extent = le32(e + 4);
+            entry.size = 0;
+            entry.isDirectory = true;
+        } else if (e[0] == 'Z' && e[1] == 'F' && l >= 16 && e[4] == 'p' && e[5] == 'z') {
+            // zisofs: header size in 4-byte units, log2 of the block size, size.
+            if (e[7] >= 15 && e[7] <= 17) {
+                entry.zisofsBlockLog2 = e[7];
+                entry.zisofsSize = le32(e + 8);
+            }
+        } else if (e[0] == 'R' && e[1] == 'E') {
+            state.relocated = true;
+        } else if (e[0] == 'C' && e[1] == 'E' && l >= 28) {
+            ceBlock = le32(e + 4);
+            ceOffset = le32(e + 12);
+            ceLength = le32(e + 20);
+        } else if (e[0] == 'S' && e[1] == 'T') {
+            break;
+        }
+        pos += l;
+    }
+
+    if (ceLength > 0 && ceLength <= SectorSize * 16 && depth < 16) {
+        QByteArray area(int(ceLength), Qt::Uninitialized);
+        if (readAt(qint64(ceBlock) * SectorSize + ceOffset, area.data(), area.size()) == area.size()) {
+            parseSystemUse(reinterpret_cast<const uchar *>(area.constData()), area.size(),
+                           entry, state, depth + 1);
+        }
+    }
+}
+
+bool Iso9660Reader::parseRecord(const uchar *rec, int len, IsoDirEntry &entry, bool &isSelf, bool &isParent,
+                                bool *relocated) {
+    if (len < 34 || rec[0] < 34 || rec[0] > len) return false;
+    const int recLen = rec[0];
+    const int nameLen = rec[32];
+    if (33 + nameLen > recLen) return false;
+
+    entry = IsoDirEntry();
+    entry.extent = le32(rec + 2);
+    entry.size = le32(rec + 10);
+    entry.mtime = isoDate7(rec + 18);
+    entry.isDirectory = rec[25] & 0x02;
+    isSelf = nameLen == 1 && rec[33] == 0;
+    isParent = nameLen == 1 && rec[33] == 1;
+
+    SystemUse su;
+    if (names == RockRidgeNames) {
+        const int off = 33 + nameLen + ((nameLen & 1) ? 0 : 1) + suspSkip;
+        if (off < recLen) parseSystemUse(rec + off, recLen - off, entry, su, 0);
+    }
+    if (relocated) *relocated = su.relocated;
+    if (!isSelf && !isParent) {
+        entry.name = su.name.isEmpty() ? decodeName(rec + 33, nameLen, entry.isDirectory) : su.name;
+        // Names end up in paths on disk when extracting; one that isn't a
+        // single path component would lead out of the target directory.
+        if (entry.name.isEmpty() || entry.name == "." || entry.name == ".." || entry.name.contains('/')
+            || entry.name.contains(QChar(0)))
+            return false;
+    }
+    return true;
+}
+
+bool Iso9660Reader::readDirectory(const IsoDirEntry &dir, QVector<IsoDirEntry> &out) {
+    out.clear();
+    if (fd < 0 || !dir.isDirectory) return false;
+
+    quint64 size = dir.size;
+    if (size == 0) {
+        // Rock Ridge child links don't carry a size; take it from the "." record.
+        QByteArray first = readSectors(dir.extent, 1);
+        if (first.size() < 34) return false;
+        size = le32(reinterpret_cast<const uchar *>(first.constData()) + 10);
+    }
+    if (size > quint64(256) * 1024 * 1024) {
+        error = "Directory extent too large";
+        return false;
+    }
+
+    QByteArray data(int(size), Qt::Uninitialized);
+    if (readAt(qint64(dir.extent) * SectorSize, data.data(), data.size()) != data.size()) {
+        error = "Short read in directory extent";
+        return false;
+    }
+
+    const uchar *d = reinterpret_cast<const uchar *>(data.constData());
+    bool continuing = false;
+    int pos = 0;
+    while (pos < data.size()) {
+        const int recLen = d[pos];
+        if (recLen == 0) {
+            // Records never straddle sectors; the rest of this one is padding.
+            pos = (pos / SectorSize + 1) * SectorSize;
+            continue;
+        }
+        if (pos + recLen > data.size()) break;
+
+        IsoDirEntry entry;
+        bool self = false, parent = false, relocated = false;
+        const bool moreExtents = d[pos + 25] & 0x80;
+        if (parseRecord(d + pos, recLen, entry, self, parent, &relocated) && !self && !parent
+            && !relocated) {
+            if (continuing && !out.isEmpty()) {
+                IsoDirEntry &last = out.last();
+                if (last.extents.isEmpty())
+                    last.extents.append({last.extent, quint32(last.size)});
+                last.extents.append({entry.extent, quint32(entry.size)});
+                last.size += entry.size;
+            } else {
+                out.append(entry);
+            }
+            continuing = moreExtents;
+        }
+        pos += recLen;
+    }
+    return true;
+}
+
+bool Iso9660Reader::findEntry(const QString &isoPath, IsoDirEntry &out) {
+    if (fd < 0) return false;
+    IsoDirEntry current = root;
+    QVector<IsoDirEntry> entries;
+    for (const QString &part : isoPath.split('/', QString::SkipEmptyParts)) {
+        if (!readDirectory(current, entries)) return false;
+        auto it = std::find_if(entries.cbegin(), entries.cend(),
+                               [&part](const IsoDirEntry &e) { return e.name == part; });
+        if (it == entries.cend()) return false;
+        current = *it;
+    }
+    out = current;
+    return true;
+}
+
+bool Iso9660Reader::walk(const Visitor &visitor) {
+    if (fd < 0) return false;
+
+    QHash<quint32, QString> dirPath;
+    QHash<quint32, IsoDirEntry> dirEntry;
+    QSet<quint32> visited;
+    dirPath.insert(root.extent, QStringLiteral("/"));
+    dirEntry.insert(root.extent, root);
+
+    QVector<IsoDirEntry> entries;
+    // Returns false once the visitor asks to stop.
+    auto visitDir = [&](quint32 extent) -> bool {
+        if (visited.contains(extent)) return true;
+        visited.insert(extent);
+        const QString parentPath = dirPath.value(extent);
+        if (!readDirectory(dirEntry.value(extent), entries)) return true;
+        for (const IsoDirEntry &entry : entries) {
+            if (!visitor(parentPath, entry)) return false;
+            if (entry.isDirectory && !dirPath.contains(entry.extent)) {
+                dirPath.insert(entry.extent, parentPath == "/" ? "/" + entry.name
+                                                               : parentPath + "/" + entry.name);
+                dirEntry.insert(entry.extent, entry);
+            }
+        }
+        return true;
+    };
+
+    // The path table lists parents before children, so one pass normally
+    // resolves every directory; relocated ones may need another.
+    QVector<PathTableRecord> table;
+    readPathTable(table);
+    QVector<int> pending;
+    for (int i = 0; i < table.size(); ++i) pending.append(i);
+    while (!pending.isEmpty()) {
+        QVector<int> deferred;
+        for (int idx : pending) {
+            const quint32 extent = table.at(idx).extent;
+            if (!dirPath.contains(extent)) {
+                deferred.append(idx);
+                continue;
+            }
+            if (!visitDir(extent)) return true;
+        }
+        if (deferred.size() == pending.size()) break;
+        pending = deferred;
+    }
+
+    // Anything the path table missed (or no path table at all).
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        const QList<quint32> known = dirPath.keys();
+        for (quint32 extent : known) {
+            if (visited.contains(extent)) continue;
+            progress = true;
+            if (!visitDir(extent)) return true;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,106 @@
+#ifndef ISO9660READER_H
+#define ISO9660READER_H
+
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+#include <functional>
+
+// One contiguous run of 2048-byte sectors belonging to a file.
+struct IsoExtent {
+    quint32 lba = 0;
+    quint32 length = 0;
+};
+
+// A directory record as seen through the best available naming
+// (Rock Ridge > Joliet > plain ISO9660).
+struct IsoDirEntry {
+    QString name;
+    quint32 extent = 0;       // LBA of the first extent
+    quint64 size = 0;         // total data length over all extents
+    qint64 mtime = 0;         // seconds since epoch, UTC
+    quint32 mode = 0;         // Rock Ridge PX mode, 0 if unknown
+    bool isDirectory = false;
+    QVector<IsoExtent> extents; // only filled for multi-extent files
+    // Rock Ridge ZF: the data is zisofs, in blocks of 2^zisofsBlockLog2 bytes.
+    quint8 zisofsBlockLog2 = 0;
+    quint32 zisofsSize = 0;   // uncompressed size
+
+    bool isCompressed() const { return zisofsBlockLog2 != 0; }
+    // What the file holds once read, compressed or not.
+    quint64 contentSize() const { return isCompressed() ? zisofsSize : size; }
+};
+
+// Reads volume descriptors, the path table and directory extents straight
+// from an image file with pread(), without starting any external tool.
+class Iso9660Reader {
+public:
+    enum NameSource { PlainNames, JolietNames, RockRidgeNames };
+
+    static const int SectorSize = 2048;
+
+    Iso9660Reader() = default;
+    explicit Iso9660Reader(const QString &imagePath);
+    ~Iso9660Reader();
+
+    bool open(const QString &imagePath);
+    void close();
+    bool isOpen() const { return fd >= 0; }
+    QString errorString() const { return error; }
+
+    QString imagePath() const { return path; }
+    QString volumeId() const { return volId; }
+    NameSource nameSource() const { return names; }
+    quint32 volumeSpaceSize() const { return volumeBlocks; }
+    const IsoDirEntry &rootEntry() const { return root; }
+
+    // Lists the entries of one directory, without "." and "..".
+    bool readDirectory(const IsoDirEntry &dir, QVector<IsoDirEntry> &out);
+    // Looks up an absolute path ("/" is the root) one directory at a time.
+    bool findEntry(const QString &isoPath, IsoDirEntry &out);
+
+    // Visits every entry of the image. Directories are read in path table
+    // order so the image is scanned mostly front to back. parentPath is
+    // "/" for the root and has no trailing slash otherwise. Returning false
+    // from the visitor stops the walk.
+    typedef std::function<bool(const QString &parentPath, const IsoDirEntry &entry)> Visitor;
+    bool walk(const Visitor &visitor);
+
+    qint64 readAt(qint64 offset, char *buf, qint64 len) const;
+    QByteArray readSectors(quint32 lba, quint32 count) const;
+    int handle() const { return fd; }
+
+private:
+    struct PathTableRecord {
+        quint32 extent;
+        quint16 parent;    // 1-based index into the path table
+        QByteArray rawName;
+    };
+
+    bool readVolumeDescriptors();
+    bool readPathTable(QVector<PathTableRecord> &out);
+    struct SystemUse {
+        QString name;
+        bool nameDone = false;
+        bool relocated = false;
+    };
+
+    bool parseRecord(const uchar *rec, int len, IsoDirEntry &entry, bool &isSelf, bool &isParent,
+                     bool *relocated = nullptr);
+    void parseSystemUse(const uchar *su, int len, IsoDirEntry &entry, SystemUse &state, int depth);
+    QString decodeName(const uchar *id, int len, bool isDirectory) const;
+
+    int fd = -1;
+    QString path;
+    QString error;
+    QString volId;
+    NameSource names = PlainNames;
+    quint32 volumeBlocks = 0;
+    quint32 pathTableSize = 0;
+    quint32 pathTableLba = 0;
+    int suspSkip = 0;
+    bool joliet = false;
+    IsoDirEntry root;
+};
+
+#endif // ISO9660READER_H
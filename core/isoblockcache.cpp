@@ -0,0 +1,146 @@
+#include "isoblockcache.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+IsoBlockCache::IsoBlockCache(int imageFd, qint64 capacityBytes)
+    : fd(imageFd), blocksPerShard(int(qMax<qint64>(1, capacityBytes / BlockSize / ShardCount))) {}
+
+IsoBlockCache::~IsoBlockCache() {}
+
+void IsoBlockCache::clear() {
+    for (Shard &shard : shards) {
+        QMutexLocker lock(&shard.mutex);
+        shard.blocks.clear();
+        shard.lru.clear();
+    }
+}
+
+bool IsoBlockCache::lookup(quint64 block, QByteArray &out) {
+    Shard &shard = shardFor(block);
+    QMutexLocker lock(&shard.mutex);
+    auto it = shard.blocks.constFind(block);
+    if (it == shard.blocks.constEnd()) return false;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it.value());
+    out = it.value()->data;
+    return true;
+}
+
+void IsoBlockCache::insert(quint64 block, const QByteArray &data) {
+    Shard &shard = shardFor(block);
+    QMutexLocker lock(&shard.mutex);
+    auto it = shard.blocks.find(block);
+    if (it != shard.blocks.end()) {
+        it.value()->data = data;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it.value());
+        return;
+    }
+    shard.lru.push_front({block, data});
+    shard.blocks.insert(block, shard.lru.begin());
+    while (int(shard.lru.size()) > blocksPerShard) {
+        shard.blocks.remove(shard.lru.back().index);
+        shard.lru.pop_back();
+    }
+}
+
+qint64 IsoBlockCache::fetch(quint64 first, quint64 count, QByteArray &wanted) {
+    QByteArray buffer(int(count * BlockSize), Qt::Uninitialized);
+    const off_t start = off_t(first * BlockSize);
+    qint64 got = 0;
+    while (got < buffer.size()) {
+        const ssize_t n = ::pread(fd, buffer.data() + got, size_t(buffer.size() - got), start + off_t(got));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        got += n;
+    }
+    fetched.fetchAndAddRelaxed(quint64(got));
+    for (quint64 i = 0; i < count && qint64(i) * BlockSize < got; ++i) {
+        const QByteArray data = buffer.mid(int(i) * BlockSize, int(qMin<qint64>(BlockSize, got - qint64(i) * BlockSize)));
+        insert(first + i, data);
+        if (i == 0) wanted = data;
+    }
+    if (got == 0) wanted.clear();
+    return got;
+}
+
+qint64 IsoBlockCache::advance(Stream *stream, qint64 offset, qint64 len) const {
+    if (!stream) return 0;
+    // Each read that picks up where the last one ended doubles the window.
+    if (offset == stream->nextOffset) stream->window = qBound(qint64(4 * BlockSize), stream->window * 2, maxReadAhead);
+    else stream->window = 0;
+    stream->nextOffset = offset + len;
+    return stream->window;
+}
+
+qint64 IsoBlockCache::readAt(qint64 pos, char *buf, qint64 len, Stream *stream) {
+    if (pos < 0 || len < 0) return -1;
+    return readBlocks(pos, buf, len, advance(stream, pos, len));
+}
+
+qint64 IsoBlockCache::readBlocks(qint64 pos, char *buf, qint64 len, qint64 ahead) {
+    qint64 done = 0;
+    while (done < len) {
+        const qint64 at = pos + done;
+        const quint64 block = quint64(at / BlockSize);
+        const int within = int(at % BlockSize);
+        QByteArray data;
+        if (lookup(block, data)) {
+            hitCount.fetchAndAddRelaxed(1);
+        } else {
+            missCount.fetchAndAddRelaxed(1);
+            // Whatever is still needed plus the read-ahead, in one pread().
+            const quint64 last = quint64((pos + len + ahead - 1) / BlockSize);
+            if (fetch(block, last - block + 1, data) < 0) return done > 0 ? done : -1;
+        }
+        if (data.size() <= within) break;   // past the end of the image
+        const qint64 n = qMin<qint64>(len - done, data.size() - within);
+        memcpy(buf + done, data.constData() + within, size_t(n));
+        done += n;
+        if (data.size() < BlockSize) break;
+    }
+    return done;
+}
+
+qint64 IsoBlockCache::read(const IsoVfs::File &file, qint64 offset, char *buf, qint64 len, Stream *stream) {
+    if (!file.isValid() || offset < 0 || len < 0) return -1;
+    // Sequential or not by file offset: a file's extents need not be
+    // adjacent in the image, and zisofs reads land on compressed offsets.
+    const qint64 ahead = advance(stream, offset, len);
+    if (file.zisofsBlockLog2) {
+        // Inflated blocks are cached by the decoder; the compressed sectors
+        // still go through the block cache and its read-ahead.
+        return zisofs.read(file.extents.first().lba, file.size, file.zisofsBlockLog2,
+                           [this, &file, ahead](qint64 at, char *to, qint64 n) {
+                               return readStored(file, at, to, n, ahead);
+                           },
+                           offset, buf, len);
+    }
+    return readStored(file, offset, buf, len, ahead);
+}
+
+qint64 IsoBlockCache::readStored(const IsoVfs::File &file, qint64 offset, char *buf, qint64 len, qint64 ahead) {
+    quint64 stored = 0;
+    for (const IsoExtent &extent : file.extents) stored += extent.length;
+    if (quint64(offset) >= stored) return 0;
+    len = qMin(len, qint64(stored) - offset);
+
+    qint64 done = 0;
+    qint64 extentStart = 0;
+    for (const IsoExtent &extent : file.extents) {
+        const qint64 extentEnd = extentStart + extent.length;
+        if (offset + done < extentEnd && done < len) {
+            const qint64 within = offset + done - extentStart;
+            const qint64 n = qMin(len - done, extentEnd - (offset + done));
+            const qint64 pos = qint64(extent.lba) * Iso9660Reader::SectorSize + within;
+            // No further than the extent: what follows it is another file.
+            const qint64 got = readBlocks(pos, buf + done, n, qMin(ahead, extentEnd - (offset + done) - n));
+            if (got < 0) return done > 0 ? done : -1;
+            done += got;
+            if (got < n) break;
+        }
+        extentStart = extentEnd;
+    }
+    return done;
+}
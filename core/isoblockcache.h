@@ -0,0 +1,83 @@
+#ifndef ISOBLOCKCACHE_H
+#define ISOBLOCKCACHE_H
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+
+#include <list>
+
+#include "isovfs.h"
+
+// Keeps recently read image sectors in memory, in blocks of BlockSectors
+// 2048-byte sectors with least-recently-used eviction. Callers that read a
+// file front to back get a read-ahead window that doubles on every
+// sequential read, so a streaming reader turns into a few large pread()s.
+// The cache is split into shards with a lock each so several threads can
+// read at once.
+class IsoBlockCache {
+public:
+    static const int BlockSectors = 16;
+    static const int BlockSize = BlockSectors * Iso9660Reader::SectorSize;
+
+    // Read-ahead state of one reader (an open file handle, a stream...).
+    // nextOffset is in the reader's terms: image offsets for readAt(), file
+    // offsets for read().
+    struct Stream {
+        qint64 nextOffset = -1;
+        qint64 window = 0;
+    };
+
+    explicit IsoBlockCache(int imageFd, qint64 capacityBytes = qint64(64) << 20);
+    ~IsoBlockCache();
+
+    void setMaxReadAhead(qint64 bytes) { maxReadAhead = bytes; }
+
+    // Reads len bytes at the absolute image offset pos; returns the count
+    // (short at the end of the image) or -1.
+    qint64 readAt(qint64 pos, char *buf, qint64 len, Stream *stream = nullptr);
+    // Reads part of a file through its extents, inflating zisofs data.
+    qint64 read(const IsoVfs::File &file, qint64 offset, char *buf, qint64 len, Stream *stream = nullptr);
+    void clear();
+
+    quint64 hits() const { return hitCount.load(); }
+    quint64 misses() const { return missCount.load(); }
+    quint64 bytesFetched() const { return fetched.load(); }
+
+private:
+    Q_DISABLE_COPY(IsoBlockCache)
+
+    static const int ShardCount = 16;
+
+    struct Block {
+        quint64 index;
+        QByteArray data;
+    };
+
+    struct Shard {
+        QMutex mutex;
+        std::list<Block> lru;   // most recently used first
+        QHash<quint64, std::list<Block>::iterator> blocks;
+    };
+
+    Shard &shardFor(quint64 block) { return shards[block % ShardCount]; }
+    bool lookup(quint64 block, QByteArray &out);
+    void insert(quint64 block, const QByteArray &data);
+    qint64 fetch(quint64 first, quint64 count, QByteArray &wanted);
+    // Updates stream for a read of len bytes at offset; returns the window.
+    qint64 advance(Stream *stream, qint64 offset, qint64 len) const;
+    qint64 readBlocks(qint64 pos, char *buf, qint64 len, qint64 ahead);
+    qint64 readStored(const IsoVfs::File &file, qint64 offset, char *buf, qint64 len, qint64 ahead);
+
+    int fd;
+    int blocksPerShard;
+    qint64 maxReadAhead = qint64(4) << 20;
+    Shard shards[ShardCount];
+    QAtomicInteger<quint64> hitCount;
+    QAtomicInteger<quint64> missCount;
+    QAtomicInteger<quint64> fetched;
+    IsoZisofsDecoder zisofs;
+};
+
+#endif // ISOBLOCKCACHE_H
@@ -0,0 +1,277 @@
+#include "isobuildtree.h"
+#include "isotrace.h"
+#include "isotreescanner.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+
+#include <algorithm>
+#include <string.h>
+
+const IsoBuildTree::Node IsoBuildTree::Root;
+const IsoBuildTree::Node IsoBuildTree::NoNode;
+
+IsoBuildTree::IsoBuildTree() {
+    clear();
+}
+
+IsoBuildTree::~IsoBuildTree() {
+    for (Entry *block : qAsConst(blocks)) delete[] block;
+}
+
+qint64 IsoBuildTree::memoryUsed() const {
+    return strings.memoryUsed() + qint64(blocks.size()) * NodesPerBlock * qint64(sizeof(Entry))
+           + qint64(slots.size()) * qint64(sizeof(Node));
+}
+
+void IsoBuildTree::clear() {
+    strings.clear();
+    for (Entry *block : qAsConst(blocks)) delete[] block;
+    blocks.clear();
+    slots.clear();
+    error.clear();
+    blocks.append(new Entry[NodesPerBlock]);
+    Entry &root = blocks[0][0];
+    root.parent = NoNode;
+    root.name = strings.add("", 0);
+    root.source = IsoStringTable::NoString;
+    root.flags = Directory;
+    count = 1;
+}
+
+quint32 IsoBuildTree::hash(Node parent, const char *name, int length) {
+    return qHashBits(name, size_t(length), parent);
+}
+
+IsoBuildTree::Node IsoBuildTree::lookup(Node parent, const char *name, int length) const {
+    if (slots.isEmpty()) return NoNode;
+    const quint32 mask = quint32(slots.size() - 1);
+    for (quint32 i = hash(parent, name, length) & mask;; i = (i + 1) & mask) {
+        const Node node = slots.at(int(i));
+        if (node == NoNode) return NoNode;
+        const Entry &e = at(node);
+        // Removed nodes keep their slot so probing goes on past them.
+        if (e.parent == parent && !(e.flags & Removed) && strings.length(e.name) == length
+            && memcmp(strings.at(e.name), name, size_t(length)) == 0)
+            return node;
+    }
+}
+
+void IsoBuildTree::rehash(int slotCount) {
+    QVector<Node> fresh(slotCount, NoNode);
+    const quint32 mask = quint32(slotCount - 1);
+    for (int n = 1; n < count; ++n) {
+        const Entry &e = at(Node(n));
+        if (e.flags & Removed) continue;
+        quint32 i = hash(e.parent, strings.at(e.name), strings.length(e.name)) & mask;
+        while (fresh.at(int(i)) != NoNode) i = (i + 1) & mask;
+        fresh[int(i)] = Node(n);
+    }
+    slots.swap(fresh);
+}
+
+// Checks the budget for what storing stringBytes more, and a new node if
+// newNode, would allocate, then grows the hash set if it is due.
+bool IsoBuildTree::reserveFor(int stringBytes, bool newNode) {
+    const bool grow = newNode && (slots.isEmpty() || qint64(count) * 4 >= qint64(slots.size()) * 3);
+    const int slotCount = slots.isEmpty() ? 1024 : slots.size() * 2;
+    qint64 growth = strings.growthFor(stringBytes);
+    if (newNode && count % NodesPerBlock == 0) growth += NodesPerBlock * qint64(sizeof(Entry));
+    // The old set is still there while the new one fills.
+    if (grow) growth += qint64(slotCount) * qint64(sizeof(Node));
+    if (budget > 0 && memoryUsed() + growth > budget) {
+        error = QString("The memory budget of %1 MB is used up after %2 entries").arg(budget >> 20).arg(count - 1);
+        return false;
+    }
+    if (newNode && count == int(NoNode >> 1)) {
+        error = "Too many entries";
+        return false;
+    }
+    if (grow) rehash(slotCount);
+    return true;
+}
+
+IsoBuildTree::Node IsoBuildTree::insert(Node parent, const QByteArray &name, const QByteArray *source, bool isDirectory,
+                                        bool *added) {
+    if (added) *added = false;
+    if (parent == NoNode) return NoNode;
+    if (!(at(parent).flags & Directory)) {
+        error = QFile::decodeName(name) + ": its parent is not a directory";
+        return NoNode;
+    }
+    if (name.isEmpty() || name.size() > IsoStringTable::MaxLength || name == "." || name == "..") {
+        error = "Invalid name " + QFile::decodeName(name);
+        return NoNode;
+    }
+    const bool ownSource = source && !source->isEmpty();
+
+    Node node = lookup(parent, name.constData(), name.size());
+    if (node != NoNode) {
+        if (!source) return node;
+        if (ownSource && (at(node).source == IsoStringTable::NoString || strings.bytes(at(node).source) != *source)) {
+            if (!reserveFor(source->size() + 3, false)) return NoNode;
+            at(node).source = strings.add(*source);
+        } else if (!ownSource) {
+            at(node).source = IsoStringTable::NoString;
+        }
+        Entry &e = at(node);
+        e.flags = (e.flags & ~(Directory | Derived)) | (isDirectory ? Directory : 0) | (ownSource ? 0 : Derived);
+        return node;
+    }
+
+    if (!reserveFor(name.size() + 3 + (ownSource ? source->size() + 3 : 0), true)) return NoNode;
+    if (count % NodesPerBlock == 0) blocks.append(new Entry[NodesPerBlock]);
+    node = Node(count++);
+    Entry &e = at(node);
+    e.parent = parent;
+    e.name = strings.add(name);
+    e.source = ownSource ? strings.add(*source) : IsoStringTable::NoString;
+    e.flags = (isDirectory ? Directory : 0) | (source && !ownSource ? Derived : 0);
+    const quint32 mask = quint32(slots.size() - 1);
+    quint32 i = hash(parent, name.constData(), name.size()) & mask;
+    while (slots.at(int(i)) != NoNode) i = (i + 1) & mask;
+    slots[int(i)] = node;
+    if (added) *added = true;
+    return node;
+}
+
+IsoBuildTree::Node IsoBuildTree::resolve(Node from, const QByteArray &relativePath, bool create) {
+    Node node = from;
+    for (const QByteArray &part : relativePath.split('/')) {
+        if (part.isEmpty()) continue;
+        node = create ? insert(node, part, nullptr, true, nullptr) : lookup(node, part.constData(), part.size());
+        if (node == NoNode) break;
+    }
+    return node;
+}
+
+IsoBuildTree::Node IsoBuildTree::find(const QString &isoPath) const {
+    Node node = Root;
+    for (const QByteArray &part : QFile::encodeName(isoPath).split('/')) {
+        if (part.isEmpty()) continue;
+        node = lookup(node, part.constData(), part.size());
+        if (node == NoNode) break;
+    }
+    return node;
+}
+
+IsoBuildTree::Node IsoBuildTree::add(const QString &isoPath, const QString &sourcePath, bool isDirectory, bool *added) {
+    if (added) *added = false;
+    if (sourcePath.isEmpty()) return addDirectory(isoPath);
+    QByteArray path = QFile::encodeName(isoPath);
+    while (path.endsWith('/')) path.chop(1);
+    const int slash = path.lastIndexOf('/');
+    const QByteArray name = path.mid(slash + 1);
+    if (name.isEmpty()) {
+        error = "The root can't be replaced";
+        return NoNode;
+    }
+    const QByteArray source = QFile::encodeName(sourcePath);
+    return insert(resolve(Root, path.left(qMax(0, slash)), true), name, &source, isDirectory, added);
+}
+
+IsoBuildTree::Node IsoBuildTree::addDirectory(const QString &isoPath) {
+    return resolve(Root, QFile::encodeName(isoPath), true);
+}
+
+bool IsoBuildTree::addTree(const QString &isoDir, const QString &sourceDir) {
+    const QString root = QFileInfo(sourceDir).absoluteFilePath();
+    // At "/" the contents are merged into the root, which has no source;
+    // what is found there stores its own.
+    const bool atRoot = QFile::encodeName(isoDir).replace('/', QByteArray()).isEmpty();
+    const Node top = atRoot ? Root : add(isoDir, root, true);
+    if (top == NoNode) return false;
+    QByteArray rootPath = QFile::encodeName(root);
+    if (rootPath.endsWith('/')) rootPath.chop(1);
+
+    IsoTrace::Phase trace("stage", "build tree " + root);
+    IsoTreeScanner scanner;
+    if (!scanner.start(root)) {
+        error = root + ": cannot be read";
+        return false;
+    }
+    QByteArray dir = rootPath;
+    Node dirNode = top;
+    bool derive = true;
+    qint64 files = 0;
+    IsoTreeScanner::Entry entry;
+    while (scanner.next(entry)) {
+        const int slash = entry.path.lastIndexOf('/');
+        if (slash < rootPath.size()) continue;
+        if (slash != dir.size() || memcmp(entry.path.constData(), dir.constData(), size_t(slash)) != 0) {
+            dir = entry.path.left(slash);
+            // Directories come out before their contents, so it is there.
+            dirNode = resolve(top, dir.mid(rootPath.size() + 1), false);
+            // What is found in it can derive its source only if dir is
+            // what the node resolves to; after a merge it may not be.
+            derive = dirNode != NoNode && sourcePath(dirNode) == dir;
+        }
+        if (dirNode == NoNode) continue;
+        const QByteArray source = derive ? QByteArray() : entry.path;
+        if (insert(dirNode, entry.path.mid(slash + 1), &source, entry.isDir(), nullptr) == NoNode) {
+            scanner.cancel();
+            return false;
+        }
+        if (!entry.isDir()) ++files;
+    }
+    trace.addFiles(files);
+    if (!scanner.errors().isEmpty()) {
+        error = scanner.errors().first();
+        return false;
+    }
+    return true;
+}
+
+bool IsoBuildTree::remove(const QString &isoPath) {
+    const Node node = find(isoPath);
+    if (node == NoNode || node == Root) return false;
+    // What is below it becomes unreachable.
+    at(node).flags |= Removed;
+    return true;
+}
+
+QByteArray IsoBuildTree::sourcePath(Node node) const {
+    // Up to the nearest node with a source of its own, then back down.
+    QVector<Node> below;
+    for (; node != NoNode && node != Root; node = at(node).parent) {
+        const Entry &e = at(node);
+        if (e.source != IsoStringTable::NoString) {
+            QByteArray path(strings.at(e.source), strings.length(e.source));
+            for (int i = below.size() - 1; i >= 0; --i) path += '/' + QByteArray(name(below.at(i)));
+            return path;
+        }
+        if (!(e.flags & Derived)) break;
+        below.append(node);
+    }
+    return QByteArray();
+}
+
+bool IsoBuildTree::walk(const std::function<bool(Node)> &visitor) const {
+    // Children grouped by parent with a counting sort. Once they are
+    // placed, first[p] is where p's children end and first[p - 1] where
+    // they start.
+    QVector<quint32> first(count + 1, 0);
+    for (int n = 1; n < count; ++n)
+        if (!(at(Node(n)).flags & Removed)) ++first[int(at(Node(n)).parent) + 1];
+    for (int p = 0; p < count; ++p) first[p + 1] += first[p];
+    QVector<Node> children(int(first.at(count)));
+    for (int n = 1; n < count; ++n)
+        if (!(at(Node(n)).flags & Removed)) children[int(first[int(at(Node(n)).parent)]++)] = Node(n);
+
+    auto byName = [this](Node a, Node b) { return strcmp(name(a), name(b)) < 0; };
+    QVector<Node> stack;
+    auto pushChildren = [&](Node dir) {
+        Node *begin = children.data() + (dir == Root ? 0 : first.at(int(dir) - 1));
+        Node *end = children.data() + first.at(int(dir));
+        std::sort(begin, end, byName);
+        while (end != begin) stack.append(*--end);
+    };
+    pushChildren(Root);
+    while (!stack.isEmpty()) {
+        const Node node = stack.takeLast();
+        if (!visitor(node)) return false;
+        if (isDirectory(node)) pushChildren(node);
+    }
+    return true;
+}
@@ -0,0 +1,98 @@
+#ifndef ISOBUILDTREE_H
+#define ISOBUILDTREE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+#include "isostringtable.h"
+
+// What goes into an image, held compactly enough for millions of files
+// within a fixed memory budget: 16 bytes per node in blocks, names and
+// sources in an IsoStringTable, and (parent, name) lookups through an
+// open-addressing hash set of node numbers. Adding a path that is already
+// there replaces its source, so every path appears once.
+//
+// Trees added with addTree() are streamed in from IsoTreeScanner and their
+// nodes store no source path of their own; it is derived from the
+// directory they were found in. Names are kept in the local 8-bit
+// encoding, as on disk.
+class IsoBuildTree {
+public:
+    typedef quint32 Node;
+    static const Node Root = 0;
+    static const Node NoNode = 0xffffffffu;
+
+    IsoBuildTree();
+    ~IsoBuildTree();
+
+    // Adds fail once memoryUsed() would go over bytes; 0 turns the limit off.
+    void setMemoryBudget(qint64 bytes) { budget = bytes; }
+    qint64 memoryBudget() const { return budget; }
+    qint64 memoryUsed() const;
+
+    // Puts sourcePath (a file, or a directory without its contents) at
+    // isoPath, creating missing parents without a local counterpart. Sets
+    // added if the path wasn't there. NoNode on errors.
+    Node add(const QString &isoPath, const QString &sourcePath, bool isDirectory, bool *added = nullptr);
+    // An empty directory with no local counterpart.
+    Node addDirectory(const QString &isoPath);
+    // sourceDir at isoDir and everything below it; at "/" its contents.
+    bool addTree(const QString &isoDir, const QString &sourceDir);
+    bool remove(const QString &isoPath);
+    Node find(const QString &isoPath) const;
+    void clear();
+
+    // Nodes ever added, the root and removed ones included.
+    int nodeCount() const { return count; }
+    QString errorString() const { return error; }
+
+    Node parent(Node node) const { return at(node).parent; }
+    const char *name(Node node) const { return strings.at(at(node).name); }
+    bool isDirectory(Node node) const { return at(node).flags & Directory; }
+    // Where the node's data comes from, empty for directories without one.
+    QByteArray sourcePath(Node node) const;
+
+    // Visits the nodes below the root parents first, each directory's
+    // children in name order, i.e. in path order. Returning false stops.
+    // Needs 8 bytes per node on top while it runs.
+    bool walk(const std::function<bool(Node node)> &visitor) const;
+
+private:
+    Q_DISABLE_COPY(IsoBuildTree)
+
+    enum Flags : quint32 { Directory = 1, Removed = 2, Derived = 4 };
+
+    struct Entry {
+        Node parent;
+        IsoStringTable::Id name;
+        IsoStringTable::Id source;    // NoString: derived or none (Flags)
+        quint32 flags;
+    };
+
+    static const int BlockShift = 16;
+    static const int NodesPerBlock = 1 << BlockShift;
+
+    const Entry &at(Node node) const { return blocks.at(int(node >> BlockShift))[node & (NodesPerBlock - 1)]; }
+    Entry &at(Node node) { return blocks[int(node >> BlockShift)][node & (NodesPerBlock - 1)]; }
+
+    // source: nullptr keeps an existing node's, empty derives it from the
+    // parent, anything else is stored.
+    Node insert(Node parent, const QByteArray &name, const QByteArray *source, bool isDirectory, bool *added);
+    Node lookup(Node parent, const char *name, int length) const;
+    Node resolve(Node from, const QByteArray &relativePath, bool create);
+    bool reserveFor(int stringBytes, bool newNode);
+    void rehash(int slotCount);
+    static quint32 hash(Node parent, const char *name, int length);
+
+    IsoStringTable strings;
+    QVector<Entry *> blocks;
+    int count = 0;
+    QVector<Node> slots;           // NoNode when free
+    qint64 budget = 0;
+    QString error;
+};
+
+#endif // ISOBUILDTREE_H
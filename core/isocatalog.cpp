@@ -0,0 +1,294 @@
+#include "isocatalog.h"
+#include "isotrace.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <string.h>
+
+// Fixed-size records in host byte order; a catalog written on a host with
+// the other byte order fails the version check and is rebuilt.
+struct IsoCatalog::Header {
+    char magic[8];
+    quint32 version;
+    quint32 nodeCount;
+    quint32 dirCount;
+    quint32 nameBytes;
+    uchar fingerprint[32];
+    quint64 reserved;
+};
+
+struct IsoCatalog::Node {
+    quint32 extent;
+    quint32 nameOffset;
+    quint64 size;
+    qint64 mtime;
+    quint16 nameLength;
+    quint8 isDirectory;
+    quint8 zisofsBlockLog2;
+    quint32 zisofsSize;
+};
+
+struct IsoCatalog::Dir {
+    quint32 extent;
+    quint32 firstChild;
+    quint32 childCount;
+};
+
+namespace {
+
+const char Magic[8] = {'I', 'S', 'O', 'C', 'A', 'T', '\0', '\0'};
+const quint32 Version = 2;
+
+QAtomicInteger<qint64> cacheLimit(qint64(256) << 20);
+QMutex buildMutex;
+QSet<QByteArray> building;
+
+class BuildTask : public QRunnable {
+public:
+    BuildTask(const QString &imagePath, const QByteArray &fingerprint)
+        : imagePath(imagePath), fingerprint(fingerprint) {}
+
+    void run() override {
+        Iso9660Reader reader;
+        if (reader.open(imagePath)) IsoCatalog::build(reader);
+        QMutexLocker lock(&buildMutex);
+        building.remove(fingerprint);
+    }
+
+private:
+    QString imagePath;
+    QByteArray fingerprint;
+};
+
+} // namespace
+
+IsoCatalog::IsoCatalog() {}
+
+IsoCatalog::~IsoCatalog() {
+    close();
+}
+
+QString IsoCatalog::cacheDirectory() {
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/QT-CDTools/catalogs";
+}
+
+void IsoCatalog::setCacheLimit(qint64 bytes) {
+    cacheLimit.store(bytes);
+}
+
+QString IsoCatalog::cacheFile(const QByteArray &fingerprint) {
+    return cacheDirectory() + "/" + QString::fromLatin1(fingerprint.left(16).toHex()) + ".cat";
+}
+
+QByteArray IsoCatalog::fingerprint(const QString &imagePath) {
+    QFile image(imagePath);
+    if (!image.open(QIODevice::ReadOnly) || !image.seek(16 * Iso9660Reader::SectorSize)) return QByteArray();
+    const QByteArray pvd = image.read(Iso9660Reader::SectorSize);
+    if (pvd.size() != Iso9660Reader::SectorSize) return QByteArray();
+
+    const QFileInfo fi(imagePath);
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(QByteArray::number(fi.size()) + ":" + QByteArray::number(fi.lastModified().toMSecsSinceEpoch()) + ":");
+    hash.addData(pvd);
+    return hash.result();
+}
+
+bool IsoCatalog::load(const QString &imagePath) {
+    IsoTrace::Phase trace("open", "catalog " + imagePath);
+    close();
+    const QByteArray key = fingerprint(imagePath);
+    if (key.isEmpty()) return false;
+    file.setFileName(cacheFile(key));
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    const qint64 length = file.size();
+    const uchar *map = length >= qint64(sizeof(Header)) ? file.map(0, length) : nullptr;
+    const Header *h = reinterpret_cast<const Header *>(map);
+    const bool valid = h && memcmp(h->magic, Magic, sizeof(Magic)) == 0 && h->version == Version
+                       && memcmp(h->fingerprint, key.constData(), sizeof(h->fingerprint)) == 0 && h->nodeCount > 0
+                       && qint64(sizeof(Header)) + qint64(h->nodeCount) * qint64(sizeof(Node))
+                                  + qint64(h->dirCount) * qint64(sizeof(Dir)) + h->nameBytes == length;
+    if (!valid) {
+        close();
+        return false;
+    }
+
+    data = map;
+    header = h;
+    nodes = reinterpret_cast<const Node *>(data + sizeof(Header));
+    dirs = reinterpret_cast<const Dir *>(nodes + h->nodeCount);
+    names = reinterpret_cast<const char *>(dirs + h->dirCount);
+    // Eviction goes by mtime, so a hit marks the catalog as recently used.
+    file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+    return true;
+}
+
+void IsoCatalog::close() {
+    if (data) file.unmap(const_cast<uchar *>(data));
+    file.close();
+    data = nullptr;
+    header = nullptr;
+    nodes = nullptr;
+    dirs = nullptr;
+    names = nullptr;
+}
+
+int IsoCatalog::nodeCount() const {
+    return header ? int(header->nodeCount) : 0;
+}
+
+IsoDirEntry IsoCatalog::entry(quint32 node) const {
+    const Node &n = nodes[node];
+    IsoDirEntry e;
+    if (quint64(n.nameOffset) + n.nameLength <= header->nameBytes)
+        e.name = QString::fromUtf8(names + n.nameOffset, n.nameLength);
+    e.extent = n.extent;
+    e.size = n.size;
+    e.mtime = n.mtime;
+    e.isDirectory = n.isDirectory;
+    e.zisofsBlockLog2 = n.zisofsBlockLog2;
+    e.zisofsSize = n.zisofsSize;
+    return e;
+}
+
+IsoDirEntry IsoCatalog::rootEntry() const {
+    return isLoaded() ? entry(0) : IsoDirEntry();
+}
+
+bool IsoCatalog::readDirectory(const IsoDirEntry &dir, QVector<IsoDirEntry> &out) const {
+    out.clear();
+    if (!isLoaded()) return false;
+    const Dir *end = dirs + header->dirCount;
+    const Dir *it = std::lower_bound(dirs, end, dir.extent, [](const Dir &d, quint32 extent) { return d.extent < extent; });
+    if (it == end || it->extent != dir.extent) return false;
+    if (quint64(it->firstChild) + it->childCount > header->nodeCount) return false;
+    out.reserve(int(it->childCount));
+    for (quint32 i = 0; i < it->childCount; ++i) out.append(entry(it->firstChild + i));
+    return true;
+}
+
+bool IsoCatalog::build(Iso9660Reader &reader, QString *error) {
+    IsoTrace::Phase trace("scan", "catalog " + reader.imagePath());
+    const QByteArray key = fingerprint(reader.imagePath());
+    if (key.isEmpty()) {
+        if (error) *error = "Cannot read the volume descriptor";
+        return false;
+    }
+
+    // Group what the walk reports by the extent of the parent directory.
+    const IsoDirEntry root = reader.rootEntry();
+    QHash<QString, quint32> dirExtent;
+    QHash<quint32, QVector<IsoDirEntry>> children;
+    dirExtent.insert("/", root.extent);
+    QString lastParent;
+    QVector<IsoDirEntry> *current = nullptr;
+    const bool walked = reader.walk([&](const QString &parentPath, const IsoDirEntry &e) {
+        if (!current || parentPath != lastParent) {
+            lastParent = parentPath;
+            current = &children[dirExtent.value(parentPath)];
+        }
+        current->append(e);
+        if (e.isDirectory) dirExtent.insert(parentPath == "/" ? "/" + e.name : parentPath + "/" + e.name, e.extent);
+        return true;
+    });
+    if (!walked) {
+        if (error) *error = reader.errorString();
+        return false;
+    }
+
+    // Breadth first from the root, so every directory's children are
+    // contiguous in the node table.
+    QVector<Node> nodeTable;
+    QVector<Dir> dirTable;
+    QByteArray nameBlob;
+    QVector<IsoDirEntry> order{root};
+    order.reserve(dirExtent.size());
+    QSet<quint32> listed;
+    auto appendNode = [&](const IsoDirEntry &e) {
+        const QByteArray name = e.name.toUtf8().left(0xffff);
+        Node n;
+        memset(&n, 0, sizeof(n));
+        n.extent = e.extent;
+        n.nameOffset = quint32(nameBlob.size());
+        n.nameLength = quint16(name.size());
+        n.size = e.size;
+        n.mtime = e.mtime;
+        n.isDirectory = e.isDirectory ? 1 : 0;
+        n.zisofsBlockLog2 = e.zisofsBlockLog2;
+        n.zisofsSize = e.zisofsSize;
+        nameBlob.append(name);
+        nodeTable.append(n);
+    };
+    appendNode(root);
+    for (int i = 0; i < order.size(); ++i) {
+        const quint32 extent = order.at(i).extent;
+        auto it = children.constFind(extent);
+        if (it == children.constEnd() || listed.contains(extent)) continue;
+        listed.insert(extent);
+        dirTable.append({extent, quint32(nodeTable.size()), quint32(it->size())});
+        for (const IsoDirEntry &e : *it) {
+            appendNode(e);
+            if (e.isDirectory) order.append(e);
+        }
+    }
+    std::sort(dirTable.begin(), dirTable.end(), [](const Dir &a, const Dir &b) { return a.extent < b.extent; });
+    trace.addFiles(nodeTable.size());
+
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, Magic, sizeof(Magic));
+    h.version = Version;
+    h.nodeCount = quint32(nodeTable.size());
+    h.dirCount = quint32(dirTable.size());
+    h.nameBytes = quint32(nameBlob.size());
+    memcpy(h.fingerprint, key.constData(), sizeof(h.fingerprint));
+
+    const QString path = cacheFile(key);
+    QDir().mkpath(QFileInfo(path).path());
+    QSaveFile out(path);
+    bool ok = out.open(QIODevice::WriteOnly);
+    ok = ok && out.write(reinterpret_cast<const char *>(&h), sizeof(h)) == qint64(sizeof(h));
+    ok = ok && out.write(reinterpret_cast<const char *>(nodeTable.constData()), qint64(nodeTable.size()) * qint64(sizeof(Node)))
+                       == qint64(nodeTable.size()) * qint64(sizeof(Node));
+    ok = ok && out.write(reinterpret_cast<const char *>(dirTable.constData()), qint64(dirTable.size()) * qint64(sizeof(Dir)))
+                       == qint64(dirTable.size()) * qint64(sizeof(Dir));
+    ok = ok && out.write(nameBlob) == nameBlob.size();
+    ok = ok && out.commit();
+    if (!ok) {
+        if (error) *error = path + ": " + out.errorString();
+        return false;
+    }
+    evict();
+    return true;
+}
+
+void IsoCatalog::buildInBackground(const QString &imagePath) {
+    const QByteArray key = fingerprint(imagePath);
+    if (key.isEmpty() || QFileInfo::exists(cacheFile(key))) return;
+    QMutexLocker lock(&buildMutex);
+    if (building.contains(key)) return;
+    building.insert(key);
+    QThreadPool::globalInstance()->start(new BuildTask(imagePath, key));
+}
+
+void IsoCatalog::evict() {
+    QDir dir(cacheDirectory());
+    // Newest first; the most recently used one is always kept.
+    const QFileInfoList list = dir.entryInfoList({"*.cat"}, QDir::Files, QDir::Time);
+    qint64 total = 0;
+    for (int i = 0; i < list.size(); ++i) {
+        total += list.at(i).size();
+        if (i > 0 && total > cacheLimit.load()) QFile::remove(list.at(i).absoluteFilePath());
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef ISOCATALOG_H
+#define ISOCATALOG_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+#include "iso9660reader.h"
+
+// The directory tree of one image flattened into a binary file under the
+// user's cache directory and mapped back in on the next open. Children of a
+// directory are stored next to each other and directories are indexed by
+// extent, so listing one is a binary search plus a copy of its names.
+//
+// Catalogs are keyed by image size, mtime and a hash of the primary volume
+// descriptor; an image that was changed in any way simply misses. The least
+// recently used catalogs are dropped once the cache grows past its limit.
+class IsoCatalog {
+public:
+    IsoCatalog();
+    ~IsoCatalog();
+
+    // Maps the catalog for imagePath, if there is a current one.
+    bool load(const QString &imagePath);
+    void close();
+    bool isLoaded() const { return data != nullptr; }
+    int nodeCount() const;
+
+    IsoDirEntry rootEntry() const;
+    // Same contract as Iso9660Reader::readDirectory(); dir is found by its
+    // extent. Multi-extent files only carry their first extent.
+    bool readDirectory(const IsoDirEntry &dir, QVector<IsoDirEntry> &out) const;
+
+    // Walks the whole image and writes its catalog. Safe to call from any
+    // thread; the reader must not be used elsewhere meanwhile.
+    static bool build(Iso9660Reader &reader, QString *error = nullptr);
+    // Builds the catalog for imagePath on the global thread pool with a
+    // reader of its own, unless a current one exists.
+    static void buildInBackground(const QString &imagePath);
+
+    static QByteArray fingerprint(const QString &imagePath);
+    static QString cacheDirectory();
+    static void setCacheLimit(qint64 bytes);
+    static void evict();
+
+private:
+    Q_DISABLE_COPY(IsoCatalog)
+
+    struct Header;
+    struct Node;
+    struct Dir;
+
+    static QString cacheFile(const QByteArray &fingerprint);
+    IsoDirEntry entry(quint32 node) const;
+
+    QFile file;
+    const uchar *data = nullptr;
+    const Header *header = nullptr;
+    const Node *nodes = nullptr;
+    const Dir *dirs = nullptr;
+    const char *names = nullptr;
+};
+
+#endif // ISOCATALOG_H
@@ -0,0 +1,119 @@
+#include "isochangeset.h"
+#include "isotreemodel.h"
+
+#include <QDir>
+#include <QFileInfo>
+
+QString IsoChangeSet::normalize(const QString &isoPath) {
+    return QDir::cleanPath("/" + isoPath);
+}
+
+void IsoChangeSet::add(const QString &isoPath, const QString &sourcePath) {
+    const QString path = normalize(isoPath);
+    // Re-adding the same target just swaps the source.
+    for (int i = changes.size() - 1; i >= 0; --i) {
+        Change &c = changes[i];
+        if (c.kind == Add && c.isoPath == path) {
+            c.argument = sourcePath;
+            return;
+        }
+        if (c.isoPath == path || (c.kind == Rename && c.argument == path)) break;
+    }
+    changes.append({Add, path, sourcePath});
+}
+
+void IsoChangeSet::addDirectory(const QString &isoPath) {
+    changes.append({MakeDirectory, normalize(isoPath), QString()});
+}
+
+void IsoChangeSet::remove(const QString &isoPath) {
+    // Dropping the additions instead would need to know what the image
+    // held before them; a rename into the path or an addition that created
+    // its parents would leave the -rm_r with nothing to remove.
+    changes.append({Remove, normalize(isoPath), QString()});
+}
+
+void IsoChangeSet::rename(const QString &fromIsoPath, const QString &toIsoPath) {
+    changes.append({Rename, normalize(fromIsoPath), normalize(toIsoPath)});
+}
+
+QString IsoChangeSet::addedSource(const QString &isoPath) const {
+    const QString path = normalize(isoPath);
+    for (int i = changes.size() - 1; i >= 0; --i) {
+        const Change &c = changes.at(i);
+        if (c.kind == Add && c.isoPath == path) return c.argument;
+        if (c.isoPath == path || (c.kind == Rename && c.argument == path)
+            || (c.kind == Remove && path.startsWith(c.isoPath + "/")))
+            break;
+    }
+    return QString();
+}
+
+QStringList IsoChangeSet::commandArguments() const {
+    QStringList args;
+    for (const Change &c : changes) {
+        switch (c.kind) {
+        case Add:
+            args << "-map" << c.argument << c.isoPath;
+            break;
+        case Remove:
+            args << "-rm_r" << c.isoPath << "--";
+            break;
+        case Rename:
+            args << "-mv" << c.isoPath << c.argument << "--";
+            break;
+        case MakeDirectory:
+            args << "-mkdir" << c.isoPath << "--";
+            break;
+        }
+    }
+    return args;
+}
+
+QStringList IsoChangeSet::xorrisoArguments(const QString &image) const {
+    return QStringList{"-md5", "on", "-dev", image} + commandArguments() + QStringList{"-commit"};
+}
+
+QStringList IsoChangeSet::estimateArguments(const QString &image) const {
+    return QStringList{"-dev", image} + commandArguments() + QStringList{"-print_size", "-rollback_end"};
+}
+
+QStringList IsoChangeSet::xorrisoArguments(const QString &inImage, const QString &outImage) const {
+    return QStringList{"-md5", "on", "-indev", inImage, "-outdev", outImage} + commandArguments()
+           + QStringList{"-commit"};
+}
+
+void IsoChangeSet::applyTo(IsoTreeModel *model, int from) const {
+    for (int i = qMax(0, from); i < changes.size(); ++i) {
+        const Change &c = changes.at(i);
+        QModelIndex index = model->findPath(c.isoPath);
+        switch (c.kind) {
+        case Add:
+            if (index.isValid()) {
+                model->setNodeFlags(index, IsoTreeModel::Modified);
+            } else {
+                QFileInfo fi(c.argument);
+                model->addPath(c.isoPath, fi.isDir(), IsoTreeModel::Added, fi.isDir() ? 0 : quint64(fi.size()));
+            }
+            break;
+        case Remove:
+            if (index.isValid()) model->removeIndex(index);
+            break;
+        case Rename:
+            if (!index.isValid()) break;
+            if (c.isoPath.section('/', 0, -2) == c.argument.section('/', 0, -2)) {
+                model->renameIndex(index, c.argument.section('/', -1));
+            } else {
+                // Moved elsewhere: the node is re-created at the target, its
+                // contents show up again after the next reload.
+                const bool isDir = index.data(IsoTreeModel::IsDirectoryRole).toBool();
+                model->removeIndex(index);
+                model->addPath(c.argument, isDir, IsoTreeModel::Added);
+            }
+            break;
+        case MakeDirectory:
+            if (!index.isValid()) model->addPath(c.isoPath, true, IsoTreeModel::Added);
+            break;
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef ISOCHANGESET_H
+#define ISOCHANGESET_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class IsoTreeModel;
+
+// Pending edits to an image, kept in the order they were made. Commit
+// turns them into one xorriso run (one new session) instead of one
+// process and one session per file.
+class IsoChangeSet {
+public:
+    enum Kind { Add, Remove, Rename, MakeDirectory };
+
+    struct Change {
+        Kind kind;
+        QString isoPath;    // target for Add/MakeDirectory, path for Remove, old path for Rename
+        QString argument;   // local source for Add, new path for Rename
+    };
+
+    // Adds or replaces isoPath with the local file or directory sourcePath.
+    void add(const QString &isoPath, const QString &sourcePath);
+    // An empty directory with no local counterpart.
+    void addDirectory(const QString &isoPath);
+    // Always a -rm_r of its own, run after the changes before it: the path
+    // exists by then whether it came from the image, an addition or a
+    // rename, and an addition removed in the same session writes no data.
+    void remove(const QString &isoPath);
+    void rename(const QString &fromIsoPath, const QString &toIsoPath);
+    void clear() { changes.clear(); }
+
+    bool isEmpty() const { return changes.isEmpty(); }
+    int size() const { return changes.size(); }
+    const QVector<Change> &list() const { return changes; }
+    // The local file staged at isoPath, empty if nothing is (or it was
+    // removed or moved away since).
+    QString addedSource(const QString &isoPath) const;
+
+    // The edit commands only, for composing with other xorriso options.
+    QStringList commandArguments() const;
+    // Appends a session to image in place: -dev image <changes> -commit.
+    // Both this and the overload below record MD5s for the session and its
+    // files (-md5 on) so IsoVerifier can check the result.
+    QStringList xorrisoArguments(const QString &image) const;
+    // Same as above but only reports the size of that session (-print_size)
+    // and discards everything again.
+    QStringList estimateArguments(const QString &image) const;
+    // Writes the edited image to a new file: -indev in -outdev out <changes> -commit
+    QStringList xorrisoArguments(const QString &inImage, const QString &outImage) const;
+
+    // Mirrors changes [from, size()) in a tree model without re-listing.
+    void applyTo(IsoTreeModel *model, int from = 0) const;
+
+    static QString normalize(const QString &isoPath);
+
+private:
+    QVector<Change> changes;
+};
+
+#endif // ISOCHANGESET_H
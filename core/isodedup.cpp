@@ -0,0 +1,417 @@
+#include "isodedup.h"
+#include "isostagingarea.h"
+#include "isotrace.h"
+#include "isotreescanner.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThread>
+#include <QThreadPool>
+#include <QtEndian>
+
+#include <functional>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+namespace {
+
+const int ReadSize = 1 << 20;
+const quint32 CacheMagic = 0x49534448; // "ISDH"
+const quint32 CacheVersion = 1;
+
+// xxHash64, streaming form of the reference algorithm.
+class Xxh64 {
+public:
+    Xxh64() {
+        acc[0] = Prime1 + Prime2;
+        acc[1] = Prime2;
+        acc[2] = 0;
+        acc[3] = 0 - Prime1;
+    }
+
+    void update(const uchar *data, size_t len) {
+        total += len;
+        if (pending + len < 32) {
+            memcpy(buffer + pending, data, len);
+            pending += len;
+            return;
+        }
+        if (pending) {
+            const size_t fill = 32 - pending;
+            memcpy(buffer + pending, data, fill);
+            stripe(buffer);
+            data += fill;
+            len -= fill;
+            pending = 0;
+        }
+        for (; len >= 32; data += 32, len -= 32) stripe(data);
+        memcpy(buffer, data, len);
+        pending = len;
+    }
+
+    quint64 digest() const {
+        quint64 h;
+        if (total >= 32) {
+            h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+            for (quint64 v : acc) h = merge(h, v);
+        } else {
+            h = Prime5;
+        }
+        h += total;
+
+        const uchar *p = buffer;
+        size_t left = pending;
+        for (; left >= 8; p += 8, left -= 8) {
+            h ^= round(0, qFromLittleEndian<quint64>(p));
+            h = rotl(h, 27) * Prime1 + Prime4;
+        }
+        if (left >= 4) {
+            h ^= quint64(qFromLittleEndian<quint32>(p)) * Prime1;
+            h = rotl(h, 23) * Prime2 + Prime3;
+            p += 4;
+            left -= 4;
+        }
+        for (; left > 0; ++p, --left) {
+            h ^= *p * Prime5;
+            h = rotl(h, 11) * Prime1;
+        }
+
+        h ^= h >> 33;
+        h *= Prime2;
+        h ^= h >> 29;
+        h *= Prime3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    static const quint64 Prime1 = 11400714785074694791ULL;
+    static const quint64 Prime2 = 14029467366897019727ULL;
+    static const quint64 Prime3 = 1609587929392839161ULL;
+    static const quint64 Prime4 = 9650029242287828579ULL;
+    static const quint64 Prime5 = 2870177450012600261ULL;
+
+    static quint64 rotl(quint64 x, int r) { return (x << r) | (x >> (64 - r)); }
+    static quint64 round(quint64 acc, quint64 input) { return rotl(acc + input * Prime2, 31) * Prime1; }
+    static quint64 merge(quint64 h, quint64 v) { return (h ^ round(0, v)) * Prime1 + Prime4; }
+
+    void stripe(const uchar *p) {
+        for (int i = 0; i < 4; ++i) acc[i] = round(acc[i], qFromLittleEndian<quint64>(p + 8 * i));
+    }
+
+    quint64 acc[4];
+    uchar buffer[32];
+    size_t pending = 0;
+    quint64 total = 0;
+};
+
+int openSequential(const QString &path) {
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (fd >= 0) ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return fd;
+}
+
+// Fills buf unless the file ends first; returns the byte count or -1.
+ssize_t readFull(int fd, char *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        const ssize_t n = ::read(fd, buf + got, len - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        got += size_t(n);
+    }
+    return ssize_t(got);
+}
+
+class Task : public QRunnable {
+public:
+    explicit Task(std::function<void()> function) : function(std::move(function)) {}
+    void run() override { function(); }
+
+private:
+    std::function<void()> function;
+};
+
+void collectTree(const IsoStagingArea &staging, const QString &sourceDir, const QString &isoDir,
+                 QMap<QString, IsoDeduplicator::File> &files) {
+    const QByteArray root = IsoTreeScanner::rootPath(sourceDir);
+    const int rootLength = root.endsWith('/') ? root.size() - 1 : root.size();
+    const QString prefix = isoDir == "/" ? QString() : isoDir;
+    IsoTreeScanner scanner;
+    scanner.setFilter([&staging](const QByteArray &path) { return staging.isExcluded(QFile::decodeName(path)); });
+    scanner.scan(sourceDir, [&](const IsoTreeScanner::Entry &entry) {
+        if (!entry.isFile()) return;
+        const QString isoPath = prefix + QFile::decodeName(entry.path.mid(rootLength));
+        files.insert(isoPath, {isoPath, QFile::decodeName(entry.path), entry.size});
+    });
+}
+
+} // namespace
+
+uint qHash(const IsoDeduplicator::Key &key, uint seed) {
+    return qHash(key.device, seed) ^ qHash(key.inode, seed) ^ qHash(key.mtimeNs, seed) ^ qHash(key.size, seed);
+}
+
+IsoDeduplicator::IsoDeduplicator() : maxThreads(QThread::idealThreadCount()) {
+    const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    if (!cacheDir.isEmpty()) cachePath = cacheDir + "/QT-CDTools/file-hashes";
+}
+
+IsoDeduplicator::~IsoDeduplicator() {}
+
+quint64 IsoDeduplicator::hashFile(const QString &path, bool *ok) {
+    if (ok) *ok = false;
+    const int fd = openSequential(path);
+    if (fd < 0) return 0;
+    std::vector<char> buf(ReadSize);
+    Xxh64 hash;
+    ssize_t n;
+    while ((n = readFull(fd, buf.data(), buf.size())) > 0) {
+        hash.update(reinterpret_cast<const uchar *>(buf.data()), size_t(n));
+        if (size_t(n) < buf.size()) break;
+    }
+    ::close(fd);
+    if (n < 0) return 0;
+    if (ok) *ok = true;
+    return hash.digest();
+}
+
+bool IsoDeduplicator::sameContent(const QString &a, const QString &b) {
+    const int fa = openSequential(a);
+    const int fb = fa < 0 ? -1 : openSequential(b);
+    bool same = fa >= 0 && fb >= 0;
+    std::vector<char> bufA(same ? ReadSize : 0), bufB(same ? ReadSize : 0);
+    while (same) {
+        const ssize_t na = readFull(fa, bufA.data(), bufA.size());
+        const ssize_t nb = readFull(fb, bufB.data(), bufB.size());
+        if (na < 0 || na != nb || memcmp(bufA.data(), bufB.data(), size_t(na)) != 0) same = false;
+        else if (size_t(na) < bufA.size()) break;
+    }
+    if (fa >= 0) ::close(fa);
+    if (fb >= 0) ::close(fb);
+    return same;
+}
+
+bool IsoDeduplicator::statKey(const QString &path, Key &key) {
+    struct stat st;
+    if (::stat(QFile::encodeName(path).constData(), &st) != 0) return false;
+    key.device = quint64(st.st_dev);
+    key.inode = quint64(st.st_ino);
+#ifdef Q_OS_MACOS
+    key.mtimeNs = qint64(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    key.mtimeNs = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    key.size = quint64(st.st_size);
+    return true;
+}
+
+void IsoDeduplicator::holdCache(bool hold) {
+    cacheHeld = hold;
+    if (hold) return;
+    saveCache();
+    cache.clear();
+    cacheLoaded = false;
+}
+
+void IsoDeduplicator::loadCache() {
+    if (cacheHeld && cacheLoaded) return;
+    cacheLoaded = true;
+    cache.clear();
+    cacheDirty = false;
+    QFile file(cachePath);
+    if (cachePath.isEmpty() || !file.open(QIODevice::ReadOnly)) return;
+    QDataStream in(&file);
+    quint32 magic, version, count;
+    in >> magic >> version >> count;
+    if (magic != CacheMagic || version != CacheVersion) return;
+    cache.reserve(int(count));
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        Key key;
+        quint64 hash;
+        in >> key.device >> key.inode >> key.mtimeNs >> key.size >> hash;
+        if (in.status() == QDataStream::Ok) cache.insert(key, hash);
+    }
+}
+
+void IsoDeduplicator::saveCache() const {
+    if (cachePath.isEmpty() || !cacheDirty) return;
+    QDir().mkpath(QFileInfo(cachePath).path());
+    QSaveFile file(cachePath);
+    if (!file.open(QIODevice::WriteOnly)) return;
+    QDataStream out(&file);
+    out << CacheMagic << CacheVersion << quint32(cache.size());
+    for (auto it = cache.constBegin(); it != cache.constEnd(); ++it)
+        out << it.key().device << it.key().inode << it.key().mtimeNs << it.key().size << it.value();
+    file.commit();
+}
+
+// Hashes each distinct inode of files once, taking what the cache already
+// knows, and adds the new hashes to it.
+void IsoDeduplicator::hashAll(const QVector<File> &files, QVector<Key> &keys, QVector<bool> &valid,
+                              QVector<quint64> &hashes) {
+    loadCache();
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, maxThreads));
+    keys.fill(Key(), files.size());
+    valid.fill(false, files.size());
+    hashes.fill(0, files.size());
+    QHash<Key, int> firstWithKey;
+    QVector<int> toHash;
+    for (int i = 0; i < files.size(); ++i) {
+        if (!statKey(files.at(i).sourcePath, keys[i]) || keys.at(i).size != files.at(i).size) continue;
+        valid[i] = true;
+        auto cached = cache.constFind(keys.at(i));
+        if (cached != cache.constEnd()) {
+            hashes[i] = cached.value();
+            ++hits;
+        } else if (!firstWithKey.contains(keys.at(i))) {
+            firstWithKey.insert(keys.at(i), i);
+            toHash << i;
+        }
+    }
+    qint64 bytes = 0;
+    for (int i : toHash) bytes += qint64(files.at(i).size);
+    total.store(bytes);
+    for (int i : toHash) {
+        bool *ok = &valid[i];
+        quint64 *hash = &hashes[i];
+        const QString path = files.at(i).sourcePath;
+        const qint64 size = qint64(files.at(i).size);
+        pool.start(new Task([this, ok, hash, path, size]() {
+            if (stop.load()) {
+                *ok = false;
+                return;
+            }
+            *hash = hashFile(path, ok);
+            done.fetchAndAddRelaxed(size);
+        }));
+    }
+    pool.waitForDone();
+    hashed = toHash.size();
+    for (int i : toHash) {
+        if (!valid.at(i)) continue;
+        cache.insert(keys.at(i), hashes.at(i));
+        cacheDirty = true;
+    }
+    for (int i = 0; i < files.size(); ++i) {
+        if (!valid.at(i)) continue;
+        auto it = cache.constFind(keys.at(i));
+        valid[i] = it != cache.constEnd();
+        if (valid.at(i)) hashes[i] = it.value();
+    }
+    if (!cacheHeld) saveCache();
+}
+
+QVector<quint64> IsoDeduplicator::hashFiles(const QVector<File> &files, QVector<bool> *ok) {
+    hashed = 0;
+    hits = 0;
+    done.store(0);
+    total.store(0);
+    QVector<Key> keys;
+    QVector<quint64> hashes;
+    hashAll(files, keys, *ok, hashes);
+    return hashes;
+}
+
+QVector<IsoDeduplicator::Duplicate> IsoDeduplicator::run(const QVector<File> &files) {
+    IsoTrace::Phase trace("stage", "dedup");
+    trace.addFiles(files.size());
+    saved = 0;
+    hashed = 0;
+    hits = 0;
+    done.store(0);
+    total.store(0);
+
+    // Only sizes that occur more than once can hold duplicates; empty files
+    // have no data to share.
+    QHash<quint64, int> sizeCount;
+    for (const File &f : files)
+        if (f.size > 0) ++sizeCount[f.size];
+    QVector<File> candidates;
+    for (const File &f : files)
+        if (sizeCount.value(f.size) > 1) candidates << f;
+    if (candidates.isEmpty()) return {};
+
+    QVector<Key> keys;
+    QVector<bool> valid;
+    QVector<quint64> hashes;
+    hashAll(candidates, keys, valid, hashes);
+    if (isCancelled()) return {};
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, maxThreads));
+    qint64 bytes = total.load();
+
+    // Equal size and hash: the first file in ISO order is kept, the rest are
+    // confirmed against it byte by byte. Hard links are already shared.
+    QMap<QPair<quint64, quint64>, int> canonical;
+    QVector<int> pairs; // candidate index, canonical index
+    for (int i = 0; i < candidates.size(); ++i) {
+        if (!valid.at(i)) continue;
+        const QPair<quint64, quint64> id(candidates.at(i).size, hashes.at(i));
+        auto it = canonical.constFind(id);
+        if (it == canonical.constEnd()) {
+            canonical.insert(id, i);
+        } else if (keys.at(i).device != keys.at(*it).device || keys.at(i).inode != keys.at(*it).inode) {
+            pairs << i << *it;
+        }
+    }
+    QVector<bool> same(pairs.size() / 2, false);
+    for (int p = 0; p < same.size(); ++p) bytes += 2 * qint64(candidates.at(pairs.at(2 * p)).size);
+    total.store(bytes);
+    for (int p = 0; p < same.size(); ++p) {
+        bool *result = &same[p];
+        const QString a = candidates.at(pairs.at(2 * p)).sourcePath;
+        const QString b = candidates.at(pairs.at(2 * p + 1)).sourcePath;
+        const qint64 size = 2 * qint64(candidates.at(pairs.at(2 * p)).size);
+        pool.start(new Task([this, result, a, b, size]() {
+            if (stop.load()) return;
+            *result = sameContent(a, b);
+            done.fetchAndAddRelaxed(size);
+        }));
+    }
+    pool.waitForDone();
+    if (isCancelled()) return {};
+
+    QVector<Duplicate> duplicates;
+    for (int p = 0; p < same.size(); ++p) {
+        if (!same.at(p)) continue;
+        const File &f = candidates.at(pairs.at(2 * p));
+        const File &kept = candidates.at(pairs.at(2 * p + 1));
+        duplicates.append({f.isoPath, f.sourcePath, kept.sourcePath, f.size, f.tag, kept.tag});
+        saved += f.size;
+    }
+    return duplicates;
+}
+
+QVector<IsoDeduplicator::File> IsoDeduplicator::stagedFiles(const IsoStagingArea &staging) {
+    // Parents come first, so a nested graft overwrites what its enclosing
+    // directory listed at the same path.
+    QMap<QString, File> files;
+    const QMap<QString, QString> &grafts = staging.graftPoints();
+    for (auto it = grafts.constBegin(); it != grafts.constEnd(); ++it) {
+        if (it.value().isEmpty()) continue;
+        const QFileInfo fi(it.value());
+        if (fi.isDir()) collectTree(staging, fi.absoluteFilePath(), it.key(), files);
+        else if (fi.isFile()) files.insert(it.key(), {it.key(), fi.absoluteFilePath(), quint64(fi.size())});
+    }
+    return files.values().toVector();
+}
+
+void IsoDeduplicator::apply(IsoStagingArea &staging, const QVector<Duplicate> &duplicates) {
+    // add() hides the original under its enclosing graft with -x.
+    for (const Duplicate &d : duplicates) staging.add(d.isoPath, d.canonicalSource);
+}
@@ -0,0 +1,106 @@
+#ifndef ISODEDUP_H
+#define ISODEDUP_H
+
+#include <QAtomicInteger>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+class IsoStagingArea;
+
+// Finds staged files with identical content so an image stores their data
+// once. Candidates are grouped by size, hashed in parallel with XXH64 and
+// confirmed byte by byte. Hashes are remembered per (device, inode, mtime,
+// size) in a cache file, so a repeat build only hashes what changed.
+//
+// The builders share data by pointing every duplicate at one canonical
+// source file: mkisofs/genisoimage (-cache-inodes) and libisofs both write
+// one extent for nodes that come from the same device and inode.
+class IsoDeduplicator {
+public:
+    struct File {
+        QString isoPath;
+        QString sourcePath;
+        quint64 size = 0;
+        quint32 tag = 0;   // the caller's, passed through
+    };
+
+    struct Duplicate {
+        QString isoPath;
+        QString sourcePath;
+        QString canonicalSource;
+        quint64 size = 0;
+        quint32 tag = 0;
+        quint32 canonicalTag = 0;
+    };
+
+    IsoDeduplicator();
+    ~IsoDeduplicator();
+
+    // Defaults to QT-CDTools/file-hashes under the user's cache directory;
+    // an empty path turns the cache off.
+    void setCacheFile(const QString &path) { cachePath = path; }
+    void setMaxThreads(int threads) { maxThreads = threads; }
+
+    // Blocks until done; hashing runs on a private thread pool.
+    QVector<Duplicate> run(const QVector<File> &files);
+    // For callers that run() batch after batch: the hash cache stays loaded
+    // in between and is written once, when it is released.
+    void holdCache(bool hold);
+    // Just the hashes, through the cache, for callers that split a group
+    // too big for one run() by hash first; ok[i] is false for files that
+    // couldn't be read.
+    QVector<quint64> hashFiles(const QVector<File> &files, QVector<bool> *ok);
+
+    // Thread-safe, for whoever waits on another thread: cancel() makes this
+    // run and any later one return no duplicates; the bytes read so far out
+    // of all that will be, hashing and comparing.
+    void cancel() { stop.store(1); }
+    bool isCancelled() const { return stop.load() != 0; }
+    qint64 bytesDone() const { return done.load(); }
+    qint64 bytesTotal() const { return total.load(); }
+
+    quint64 bytesSaved() const { return saved; }
+    int filesHashed() const { return hashed; }
+    int cacheHits() const { return hits; }
+
+    // Every regular file the staging area would put into the image.
+    static QVector<File> stagedFiles(const IsoStagingArea &staging);
+    // Grafts each duplicate onto its canonical source.
+    static void apply(IsoStagingArea &staging, const QVector<Duplicate> &duplicates);
+
+    static quint64 hashFile(const QString &path, bool *ok = nullptr);
+
+private:
+    struct Key {
+        quint64 device;
+        quint64 inode;
+        qint64 mtimeNs;
+        quint64 size;
+        bool operator==(const Key &other) const {
+            return device == other.device && inode == other.inode && mtimeNs == other.mtimeNs && size == other.size;
+        }
+    };
+    friend uint qHash(const Key &key, uint seed);
+
+    void loadCache();
+    void saveCache() const;
+    void hashAll(const QVector<File> &files, QVector<Key> &keys, QVector<bool> &valid, QVector<quint64> &hashes);
+    static bool statKey(const QString &path, Key &key);
+    static bool sameContent(const QString &a, const QString &b);
+
+    QString cachePath;
+    int maxThreads;
+    QAtomicInt stop;
+    QAtomicInteger<qint64> done;
+    QAtomicInteger<qint64> total;
+    QHash<Key, quint64> cache;
+    bool cacheLoaded = false;
+    bool cacheHeld = false;
+    bool cacheDirty = false;
+    quint64 saved = 0;
+    int hashed = 0;
+    int hits = 0;
+};
+
+#endif // ISODEDUP_H
@@ -0,0 +1,445 @@
+#include "isoextractor.h"
+#include "isotreescanner.h"
+#include "isozisofs.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QRunnable>
+#include <QSet>
+#include <QThread>
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#if defined(Q_OS_LINUX) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define HAVE_COPY_FILE_RANGE 1
+#endif
+
+namespace {
+
+const qint64 BufferSize = 1 << 20;
+const size_t BufferAlign = 4096;
+// copy_file_range is asked for this much at a time so cancel stays prompt.
+const qint64 KernelChunk = 8 << 20;
+
+QString errnoString() {
+    return QString::fromLocal8Bit(strerror(errno));
+}
+
+#ifndef POSIX_FADV_NORMAL
+// No posix_fadvise (macOS); the hints below become no-ops.
+enum { POSIX_FADV_SEQUENTIAL, POSIX_FADV_WILLNEED, POSIX_FADV_DONTNEED };
+#endif
+
+void adviseRange(int fd, qint64 offset, qint64 len, int advice) {
+#ifdef POSIX_FADV_NORMAL
+    ::posix_fadvise(fd, off_t(offset), off_t(len), advice);
+#else
+    Q_UNUSED(fd);
+    Q_UNUSED(offset);
+    Q_UNUSED(len);
+    Q_UNUSED(advice);
+#endif
+}
+
+// Copies len bytes from in at inOffset to out at outOffset. kernelCopy is
+// cleared once copy_file_range turns out not to work for this pair of files.
+bool copyRange(int in, qint64 inOffset, int out, qint64 outOffset, qint64 len, char *buffer,
+               bool &kernelCopy, QAtomicInteger<qint64> &done, const QAtomicInt &cancelled, QString &error) {
+#ifdef HAVE_COPY_FILE_RANGE
+    while (kernelCopy && len > 0) {
+        if (cancelled.load()) return false;
+        loff_t inOff = inOffset, outOff = outOffset;
+        ssize_t n = ::copy_file_range(in, &inOff, out, &outOff, size_t(qMin(len, KernelChunk)), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+                kernelCopy = false;
+                break;
+            }
+            error = errnoString();
+            return false;
+        }
+        if (n == 0) {
+            error = "Unexpected end of data";
+            return false;
+        }
+        inOffset += n;
+        outOffset += n;
+        len -= n;
+        done.fetchAndAddRelaxed(n);
+    }
+#else
+    kernelCopy = false;
+#endif
+
+    while (len > 0) {
+        if (cancelled.load()) return false;
+        ssize_t n = ::pread(in, buffer, size_t(qMin(len, BufferSize)), off_t(inOffset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            error = errnoString();
+            return false;
+        }
+        if (n == 0) {
+            error = "Unexpected end of data";
+            return false;
+        }
+        for (ssize_t written = 0; written < n;) {
+            ssize_t w = ::pwrite(out, buffer + written, size_t(n - written), off_t(outOffset + written));
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                error = errnoString();
+                return false;
+            }
+            written += w;
+        }
+        inOffset += n;
+        outOffset += n;
+        len -= n;
+        done.fetchAndAddRelaxed(n);
+    }
+    return true;
+}
+
+// Stored bytes of a file in the image, through its extents.
+qint64 preadExtents(int fd, const QVector<IsoExtent> &extents, qint64 offset, char *buf, qint64 len) {
+    qint64 done = 0;
+    qint64 extentStart = 0;
+    for (const IsoExtent &extent : extents) {
+        const qint64 extentEnd = extentStart + extent.length;
+        while (offset + done < extentEnd && done < len) {
+            const qint64 within = offset + done - extentStart;
+            const qint64 want = qMin(len - done, extentEnd - (offset + done));
+            const ssize_t n = ::pread(fd, buf + done, size_t(want), off_t(qint64(extent.lba) * Iso9660Reader::SectorSize + within));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return done > 0 ? done : -1;
+            done += n;
+        }
+        extentStart = extentEnd;
+    }
+    return done;
+}
+
+// Inflates a zisofs file from the image into out, a buffer at a time.
+bool inflateRange(int in, const QVector<IsoExtent> &extents, quint64 size, int blockLog2, int out, char *buffer,
+                  QAtomicInteger<qint64> &done, const QAtomicInt &cancelled, QString &error) {
+    IsoZisofsDecoder decoder(0);   // every block is read once
+    const IsoZisofs::StoredReader stored = [in, &extents](qint64 offset, char *buf, qint64 len) {
+        return preadExtents(in, extents, offset, buf, len);
+    };
+    for (qint64 at = 0; at < qint64(size);) {
+        if (cancelled.load()) return false;
+        const qint64 n = decoder.read(extents.first().lba, size, blockLog2, stored, at, buffer,
+                                      qMin<qint64>(BufferSize, qint64(size) - at));
+        if (n <= 0) {
+            error = "Damaged zisofs data";
+            return false;
+        }
+        for (qint64 written = 0; written < n;) {
+            const ssize_t w = ::pwrite(out, buffer + written, size_t(n - written), off_t(at + written));
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                error = errnoString();
+                return false;
+            }
+            written += w;
+        }
+        at += n;
+        done.fetchAndAddRelaxed(n);
+    }
+    return true;
+}
+
+} // namespace
+
+class IsoExtractor::Worker : public QRunnable {
+public:
+    explicit Worker(IsoExtractor *owner) : owner(owner) {}
+
+    void run() override {
+        char *buffer = nullptr;
+        if (::posix_memalign(reinterpret_cast<void **>(&buffer), BufferAlign, size_t(BufferSize)) != 0)
+            buffer = nullptr;
+
+        for (;;) {
+            const int i = owner->nextItem.fetchAndAddRelaxed(1);
+            if (i >= owner->items.size() || owner->cancelled.load()) break;
+            const Item &item = owner->items.at(i);
+            QString error;
+            const bool ok = buffer ? owner->copyItem(item, buffer, error) : false;
+            if (!buffer) error = "Out of memory";
+            if (!ok) owner->failures.ref();
+            owner->filesDone.ref();
+            IsoExtractor *o = owner;
+            const QString target = item.target;
+            QMetaObject::invokeMethod(owner, [o, target, ok, error]() {
+                emit o->fileFinished(target, ok, error);
+            }, Qt::QueuedConnection);
+        }
+
+        ::free(buffer);
+        IsoExtractor *o = owner;
+        if (!o->activeWorkers.deref())
+            QMetaObject::invokeMethod(o, [o]() { o->workerDone(); }, Qt::QueuedConnection);
+    }
+
+private:
+    IsoExtractor *owner;
+};
+
+IsoExtractor::IsoExtractor(QObject *parent) : QObject(parent) {
+    pool.setMaxThreadCount(qBound(2, QThread::idealThreadCount(), 4));
+    progressTimer.setInterval(200);
+    connect(&progressTimer, &QTimer::timeout, this, &IsoExtractor::reportProgress);
+}
+
+IsoExtractor::~IsoExtractor() {
+    cancel();
+    pool.waitForDone();
+    if (imageFd >= 0) ::close(imageFd);
+}
+
+void IsoExtractor::setMaxThreads(int threads) {
+    pool.setMaxThreadCount(qMax(1, threads));
+}
+
+void IsoExtractor::clear() {
+    if (running) return;
+    items.clear();
+    directories.clear();
+    imagePath.clear();
+    bytesTotal = 0;
+}
+
+int IsoExtractor::addFromImage(Iso9660Reader *reader, const QString &isoPath, const QString &target) {
+    if (running || !reader || !reader->isOpen()) return -1;
+    // All image items of one run are read through a single descriptor.
+    if (!imagePath.isEmpty() && imagePath != reader->imagePath()) return -1;
+
+    IsoDirEntry entry;
+    if (!reader->findEntry(isoPath, entry)) return -1;
+    imagePath = reader->imagePath();
+    int count = 0;
+    QString root = QDir::cleanPath(target);
+    if (!root.endsWith('/')) root += '/';
+    addImageEntry(reader, entry, target, root, count);
+    return count;
+}
+
+void IsoExtractor::addImageEntry(Iso9660Reader *reader, const IsoDirEntry &entry, const QString &target,
+                                 const QString &root, int &count) {
+    if (entry.isDirectory) {
+        directories << target;
+        QVector<IsoDirEntry> children;
+        if (!reader->readDirectory(entry, children)) return;
+        for (const IsoDirEntry &child : children) {
+            // The reader drops names that aren't one path component; this
+            // keeps anything else from writing outside the chosen folder.
+            const QString childTarget = target + "/" + child.name;
+            if (!QDir::cleanPath(childTarget).startsWith(root)) continue;
+            addImageEntry(reader, child, childTarget, root, count);
+        }
+        return;
+    }
+
+    Item item;
+    item.target = target;
+    item.size = entry.contentSize();
+    item.mtime = entry.mtime;
+    item.zisofsBlockLog2 = entry.zisofsBlockLog2;
+    item.extents = entry.extents;
+    if (item.extents.isEmpty()) item.extents.append({entry.extent, quint32(entry.size)});
+    items.append(item);
+    bytesTotal += item.size;
+    ++count;
+}
+
+int IsoExtractor::addFromFile(const QString &sourcePath, const QString &target) {
+    if (running) return -1;
+    QFileInfo fi(sourcePath);
+    if (!fi.exists()) return -1;
+
+    auto addFile = [this](const QFileInfo &file, const QString &to) {
+        Item item;
+        item.target = to;
+        item.sourcePath = file.absoluteFilePath();
+        item.size = quint64(file.size());
+        item.mtime = file.lastModified().toSecsSinceEpoch();
+        items.append(item);
+        bytesTotal += item.size;
+    };
+
+    if (!fi.isDir()) {
+        addFile(fi, target);
+        return 1;
+    }
+
+    int count = 0;
+    const QByteArray root = IsoTreeScanner::rootPath(fi.absoluteFilePath());
+    const int rootLength = root.endsWith('/') ? root.size() - 1 : root.size();
+    directories << target;
+    IsoTreeScanner scanner;
+    scanner.scan(fi.absoluteFilePath(), [&](const IsoTreeScanner::Entry &entry) {
+        const QString to = target + QFile::decodeName(entry.path.mid(rootLength));
+        if (entry.isDir()) {
+            directories << to;
+        } else if (entry.isFile()) {
+            Item item;
+            item.target = to;
+            item.sourcePath = QFile::decodeName(entry.path);
+            item.size = entry.size;
+            item.mtime = entry.mtime();
+            items.append(item);
+            bytesTotal += item.size;
+            ++count;
+        }
+    });
+    return count;
+}
+
+bool IsoExtractor::start() {
+    if (running || items.isEmpty()) return false;
+
+    if (!imagePath.isEmpty()) {
+        imageFd = ::open(QFile::encodeName(imagePath).constData(), O_RDONLY | O_CLOEXEC);
+        if (imageFd < 0) return false;
+    }
+
+    // The same target may have been queued twice (a directory and a file in it).
+    QSet<QString> seen;
+    QVector<Item> unique;
+    unique.reserve(items.size());
+    for (const Item &item : qAsConst(items)) {
+        if (!seen.contains(item.target)) {
+            seen.insert(item.target);
+            unique.append(item);
+        }
+    }
+    items.swap(unique);
+    bytesTotal = 0;
+    for (const Item &item : qAsConst(items)) bytesTotal += item.size;
+
+    // Image data in disk order; local files keep the order they were added in.
+    std::stable_sort(items.begin(), items.end(), [](const Item &a, const Item &b) {
+        if (a.sourcePath.isEmpty() != b.sourcePath.isEmpty()) return a.sourcePath.isEmpty();
+        if (!a.sourcePath.isEmpty()) return false;
+        return a.extents.first().lba < b.extents.first().lba;
+    });
+
+    // Creating directories from the workers would only make them race.
+    QSet<QString> made;
+    QStringList dirs = directories;
+    for (const Item &item : qAsConst(items)) dirs << QFileInfo(item.target).path();
+    for (const QString &dir : qAsConst(dirs)) {
+        if (made.contains(dir)) continue;
+        made.insert(dir);
+        QDir().mkpath(dir);
+    }
+
+    nextItem.store(0);
+    filesDone.store(0);
+    failures.store(0);
+    cancelled.store(0);
+    bytesDone.store(0);
+    running = true;
+    trace.reset(new IsoTrace::Phase("extract", imagePath.isEmpty() ? QString("local files") : imagePath));
+    clock.start();
+    progressTimer.start();
+
+    const int threads = qMin(pool.maxThreadCount(), items.size());
+    activeWorkers.store(threads);
+    for (int i = 0; i < threads; ++i) pool.start(new Worker(this));
+    return true;
+}
+
+void IsoExtractor::cancel() {
+    cancelled.store(1);
+}
+
+bool IsoExtractor::copyItem(const Item &item, char *buffer, QString &error) {
+    const bool fromImage = item.sourcePath.isEmpty();
+    int in = imageFd;
+    if (!fromImage) {
+        in = ::open(QFile::encodeName(item.sourcePath).constData(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) {
+            error = errnoString();
+            return false;
+        }
+        adviseRange(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    } else {
+        for (const IsoExtent &extent : item.extents)
+            adviseRange(in, qint64(extent.lba) * Iso9660Reader::SectorSize, extent.length, POSIX_FADV_WILLNEED);
+    }
+
+    const QByteArray target = QFile::encodeName(item.target);
+    int out = ::open(target.constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        error = errnoString();
+        if (!fromImage) ::close(in);
+        return false;
+    }
+
+    bool ok = true;
+    bool kernelCopy = true;
+    qint64 outOffset = 0;
+    if (fromImage && item.zisofsBlockLog2) {
+        ok = inflateRange(in, item.extents, item.size, item.zisofsBlockLog2, out, buffer, bytesDone, cancelled, error);
+    } else if (fromImage) {
+        for (const IsoExtent &extent : item.extents) {
+            const qint64 inOffset = qint64(extent.lba) * Iso9660Reader::SectorSize;
+            ok = copyRange(in, inOffset, out, outOffset, extent.length, buffer, kernelCopy, bytesDone, cancelled, error);
+            // Extracted data is rarely read again through the image.
+            adviseRange(in, inOffset, extent.length, POSIX_FADV_DONTNEED);
+            if (!ok) break;
+            outOffset += extent.length;
+        }
+    } else {
+        ok = copyRange(in, 0, out, 0, qint64(item.size), buffer, kernelCopy, bytesDone, cancelled, error);
+        ::close(in);
+    }
+
+    if (ok && item.mtime > 0) {
+        struct timespec times[2];
+        times[0].tv_sec = times[1].tv_sec = time_t(item.mtime);
+        times[0].tv_nsec = times[1].tv_nsec = 0;
+        ::futimens(out, times);
+    }
+    if (::close(out) != 0 && ok) {
+        error = errnoString();
+        ok = false;
+    }
+    if (!ok) {
+        if (error.isEmpty()) error = "Cancelled";
+        ::unlink(target.constData());
+    }
+    return ok;
+}
+
+void IsoExtractor::reportProgress() {
+    const double seconds = clock.elapsed() / 1000.0;
+    const qint64 done = bytesDone.load();
+    emit progress(done, qint64(bytesTotal), filesDone.load(), items.size(), seconds > 0 ? done / seconds : -1);
+}
+
+void IsoExtractor::workerDone() {
+    progressTimer.stop();
+    if (imageFd >= 0) ::close(imageFd);
+    imageFd = -1;
+    reportProgress();
+
+    trace->addFiles(filesDone.load());
+    trace.reset();
+    const int failed = failures.load();
+    const bool wasCancelled = cancelled.load();
+    running = false;
+    clear();
+    emit finished(failed, wasCancelled);
+}
@@ -0,0 +1,92 @@
+#ifndef ISOEXTRACTOR_H
+#define ISOEXTRACTOR_H
+
+#include <QObject>
+#include <QVector>
+#include <QStringList>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QTimer>
+#include <QScopedPointer>
+
+#include "iso9660reader.h"
+#include "isotrace.h"
+
+// Copies many files out of an image (or off a mounted copy of one) with a
+// small pool of worker threads. Image files are sorted by their first
+// extent so the workers walk the image front to back instead of seeking
+// around it; data goes through copy_file_range() where the kernel has it
+// and through large aligned buffers otherwise. zisofs-compressed files are
+// inflated on the way out.
+class IsoExtractor : public QObject {
+    Q_OBJECT
+
+public:
+    explicit IsoExtractor(QObject *parent = nullptr);
+    ~IsoExtractor() override;
+
+    void setMaxThreads(int threads);
+
+    // Queues isoPath (a file, or a directory and everything below it) from
+    // the image open in reader to target. Returns the number of files queued,
+    // or -1 if the path isn't in the image.
+    int addFromImage(Iso9660Reader *reader, const QString &isoPath, const QString &target);
+    // Queues a local file or directory tree, e.g. from a mount point or a
+    // pending replacement.
+    int addFromFile(const QString &sourcePath, const QString &target);
+    void clear();
+
+    int fileCount() const { return items.size(); }
+    quint64 totalBytes() const { return bytesTotal; }
+
+    bool start();
+    bool isRunning() const { return running; }
+
+public slots:
+    void cancel();
+
+signals:
+    void fileFinished(const QString &target, bool ok, const QString &error);
+    void progress(qint64 bytesDone, qint64 bytesTotal, int filesDone, int filesTotal, double bytesPerSecond);
+    void finished(int failures, bool cancelled);
+
+private:
+    struct Item {
+        QString target;
+        QString sourcePath;          // empty for items read from the image
+        QVector<IsoExtent> extents;  // byte lengths, in image order
+        quint64 size = 0;
+        qint64 mtime = 0;
+        quint8 zisofsBlockLog2 = 0;  // image data to inflate
+    };
+
+    class Worker;
+    friend class Worker;
+
+    void addImageEntry(Iso9660Reader *reader, const IsoDirEntry &entry, const QString &target, const QString &root,
+                       int &count);
+    bool copyItem(const Item &item, char *buffer, QString &error);
+    void workerDone();
+    void reportProgress();
+
+    QVector<Item> items;
+    QStringList directories;
+    QString imagePath;
+    int imageFd = -1;
+    quint64 bytesTotal = 0;
+
+    QThreadPool pool;
+    QTimer progressTimer;
+    QElapsedTimer clock;
+    QAtomicInt nextItem;
+    QAtomicInt filesDone;
+    QAtomicInt failures;
+    QAtomicInt activeWorkers;
+    QAtomicInt cancelled;
+    QAtomicInteger<qint64> bytesDone;
+    bool running = false;
+    QScopedPointer<IsoTrace::Phase> trace;
+};
+
+#endif // ISOEXTRACTOR_H
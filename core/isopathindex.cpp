@@ -0,0 +1,36 @@
+#include "isopathindex.h"
+
+quint32 IsoPathIndex::intern(const QString &name) {
+    auto it = nameIds.constFind(name);
+    if (it != nameIds.constEnd()) return it.value();
+    const quint32 id = quint32(nameList.size());
+    nameList.append(name);
+    nameIds.insert(name, id);
+    return id;
+}
+
+quint32 IsoPathIndex::child(quint32 parent, const QString &name) const {
+    auto it = nameIds.constFind(name);
+    if (it == nameIds.constEnd()) return NoNode;
+    return child(parent, it.value());
+}
+
+void IsoPathIndex::insert(quint32 parent, quint32 nameId, quint32 node) {
+    // First entry wins if an image lists the same name twice.
+    const quint64 k = key(parent, nameId);
+    if (!children.contains(k)) children.insert(k, node);
+}
+
+void IsoPathIndex::remove(quint32 parent, quint32 nameId) {
+    children.remove(key(parent, nameId));
+}
+
+void IsoPathIndex::reserve(int entries) {
+    children.reserve(entries);
+}
+
+void IsoPathIndex::clear() {
+    nameIds.clear();
+    nameList.clear();
+    children.clear();
+}
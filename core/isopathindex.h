@@ -0,0 +1,38 @@
+#ifndef ISOPATHINDEX_H
+#define ISOPATHINDEX_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+// Interns path components and maps (parent node, name) to the child node,
+// so resolving or inserting a path costs one hash lookup per component
+// instead of a scan over every sibling.
+class IsoPathIndex {
+public:
+    static const quint32 NoNode = 0;   // node 0 is the root, never a child
+
+    quint32 intern(const QString &name);
+    const QString &name(quint32 nameId) const { return nameList.at(int(nameId)); }
+    int nameCount() const { return nameList.size(); }
+
+    quint32 child(quint32 parent, quint32 nameId) const {
+        return children.value(key(parent, nameId), NoNode);
+    }
+    quint32 child(quint32 parent, const QString &name) const;
+
+    void insert(quint32 parent, quint32 nameId, quint32 node);
+    void remove(quint32 parent, quint32 nameId);
+    int size() const { return children.size(); }
+    void reserve(int entries);
+    void clear();
+
+private:
+    static quint64 key(quint32 parent, quint32 nameId) { return (quint64(parent) << 32) | nameId; }
+
+    QHash<QString, quint32> nameIds;
+    QVector<QString> nameList;
+    QHash<quint64, quint32> children;
+};
+
+#endif // ISOPATHINDEX_H
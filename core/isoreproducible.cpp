@@ -0,0 +1,76 @@
+#include "isoreproducible.h"
+#include "isodedup.h"
+#include "isostagingarea.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QVector>
+
+#include <algorithm>
+
+IsoReproducibleBuild IsoReproducibleBuild::fromEnvironment() {
+    bool ok = false;
+    const qint64 epoch = qgetenv("SOURCE_DATE_EPOCH").trimmed().toLongLong(&ok);
+    return ok && epoch >= 0 ? IsoReproducibleBuild(epoch) : IsoReproducibleBuild();
+}
+
+QString IsoReproducibleBuild::uuid() const {
+    if (!isEnabled()) return QString();
+    return QDateTime::fromSecsSinceEpoch(epoch, Qt::UTC).toString("yyyyMMddhhmmss") + "00";
+}
+
+QStringList IsoReproducibleBuild::mkisofsArguments() const {
+    if (!isEnabled()) return QStringList();
+    // xorriso 1.4.8 and later take the creation date from SOURCE_DATE_EPOCH
+    // on their own; the rest is spelled out for older ones.
+    const QString seconds = "=" + QString::number(epoch);
+    return {"--modification-date=" + uuid(),
+            "--set_all_file_dates", seconds,
+            "-uid", "0", "-gid", "0"};
+}
+
+QStringList IsoReproducibleBuild::xorrisoArguments() const {
+    if (!isEnabled()) return QStringList();
+    const QString seconds = "=" + QString::number(epoch);
+    return {"-volume_date", "c", seconds,
+            "-volume_date", "m", seconds,
+            "-volume_date", "uuid", uuid(),
+            "-volume_date", "all_file_dates", seconds,
+            "-chown_r", "0", "/", "--",
+            "-chgrp_r", "0", "/", "--"};
+}
+
+bool IsoReproducibleBuild::writeSortWeights(const IsoStagingArea &staging, const QString &directory,
+                                            QStringList &args, QString *error) const {
+    if (!isEnabled()) return true;
+    // Keys with the separator below every other byte give the order of a
+    // walk that visits each directory's entries by name, parents first.
+    QVector<QByteArray> keys;
+    for (const IsoDeduplicator::File &file : IsoDeduplicator::stagedFiles(staging)) {
+        if (file.isoPath.contains('\n')) {
+            if (error) *error = "Sort weight entries can't contain a newline: " + file.isoPath;
+            return false;
+        }
+        keys << QFile::encodeName(file.isoPath).replace('/', '\x01');
+    }
+    std::sort(keys.begin(), keys.end());
+    QFile list(QDir(directory).filePath("sort-weights"));
+    if (!list.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (error) *error = list.fileName() + ": " + list.errorString();
+        return false;
+    }
+    int weight = keys.size();
+    for (const QByteArray &key : qAsConst(keys)) {
+        if (list.write(QByteArray::number(weight--) + ' ' + QByteArray(key).replace('\x01', '/') + '\n') < 0) {
+            if (error) *error = list.fileName() + ": " + list.errorString();
+            return false;
+        }
+    }
+    if (!list.flush()) {
+        if (error) *error = list.fileName() + ": " + list.errorString();
+        return false;
+    }
+    args << "--sort-weight-list" << list.fileName();
+    return true;
+}
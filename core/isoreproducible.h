@@ -0,0 +1,46 @@
+#ifndef ISOREPRODUCIBLE_H
+#define ISOREPRODUCIBLE_H
+
+#include <QString>
+#include <QStringList>
+
+class IsoStagingArea;
+
+// Settings for builds whose bytes depend only on their inputs, driven by
+// SOURCE_DATE_EPOCH (https://reproducible-builds.org/specs/source-date-epoch/).
+// Every volume and file timestamp becomes that time, the volume UUID is
+// derived from it and owners are reset to root. Directory records are
+// sorted by all the builders anyway, and file data is laid out in ISO path
+// order through sort weights; libisofs otherwise orders it by source inode.
+// Without SOURCE_DATE_EPOCH builds stay as they were.
+class IsoReproducibleBuild {
+public:
+    IsoReproducibleBuild() {}
+    explicit IsoReproducibleBuild(qint64 epoch) : epoch(epoch) {}
+
+    // Disabled unless SOURCE_DATE_EPOCH holds a non-negative integer.
+    static IsoReproducibleBuild fromEnvironment();
+
+    bool isEnabled() const { return epoch >= 0; }
+    qint64 timestamp() const { return epoch; }
+    // "YYYYMMDDhhmmsscc" in UTC, the form of ISO 9660 volume dates and of
+    // the UUID GRUB uses to find the volume.
+    QString uuid() const;
+
+    // Options for xorriso -as mkisofs; empty when disabled.
+    QStringList mkisofsArguments() const;
+    // Descending weights for every file staging puts into the image, in
+    // path order, written to directory/sort-weights for xorriso -as
+    // mkisofs; args gets --sort-weight-list appended. Scans the staged
+    // trees, so it belongs off the GUI thread. Does nothing when disabled.
+    bool writeSortWeights(const IsoStagingArea &staging, const QString &directory, QStringList &args,
+                          QString *error = nullptr) const;
+    // Commands for native xorriso runs that write a new image, to go before
+    // -commit; empty when disabled.
+    QStringList xorrisoArguments() const;
+
+private:
+    qint64 epoch = -1;
+};
+
+#endif // ISOREPRODUCIBLE_H
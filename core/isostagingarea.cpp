@@ -0,0 +1,314 @@
+#include "isostagingarea.h"
+#include "isotrace.h"
+#include "isotreescanner.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+#ifdef Q_OS_LINUX
+#include <linux/fs.h>
+#endif
+#ifdef Q_OS_MACOS
+#include <sys/clonefile.h>
+#endif
+
+#if defined(Q_OS_LINUX) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define HAVE_COPY_FILE_RANGE 1
+#endif
+
+namespace {
+
+// mkisofs splits graft points at the first unescaped '='.
+QString escapeGraft(const QString &path) {
+    QString escaped = path;
+    escaped.replace("\\", "\\\\");
+    escaped.replace("=", "\\=");
+    return escaped;
+}
+
+// -exclude-list lines are glob patterns, like -m.
+QString escapeGlob(const QString &path) {
+    QString escaped;
+    escaped.reserve(path.size());
+    for (const QChar c : path) {
+        if (c == '\\' || c == '*' || c == '?' || c == '[') escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+bool writeLine(QFile &file, const QString &line, QString *error) {
+    if (line.contains('\n')) {
+        if (error) *error = "Path list entries can't contain a newline: " + line;
+        return false;
+    }
+    if (file.write(QFile::encodeName(line) + '\n') < 0) {
+        if (error) *error = file.fileName() + ": " + file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool cloneFile(const QByteArray &source, const QByteArray &target) {
+#if defined(Q_OS_LINUX) && defined(FICLONE)
+    int in = ::open(source.constData(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+    int out = ::open(target.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (out < 0) {
+        ::close(in);
+        return false;
+    }
+    const bool ok = ::ioctl(out, FICLONE, in) == 0;
+    ::close(in);
+    ::close(out);
+    if (!ok) ::unlink(target.constData());
+    return ok;
+#elif defined(Q_OS_MACOS)
+    return ::clonefile(source.constData(), target.constData(), 0) == 0;
+#else
+    Q_UNUSED(source);
+    Q_UNUSED(target);
+    return false;
+#endif
+}
+
+bool copyData(const QByteArray &source, const QByteArray &target, QString *error) {
+#ifdef HAVE_COPY_FILE_RANGE
+    int in = ::open(source.constData(), O_RDONLY | O_CLOEXEC);
+    int out = in < 0 ? -1 : ::open(target.constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (in >= 0 && out >= 0) {
+        struct stat st;
+        bool ok = ::fstat(in, &st) == 0;
+        for (off_t left = ok ? st.st_size : 0; ok && left > 0;) {
+            ssize_t n = ::copy_file_range(in, nullptr, out, nullptr, size_t(left), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) ok = false;
+            else left -= n;
+        }
+        ::close(in);
+        ::close(out);
+        if (ok) {
+            const struct timespec times[2] = {st.st_atim, st.st_mtim};
+            ::utimensat(AT_FDCWD, target.constData(), times, 0);
+            return true;
+        }
+        ::unlink(target.constData());
+    } else if (in >= 0) {
+        ::close(in);
+    }
+#endif
+    // Not supported between these filesystems, or no copy_file_range at all.
+    const QString from = QFile::decodeName(source), to = QFile::decodeName(target);
+    QFile file(from);
+    if (file.copy(to)) return true;
+    if (error) *error = from + ": " + file.errorString();
+    return false;
+}
+
+} // namespace
+
+IsoStagingArea::IsoStagingArea() {}
+
+IsoStagingArea::~IsoStagingArea() {}
+
+QString IsoStagingArea::normalize(const QString &isoPath) {
+    return QDir::cleanPath("/" + isoPath);
+}
+
+void IsoStagingArea::add(const QString &isoPath, const QString &sourcePath) {
+    const QString path = normalize(isoPath);
+    const QString source = QFileInfo(sourcePath).absoluteFilePath();
+    removeBelow(path);
+
+    // Already there through an enclosing graft (or being put back after a
+    // remove); -x would hide a graft of the same source anyway.
+    const QString covered = coveringSource(path);
+    if (covered == source) {
+        excluded.remove(source);
+        return;
+    }
+    // Otherwise hide what the enclosing graft would put at the same place.
+    if (!covered.isEmpty()) excluded.insert(covered);
+    grafts.insert(path, source);
+}
+
+void IsoStagingArea::addDirectory(const QString &isoPath) {
+    const QString path = normalize(isoPath);
+    if (grafts.contains(path) || QFileInfo(sourcePath(path)).isDir()) return;
+    grafts.insert(path, QString());
+}
+
+void IsoStagingArea::remove(const QString &isoPath) {
+    const QString path = normalize(isoPath);
+    removeBelow(path);
+    const QString covered = coveringSource(path);
+    if (!covered.isEmpty()) excluded.insert(covered);
+}
+
+void IsoStagingArea::clear() {
+    grafts.clear();
+    excluded.clear();
+}
+
+void IsoStagingArea::removeBelow(const QString &isoPath) {
+    if (isoPath == "/") {
+        clear();
+        return;
+    }
+    grafts.remove(isoPath);
+    const QString prefix = isoPath + "/";
+    for (auto it = grafts.lowerBound(prefix); it != grafts.end() && it.key().startsWith(prefix);)
+        it = grafts.erase(it);
+}
+
+QString IsoStagingArea::coveringSource(const QString &isoPath) const {
+    // The nearest grafted ancestor directory decides.
+    for (QString dir = isoPath; dir != "/";) {
+        dir = dir.section('/', 0, -2);
+        if (dir.isEmpty()) dir = "/";
+        auto it = grafts.constFind(dir);
+        if (it == grafts.constEnd()) continue;
+        if (it.value().isEmpty()) return QString();
+        return it.value() + (dir == "/" ? isoPath : isoPath.mid(dir.size()));
+    }
+    return QString();
+}
+
+QString IsoStagingArea::sourcePath(const QString &isoPath) const {
+    const QString path = normalize(isoPath);
+    auto it = grafts.constFind(path);
+    if (it != grafts.constEnd()) return it.value();
+    const QString covered = coveringSource(path);
+    return excluded.contains(covered) ? QString() : covered;
+}
+
+QString IsoStagingArea::emptyDirectory() const {
+    if (!emptyDir) emptyDir.reset(new QTemporaryDir);
+    return emptyDir->path();
+}
+
+QStringList IsoStagingArea::mkisofsArguments() const {
+    QStringList args{"-graft-points"};
+    for (const QString &path : excluded) args << "-x" << path;
+    for (auto it = grafts.constBegin(); it != grafts.constEnd(); ++it) {
+        const QString source = it.value().isEmpty() ? emptyDirectory() : it.value();
+        args << escapeGraft(it.key()) + "=" + escapeGraft(source);
+    }
+    return args;
+}
+
+bool IsoStagingArea::writePathLists(const QString &directory, QStringList &args, QString *error) const {
+    IsoTrace::Phase trace("stage", "path lists");
+    trace.addFiles(grafts.size());
+    QFile pathList(QDir(directory).filePath("path-list"));
+    QFile excludeList(QDir(directory).filePath("exclude-list"));
+    for (QFile *file : {&pathList, &excludeList}) {
+        if (!file->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            if (error) *error = file->fileName() + ": " + file->errorString();
+            return false;
+        }
+    }
+    // Sorted, so the same staging always gives the same files.
+    QStringList exclusions = excluded.values();
+    std::sort(exclusions.begin(), exclusions.end());
+    for (const QString &path : qAsConst(exclusions))
+        if (!writeLine(excludeList, escapeGlob(path), error)) return false;
+    for (auto it = grafts.constBegin(); it != grafts.constEnd(); ++it) {
+        const QString source = it.value().isEmpty() ? emptyDirectory() : it.value();
+        if (!writeLine(pathList, escapeGraft(it.key()) + "=" + escapeGraft(source), error)) return false;
+    }
+    for (QFile *file : {&pathList, &excludeList}) {
+        if (!file->flush()) {
+            if (error) *error = file->fileName() + ": " + file->errorString();
+            return false;
+        }
+    }
+    args = QStringList{"-graft-points", "-path-list", pathList.fileName()};
+    if (!excluded.isEmpty()) args << "-exclude-list" << excludeList.fileName();
+    return true;
+}
+
+bool IsoStagingArea::linkOrCopy(const QString &sourcePath, const QString &targetPath, QString *error) {
+    const QByteArray source = QFile::encodeName(sourcePath);
+    const QByteArray target = QFile::encodeName(targetPath);
+    ::unlink(target.constData());
+    if (cloneFile(source, target)) return true;
+    if (::link(source.constData(), target.constData()) == 0) return true;
+    return copyData(source, target, error);
+}
+
+bool IsoStagingArea::hasChanges(const QString &isoPath, const QString &sourcePath) const {
+    const QString prefix = isoPath == "/" ? "/" : isoPath + "/";
+    auto it = grafts.lowerBound(prefix);
+    if (it != grafts.constEnd() && it.key().startsWith(prefix)) return true;
+    const QString sourcePrefix = sourcePath + "/";
+    for (const QString &path : excluded)
+        if (path.startsWith(sourcePrefix)) return true;
+    return false;
+}
+
+bool IsoStagingArea::materializeTree(const QString &sourceDir, const QString &targetDir, QString *error) const {
+    if (!QDir().mkpath(targetDir)) {
+        if (error) *error = "Cannot create " + targetDir;
+        return false;
+    }
+    const QByteArray root = IsoTreeScanner::rootPath(sourceDir);
+    const int rootLength = root.endsWith('/') ? root.size() - 1 : root.size();
+    IsoTreeScanner scanner;
+    scanner.setFilter([this](const QByteArray &path) { return excluded.contains(QFile::decodeName(path)); });
+    if (!scanner.start(sourceDir)) return false;
+    // Directories arrive before their contents.
+    IsoTreeScanner::Entry entry;
+    while (scanner.next(entry)) {
+        const QString source = QFile::decodeName(entry.path);
+        const QString target = targetDir + QFile::decodeName(entry.path.mid(rootLength));
+        const bool ok = entry.isDir() ? QDir().mkpath(target) : linkOrCopy(source, target, error);
+        if (!ok) {
+            if (error && entry.isDir()) *error = "Cannot create " + target;
+            scanner.cancel();
+            return false;
+        }
+    }
+    const QStringList failed = scanner.errors();
+    if (!failed.isEmpty()) {
+        if (error) *error = failed.first();
+        return false;
+    }
+    return true;
+}
+
+bool IsoStagingArea::materialize(const QString &root, QString *error, bool allowSymlinks) const {
+    // Parents sort before their children, so nested grafts land on top.
+    for (auto it = grafts.constBegin(); it != grafts.constEnd(); ++it) {
+        const QString target = root + (it.key() == "/" ? QString() : it.key());
+        const QString source = it.value();
+        QDir().mkpath(QFileInfo(target).path());
+
+        if (source.isEmpty()) {
+            QDir().mkpath(target);
+            continue;
+        }
+        const QFileInfo fi(source);
+        if (!fi.exists()) {
+            if (error) *error = source + ": No such file or directory";
+            return false;
+        }
+        if (allowSymlinks && it.key() != "/" && (!fi.isDir() || !hasChanges(it.key(), source))) {
+            QFile::remove(target);
+            if (QFile::link(source, target)) continue;
+        }
+        const bool ok = fi.isDir() ? materializeTree(source, target, error) : linkOrCopy(source, target, error);
+        if (!ok) return false;
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef ISOSTAGINGAREA_H
+#define ISOSTAGINGAREA_H
+
+#include <QMap>
+#include <QSet>
+#include <QSharedPointer>
+#include <QStringList>
+
+class QTemporaryDir;
+
+// The contents of an image being put together, kept as graft points
+// (ISO path -> local source path) instead of a copied scratch tree. Adding
+// a 20 GB directory costs one map entry; mkisofs/xorriso read the data from
+// where it already is. Removing something that lives inside a grafted
+// directory excludes its source path rather than deleting anything.
+class IsoStagingArea {
+public:
+    IsoStagingArea();
+    ~IsoStagingArea();
+
+    // Puts the local file or directory sourcePath at isoPath, replacing
+    // whatever was staged there before.
+    void add(const QString &isoPath, const QString &sourcePath);
+    // An empty directory with no local counterpart.
+    void addDirectory(const QString &isoPath);
+    void remove(const QString &isoPath);
+    void clear();
+
+    bool isEmpty() const { return grafts.isEmpty(); }
+    // ISO path -> source path, sorted so parents come before children. An
+    // empty source marks a directory created with addDirectory().
+    const QMap<QString, QString> &graftPoints() const { return grafts; }
+    bool isExcluded(const QString &sourcePath) const { return excluded.contains(sourcePath); }
+
+    // Where the data for isoPath comes from, empty if it is only a
+    // directory made with addDirectory() or isn't staged at all.
+    QString sourcePath(const QString &isoPath) const;
+
+    // -graft-points, -x <excluded>... and iso=source pairs for mkisofs,
+    // genisoimage or xorriso -as mkisofs.
+    QStringList mkisofsArguments() const;
+    // The same, but with the graft points written to directory/path-list and
+    // the exclusions to directory/exclude-list, one per line. args gets the
+    // options that read them, so the command line has the same size however
+    // many entries there are. Fails on paths containing a newline.
+    bool writePathLists(const QString &directory, QStringList &args, QString *error = nullptr) const;
+
+    // Builds a real tree under root for tools that can't take graft points.
+    // Files are reflinked where the filesystem allows it, otherwise hard
+    // linked, otherwise copied. The result shares data with the sources and
+    // must be treated as read-only. With allowSymlinks, untouched directories
+    // and files become symlinks instead (for tools that follow them).
+    bool materialize(const QString &root, QString *error = nullptr, bool allowSymlinks = false) const;
+
+    static bool linkOrCopy(const QString &sourcePath, const QString &targetPath, QString *error = nullptr);
+    static QString normalize(const QString &isoPath);
+
+private:
+    void removeBelow(const QString &isoPath);
+    QString coveringSource(const QString &isoPath) const;
+    bool hasChanges(const QString &isoPath, const QString &sourcePath) const;
+    bool materializeTree(const QString &sourceDir, const QString &targetDir, QString *error) const;
+    QString emptyDirectory() const;
+
+    QMap<QString, QString> grafts;
+    QSet<QString> excluded;
+    // Shared by copies, created the first time an empty directory is grafted.
+    mutable QSharedPointer<QTemporaryDir> emptyDir;
+};
+
+#endif // ISOSTAGINGAREA_H
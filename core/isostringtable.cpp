@@ -0,0 +1,40 @@
+#include "isostringtable.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const IsoStringTable::Id IsoStringTable::NoString;
+
+IsoStringTable::~IsoStringTable() {
+    clear();
+}
+
+qint64 IsoStringTable::growthFor(int length) const {
+    return used + 2 + length + 1 > BlockSize ? BlockSize : 0;
+}
+
+IsoStringTable::Id IsoStringTable::add(const char *data, int length) {
+    if (length < 0 || length > MaxLength) return NoString;
+    if (used + 2 + length + 1 > BlockSize) {
+        // Ids are offsets into the blocks laid end to end.
+        if (quint64(blocks.size() + 1) * BlockSize > NoString) return NoString;
+        char *block = static_cast<char *>(malloc(BlockSize));
+        if (!block) return NoString;
+        blocks.append(block);
+        used = 0;
+    }
+    char *p = blocks.last() + used;
+    p[0] = char(length & 0xff);
+    p[1] = char(length >> 8);
+    memcpy(p + 2, data, size_t(length));
+    p[2 + length] = '\0';
+    const Id id = Id(blocks.size() - 1) * BlockSize + Id(used + 2);
+    used += 2 + length + 1;
+    return id;
+}
+
+void IsoStringTable::clear() {
+    for (char *block : qAsConst(blocks)) free(block);
+    blocks.clear();
+    used = BlockSize;
+}
@@ -0,0 +1,44 @@
+#ifndef ISOSTRINGTABLE_H
+#define ISOSTRINGTABLE_H
+
+#include <QByteArray>
+#include <QVector>
+
+// Append-only storage for millions of short byte strings (names, paths):
+// they are packed NUL-terminated into 1 MiB blocks behind a two-byte
+// length, instead of one heap allocation and QString header each, and
+// addressed by a 32-bit id. Nothing is freed before clear().
+class IsoStringTable {
+public:
+    typedef quint32 Id;
+    static const Id NoString = 0xffffffffu;
+    static const int BlockSize = 1 << 20;
+    static const int MaxLength = 0xffff;
+
+    IsoStringTable() = default;
+    ~IsoStringTable();
+
+    // NoString if length is over MaxLength or the table is full (4 GiB).
+    Id add(const char *data, int length);
+    Id add(const QByteArray &s) { return add(s.constData(), s.size()); }
+
+    const char *at(Id id) const { return blocks.at(int(id / BlockSize)) + id % BlockSize; }
+    int length(Id id) const {
+        const uchar *p = reinterpret_cast<const uchar *>(at(id));
+        return p[-2] | (p[-1] << 8);
+    }
+    QByteArray bytes(Id id) const { return QByteArray::fromRawData(at(id), length(id)); }
+
+    // What the next add() of length bytes would allocate: 0 or a block.
+    qint64 growthFor(int length) const;
+    qint64 memoryUsed() const { return qint64(blocks.size()) * BlockSize; }
+    void clear();
+
+private:
+    Q_DISABLE_COPY(IsoStringTable)
+
+    QVector<char *> blocks;
+    int used = BlockSize;      // in the last block
+};
+
+#endif // ISOSTRINGTABLE_H
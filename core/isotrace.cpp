@@ -0,0 +1,286 @@
+#include "isotrace.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QMutex>
+#include <QSaveFile>
+#include <QThread>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+namespace {
+
+struct Counters {
+    qint64 wallNs = 0;
+    qint64 cpuNs = 0;
+    qint64 childCpuNs = 0;
+    qint64 bytesRead = 0;
+    qint64 bytesWritten = 0;
+    qint64 readCalls = 0;
+    qint64 writeCalls = 0;
+};
+
+struct State {
+    QAtomicInt enabled;
+    QAtomicInt generation;
+    QMutex mutex;
+    QElapsedTimer clock;
+    QVector<IsoTrace::Event> events;
+    QString prefix;
+};
+
+State &state() {
+    static State s;
+    return s;
+}
+
+qint64 nanoseconds(const struct timeval &tv) {
+    return qint64(tv.tv_sec) * 1000000000 + qint64(tv.tv_usec) * 1000;
+}
+
+void readProcessIo(Counters &c) {
+#ifdef Q_OS_LINUX
+    // rchar/wchar count what read()/write() and friends moved, from the
+    // page cache or not; syscr/syscw count the calls.
+    const int fd = ::open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    char buf[512];
+    const ssize_t n = ::read(fd, buf, sizeof(buf));
+    ::close(fd);
+    if (n <= 0) return;
+    for (const QByteArray &line : QByteArray(buf, int(n)).split('\n')) {
+        const int colon = line.indexOf(':');
+        if (colon < 0) continue;
+        const QByteArray key = line.left(colon);
+        const qint64 value = line.mid(colon + 1).trimmed().toLongLong();
+        if (key == "rchar") c.bytesRead = value;
+        else if (key == "wchar") c.bytesWritten = value;
+        else if (key == "syscr") c.readCalls = value;
+        else if (key == "syscw") c.writeCalls = value;
+    }
+#else
+    Q_UNUSED(c);
+#endif
+}
+
+Counters snapshot() {
+    Counters c;
+    c.wallNs = state().clock.nsecsElapsed();
+    struct rusage usage;
+    if (::getrusage(RUSAGE_SELF, &usage) == 0) c.cpuNs = nanoseconds(usage.ru_utime) + nanoseconds(usage.ru_stime);
+    if (::getrusage(RUSAGE_CHILDREN, &usage) == 0)
+        c.childCpuNs = nanoseconds(usage.ru_utime) + nanoseconds(usage.ru_stime);
+    readProcessIo(c);
+    return c;
+}
+
+double ms(qint64 ns) {
+    return ns / 1e6;
+}
+
+// Small, stable thread numbers instead of pthread handles.
+QHash<quint64, int> threadNumbers(const QVector<IsoTrace::Event> &events) {
+    QHash<quint64, int> numbers;
+    for (const IsoTrace::Event &e : events)
+        if (!numbers.contains(e.thread)) numbers.insert(e.thread, numbers.size() + 1);
+    return numbers;
+}
+
+QJsonObject counters(const IsoTrace::Event &e) {
+    QJsonObject o;
+    o["wall_ms"] = ms(e.wallNs);
+    o["cpu_ms"] = ms(e.cpuNs);
+    o["child_cpu_ms"] = ms(e.childCpuNs);
+    o["bytes_read"] = double(e.bytesRead);
+    o["bytes_written"] = double(e.bytesWritten);
+    o["read_calls"] = double(e.readCalls);
+    o["write_calls"] = double(e.writeCalls);
+    o["files"] = double(e.files);
+    return o;
+}
+
+// Per category, in first-seen order; startNs holds the phase count.
+QVector<IsoTrace::Event> totals(const QVector<IsoTrace::Event> &events) {
+    QVector<IsoTrace::Event> out;
+    QHash<QByteArray, int> index;
+    for (const IsoTrace::Event &e : events) {
+        auto it = index.constFind(e.category);
+        if (it == index.constEnd()) {
+            it = index.insert(e.category, out.size());
+            IsoTrace::Event total;
+            total.category = e.category;
+            out.append(total);
+        }
+        IsoTrace::Event &t = out[it.value()];
+        t.startNs += 1;
+        t.wallNs += e.wallNs;
+        t.cpuNs += e.cpuNs;
+        t.childCpuNs += e.childCpuNs;
+        t.bytesRead += e.bytesRead;
+        t.bytesWritten += e.bytesWritten;
+        t.readCalls += e.readCalls;
+        t.writeCalls += e.writeCalls;
+        t.files += e.files;
+    }
+    return out;
+}
+
+bool writeFile(const QString &path, const QByteArray &data, QString *error) {
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+        if (error) *error = path + ": " + file.errorString();
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+IsoTrace::Phase::Phase(const char *category, const QString &name) {
+    if (!isEnabled()) return;
+    active = true;
+    start.category = category;
+    start.name = name;
+    start.thread = quint64(quintptr(QThread::currentThreadId()));
+    const Counters c = snapshot();
+    start.startNs = c.wallNs;
+    start.cpuNs = c.cpuNs;
+    start.childCpuNs = c.childCpuNs;
+    start.bytesRead = c.bytesRead;
+    start.bytesWritten = c.bytesWritten;
+    start.readCalls = c.readCalls;
+    start.writeCalls = c.writeCalls;
+}
+
+void IsoTrace::Phase::end() {
+    if (!active) return;
+    active = false;
+    if (!isEnabled()) return;
+    const Counters c = snapshot();
+    Event e = start;
+    e.wallNs = c.wallNs - start.startNs;
+    e.cpuNs = c.cpuNs - start.cpuNs;
+    e.childCpuNs = c.childCpuNs - start.childCpuNs;
+    e.bytesRead = c.bytesRead - start.bytesRead + extraRead.load();
+    e.bytesWritten = c.bytesWritten - start.bytesWritten + extraWritten.load();
+    e.readCalls = c.readCalls - start.readCalls;
+    e.writeCalls = c.writeCalls - start.writeCalls;
+    e.files = files.load();
+    State &s = state();
+    QMutexLocker lock(&s.mutex);
+    s.events.append(e);
+    s.generation.ref();
+}
+
+void IsoTrace::setEnabled(bool on) {
+    State &s = state();
+    QMutexLocker lock(&s.mutex);
+    if (on && !s.clock.isValid()) s.clock.start();
+    s.enabled.store(on);
+}
+
+bool IsoTrace::isEnabled() {
+    return state().enabled.load();
+}
+
+void IsoTrace::enableFromEnvironment() {
+    const QByteArray prefix = qgetenv("ISOMANAGER_TRACE");
+    if (prefix.isEmpty()) return;
+    state().prefix = QFile::decodeName(prefix);
+    setEnabled(true);
+    qAddPostRoutine([]() {
+        QString error;
+        if (!save(state().prefix, &error)) fprintf(stderr, "%s\n", qPrintable(error));
+    });
+}
+
+QVector<IsoTrace::Event> IsoTrace::events() {
+    State &s = state();
+    QMutexLocker lock(&s.mutex);
+    return s.events;
+}
+
+void IsoTrace::clear() {
+    State &s = state();
+    QMutexLocker lock(&s.mutex);
+    s.events.clear();
+    s.generation.ref();
+}
+
+int IsoTrace::generation() {
+    return state().generation.load();
+}
+
+QByteArray IsoTrace::toJson() {
+    const QVector<Event> list = events();
+    const QHash<quint64, int> threads = threadNumbers(list);
+    QJsonArray phases;
+    for (const Event &e : list) {
+        QJsonObject o = counters(e);
+        o["category"] = QString::fromLatin1(e.category);
+        o["name"] = e.name;
+        o["thread"] = threads.value(e.thread);
+        o["start_ms"] = ms(e.startNs);
+        phases.append(o);
+    }
+    QJsonObject byCategory;
+    for (const Event &t : totals(list)) {
+        QJsonObject o = counters(t);
+        o["phases"] = double(t.startNs);
+        byCategory[QString::fromLatin1(t.category)] = o;
+    }
+    QJsonObject root;
+    root["phases"] = phases;
+    root["totals"] = byCategory;
+    return QJsonDocument(root).toJson();
+}
+
+QByteArray IsoTrace::toChromeTrace() {
+    const QVector<Event> list = events();
+    const QHash<quint64, int> threads = threadNumbers(list);
+    const double pid = double(QCoreApplication::applicationPid());
+    QJsonArray trace;
+    for (const Event &e : list) {
+        QJsonObject o;
+        o["name"] = e.name.isEmpty() ? QString::fromLatin1(e.category) : e.name;
+        o["cat"] = QString::fromLatin1(e.category);
+        o["ph"] = "X";
+        o["ts"] = e.startNs / 1e3;
+        o["dur"] = e.wallNs / 1e3;
+        o["pid"] = pid;
+        o["tid"] = threads.value(e.thread);
+        o["args"] = counters(e);
+        trace.append(o);
+    }
+    QJsonObject root;
+    root["traceEvents"] = trace;
+    root["displayTimeUnit"] = "ms";
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+QString IsoTrace::summary() {
+    QString out;
+    for (const Event &t : totals(events())) {
+        out += QString("%1 %2 phase(s), wall %3 ms, cpu %4 ms, tools %5 ms, read %6 MB in %7 calls, "
+                       "written %8 MB in %9 calls, %10 file(s)\n")
+                   .arg(QString::fromLatin1(t.category), -8).arg(t.startNs)
+                   .arg(ms(t.wallNs), 0, 'f', 1).arg(ms(t.cpuNs), 0, 'f', 1).arg(ms(t.childCpuNs), 0, 'f', 1)
+                   .arg(t.bytesRead / 1048576.0, 0, 'f', 1).arg(t.readCalls)
+                   .arg(t.bytesWritten / 1048576.0, 0, 'f', 1).arg(t.writeCalls).arg(t.files);
+    }
+    return out;
+}
+
+bool IsoTrace::save(const QString &prefix, QString *error) {
+    return writeFile(prefix + ".trace.json", toChromeTrace(), error)
+           && writeFile(prefix + ".stats.json", toJson(), error);
+}
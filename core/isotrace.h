@@ -0,0 +1,80 @@
+#ifndef ISOTRACE_H
+#define ISOTRACE_H
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+// Per-phase timing and I/O counters for the ISO operations: open, scan,
+// stage, write, verify and extract, plus the external tools ("tool").
+// Tracing is off unless enabled, and a Phase then costs one atomic load.
+//
+// A finished Phase records its wall time, the process CPU time (all
+// threads), the CPU time of child processes reaped during it, and the
+// bytes and read/write syscalls of the process over it from /proc/self/io
+// (Linux; elsewhere only what callers add by hand). Those are process-wide,
+// so phases overlapping on other threads share them; an external tool's
+// own I/O is not included.
+class IsoTrace {
+public:
+    struct Event {
+        QByteArray category;
+        QString name;
+        quint64 thread = 0;
+        qint64 startNs = 0;       // since tracing was enabled
+        qint64 wallNs = 0;
+        qint64 cpuNs = 0;
+        qint64 childCpuNs = 0;
+        qint64 bytesRead = 0;
+        qint64 bytesWritten = 0;
+        qint64 readCalls = 0;
+        qint64 writeCalls = 0;
+        qint64 files = 0;
+    };
+
+    // Records from construction until end() or destruction. The add*()
+    // calls may come from any thread.
+    class Phase {
+    public:
+        Phase(const char *category, const QString &name);
+        ~Phase() { end(); }
+
+        void addFiles(qint64 n) { files.fetchAndAddRelaxed(n); }
+        // I/O the process counters miss, e.g. reads through a mapping.
+        void addBytesRead(qint64 n) { extraRead.fetchAndAddRelaxed(n); }
+        void addBytesWritten(qint64 n) { extraWritten.fetchAndAddRelaxed(n); }
+        void end();
+
+    private:
+        Q_DISABLE_COPY(Phase)
+
+        Event start;
+        bool active = false;
+        QAtomicInteger<qint64> files{0};
+        QAtomicInteger<qint64> extraRead{0};
+        QAtomicInteger<qint64> extraWritten{0};
+    };
+
+    static void setEnabled(bool on);
+    static bool isEnabled();
+    // Enables tracing when ISOMANAGER_TRACE is set and saves to that
+    // prefix when the application object goes away.
+    static void enableFromEnvironment();
+
+    static QVector<Event> events();
+    static void clear();
+    // Changes whenever an event is recorded or cleared, for pollers.
+    static int generation();
+
+    // The events and per-category totals.
+    static QByteArray toJson();
+    // Complete ("X") events for chrome://tracing and Perfetto.
+    static QByteArray toChromeTrace();
+    // One line per category, for terminals.
+    static QString summary();
+    // prefix.trace.json and prefix.stats.json.
+    static bool save(const QString &prefix, QString *error = nullptr);
+};
+
+#endif // ISOTRACE_H
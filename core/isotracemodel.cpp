@@ -0,0 +1,53 @@
+#include "isotracemodel.h"
+
+IsoTraceModel::IsoTraceModel(QObject *parent) : QAbstractTableModel(parent) {
+    poll.setInterval(500);
+    connect(&poll, &QTimer::timeout, this, &IsoTraceModel::refresh);
+    poll.start();
+    refresh();
+}
+
+void IsoTraceModel::refresh() {
+    const int generation = IsoTrace::generation();
+    if (generation == seen) return;
+    seen = generation;
+    beginResetModel();
+    rows = IsoTrace::events();
+    endResetModel();
+}
+
+int IsoTraceModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : rows.size();
+}
+
+int IsoTraceModel::columnCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant IsoTraceModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid() || index.row() >= rows.size()) return QVariant();
+    if (role == Qt::TextAlignmentRole && index.column() >= Wall) return int(Qt::AlignRight | Qt::AlignVCenter);
+    if (role != Qt::DisplayRole) return QVariant();
+    const IsoTrace::Event &e = rows.at(index.row());
+    switch (index.column()) {
+    case Category: return QString::fromLatin1(e.category);
+    case Name: return e.name;
+    case Wall: return QString::number(e.wallNs / 1e6, 'f', 1);
+    case Cpu: return QString::number(e.cpuNs / 1e6, 'f', 1);
+    case ChildCpu: return QString::number(e.childCpuNs / 1e6, 'f', 1);
+    case Read: return QString::number(e.bytesRead / 1048576.0, 'f', 1);
+    case Written: return QString::number(e.bytesWritten / 1048576.0, 'f', 1);
+    case ReadCalls: return e.readCalls;
+    case WriteCalls: return e.writeCalls;
+    case Files: return e.files;
+    }
+    return QVariant();
+}
+
+QVariant IsoTraceModel::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole) return QVariant();
+    static const char *const Titles[ColumnCount] = {
+        "Phase", "Name", "Wall ms", "CPU ms", "Tools ms", "Read MB", "Written MB", "Reads", "Writes", "Files"
+    };
+    return section >= 0 && section < ColumnCount ? QString::fromLatin1(Titles[section]) : QVariant();
+}
@@ -0,0 +1,35 @@
+#ifndef ISOTRACEMODEL_H
+#define ISOTRACEMODEL_H
+
+#include <QAbstractTableModel>
+#include <QTimer>
+#include <QVector>
+
+#include "isotrace.h"
+
+// The recorded IsoTrace phases as a table, newest last, for a stats panel.
+// Phases end on worker threads, so the model polls for new ones instead of
+// being told.
+class IsoTraceModel : public QAbstractTableModel {
+    Q_OBJECT
+
+public:
+    enum Column { Category, Name, Wall, Cpu, ChildCpu, Read, Written, ReadCalls, WriteCalls, Files, ColumnCount };
+
+    explicit IsoTraceModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+public slots:
+    void refresh();
+
+private:
+    QVector<IsoTrace::Event> rows;
+    int seen = -1;
+    QTimer poll;
+};
+
+#endif // ISOTRACEMODEL_H
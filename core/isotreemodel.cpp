@@ -0,0 +1,323 @@
+#include "isotreemodel.h"
+
+#include <QPointer>
+#include <QStringList>
+
+IsoTreeModel::IsoTreeModel(QObject *parent)
+    : QAbstractItemModel(parent), header("Name") {
+    resetTable();
+}
+
+void IsoTreeModel::resetTable() {
+    ++generation;
+    nodes.clear();
+    childLists.clear();
+    pathIndex.clear();
+
+    IsoTreeEntry rootEntry;
+    if (src) rootEntry = src->rootEntry();
+    Node root = {};
+    root.extent = rootEntry.extent;
+    root.size = rootEntry.size;
+    root.mtime = rootEntry.mtime;
+    root.flags = Directory | (src ? 0 : Fetched);
+    root.nameId = pathIndex.intern(QString());
+    root.children = 0;
+    childLists.append(QVector<quint32>());
+    nodes.append(root);
+}
+
+void IsoTreeModel::setSource(IsoDirectorySource *source) {
+    beginResetModel();
+    src = source;
+    resetTable();
+    endResetModel();
+    fetch(0);
+}
+
+void IsoTreeModel::clear() {
+    setSource(nullptr);
+}
+
+void IsoTreeModel::setHeaderLabel(const QString &label) {
+    header = label;
+    emit headerDataChanged(Qt::Horizontal, 0, 0);
+}
+
+void IsoTreeModel::setIcons(const QVariant &dir, const QVariant &file) {
+    dirIcon = dir;
+    fileIcon = file;
+}
+
+void IsoTreeModel::setFlagData(NodeFlag flag, int role, const QVariant &value) {
+    flagData.insert(qMakePair(int(flag), role), value);
+}
+
+QModelIndex IsoTreeModel::indexOf(quint32 node) const {
+    if (node == 0 || node >= quint32(nodes.size())) return QModelIndex();
+    return createIndex(int(nodes.at(int(node)).row), 0, quintptr(node));
+}
+
+IsoTreeEntry IsoTreeModel::nodeEntry(quint32 node) const {
+    const Node &n = nodes.at(int(node));
+    IsoTreeEntry entry;
+    entry.name = nodeName(node);
+    entry.size = n.size;
+    entry.mtime = n.mtime;
+    entry.extent = n.extent;
+    entry.flags = n.flags;
+    return entry;
+}
+
+quint32 IsoTreeModel::appendNode(quint32 parent, const IsoTreeEntry &entry) {
+    const int siblings = int(nodes.at(int(parent)).children);
+    Node n = {};
+    n.parent = parent;
+    n.row = quint32(childLists.at(siblings).size());
+    n.nameId = pathIndex.intern(entry.name);
+    n.extent = entry.extent;
+    n.size = entry.size;
+    n.mtime = entry.mtime;
+    n.flags = entry.flags & ~Fetched;
+    n.children = NoChildren;
+    if (n.flags & Directory) {
+        n.children = quint32(childLists.size());
+        childLists.append(QVector<quint32>());
+        // Nothing to pull for directories that only exist in this model.
+        if (!src || (n.flags & Added)) n.flags |= Fetched;
+    }
+    const quint32 id = quint32(nodes.size());
+    nodes.append(n);
+    childLists[siblings].append(id);
+    pathIndex.insert(parent, n.nameId, id);
+    return id;
+}
+
+quint32 IsoTreeModel::findChild(quint32 parent, const QString &name) const {
+    return pathIndex.child(parent, name);
+}
+
+bool IsoTreeModel::isAttached(quint32 node) const {
+    for (; node != 0; node = nodes.at(int(node)).parent) {
+        const Node &n = nodes.at(int(node));
+        const QVector<quint32> &siblings = childLists.at(int(nodes.at(int(n.parent)).children));
+        if (int(n.row) >= siblings.size() || siblings.at(int(n.row)) != node) return false;
+    }
+    return true;
+}
+
+void IsoTreeModel::fetch(quint32 node) {
+    const quint8 flags = nodes.at(int(node)).flags;
+    if (!(flags & Directory) || (flags & Fetched) || !src) return;
+    nodes[int(node)].flags |= Fetched | Listing;
+
+    // The listing may arrive after the model was reset or the directory
+    // removed; node ids are only good for the table they came from.
+    QPointer<IsoTreeModel> self(this);
+    const quint32 table = generation;
+    src->requestDirectory(path(indexOf(node)), nodeEntry(node),
+                          [self, table, node](bool ok, const QVector<IsoTreeEntry> &entries) {
+                              if (self && self->generation == table) self->listingArrived(node, ok, entries);
+                          });
+}
+
+void IsoTreeModel::listingArrived(quint32 node, bool ok, const QVector<IsoTreeEntry> &entries) {
+    nodes[int(node)].flags &= ~Listing;
+    if (!ok || !isAttached(node)) return;
+
+    // Settle what addPath() put here in the meantime: listed names are in
+    // the image (an addition over one replaces it), the rest are new.
+    for (const IsoTreeEntry &entry : entries) {
+        const quint32 child = findChild(node, entry.name);
+        if (!child || !(nodes.at(int(child)).flags & Unconfirmed)) continue;
+        quint8 &flags = nodes[int(child)].flags;
+        flags &= ~Unconfirmed;
+        if (flags & Added) {
+            flags = quint8((flags & ~Added) | Modified);
+            // It has image contents to list after all.
+            if ((flags & Directory) && !(flags & Listing)) flags &= ~Fetched;
+        }
+        emit dataChanged(indexOf(child), indexOf(child));
+    }
+    for (quint32 child : childLists.at(int(nodes.at(int(node)).children))) {
+        quint8 &flags = nodes[int(child)].flags;
+        if (!(flags & Unconfirmed)) continue;
+        flags = quint8((flags & ~Unconfirmed) | Added);
+        if (flags & Directory) flags |= Fetched;
+        emit dataChanged(indexOf(child), indexOf(child));
+    }
+    insertListing(node, entries);
+}
+
+void IsoTreeModel::insertListing(quint32 node, const QVector<IsoTreeEntry> &entries) {
+    QVector<int> fresh;
+    fresh.reserve(entries.size());
+    for (int i = 0; i < entries.size(); ++i)
+        if (!findChild(node, entries.at(i).name)) fresh.append(i);
+    if (fresh.isEmpty()) return;
+
+    const int children = int(nodes.at(int(node)).children);
+    const int first = childLists.at(children).size();
+    beginInsertRows(indexOf(node), first, first + fresh.size() - 1);
+    childLists[children].reserve(first + fresh.size());
+    pathIndex.reserve(pathIndex.size() + fresh.size());
+    for (int i : qAsConst(fresh)) appendNode(node, entries.at(i));
+    endInsertRows();
+}
+
+QString IsoTreeModel::path(const QModelIndex &index) const {
+    QStringList parts;
+    for (quint32 node = nodeOf(index); node != 0; node = nodes.at(int(node)).parent)
+        parts.prepend(nodeName(node));
+    return "/" + parts.join("/");
+}
+
+QModelIndex IsoTreeModel::findPath(const QString &path) {
+    quint32 node = 0;
+    for (const QString &part : path.split('/', QString::SkipEmptyParts)) {
+        fetch(node);
+        node = findChild(node, part);
+        if (!node) return QModelIndex();
+    }
+    return indexOf(node);
+}
+
+QModelIndex IsoTreeModel::addPath(const QString &path, bool isDirectory, quint8 flags, quint64 size) {
+    const QStringList parts = path.split('/', QString::SkipEmptyParts);
+    quint32 node = 0;
+    for (int i = 0; i < parts.size(); ++i) {
+        fetch(node);
+        const bool last = i == parts.size() - 1;
+        quint32 child = findChild(node, parts.at(i));
+        if (!child) {
+            IsoTreeEntry entry;
+            entry.name = parts.at(i);
+            quint8 own = last ? flags : quint8(src ? Added : 0);
+            if (nodes.at(int(node)).flags & Listing) own = last ? quint8(own | Unconfirmed) : quint8(Unconfirmed);
+            entry.flags = quint8(own | ((!last || isDirectory) ? Directory : 0));
+            if (last) entry.size = size;
+            const int row = childLists.at(int(nodes.at(int(node)).children)).size();
+            beginInsertRows(indexOf(node), row, row);
+            child = appendNode(node, entry);
+            endInsertRows();
+        } else if (!last && !(nodes.at(int(child)).flags & Directory)) {
+            // Listings without type info report a directory before its children.
+            nodes[int(child)].flags |= Directory | Fetched;
+            nodes[int(child)].children = quint32(childLists.size());
+            childLists.append(QVector<quint32>());
+        } else if (last && flags) {
+            setNodeFlags(indexOf(child), flags);
+        }
+        node = child;
+    }
+    return indexOf(node);
+}
+
+bool IsoTreeModel::removeIndex(const QModelIndex &index) {
+    const quint32 node = nodeOf(index);
+    if (node == 0) return false;
+    const quint32 parent = nodes.at(int(node)).parent;
+    const int row = int(nodes.at(int(node)).row);
+
+    beginRemoveRows(index.parent(), row, row);
+    QVector<quint32> &siblings = childLists[int(nodes.at(int(parent)).children)];
+    siblings.remove(row);
+    for (int i = row; i < siblings.size(); ++i) nodes[int(siblings.at(i))].row = quint32(i);
+    pathIndex.remove(parent, nodes.at(int(node)).nameId);
+    endRemoveRows();
+    return true;
+}
+
+bool IsoTreeModel::renameIndex(const QModelIndex &index, const QString &name) {
+    const quint32 node = nodeOf(index);
+    if (node == 0 || name.isEmpty() || name.contains('/')) return false;
+    const quint32 parent = nodes.at(int(node)).parent;
+    if (findChild(parent, name)) return false;
+
+    pathIndex.remove(parent, nodes.at(int(node)).nameId);
+    nodes[int(node)].nameId = pathIndex.intern(name);
+    pathIndex.insert(parent, nodes.at(int(node)).nameId, node);
+    emit dataChanged(index, index);
+    return true;
+}
+
+void IsoTreeModel::setNodeFlags(const QModelIndex &index, quint8 flags, bool on) {
+    const quint32 node = nodeOf(index);
+    if (node == 0) return;
+    if (on) nodes[int(node)].flags |= flags;
+    else nodes[int(node)].flags &= ~flags;
+    emit dataChanged(index, index);
+}
+
+QModelIndex IsoTreeModel::index(int row, int column, const QModelIndex &parent) const {
+    if (column != 0 || row < 0) return QModelIndex();
+    const Node &p = nodes.at(int(nodeOf(parent)));
+    if (p.children == NoChildren) return QModelIndex();
+    const QVector<quint32> &children = childLists.at(int(p.children));
+    if (row >= children.size()) return QModelIndex();
+    return createIndex(row, 0, quintptr(children.at(row)));
+}
+
+QModelIndex IsoTreeModel::parent(const QModelIndex &child) const {
+    if (!child.isValid()) return QModelIndex();
+    return indexOf(nodes.at(int(nodeOf(child))).parent);
+}
+
+int IsoTreeModel::rowCount(const QModelIndex &parent) const {
+    if (parent.column() > 0) return 0;
+    const Node &p = nodes.at(int(nodeOf(parent)));
+    return p.children == NoChildren ? 0 : childLists.at(int(p.children)).size();
+}
+
+int IsoTreeModel::columnCount(const QModelIndex &) const {
+    return 1;
+}
+
+bool IsoTreeModel::hasChildren(const QModelIndex &parent) const {
+    const Node &p = nodes.at(int(nodeOf(parent)));
+    if (!(p.flags & Directory)) return false;
+    return !(p.flags & Fetched) || !childLists.at(int(p.children)).isEmpty();
+}
+
+bool IsoTreeModel::canFetchMore(const QModelIndex &parent) const {
+    const Node &p = nodes.at(int(nodeOf(parent)));
+    return src && (p.flags & Directory) && !(p.flags & Fetched);
+}
+
+void IsoTreeModel::fetchMore(const QModelIndex &parent) {
+    fetch(nodeOf(parent));
+}
+
+QVariant IsoTreeModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid()) return QVariant();
+    const quint32 node = nodeOf(index);
+    const Node &n = nodes.at(int(node));
+
+    switch (role) {
+    case Qt::DisplayRole:
+        return nodeName(node);
+    case PathRole:
+        return path(index);
+    case SizeRole:
+        return n.size;
+    case ExtentRole:
+        return n.extent;
+    case IsDirectoryRole:
+        return bool(n.flags & Directory);
+    case FlagsRole:
+        return int(n.flags);
+    default:
+        break;
+    }
+
+    for (auto it = flagData.constBegin(); it != flagData.constEnd(); ++it) {
+        if (it.key().second == role && (n.flags & it.key().first)) return it.value();
+    }
+    if (role == Qt::DecorationRole) return (n.flags & Directory) ? dirIcon : fileIcon;
+    return QVariant();
+}
+
+QVariant IsoTreeModel::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (section == 0 && orientation == Qt::Horizontal && role == Qt::DisplayRole) return header;
+    return QVariant();
+}
@@ -0,0 +1,140 @@
+#ifndef ISOTREEMODEL_H
+#define ISOTREEMODEL_H
+
+#include <QAbstractItemModel>
+#include <QVector>
+#include <QMap>
+#include <QPair>
+
+#include <functional>
+
+#include "isopathindex.h"
+
+// What a directory source reports for one entry.
+struct IsoTreeEntry {
+    QString name;
+    quint64 size = 0;
+    qint64 mtime = 0;
+    quint32 extent = 0;
+    quint8 flags = 0;   // IsoTreeModel::NodeFlag bits
+};
+
+// Supplies directory listings to IsoTreeModel, one directory at a time.
+class IsoDirectorySource {
+public:
+    typedef std::function<void(bool ok, const QVector<IsoTreeEntry> &entries)> ListCallback;
+
+    virtual ~IsoDirectorySource() {}
+    virtual IsoTreeEntry rootEntry() = 0;
+    // path is the directory's full path inside the image ("/" for the root).
+    virtual bool listDirectory(const QString &path, const IsoTreeEntry &dir, QVector<IsoTreeEntry> &out) = 0;
+    // What the model calls. Sources that wait on something else (another
+    // process) answer later, on the model's thread; the rest call
+    // listDirectory() and answer right away.
+    virtual void requestDirectory(const QString &path, const IsoTreeEntry &dir, const ListCallback &done) {
+        QVector<IsoTreeEntry> out;
+        const bool ok = listDirectory(path, dir, out);
+        done(ok, out);
+    }
+};
+
+// Tree model over a flat node table. Directory contents are pulled from the
+// source only when a view asks for them (canFetchMore/fetchMore), so the
+// cost of opening an image doesn't depend on how many files it holds.
+class IsoTreeModel : public QAbstractItemModel {
+    Q_OBJECT
+
+public:
+    enum NodeFlag {
+        Directory = 0x01,
+        Fetched   = 0x02,
+        Modified  = 0x04,
+        Added     = 0x08,
+        // The directory's listing was asked for and hasn't come back yet.
+        Listing   = 0x10,
+        // Made by addPath() under a Listing directory: whether it is in the
+        // image is settled when that listing arrives.
+        Unconfirmed = 0x20
+    };
+
+    enum Roles {
+        PathRole = Qt::UserRole + 1,
+        SizeRole,
+        ExtentRole,
+        IsDirectoryRole,
+        FlagsRole
+    };
+
+    explicit IsoTreeModel(QObject *parent = nullptr);
+
+    // Resets the model onto a new source (not owned). With no source the
+    // tree is built purely through addPath().
+    void setSource(IsoDirectorySource *source);
+    IsoDirectorySource *source() const { return src; }
+    void clear();
+
+    void setHeaderLabel(const QString &label);
+    void setIcons(const QVariant &dirIcon, const QVariant &fileIcon);
+    // Extra data (font, brush...) returned for nodes carrying the given flag.
+    void setFlagData(NodeFlag flag, int role, const QVariant &value);
+
+    QString path(const QModelIndex &index) const;
+    // Both fetch the directories along the way if needed. With a source
+    // that answers later, findPath() can't see below a directory that is
+    // still Listing yet, and addPath() marks what it makes there
+    // Unconfirmed until the listing settles it.
+    QModelIndex findPath(const QString &path);
+    QModelIndex addPath(const QString &path, bool isDirectory, quint8 flags = 0, quint64 size = 0);
+    bool removeIndex(const QModelIndex &index);
+    bool renameIndex(const QModelIndex &index, const QString &name);
+    void setNodeFlags(const QModelIndex &index, quint8 flags, bool on = true);
+    int nodeCount() const { return nodes.size(); }
+
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &child) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+private:
+    static const quint32 NoChildren = 0xffffffffu;
+
+    struct Node {
+        quint32 parent;
+        quint32 row;
+        quint32 nameId;     // interned in pathIndex
+        quint32 extent;
+        quint32 children;   // index into childLists, NoChildren for files
+        quint64 size;
+        qint64 mtime;
+        quint8 flags;
+    };
+
+    void resetTable();
+    quint32 nodeOf(const QModelIndex &index) const { return index.isValid() ? quint32(index.internalId()) : 0; }
+    QModelIndex indexOf(quint32 node) const;
+    const QString &nodeName(quint32 node) const { return pathIndex.name(nodes.at(int(node)).nameId); }
+    IsoTreeEntry nodeEntry(quint32 node) const;
+    quint32 appendNode(quint32 parent, const IsoTreeEntry &entry);
+    quint32 findChild(quint32 parent, const QString &name) const;
+    bool isAttached(quint32 node) const;
+    void fetch(quint32 node);
+    void listingArrived(quint32 node, bool ok, const QVector<IsoTreeEntry> &entries);
+    void insertListing(quint32 node, const QVector<IsoTreeEntry> &entries);
+
+    IsoDirectorySource *src = nullptr;
+    quint32 generation = 0;   // bumped on reset; late listings for an older table are dropped
+    QVector<Node> nodes;
+    QVector<QVector<quint32>> childLists;
+    IsoPathIndex pathIndex;
+    QString header;
+    QVariant dirIcon;
+    QVariant fileIcon;
+    QMap<QPair<int, int>, QVariant> flagData;
+};
+
+#endif // ISOTREEMODEL_H
@@ -0,0 +1,317 @@
+#include "isotreescanner.h"
+#include "isotrace.h"
+
+#include <QDir>
+#include <QFile>
+#include <QMutex>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#endif
+
+#if defined(Q_OS_LINUX) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 28))
+#define HAVE_STATX 1
+#endif
+
+namespace {
+
+const int QueueCapacity = 1 << 16;   // entries, a power of two
+const size_t DirentBufferSize = 64 * 1024;
+
+} // namespace
+
+bool IsoTreeScanner::Entry::isDir() const { return S_ISDIR(mode); }
+bool IsoTreeScanner::Entry::isFile() const { return S_ISREG(mode); }
+bool IsoTreeScanner::Entry::isSymLink() const { return S_ISLNK(mode); }
+
+// Bounded multi-producer queue after Dmitry Vyukov's design: every cell
+// carries a sequence number telling producers and consumers whose turn it
+// is, so neither side ever takes a lock. Cells come out in the order their
+// producers reserved them.
+class IsoTreeScanner::EntryQueue {
+public:
+    explicit EntryQueue(int capacity) : cells(size_t(capacity)), mask(quint64(capacity) - 1) {
+        for (size_t i = 0; i < cells.size(); ++i) cells[i].sequence.store(quint64(i));
+    }
+
+    bool push(Entry &entry) {
+        quint64 pos = tail.load();
+        Cell *cell;
+        for (;;) {
+            cell = &cells[size_t(pos & mask)];
+            const qint64 diff = qint64(cell->sequence.loadAcquire()) - qint64(pos);
+            if (diff == 0 && tail.testAndSetRelaxed(pos, pos + 1)) break;
+            if (diff < 0) return false;   // full
+            pos = tail.load();
+        }
+        cell->entry = std::move(entry);
+        cell->sequence.storeRelease(pos + 1);
+        return true;
+    }
+
+    bool pop(Entry &entry) {
+        quint64 pos = head.load();
+        Cell *cell;
+        for (;;) {
+            cell = &cells[size_t(pos & mask)];
+            const qint64 diff = qint64(cell->sequence.loadAcquire()) - qint64(pos + 1);
+            if (diff == 0 && head.testAndSetRelaxed(pos, pos + 1)) break;
+            if (diff < 0) return false;   // empty, or the next cell isn't written yet
+            pos = head.load();
+        }
+        entry = std::move(cell->entry);
+        cell->sequence.storeRelease(pos + mask + 1);
+        return true;
+    }
+
+private:
+    struct Cell {
+        QAtomicInteger<quint64> sequence;
+        Entry entry;
+    };
+
+    std::vector<Cell> cells;
+    const quint64 mask;
+    alignas(64) QAtomicInteger<quint64> head{0};
+    alignas(64) QAtomicInteger<quint64> tail{0};
+};
+
+// Directories waiting to be read by one worker. The owner pops from the
+// back (depth first, so it stays within one subtree), thieves take from
+// the front where the larger subtrees usually are.
+struct IsoTreeScanner::DirQueue {
+    QMutex mutex;
+    QVector<QByteArray> dirs;
+};
+
+class IsoTreeScanner::Worker : public QRunnable {
+public:
+    Worker(IsoTreeScanner *owner, int index) : owner(owner), index(index) {}
+
+    void run() override {
+        std::vector<char> buffer(DirentBufferSize);
+        int idle = 0;
+        while (!owner->cancelled.load()) {
+            QByteArray dir;
+            if (!owner->takeDirectory(index, dir)) {
+                if (owner->pendingDirs.load() == 0) break;
+                // Someone is still reading and may hand out more work.
+                if (++idle < 64) QThread::yieldCurrentThread();
+                else QThread::usleep(100);
+                continue;
+            }
+            idle = 0;
+            owner->readDirectory(index, dir, buffer.data());
+            owner->pendingDirs.deref();
+        }
+        owner->activeWorkers.deref();
+    }
+
+private:
+    IsoTreeScanner *owner;
+    int index;
+};
+
+IsoTreeScanner::IsoTreeScanner() : maxThreads(QThread::idealThreadCount()) {}
+
+IsoTreeScanner::~IsoTreeScanner() {
+    cancel();
+    qDeleteAll(dirQueues);
+}
+
+void IsoTreeScanner::setMaxThreads(int threads) {
+    maxThreads = qMax(1, threads);
+}
+
+void IsoTreeScanner::setFilter(const Filter &f) {
+    filter = f;
+}
+
+bool IsoTreeScanner::start(const QString &root) {
+    if (activeWorkers.load() > 0) return false;
+    pool.waitForDone();
+    qDeleteAll(dirQueues);
+    dirQueues.clear();
+    errorList.clear();
+    cancelled.store(0);
+    entries.reset(new EntryQueue(QueueCapacity));
+
+    const QByteArray rootPath = IsoTreeScanner::rootPath(root);
+    const int threads = qMax(1, maxThreads);
+    for (int i = 0; i < threads; ++i) dirQueues.append(new DirQueue);
+    dirQueues.first()->dirs.append(rootPath);
+    pendingDirs.store(1);
+    activeWorkers.store(threads);
+    pool.setMaxThreadCount(threads);
+    for (int i = 0; i < threads; ++i) pool.start(new Worker(this, i));
+    return true;
+}
+
+QByteArray IsoTreeScanner::rootPath(const QString &root) {
+    return QFile::encodeName(QDir::cleanPath(QDir(root).absolutePath()));
+}
+
+bool IsoTreeScanner::next(Entry &entry) {
+    if (!entries) return false;
+    for (int idle = 0;; ++idle) {
+        if (entries->pop(entry)) return true;
+        if (activeWorkers.load() == 0) {
+            // Every push happened before the last worker left.
+            if (entries->pop(entry)) return true;
+            pool.waitForDone();
+            return false;
+        }
+        if (idle < 64) QThread::yieldCurrentThread();
+        else QThread::usleep(50);
+    }
+}
+
+void IsoTreeScanner::cancel() {
+    cancelled.store(1);
+    pool.waitForDone();
+    if (entries) {
+        Entry dropped;
+        while (entries->pop(dropped)) {}
+    }
+}
+
+QStringList IsoTreeScanner::errors() const {
+    QMutexLocker lock(&errorMutex);
+    return errorList;
+}
+
+bool IsoTreeScanner::scan(const QString &root, const std::function<void(const Entry &)> &visitor) {
+    IsoTrace::Phase trace("scan", root);
+    if (!start(root)) return false;
+    Entry entry;
+    qint64 files = 0;
+    while (next(entry)) {
+        if (entry.isFile()) ++files;
+        visitor(entry);
+    }
+    trace.addFiles(files);
+    return errors().isEmpty();
+}
+
+bool IsoTreeScanner::takeDirectory(int index, QByteArray &dir) {
+    {
+        DirQueue *own = dirQueues.at(index);
+        QMutexLocker lock(&own->mutex);
+        if (!own->dirs.isEmpty()) {
+            dir = own->dirs.takeLast();
+            return true;
+        }
+    }
+    for (int i = 1; i < dirQueues.size(); ++i) {
+        DirQueue *victim = dirQueues.at((index + i) % dirQueues.size());
+        QMutexLocker lock(&victim->mutex);
+        if (!victim->dirs.isEmpty()) {
+            dir = victim->dirs.takeFirst();
+            return true;
+        }
+    }
+    return false;
+}
+
+void IsoTreeScanner::addError(const QByteArray &path) {
+    const int code = errno;
+    const QString message = QFile::decodeName(path) + ": " + QString::fromLocal8Bit(strerror(code));
+    QMutexLocker lock(&errorMutex);
+    errorList << message;
+}
+
+void IsoTreeScanner::emitEntry(int index, int dirFd, const QByteArray &dirPath, const char *name) {
+    Entry entry;
+    entry.path = dirPath.endsWith('/') ? dirPath + name : dirPath + '/' + name;
+    if (filter && filter(entry.path)) return;
+
+#ifdef HAVE_STATX
+    struct statx stx;
+    if (::statx(dirFd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME, &stx) != 0) {
+        addError(entry.path);
+        return;
+    }
+    entry.mode = stx.stx_mode;
+    entry.inode = stx.stx_ino;
+    entry.size = stx.stx_size;
+    entry.mtimeNs = qint64(stx.stx_mtime.tv_sec) * 1000000000 + stx.stx_mtime.tv_nsec;
+#else
+    struct stat st;
+    if (::fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        addError(entry.path);
+        return;
+    }
+    entry.mode = quint32(st.st_mode);
+    entry.inode = quint64(st.st_ino);
+    entry.size = quint64(st.st_size);
+#ifdef Q_OS_MACOS
+    entry.mtimeNs = qint64(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    entry.mtimeNs = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+
+    const bool isDir = entry.isDir();
+    const QByteArray subdir = isDir ? entry.path : QByteArray();
+    // The directory is queued before anything that can list its contents.
+    while (!entries->push(entry)) {
+        if (cancelled.load()) return;
+        QThread::yieldCurrentThread();
+    }
+    if (!isDir) return;
+    pendingDirs.ref();
+    DirQueue *own = dirQueues.at(index);
+    QMutexLocker lock(&own->mutex);
+    own->dirs.append(subdir);
+}
+
+void IsoTreeScanner::readDirectory(int index, const QByteArray &path, char *buffer) {
+    const int fd = ::open(path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        addError(path);
+        return;
+    }
+
+#ifdef Q_OS_LINUX
+    for (;;) {
+        const long n = ::syscall(SYS_getdents64, fd, buffer, DirentBufferSize);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) addError(path);
+        if (n <= 0) break;
+        for (long offset = 0; offset < n && !cancelled.load();) {
+            const struct dirent64 *d = reinterpret_cast<const struct dirent64 *>(buffer + offset);
+            offset += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            emitEntry(index, fd, path, name);
+        }
+    }
+    ::close(fd);
+#else
+    Q_UNUSED(buffer);
+    DIR *dir = ::fdopendir(fd);
+    if (!dir) {
+        addError(path);
+        ::close(fd);
+        return;
+    }
+    while (const struct dirent *d = ::readdir(dir)) {
+        if (cancelled.load()) break;
+        const char *name = d->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+        emitEntry(index, ::dirfd(dir), path, name);
+    }
+    ::closedir(dir);
+#endif
+}
@@ -0,0 +1,88 @@
+#ifndef ISOTREESCANNER_H
+#define ISOTREESCANNER_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QMutex>
+#include <QScopedPointer>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+#include <functional>
+
+// Walks a local directory tree with several threads, for staging or
+// copying trees with millions of files. Each worker keeps a deque of
+// directories still to read and steals from the others when it runs dry.
+// Directories are read with getdents64() and every entry is stat'ed once
+// with statx() relative to the directory's fd (readdir() and fstatat()
+// elsewhere). Nothing goes through QFileInfo.
+//
+// Entries are handed to the consumer through a bounded lock-free queue.
+// A directory always comes out before anything inside it.
+class IsoTreeScanner {
+public:
+    struct Entry {
+        QByteArray path;     // absolute, in local 8-bit encoding
+        quint64 size = 0;
+        quint64 inode = 0;
+        qint64 mtimeNs = 0;
+        quint32 mode = 0;    // st_mode
+
+        bool isDir() const;
+        bool isFile() const;
+        bool isSymLink() const;
+        qint64 mtime() const { return mtimeNs / 1000000000; }
+    };
+
+    // Return true to leave path (and everything below it) out.
+    typedef std::function<bool(const QByteArray &path)> Filter;
+
+    IsoTreeScanner();
+    ~IsoTreeScanner();
+
+    // Defaults to one thread per CPU.
+    void setMaxThreads(int threads);
+    void setFilter(const Filter &filter);
+
+    // Starts reading root in the background; the root itself isn't reported.
+    bool start(const QString &root);
+    // Blocks for the next entry; false once the walk is done and drained.
+    bool next(Entry &entry);
+    // Stops the workers early and drops anything not consumed yet.
+    void cancel();
+    // Directories that couldn't be read, once next() returned false.
+    QStringList errors() const;
+
+    // start() plus next() until done, calling visitor for every entry.
+    bool scan(const QString &root, const std::function<void(const Entry &)> &visitor);
+
+    // root as the entry paths of a walk from it begin: absolute and clean.
+    static QByteArray rootPath(const QString &root);
+
+private:
+    Q_DISABLE_COPY(IsoTreeScanner)
+
+    class EntryQueue;
+    struct DirQueue;
+    class Worker;
+    friend class Worker;
+
+    bool takeDirectory(int index, QByteArray &dir);
+    void readDirectory(int index, const QByteArray &path, char *buffer);
+    void emitEntry(int index, int dirFd, const QByteArray &dirPath, const char *name);
+    void addError(const QByteArray &path);
+
+    int maxThreads;
+    Filter filter;
+    QThreadPool pool;
+    QScopedPointer<EntryQueue> entries;
+    QVector<DirQueue *> dirQueues;
+    QAtomicInt pendingDirs;     // queued or being read
+    QAtomicInt activeWorkers;
+    QAtomicInt cancelled;
+    mutable QMutex errorMutex;
+    QStringList errorList;
+};
+
+#endif // ISOTREESCANNER_H
@@ -0,0 +1,180 @@
+#include "isotreesources.h"
+#include "iso9660reader.h"
+#include "isocatalog.h"
+#include "isostagingarea.h"
+#include "xorrisosession.h"
+
+#include <QDir>
+#include <QDateTime>
+#include <QRegularExpression>
+
+IsoTreeEntry IsoReaderSource::rootEntry() {
+    const IsoDirEntry &root = reader->rootEntry();
+    IsoTreeEntry entry;
+    entry.extent = root.extent;
+    entry.size = root.size;
+    entry.mtime = root.mtime;
+    entry.flags = IsoTreeModel::Directory;
+    return entry;
+}
+
+bool IsoReaderSource::listDirectory(const QString &, const IsoTreeEntry &dir, QVector<IsoTreeEntry> &out) {
+    IsoDirEntry isoDir;
+    isoDir.extent = dir.extent;
+    isoDir.size = dir.size;
+    isoDir.isDirectory = true;
+
+    QVector<IsoDirEntry> entries;
+    const bool cached = catalog && catalog->readDirectory(isoDir, entries);
+    if (!cached && !reader->readDirectory(isoDir, entries)) return false;
+    out.reserve(entries.size());
+    for (const IsoDirEntry &e : entries) {
+        IsoTreeEntry entry;
+        entry.name = e.name;
+        entry.size = e.contentSize();
+        entry.mtime = e.mtime;
+        entry.extent = e.extent;
+        entry.flags = e.isDirectory ? IsoTreeModel::Directory : 0;
+        out.append(entry);
+    }
+    return true;
+}
+
+IsoTreeEntry FileSystemSource::rootEntry() {
+    IsoTreeEntry entry;
+    entry.flags = IsoTreeModel::Directory;
+    return entry;
+}
+
+bool FileSystemSource::listDirectory(const QString &path, const IsoTreeEntry &, QVector<IsoTreeEntry> &out) {
+    QDir dir(filePath(path));
+    if (!dir.exists()) return false;
+    const QFileInfoList list = dir.entryInfoList(QDir::NoDotAndDotDot | QDir::AllEntries, QDir::DirsFirst | QDir::Name);
+    out.reserve(list.size());
+    for (const QFileInfo &fi : list) {
+        IsoTreeEntry entry;
+        entry.name = fi.fileName();
+        entry.size = quint64(fi.size());
+        entry.mtime = fi.lastModified().toSecsSinceEpoch();
+        entry.flags = fi.isDir() ? IsoTreeModel::Directory : 0;
+        out.append(entry);
+    }
+    return true;
+}
+
+namespace {
+
+IsoTreeEntry fileEntry(const QFileInfo &fi, const QString &name) {
+    IsoTreeEntry entry;
+    entry.name = name;
+    entry.size = fi.isDir() ? 0 : quint64(fi.size());
+    entry.mtime = fi.lastModified().toSecsSinceEpoch();
+    entry.flags = fi.isDir() ? IsoTreeModel::Directory : 0;
+    return entry;
+}
+
+} // namespace
+
+IsoTreeEntry IsoStagingSource::rootEntry() {
+    IsoTreeEntry entry;
+    entry.flags = IsoTreeModel::Directory;
+    return entry;
+}
+
+bool IsoStagingSource::listDirectory(const QString &path, const IsoTreeEntry &, QVector<IsoTreeEntry> &out) {
+    QMap<QString, IsoTreeEntry> byName;
+
+    const QString source = staging->sourcePath(path);
+    if (!source.isEmpty()) {
+        const QFileInfoList list = QDir(source).entryInfoList(QDir::NoDotAndDotDot | QDir::AllEntries);
+        for (const QFileInfo &fi : list) {
+            if (!staging->isExcluded(fi.absoluteFilePath())) byName.insert(fi.fileName(), fileEntry(fi, fi.fileName()));
+        }
+    }
+
+    // Grafts below this directory show up as (part of) their path.
+    const QMap<QString, QString> &grafts = staging->graftPoints();
+    const QString prefix = path == "/" ? "/" : path + "/";
+    for (auto it = grafts.lowerBound(prefix); it != grafts.constEnd() && it.key().startsWith(prefix); ++it) {
+        const QString rest = it.key().mid(prefix.size());
+        if (rest.isEmpty()) continue;
+        const int slash = rest.indexOf('/');
+        IsoTreeEntry entry;
+        if (slash >= 0 || it.value().isEmpty()) {
+            entry.name = rest.left(slash);
+            entry.flags = IsoTreeModel::Directory;
+            if (byName.contains(entry.name)) continue;
+        } else {
+            entry = fileEntry(QFileInfo(it.value()), rest);
+            entry.flags |= IsoTreeModel::Added;
+        }
+        byName.insert(entry.name, entry);
+    }
+
+    out.reserve(byName.size());
+    // Directories first, like FileSystemSource.
+    for (int pass = 0; pass < 2; ++pass) {
+        for (const IsoTreeEntry &entry : qAsConst(byName)) {
+            if (bool(entry.flags & IsoTreeModel::Directory) == (pass == 0)) out.append(entry);
+        }
+    }
+    return true;
+}
+
+IsoTreeEntry XorrisoSessionSource::rootEntry() {
+    IsoTreeEntry entry;
+    entry.flags = IsoTreeModel::Directory;
+    return entry;
+}
+
+bool XorrisoSessionSource::parseLslLine(const QString &line, IsoTreeEntry &entry) {
+    // drwxr-xr-x    2 0        0               0 Oct 16 10:00 'name'
+    static const QRegularExpression lsl("^([-dlbcps])\\S{9}\\s+\\d+\\s+\\S+\\s+\\S+\\s+(\\d+)\\s+"
+                                        "\\S+\\s+\\d+\\s+\\S+\\s+(.+)$");
+    QRegularExpressionMatch m = lsl.match(line);
+    if (!m.hasMatch()) return false;
+
+    QString name = m.captured(3);
+    if (m.captured(1) == "l") {
+        const int arrow = name.indexOf(" -> ");
+        if (arrow > 0) name.truncate(arrow);
+    }
+    if (name.size() >= 2 && name.startsWith('\'') && name.endsWith('\'')) name = name.mid(1, name.size() - 2);
+    name.replace("'\"'\"'", "'");
+    name = name.section('/', -1);
+    if (name.isEmpty()) return false;
+
+    entry = IsoTreeEntry();
+    entry.name = name;
+    entry.size = m.captured(2).toULongLong();
+    entry.flags = m.captured(1) == "d" ? IsoTreeModel::Directory : 0;
+    return true;
+}
+
+QVector<IsoTreeEntry> XorrisoSessionSource::parseLsl(const QStringList &lines) {
+    QVector<IsoTreeEntry> entries;
+    entries.reserve(lines.size());
+    for (const QString &line : lines) {
+        IsoTreeEntry entry;
+        if (parseLslLine(line, entry)) entries.append(entry);
+    }
+    return entries;
+}
+
+bool XorrisoSessionSource::listDirectory(const QString &path, const IsoTreeEntry &, QVector<IsoTreeEntry> &out) {
+    if (!session->isRunning()) return false;
+    const XorrisoSession::Reply reply = session->execute({"-lsl", path});
+    if (!reply.ok) return false;
+    out = parseLsl(reply.result);
+    return true;
+}
+
+void XorrisoSessionSource::requestDirectory(const QString &path, const IsoTreeEntry &, const ListCallback &done) {
+    if (!session->isRunning()) {
+        done(false, QVector<IsoTreeEntry>());
+        return;
+    }
+    session->listDirectory(path, [done](const XorrisoSession::Reply &reply) {
+        done(reply.ok, reply.ok ? parseLsl(reply.result) : QVector<IsoTreeEntry>());
+    });
+}
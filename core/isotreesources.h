@@ -0,0 +1,73 @@
+#ifndef ISOTREESOURCES_H
+#define ISOTREESOURCES_H
+
+#include "isotreemodel.h"
+
+class Iso9660Reader;
+class IsoCatalog;
+class IsoStagingArea;
+class XorrisoSession;
+
+// Lists directories straight from an image through Iso9660Reader, or from
+// a loaded IsoCatalog of the same image when one is given.
+class IsoReaderSource : public IsoDirectorySource {
+public:
+    explicit IsoReaderSource(Iso9660Reader *reader, IsoCatalog *catalog = nullptr) : reader(reader), catalog(catalog) {}
+
+    IsoTreeEntry rootEntry() override;
+    bool listDirectory(const QString &path, const IsoTreeEntry &dir, QVector<IsoTreeEntry> &out) override;
+
+private:
+    Iso9660Reader *reader;
+    IsoCatalog *catalog;
+};
+
+// Lists a local directory tree (a mount point, an extraction dir...).
+class FileSystemSource : public IsoDirectorySource {
+public:
+    explicit FileSystemSource(const QString &rootPath) : root(rootPath) {}
+
+    QString rootPath() const { return root; }
+    QString filePath(const QString &isoPath) const { return root + isoPath; }
+
+    IsoTreeEntry rootEntry() override;
+    bool listDirectory(const QString &path, const IsoTreeEntry &dir, QVector<IsoTreeEntry> &out) override;
+
+private:
+    QString root;
+};
+
+// Lists what an IsoStagingArea would put into the image: grafted
+// directories are read from disk, excluded sources are left out and
+// grafts (or the directories leading to them) are overlaid on top.
+class IsoStagingSource : public IsoDirectorySource {
+public:
+    explicit IsoStagingSource(IsoStagingArea *staging) : staging(staging) {}
+
+    IsoTreeEntry rootEntry() override;
+    bool listDirectory(const QString &path, const IsoTreeEntry &dir, QVector<IsoTreeEntry> &out) override;
+
+private:
+    IsoStagingArea *staging;
+};
+
+// Lists directories with "-lsl" through a running XorrisoSession, for
+// images the native reader can't handle. The model gets its listings from
+// the session's reply; listDirectory() waits for it instead.
+class XorrisoSessionSource : public IsoDirectorySource {
+public:
+    explicit XorrisoSessionSource(XorrisoSession *session) : session(session) {}
+
+    IsoTreeEntry rootEntry() override;
+    bool listDirectory(const QString &path, const IsoTreeEntry &dir, QVector<IsoTreeEntry> &out) override;
+    void requestDirectory(const QString &path, const IsoTreeEntry &dir, const ListCallback &done) override;
+
+    static bool parseLslLine(const QString &line, IsoTreeEntry &entry);
+
+private:
+    static QVector<IsoTreeEntry> parseLsl(const QStringList &lines);
+
+    XorrisoSession *session;
+};
+
+#endif // ISOTREESOURCES_H
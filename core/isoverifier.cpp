@@ -0,0 +1,550 @@
+#include "isoverifier.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QThread>
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+namespace {
+
+// Big enough that the read stays sequential at full speed, small enough
+// that the ring doesn't hold much memory.
+const qint64 ChunkSize = 4 << 20;
+const int RingSize = 16;
+const size_t BufferAlign = 4096;
+const qint64 LeftoverBuffer = 1 << 20;
+
+QString errnoString() {
+    return QString::fromLocal8Bit(strerror(errno));
+}
+
+char *allocate(qint64 size) {
+    void *p = nullptr;
+    return ::posix_memalign(&p, BufferAlign, size_t(size)) == 0 ? static_cast<char *>(p) : nullptr;
+}
+
+qint64 readFully(int fd, char *buf, qint64 len, qint64 offset) {
+    qint64 done = 0;
+    while (done < len) {
+        const ssize_t n = ::pread(fd, buf + done, size_t(len - done), off_t(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+// A libisofs checksum tag: "<name> pos=N range_start=N range_size=N
+// [next=N] md5=HEX self=HEX", alone in its block.
+bool parseTag(const char *block, quint32 lba, IsoVerifier::Tag &tag) {
+    static const char Prefix[] = "libisofs_";
+    if (memcmp(block, Prefix, sizeof(Prefix) - 1) != 0) return false;
+    const char *end = static_cast<const char *>(memchr(block, '\n', Iso9660Reader::SectorSize));
+    if (!end) return false;
+    const QList<QByteArray> fields = QByteArray(block, int(end - block)).split(' ');
+    if (!fields.first().endsWith("checksum_tag_v1")) return false;
+    tag = IsoVerifier::Tag();
+    tag.name = fields.first();
+    quint32 rangeSize = 0;
+    bool hasPos = false, hasMd5 = false;
+    for (const QByteArray &field : fields) {
+        const int eq = field.indexOf('=');
+        if (eq < 0) continue;
+        const QByteArray key = field.left(eq), value = field.mid(eq + 1);
+        if (key == "pos") tag.pos = value.toUInt(&hasPos);
+        else if (key == "range_start") tag.rangeStart = value.toUInt();
+        else if (key == "range_size") rangeSize = value.toUInt();
+        else if (key == "md5") {
+            tag.md5 = value.toLower();
+            hasMd5 = value.size() == 32;
+        }
+    }
+    // Anything else that happens to start a block with the text is file data.
+    return hasPos && hasMd5 && tag.pos == lba && tag.rangeStart + rangeSize == tag.pos;
+}
+
+// sha256sum escapes names holding a backslash or a newline and marks the
+// line with a leading backslash.
+QByteArray manifestLine(const QByteArray &sha256, const QString &name) {
+    QByteArray encoded = QFile::encodeName(name);
+    const bool escape = encoded.contains('\\') || encoded.contains('\n');
+    if (escape) encoded.replace('\\', "\\\\").replace('\n', "\\n");
+    return (escape ? "\\" : "") + sha256 + "  " + encoded + '\n';
+}
+
+bool readManifest(const QString &path, QHash<QString, QByteArray> &out, QString *error) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (error) *error = path + ": " + file.errorString();
+        return false;
+    }
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine();
+        if (line.endsWith('\n')) line.chop(1);
+        const bool escaped = line.startsWith('\\');
+        if (escaped) line.remove(0, 1);
+        if (line.size() < 66 || line.at(64) != ' ') continue;
+        QByteArray name = line.mid(66);
+        if (escaped) {
+            QByteArray plain;
+            for (int i = 0; i < name.size(); ++i) {
+                if (name.at(i) == '\\' && i + 1 < name.size()) {
+                    plain += name.at(i + 1) == 'n' ? '\n' : name.at(i + 1);
+                    ++i;
+                } else {
+                    plain += name.at(i);
+                }
+            }
+            name = plain;
+        }
+        out.insert(QFile::decodeName(name), line.left(64).toLower());
+    }
+    return true;
+}
+
+} // namespace
+
+// Reads the image front to back into the ring.
+class IsoVerifier::Reader : public QRunnable {
+public:
+    explicit Reader(IsoVerifier *owner) : owner(owner) {}
+
+    void run() override {
+        const int consumers = owner->filled.size();
+        qint64 at = 0;
+        for (int n = 0;; ++n) {
+            owner->freeChunks.acquire();
+            Chunk &chunk = owner->ring[n % owner->ring.size()];
+            chunk.offset = at;
+            chunk.length = 0;
+            if (!owner->cancelled.load()) {
+                chunk.length = readFully(owner->fd, chunk.data, ChunkSize, at);
+                if (chunk.length < 0) {
+                    owner->addError(owner->vfs.imagePath() + ": " + errnoString());
+                    chunk.length = 0;
+                }
+            }
+            chunk.readers.store(consumers);
+            for (QSemaphore *s : qAsConst(owner->filled)) s->release();
+            if (chunk.length == 0) break;
+            at += chunk.length;
+            owner->bytesDone.store(at);
+        }
+        owner->workerDone();
+    }
+
+private:
+    IsoVerifier *owner;
+};
+
+// Consumes every chunk: the image SHA-256 (lane -2), the MD5 tags (lane -1)
+// or the files assigned to one file lane (0 and up), which then help with
+// the leftovers.
+class IsoVerifier::Lane : public QRunnable {
+public:
+    Lane(IsoVerifier *owner, int lane, QSemaphore *filled) : owner(owner), lane(lane), filled(filled) {}
+
+    void run() override {
+        for (int n = 0;; ++n) {
+            filled->acquire();
+            Chunk &chunk = owner->ring[n % owner->ring.size()];
+            const bool end = chunk.length == 0;
+            if (!end) consume(chunk);
+            owner->release(chunk);
+            if (end) break;
+        }
+        if (lane == -2) owner->last.imageSha256 = imageHash.result().toHex();
+        else if (lane == -1) finishTags();
+        else finishFiles();
+        owner->workerDone();
+    }
+
+private:
+    void consume(const Chunk &chunk) {
+        if (lane == -2) imageHash.addData(chunk.data, int(chunk.length));
+        else if (lane == -1) scanTags(chunk);
+        else hashFiles(chunk);
+    }
+
+    // The MD5 runs from the start of the image; a tag covering a range
+    // that starts elsewhere (a later session) is checked after the pass.
+    void scanTags(const Chunk &chunk) {
+        const int sector = Iso9660Reader::SectorSize;
+        qint64 pending = 0;
+        for (qint64 at = 0; at + sector <= chunk.length; at += sector) {
+            Tag tag;
+            if (!parseTag(chunk.data + at, quint32((chunk.offset + at) / sector), tag)) continue;
+            md5.addData(chunk.data + pending, int(at - pending));
+            pending = at;
+            if (tag.rangeStart == 0) {
+                tag.checked = true;
+                tag.ok = md5.result().toHex() == tag.md5;
+            }
+            owner->last.tags.append(tag);
+        }
+        md5.addData(chunk.data + pending, int(chunk.length - pending));
+    }
+
+    void finishTags() {
+        for (Tag &tag : owner->last.tags) {
+            if (!tag.checked && !owner->cancelled.load()) owner->checkTag(tag);
+            if (tag.checked && !tag.ok)
+                owner->addError(QString("%1 at sector %2: MD5 mismatch").arg(QString::fromLatin1(tag.name)).arg(tag.pos));
+        }
+    }
+
+    void hashFiles(const Chunk &chunk) {
+        const QVector<Span> &spans = owner->laneSpans.at(lane);
+        const qint64 chunkEnd = chunk.offset + chunk.length;
+        while (cursor < spans.size()) {
+            const Span &span = spans.at(cursor);
+            const qint64 from = span.start + spanDone;
+            if (from >= chunkEnd) break;
+            const qint64 n = qMin(span.start + span.length, chunkEnd) - from;
+            QCryptographicHash *&hash = active[span.group];
+            if (!hash) hash = new QCryptographicHash(QCryptographicHash::Sha256);
+            hash->addData(chunk.data + (from - chunk.offset), int(n));
+            spanDone += n;
+            if (spanDone < span.length) break;
+            ++cursor;
+            spanDone = 0;
+            Group &group = owner->groups[span.group];
+            if ((done[span.group] += quint64(span.length)) == group.stored) {
+                group.sha256 = hash->result().toHex();
+                delete hash;
+                active.remove(span.group);
+            }
+        }
+    }
+
+    void finishFiles() {
+        for (auto it = active.constBegin(); it != active.constEnd(); ++it) {
+            if (!owner->cancelled.load())
+                owner->addError(owner->last.files.at(owner->groups.at(it.key()).files.first()).path
+                                + ": data past the end of the image");
+            delete it.value();
+        }
+        active.clear();
+        char *buffer = allocate(LeftoverBuffer);
+        for (;;) {
+            const int i = owner->nextLeftover.fetchAndAddRelaxed(1);
+            if (i >= owner->leftovers.size() || owner->cancelled.load()) break;
+            Group &group = owner->groups[owner->leftovers.at(i)];
+            if (!buffer || !owner->hashLeftover(group, buffer))
+                owner->addError(owner->last.files.at(group.files.first()).path + ": read error");
+        }
+        ::free(buffer);
+    }
+
+    IsoVerifier *owner;
+    int lane;
+    QSemaphore *filled;
+    QCryptographicHash imageHash{QCryptographicHash::Sha256};
+    QCryptographicHash md5{QCryptographicHash::Md5};
+    int cursor = 0;
+    qint64 spanDone = 0;
+    QHash<int, QCryptographicHash *> active;
+    QHash<int, quint64> done;
+};
+
+IsoVerifier::IsoVerifier(QObject *parent) : QObject(parent) {
+    fileLanes = qMax(1, QThread::idealThreadCount() - 2);
+    progressTimer.setInterval(250);
+    connect(&progressTimer, &QTimer::timeout, this, &IsoVerifier::reportProgress);
+}
+
+IsoVerifier::~IsoVerifier() {
+    cancel();
+    pool.waitForDone();
+    qDeleteAll(filled);
+    for (Chunk &chunk : ring) ::free(chunk.data);
+    if (fd >= 0) ::close(fd);
+}
+
+void IsoVerifier::setMaxThreads(int threads) {
+    fileLanes = qMax(1, threads);
+}
+
+void IsoVerifier::cancel() {
+    cancelled.store(1);
+}
+
+void IsoVerifier::addError(const QString &error) {
+    QMutexLocker lock(&errorMutex);
+    last.errors << error;
+}
+
+bool IsoVerifier::prepare(const QString &image) {
+    trace.reset(new IsoTrace::Phase("verify", image));
+    last = Result();
+    groups.clear();
+    leftovers.clear();
+    laneSpans = QVector<QVector<Span>>(fileLanes);
+    if (!vfs.open(image)) {
+        last.errors << image + ": " + vfs.errorString();
+        return false;
+    }
+    fd = ::open(QFile::encodeName(image).constData(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+        last.errors << image + ": " + errnoString();
+        return false;
+    }
+    imageSize = st.st_size;
+#ifdef POSIX_FADV_SEQUENTIAL
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    // Files sharing their data (hard links, deduplicated copies) are
+    // hashed once.
+    QHash<QPair<quint32, quint64>, int> byData;
+    vfs.reader()->walk([this, &byData](const QString &parent, const IsoDirEntry &entry) {
+        if (entry.isDirectory) return true;
+        FileSum sum;
+        sum.path = (parent == "/" ? QString() : parent.mid(1) + '/') + entry.name;
+        last.files.append(sum);
+        const auto key = qMakePair(entry.size ? entry.extent : 0u, entry.size | (quint64(entry.zisofsBlockLog2) << 56));
+        auto it = byData.constFind(key);
+        if (it == byData.constEnd()) {
+            Group group;
+            group.file = IsoVfs::fileFor(entry);
+            for (const IsoExtent &extent : group.file.extents) group.stored += extent.length;
+            if (group.stored == 0) group.sha256 = QCryptographicHash::hash(QByteArray(), QCryptographicHash::Sha256).toHex();
+            it = byData.insert(key, groups.size());
+            groups.append(group);
+        }
+        groups[it.value()].files.append(last.files.size() - 1);
+        return true;
+    });
+
+    // Streamable: uncompressed, extents in disk order, and no byte of it
+    // claimed by another group.
+    QVector<Span> all;
+    for (int g = 0; g < groups.size(); ++g) {
+        Group &group = groups[g];
+        if (group.stored == 0) continue;
+        group.streamed = !group.file.zisofsBlockLog2;
+        qint64 previousEnd = 0;
+        for (const IsoExtent &extent : group.file.extents) {
+            const qint64 start = qint64(extent.lba) * Iso9660Reader::SectorSize;
+            if (start < previousEnd) group.streamed = false;
+            previousEnd = start + extent.length;
+        }
+        if (group.streamed) {
+            for (const IsoExtent &extent : group.file.extents)
+                if (extent.length) all.append({qint64(extent.lba) * Iso9660Reader::SectorSize, qint64(extent.length), g});
+        } else {
+            leftovers.append(g);
+        }
+    }
+    std::sort(all.begin(), all.end(), [](const Span &a, const Span &b) { return a.start < b.start; });
+    qint64 reached = 0;
+    for (const Span &span : qAsConst(all)) {
+        if (span.start < reached && groups.at(span.group).streamed) {
+            groups[span.group].streamed = false;
+            leftovers.append(span.group);
+        }
+        reached = qMax(reached, span.start + span.length);
+    }
+
+    // Biggest groups first onto the least loaded lane.
+    QVector<int> order;
+    for (int g = 0; g < groups.size(); ++g)
+        if (groups.at(g).streamed) order.append(g);
+    std::sort(order.begin(), order.end(), [this](int a, int b) { return groups.at(a).stored > groups.at(b).stored; });
+    QVector<quint64> load(fileLanes, 0);
+    QVector<int> laneOf(groups.size(), -1);
+    for (int g : qAsConst(order)) {
+        const int lane = int(std::min_element(load.begin(), load.end()) - load.begin());
+        load[lane] += groups.at(g).stored;
+        laneOf[g] = lane;
+    }
+    for (const Span &span : qAsConst(all))
+        if (groups.at(span.group).streamed) laneSpans[laneOf.at(span.group)].append(span);
+
+    if (ring.isEmpty()) {
+        ring.resize(RingSize);
+        for (Chunk &chunk : ring) {
+            chunk.data = allocate(ChunkSize);
+            if (!chunk.data) {
+                for (Chunk &c : ring) ::free(c.data);
+                ring.clear();
+                last.errors << "Out of memory";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void IsoVerifier::launch() {
+    qDeleteAll(filled);
+    filled.clear();
+    for (int i = 0; i < 2 + fileLanes; ++i) filled.append(new QSemaphore);
+    freeChunks.acquire(freeChunks.available());
+    freeChunks.release(ring.size());
+    nextLeftover.store(0);
+    cancelled.store(0);
+    bytesDone.store(0);
+    running = true;
+    clock.start();
+
+    pool.setMaxThreadCount(3 + fileLanes);
+    activeWorkers.store(3 + fileLanes);
+    pool.start(new Lane(this, -2, filled.at(0)));
+    pool.start(new Lane(this, -1, filled.at(1)));
+    for (int i = 0; i < fileLanes; ++i) pool.start(new Lane(this, i, filled.at(2 + i)));
+    pool.start(new Reader(this));
+}
+
+bool IsoVerifier::start(const QString &image) {
+    if (running) return false;
+    blocking = false;
+    if (!prepare(image)) {
+        finish();
+        return false;
+    }
+    launch();
+    progressTimer.start();
+    return true;
+}
+
+bool IsoVerifier::run(const QString &image) {
+    if (running) return false;
+    blocking = true;
+    if (prepare(image)) {
+        launch();
+        pool.waitForDone();
+    }
+    finish();
+    return last.ok();
+}
+
+void IsoVerifier::release(Chunk &chunk) {
+    if (!chunk.readers.deref()) freeChunks.release();
+}
+
+bool IsoVerifier::hashLeftover(Group &group, char *buffer) {
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    for (qint64 at = 0; at < qint64(group.file.size);) {
+        const qint64 n = vfs.read(group.file, at, buffer, qMin<qint64>(LeftoverBuffer, qint64(group.file.size) - at));
+        if (n <= 0) return false;
+        hash.addData(buffer, int(n));
+        at += n;
+        // Reads through the mapping don't show up in the I/O counters.
+        if (vfs.isMapped() && !group.file.zisofsBlockLog2) trace->addBytesRead(n);
+    }
+    group.sha256 = hash.result().toHex();
+    return true;
+}
+
+void IsoVerifier::checkTag(Tag &tag) {
+    QCryptographicHash md5(QCryptographicHash::Md5);
+    QByteArray buffer(int(ChunkSize), Qt::Uninitialized);
+    const qint64 end = qint64(tag.pos) * Iso9660Reader::SectorSize;
+    for (qint64 at = qint64(tag.rangeStart) * Iso9660Reader::SectorSize; at < end;) {
+        const qint64 n = readFully(fd, buffer.data(), qMin(ChunkSize, end - at), at);
+        if (n <= 0) return;
+        md5.addData(buffer.constData(), int(n));
+        at += n;
+    }
+    tag.checked = true;
+    tag.ok = md5.result().toHex() == tag.md5;
+}
+
+void IsoVerifier::workerDone() {
+    IsoVerifier *o = this;
+    if (!activeWorkers.deref() && !blocking)
+        QMetaObject::invokeMethod(o, [o]() { o->finish(); }, Qt::QueuedConnection);
+}
+
+void IsoVerifier::finish() {
+    progressTimer.stop();
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    last.bytes = bytesDone.load();
+    last.seconds = running ? clock.nsecsElapsed() / 1e9 : 0;
+    last.cancelled = cancelled.load();
+    if (running) reportProgress();
+
+    for (const Group &group : qAsConst(groups))
+        for (int f : group.files) last.files[f].sha256 = group.sha256;
+    std::sort(last.files.begin(), last.files.end(),
+              [](const FileSum &a, const FileSum &b) { return a.path < b.path; });
+    groups.clear();
+    laneSpans.clear();
+    leftovers.clear();
+    vfs.close();
+    if (trace) trace->addFiles(last.files.size());
+    trace.reset();
+
+    const bool wasRunning = running;
+    running = false;
+    if (wasRunning && !blocking) emit finished(last.ok());
+}
+
+void IsoVerifier::reportProgress() {
+    const double seconds = clock.elapsed() / 1000.0;
+    const qint64 done = bytesDone.load();
+    emit progress(done, imageSize, seconds > 0 ? done / seconds : -1);
+}
+
+bool IsoVerifier::writeManifests(const QString &image, const Result &result, QString *error) {
+    QByteArray files;
+    for (const FileSum &sum : result.files) files += manifestLine(sum.sha256, sum.path);
+    const QPair<QString, QByteArray> manifests[] = {
+        qMakePair(manifestPath(image), manifestLine(result.imageSha256, QFileInfo(image).fileName())),
+        qMakePair(fileManifestPath(image), files),
+    };
+    for (const auto &manifest : manifests) {
+        QSaveFile file(manifest.first);
+        if (!file.open(QIODevice::WriteOnly) || file.write(manifest.second) < 0 || !file.commit()) {
+            if (error) *error = manifest.first + ": " + file.errorString();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IsoVerifier::createManifests(const QString &image, QString *error) {
+    IsoVerifier verifier;
+    if (!verifier.run(image)) {
+        if (error) *error = verifier.result().errors.value(0);
+        return false;
+    }
+    return writeManifests(image, verifier.result(), error);
+}
+
+QStringList IsoVerifier::compareWithManifests(const QString &image, const Result &result, QString *error) {
+    QStringList problems;
+    QHash<QString, QByteArray> imageSums, fileSums;
+    if (!readManifest(manifestPath(image), imageSums, error) || !readManifest(fileManifestPath(image), fileSums, error))
+        return problems;
+
+    const QByteArray expected = imageSums.value(QFileInfo(image).fileName());
+    if (expected.isEmpty()) problems << QFileInfo(image).fileName() + ": not in " + manifestPath(image);
+    else if (expected != result.imageSha256) problems << QFileInfo(image).fileName() + ": image checksum mismatch";
+    for (const FileSum &sum : result.files) {
+        auto it = fileSums.find(sum.path);
+        if (it == fileSums.end()) {
+            problems << sum.path + ": not in the manifest";
+            continue;
+        }
+        if (it.value() != sum.sha256) problems << sum.path + ": checksum mismatch";
+        fileSums.erase(it);
+    }
+    for (auto it = fileSums.constBegin(); it != fileSums.constEnd(); ++it) problems << it.key() + ": missing from the image";
+    return problems;
+}
@@ -0,0 +1,149 @@
+#ifndef ISOVERIFIER_H
+#define ISOVERIFIER_H
+
+#include <QObject>
+#include <QVector>
+#include <QStringList>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QScopedPointer>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QTimer>
+
+#include "isotrace.h"
+#include "isovfs.h"
+
+// Checks an image in one sequential pass: it is read front to back in large
+// chunks and every chunk is handed to hashing lanes on worker threads, one
+// for the image's SHA-256, one for the MD5 session tags libisofs and xorriso
+// write (-md5 on), and several for the SHA-256 of the files in it, so the
+// read never waits on a single hash. Files whose data can't be streamed in
+// disk order (zisofs, shared or interleaved extents) are hashed afterwards.
+//
+// The results go into two sha256sum manifests next to the image: one for
+// the image itself and one for its files, relative to the image root, for
+// sha256sum -c in a mount.
+class IsoVerifier : public QObject {
+    Q_OBJECT
+
+public:
+    struct Tag {
+        QByteArray name;       // libisofs_checksum_tag_v1, ..._sb_..., ...
+        quint32 pos = 0;
+        quint32 rangeStart = 0;
+        QByteArray md5;        // recorded, hex
+        bool checked = false;
+        bool ok = false;
+    };
+
+    struct FileSum {
+        QString path;          // relative to the image root
+        QByteArray sha256;     // hex
+    };
+
+    struct Result {
+        QByteArray imageSha256;
+        QVector<FileSum> files;     // in path order
+        QVector<Tag> tags;
+        QStringList errors;         // read errors and tag mismatches
+        qint64 bytes = 0;
+        double seconds = 0;
+        bool cancelled = false;
+        bool ok() const { return !cancelled && errors.isEmpty(); }
+    };
+
+    explicit IsoVerifier(QObject *parent = nullptr);
+    ~IsoVerifier() override;
+
+    // Threads hashing file contents; the reader and the two image lanes
+    // come on top.
+    void setMaxThreads(int threads);
+
+    // Hashes image in the background; finished() tells when result() is set.
+    bool start(const QString &image);
+    // The same, blocking, for callers without an event loop.
+    bool run(const QString &image);
+    bool isRunning() const { return running; }
+    const Result &result() const { return last; }
+
+    static QString manifestPath(const QString &image) { return image + ".sha256"; }
+    static QString fileManifestPath(const QString &image) { return image + ".files.sha256"; }
+    static bool writeManifests(const QString &image, const Result &result, QString *error = nullptr);
+    // run() and writeManifests() in one, for a freshly built image.
+    static bool createManifests(const QString &image, QString *error = nullptr);
+    // What differs between result and the manifests written for image.
+    static QStringList compareWithManifests(const QString &image, const Result &result, QString *error = nullptr);
+
+public slots:
+    void cancel();
+
+signals:
+    void progress(qint64 bytesDone, qint64 bytesTotal, double bytesPerSecond);
+    void finished(bool ok);
+
+private:
+    // A file's data (or several files sharing it) and where it lies.
+    struct Group {
+        IsoVfs::File file;
+        QVector<int> files;           // into last.files
+        quint64 stored = 0;
+        bool streamed = false;
+        QByteArray sha256;
+    };
+
+    struct Span {
+        qint64 start;
+        qint64 length;
+        int group;
+    };
+
+    struct Chunk {
+        char *data = nullptr;
+        qint64 offset = 0;
+        qint64 length = 0;         // 0 ends the stream
+        QAtomicInt readers;
+    };
+
+    class Reader;
+    class Lane;
+    friend class Reader;
+    friend class Lane;
+
+    bool prepare(const QString &image);
+    void launch();
+    void release(Chunk &chunk);
+    void addError(const QString &error);
+    bool hashLeftover(Group &group, char *buffer);
+    void checkTag(Tag &tag);
+    void workerDone();
+    void finish();
+    void reportProgress();
+
+    IsoVfs vfs;
+    int fd = -1;
+    qint64 imageSize = 0;
+    QVector<Group> groups;
+    QVector<QVector<Span>> laneSpans;
+    QVector<int> leftovers;        // groups hashed after the pass
+    QVector<Chunk> ring;
+    QSemaphore freeChunks;
+    QVector<QSemaphore *> filled;  // one per consumer
+
+    Result last;
+    QThreadPool pool;
+    int fileLanes = 1;
+    QTimer progressTimer;
+    QElapsedTimer clock;
+    QAtomicInt nextLeftover;
+    QAtomicInt activeWorkers;
+    QAtomicInt cancelled;
+    QAtomicInteger<qint64> bytesDone;
+    QMutex errorMutex;
+    QScopedPointer<IsoTrace::Phase> trace;
+    bool running = false;
+    bool blocking = false;
+};
+
+#endif // ISOVERIFIER_H
@@ -0,0 +1,168 @@
+#include "isovfs.h"
+
+#include <QDir>
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+IsoVfs::IsoVfs() {}
+
+IsoVfs::~IsoVfs() {
+    close();
+}
+
+bool IsoVfs::open(const QString &imagePath) {
+    close();
+    if (!image.open(imagePath)) {
+        error = image.errorString();
+        return false;
+    }
+    error.clear();
+
+    struct stat st;
+    if (::fstat(image.handle(), &st) == 0 && st.st_size > 0 && quint64(st.st_size) <= quint64(SIZE_MAX)) {
+        void *p = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, image.handle(), 0);
+        if (p != MAP_FAILED) {
+            map = static_cast<const char *>(p);
+            mapSize = qint64(st.st_size);
+        }
+    }
+    return true;
+}
+
+void IsoVfs::close() {
+    if (map) ::munmap(const_cast<char *>(map), size_t(mapSize));
+    map = nullptr;
+    mapSize = 0;
+    QMutexLocker lock(&lookupMutex);
+    dirCache.clear();
+    image.close();
+}
+
+IsoVfs::File IsoVfs::fileFor(const IsoDirEntry &entry) {
+    File file;
+    if (entry.isDirectory) return file;
+    file.extents = entry.extents;
+    if (file.extents.isEmpty()) file.extents.append({entry.extent, quint32(entry.size)});
+    file.size = entry.contentSize();
+    file.zisofsBlockLog2 = entry.zisofsBlockLog2;
+    file.mtime = entry.mtime;
+    file.valid = true;
+    return file;
+}
+
+bool IsoVfs::listLocked(const QString &dirPath, QVector<IsoDirEntry> *&out) {
+    auto it = dirCache.find(dirPath);
+    if (it == dirCache.end()) {
+        IsoDirEntry dir;
+        if (!statLocked(dirPath, dir) || !dir.isDirectory) return false;
+        QVector<IsoDirEntry> entries;
+        if (!image.readDirectory(dir, entries)) return false;
+        it = dirCache.insert(dirPath, entries);
+    }
+    out = &it.value();
+    return true;
+}
+
+bool IsoVfs::statLocked(const QString &path, IsoDirEntry &out) {
+    if (path == "/") {
+        out = image.rootEntry();
+        return true;
+    }
+    const int slash = path.lastIndexOf('/');
+    const QString parent = slash == 0 ? QStringLiteral("/") : path.left(slash);
+    const QString name = path.mid(slash + 1);
+    QVector<IsoDirEntry> *siblings;
+    if (!listLocked(parent, siblings)) return false;
+    for (const IsoDirEntry &entry : qAsConst(*siblings)) {
+        if (entry.name == name) {
+            out = entry;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool IsoVfs::stat(const QString &path, IsoDirEntry &out) {
+    if (!isOpen()) return false;
+    QMutexLocker lock(&lookupMutex);
+    return statLocked(QDir::cleanPath("/" + path), out);
+}
+
+bool IsoVfs::readdir(const QString &path, QVector<IsoDirEntry> &out) {
+    if (!isOpen()) return false;
+    QMutexLocker lock(&lookupMutex);
+    QVector<IsoDirEntry> *entries;
+    if (!listLocked(QDir::cleanPath("/" + path), entries)) return false;
+    out = *entries;
+    return true;
+}
+
+IsoVfs::File IsoVfs::openFile(const QString &path) {
+    IsoDirEntry entry;
+    return stat(path, entry) ? fileFor(entry) : File();
+}
+
+qint64 IsoVfs::read(const File &file, qint64 offset, char *buf, qint64 len) const {
+    if (!file.valid || offset < 0 || len < 0) return -1;
+    if (file.zisofsBlockLog2) {
+        return zisofs.read(file.extents.first().lba, file.size, file.zisofsBlockLog2,
+                           [this, &file](qint64 at, char *to, qint64 n) { return readStored(file, at, to, n); },
+                           offset, buf, len);
+    }
+    return readStored(file, offset, buf, len);
+}
+
+// Bytes as they are in the image, through the extents.
+qint64 IsoVfs::readStored(const File &file, qint64 offset, char *buf, qint64 len) const {
+    quint64 stored = 0;
+    for (const IsoExtent &extent : file.extents) stored += extent.length;
+    if (quint64(offset) >= stored) return 0;
+    len = qMin(len, qint64(stored) - offset);
+
+    qint64 done = 0;
+    qint64 extentStart = 0;
+    for (const IsoExtent &extent : file.extents) {
+        const qint64 extentEnd = extentStart + extent.length;
+        if (offset + done < extentEnd && done < len) {
+            const qint64 within = offset + done - extentStart;
+            const qint64 n = qMin(len - done, extentEnd - (offset + done));
+            const qint64 pos = qint64(extent.lba) * Iso9660Reader::SectorSize + within;
+            if (map && pos + n <= mapSize) {
+                memcpy(buf + done, map + pos, size_t(n));
+            } else if (image.readAt(pos, buf + done, n) != n) {
+                return -1;
+            }
+            done += n;
+        }
+        extentStart = extentEnd;
+    }
+    return done;
+}
+
+QVector<IsoVfs::Span> IsoVfs::spans(const File &file, qint64 offset, qint64 len) const {
+    QVector<Span> out;
+    if (!map || !file.valid || file.zisofsBlockLog2 || offset < 0 || len <= 0 || quint64(offset) >= file.size) return out;
+    len = qMin(len, qint64(file.size) - offset);
+
+    qint64 done = 0;
+    qint64 extentStart = 0;
+    for (const IsoExtent &extent : file.extents) {
+        const qint64 extentEnd = extentStart + extent.length;
+        if (offset + done < extentEnd && done < len) {
+            const qint64 within = offset + done - extentStart;
+            const qint64 n = qMin(len - done, extentEnd - (offset + done));
+            const qint64 pos = qint64(extent.lba) * Iso9660Reader::SectorSize + within;
+            if (pos + n > mapSize) return QVector<Span>();   // truncated image
+            Span span;
+            span.data = map + pos;
+            span.size = n;
+            out.append(span);
+            done += n;
+        }
+        extentStart = extentEnd;
+    }
+    return out;
+}
@@ -0,0 +1,80 @@
+#ifndef ISOVFS_H
+#define ISOVFS_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+#include "iso9660reader.h"
+#include "isozisofs.h"
+
+// Read-only access to the files inside an image without mounting it. The
+// image is mapped into memory; paths resolve through the reader's best
+// naming (Rock Ridge > Joliet > ISO9660) with directory listings cached, and
+// file data can be read either as copies or as spans pointing straight into
+// the mapping. zisofs-compressed files are inflated on read, with recently
+// used blocks cached. Lookups and reads may be called from several threads.
+class IsoVfs {
+public:
+    // Bytes inside the mapping; valid until close().
+    struct Span {
+        const char *data = nullptr;
+        qint64 size = 0;
+    };
+
+    // An opened file: where its data lives in the image.
+    struct File {
+        QVector<IsoExtent> extents;   // byte lengths, in file order
+        quint64 size = 0;             // uncompressed
+        quint8 zisofsBlockLog2 = 0;   // non-zero for zisofs data
+        qint64 mtime = 0;
+        bool valid = false;
+        bool isValid() const { return valid; }
+    };
+
+    IsoVfs();
+    ~IsoVfs();
+
+    bool open(const QString &imagePath);
+    void close();
+    bool isOpen() const { return image.isOpen(); }
+    QString errorString() const { return error; }
+    QString imagePath() const { return image.imagePath(); }
+    // The underlying reader, for code that works on Iso9660Reader directly.
+    Iso9660Reader *reader() { return &image; }
+    // False if the image couldn't be mapped (e.g. too big for a 32-bit
+    // address space); read() then falls back to pread().
+    bool isMapped() const { return map != nullptr; }
+
+    bool stat(const QString &path, IsoDirEntry &out);
+    bool readdir(const QString &path, QVector<IsoDirEntry> &out);
+    File openFile(const QString &path);
+
+    // Copies up to len bytes from offset; returns the count, 0 at the end of
+    // the file and -1 on errors.
+    qint64 read(const File &file, qint64 offset, char *buf, qint64 len) const;
+    // The same range as spans into the mapping, one per extent touched.
+    // Empty if the image isn't mapped, the file is compressed or the range
+    // is outside the file.
+    QVector<Span> spans(const File &file, qint64 offset, qint64 len) const;
+
+    static File fileFor(const IsoDirEntry &entry);
+
+private:
+    Q_DISABLE_COPY(IsoVfs)
+
+    bool listLocked(const QString &dirPath, QVector<IsoDirEntry> *&out);
+    bool statLocked(const QString &path, IsoDirEntry &out);
+    qint64 readStored(const File &file, qint64 offset, char *buf, qint64 len) const;
+
+    Iso9660Reader image;
+    QString error;
+    const char *map = nullptr;
+    qint64 mapSize = 0;
+    QMutex lookupMutex;
+    QHash<QString, QVector<IsoDirEntry>> dirCache;
+    mutable IsoZisofsDecoder zisofs;
+};
+
+#endif // ISOVFS_H
@@ -0,0 +1,380 @@
+#include "isozisofs.h"
+#include "isostagingarea.h"
+#include "isotrace.h"
+#include "isotreescanner.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSet>
+
+#include <algorithm>
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+namespace {
+
+const uchar Magic[8] = {0x37, 0xE4, 0x53, 0x96, 0xC9, 0xDB, 0xD6, 0x07};
+
+quint32 le32(const uchar *p) {
+    return quint32(p[0]) | (quint32(p[1]) << 8) | (quint32(p[2]) << 16) | (quint32(p[3]) << 24);
+}
+
+void putLe32(uchar *p, quint32 v) {
+    p[0] = uchar(v);
+    p[1] = uchar(v >> 8);
+    p[2] = uchar(v >> 16);
+    p[3] = uchar(v >> 24);
+}
+
+quint64 sectors(quint64 bytes) {
+    return (bytes + 2047) / 2048;
+}
+
+bool allZero(const char *data, qint64 len) {
+    for (qint64 i = 0; i < len; ++i)
+        if (data[i]) return false;
+    return true;
+}
+
+} // namespace
+
+bool IsoZisofs::hasMagic(const char *data, qint64 len) {
+    return len >= 8 && memcmp(data, Magic, 8) == 0;
+}
+
+bool IsoZisofs::compressFile(const QString &source, const QString &target, int blockLog2, int level,
+                             quint64 *storedSize, QString *error) {
+    QFile in(source);
+    if (!in.open(QIODevice::ReadOnly)) {
+        if (error) *error = source + ": " + in.errorString();
+        return false;
+    }
+    const qint64 size = in.size();
+    if (size > qint64(0xFFFFFFFFu) || blockLog2 < MinBlockLog2 || blockLog2 > MaxBlockLog2) {
+        if (error) *error = source + ": Can't be stored as zisofs";
+        return false;
+    }
+    QFile out(target);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (error) *error = target + ": " + out.errorString();
+        return false;
+    }
+    // The copy stands in for the source in the image, mode bits included.
+    struct stat st;
+    if (::fstat(in.handle(), &st) == 0) ::fchmod(out.handle(), st.st_mode & 07777);
+
+    const qint64 blockSize = qint64(1) << blockLog2;
+    const int blockCount = int((size + blockSize - 1) / blockSize);
+    QByteArray head(HeaderSize + 4 * (blockCount + 1), '\0');
+    uchar *h = reinterpret_cast<uchar *>(head.data());
+    memcpy(h, Magic, 8);
+    putLe32(h + 8, quint32(size));
+    h[12] = HeaderSize / 4;
+    h[13] = uchar(blockLog2);
+
+    QByteArray block(int(blockSize), Qt::Uninitialized);
+    QByteArray packed(int(compressBound(uLong(blockSize))), Qt::Uninitialized);
+    bool ok = out.write(head) == head.size();
+    quint64 offset = quint64(head.size());
+    for (int i = 0; ok && i < blockCount; ++i) {
+        putLe32(h + HeaderSize + 4 * i, quint32(offset));
+        const qint64 want = qMin(blockSize, size - qint64(i) * blockSize);
+        if (in.read(block.data(), want) != want) {
+            if (error) *error = source + ": " + (in.error() ? in.errorString() : QString("Changed while compressing"));
+            return false;
+        }
+        // All-zero blocks are stored as nothing.
+        if (allZero(block.constData(), want)) continue;
+        uLongf packedSize = uLongf(packed.size());
+        if (compress2(reinterpret_cast<Bytef *>(packed.data()), &packedSize,
+                      reinterpret_cast<const Bytef *>(block.constData()), uLong(want), level) != Z_OK) {
+            if (error) *error = source + ": zlib failed";
+            return false;
+        }
+        ok = out.write(packed.constData(), qint64(packedSize)) == qint64(packedSize);
+        offset += packedSize;
+        if (offset > 0xFFFFFFFFu) {
+            if (error) *error = source + ": Can't be stored as zisofs";
+            return false;
+        }
+    }
+    putLe32(h + HeaderSize + 4 * blockCount, quint32(offset));
+    ok = ok && out.seek(0) && out.write(head) == head.size();
+    if (!ok) {
+        if (error) *error = target + ": " + out.errorString();
+        return false;
+    }
+    if (storedSize) *storedSize = offset;
+    return true;
+}
+
+IsoZisofsDecoder::IsoZisofsDecoder(qint64 cacheBytes) {
+    blocks.setMaxCost(int(qBound<qint64>(0, cacheBytes, 0x7fffffff)));
+}
+
+void IsoZisofsDecoder::clear() {
+    QMutexLocker lock(&mutex);
+    blocks.clear();
+}
+
+bool IsoZisofsDecoder::inflateBlock(const IsoZisofs::StoredReader &stored, int headerSize, quint32 block,
+                                    int expected, QByteArray &out) {
+    uchar pointers[8];
+    if (stored(qint64(headerSize) + 4 * qint64(block), reinterpret_cast<char *>(pointers), 8) != 8) return false;
+    const quint32 from = le32(pointers), to = le32(pointers + 4);
+    if (to < from || to - from > compressBound(uLong(expected)) + 64) return false;
+    if (from == to) {
+        out = QByteArray(expected, '\0');
+        return true;
+    }
+    QByteArray packed(int(to - from), Qt::Uninitialized);
+    if (stored(from, packed.data(), packed.size()) != packed.size()) return false;
+    out.resize(expected);
+    uLongf outSize = uLongf(expected);
+    if (uncompress(reinterpret_cast<Bytef *>(out.data()), &outSize,
+                   reinterpret_cast<const Bytef *>(packed.constData()), uLong(packed.size())) != Z_OK)
+        return false;
+    return outSize == uLongf(expected);
+}
+
+qint64 IsoZisofsDecoder::read(quint32 key, quint64 size, int blockLog2, const IsoZisofs::StoredReader &stored,
+                              qint64 offset, char *buf, qint64 len) {
+    if (offset < 0 || len < 0 || blockLog2 < IsoZisofs::MinBlockLog2 || blockLog2 > IsoZisofs::MaxBlockLog2) return -1;
+    if (quint64(offset) >= size) return 0;
+    len = qMin(len, qint64(size) - offset);
+
+    uchar head[IsoZisofs::HeaderSize];
+    if (stored(0, reinterpret_cast<char *>(head), sizeof(head)) != qint64(sizeof(head))
+        || !IsoZisofs::hasMagic(reinterpret_cast<const char *>(head), sizeof(head)))
+        return -1;
+    const int headerSize = head[12] * 4;
+
+    const qint64 blockSize = qint64(1) << blockLog2;
+    qint64 done = 0;
+    while (done < len) {
+        const qint64 at = offset + done;
+        const quint32 block = quint32(at >> blockLog2);
+        const qint64 within = at & (blockSize - 1);
+        const quint64 cacheKey = (quint64(key) << 32) | block;
+        QByteArray data;
+        {
+            QMutexLocker lock(&mutex);
+            if (const QByteArray *cached = blocks.object(cacheKey)) data = *cached;
+        }
+        if (data.isNull()) {
+            const int expected = int(qMin<quint64>(quint64(blockSize), size - quint64(block) * quint64(blockSize)));
+            if (!inflateBlock(stored, headerSize, block, expected, data)) return done > 0 ? done : -1;
+            QMutexLocker lock(&mutex);
+            blocks.insert(cacheKey, new QByteArray(data), data.size());
+        }
+        const qint64 n = qMin(len - done, qint64(data.size()) - within);
+        if (n <= 0) break;
+        memcpy(buf + done, data.constData() + within, size_t(n));
+        done += n;
+    }
+    return done;
+}
+
+class IsoZisofsCompressor::Worker : public QRunnable {
+public:
+    explicit Worker(IsoZisofsCompressor *owner) : owner(owner) {}
+
+    void run() override {
+        QVector<Job> &jobs = *owner->running;
+        for (;;) {
+            const int i = owner->nextJob.fetchAndAddRelaxed(1);
+            if (i >= jobs.size() || owner->stop.load()) break;
+            Job &job = jobs[i];
+            job.ok = IsoZisofs::compressFile(job.source, job.target, owner->opts.blockLog2, owner->opts.level,
+                                             &job.stored, &job.error);
+            owner->done.fetchAndAddRelaxed(qint64(job.size));
+        }
+    }
+
+private:
+    IsoZisofsCompressor *owner;
+};
+
+IsoZisofsCompressor::IsoZisofsCompressor() {}
+
+IsoZisofsCompressor::~IsoZisofsCompressor() {
+    pool.waitForDone();
+}
+
+bool IsoZisofsCompressor::isEligible(const QString &path, quint64 size) const {
+    if (size < opts.minSize || size > 0xFFFFFFFFu) return false;
+    return !opts.skipExtensions.contains(QFileInfo(path).suffix().toLower());
+}
+
+bool IsoZisofsCompressor::shrinks(const Job &job) {
+    return job.ok && sectors(job.stored) < sectors(job.size);
+}
+
+void IsoZisofsCompressor::run(QVector<Job> &jobs) {
+    IsoTrace::Phase trace("stage", "zisofs");
+    trace.addFiles(jobs.size());
+    // Biggest first, so one large file doesn't start last and run alone.
+    std::sort(jobs.begin(), jobs.end(), [](const Job &a, const Job &b) { return a.size > b.size; });
+    qint64 bytes = 0;
+    for (const Job &job : qAsConst(jobs)) bytes += qint64(job.size);
+    done.store(0);
+    total.store(bytes);
+    running = &jobs;
+    nextJob.store(0);
+    const int threads = qMin(pool.maxThreadCount(), jobs.size());
+    for (int i = 0; i < threads; ++i) pool.start(new Worker(this));
+    pool.waitForDone();
+    running = nullptr;
+
+    for (const Job &job : qAsConst(jobs)) {
+        if (!job.ok && !job.error.isEmpty()) failures << job.error;
+        if (shrinks(job)) {
+            after += job.stored;
+            ++compressed;
+            // Compressed copies keep the source's modification time.
+            struct timespec times[2];
+            times[0].tv_sec = times[1].tv_sec = time_t(job.mtime);
+            times[0].tv_nsec = times[1].tv_nsec = 0;
+            ::utimensat(AT_FDCWD, QFile::encodeName(job.target).constData(), times, 0);
+        } else {
+            after += job.size;
+        }
+    }
+}
+
+QHash<QString, QString> IsoZisofsCompressor::compress(QVector<Job> &jobs) {
+    run(jobs);
+    QHash<QString, QString> result;
+    for (const Job &job : qAsConst(jobs)) {
+        if (shrinks(job)) result.insert(job.source, job.target);
+        else QFile::remove(job.target);
+    }
+    return result;
+}
+
+QHash<QString, QString> IsoZisofsCompressor::compressFiles(const QStringList &sources, const QString &workDir) {
+    before = after = 0;
+    compressed = 0;
+    failures.clear();
+
+    QVector<Job> jobs;
+    QSet<QString> seen;
+    for (const QString &source : sources) {
+        if (seen.contains(source)) continue;
+        seen.insert(source);
+        const QFileInfo fi(source);
+        const quint64 size = quint64(fi.size());
+        before += size;
+        if (!fi.isFile() || !isEligible(source, size)) {
+            after += size;
+            continue;
+        }
+        Job job;
+        job.source = source;
+        job.target = QDir(workDir).filePath(QString::number(jobs.size()) + ".zf");
+        job.size = size;
+        job.mtime = fi.lastModified().toSecsSinceEpoch();
+        jobs.append(job);
+    }
+    return compress(jobs);
+}
+
+QBitArray IsoZisofsCompressor::compressFiles(const QStringList &sources, const QStringList &targets) {
+    before = after = 0;
+    compressed = 0;
+    failures.clear();
+
+    QVector<Job> jobs;
+    for (int i = 0; i < sources.size(); ++i) {
+        const QFileInfo fi(sources.at(i));
+        const quint64 size = quint64(fi.size());
+        before += size;
+        if (!fi.isFile() || !isEligible(sources.at(i), size)) {
+            after += size;
+            continue;
+        }
+        Job job;
+        job.source = sources.at(i);
+        job.target = targets.at(i);
+        job.size = size;
+        job.mtime = fi.lastModified().toSecsSinceEpoch();
+        job.index = i;
+        jobs.append(job);
+    }
+    run(jobs);
+    QBitArray smaller(sources.size());
+    for (const Job &job : qAsConst(jobs)) {
+        if (shrinks(job)) smaller.setBit(job.index);
+        else QFile::remove(job.target);
+    }
+    return smaller;
+}
+
+QStringList IsoZisofsCompressor::bootFiles(const QString &bootImage) {
+    return QStringList{QFileInfo(bootImage).fileName(), "boot", "isolinux", "syslinux", "EFI", "efi"};
+}
+
+bool IsoZisofsCompressor::compressTree(const QString &sourceDir, const QString &workDir, QHash<QString, QString> &copies,
+                                       const QStringList &keepRaw, QString *error) {
+    before = after = 0;
+    compressed = 0;
+    failures.clear();
+    copies.clear();
+
+    const QByteArray root = IsoTreeScanner::rootPath(sourceDir);
+    const int rootLength = root.endsWith('/') ? root.size() - 1 : root.size();
+    QSet<QString> raw;
+    for (const QString &path : keepRaw) raw.insert(QDir::cleanPath(path));
+
+    // Only what gets compressed is written; everything else stays where it
+    // is and is grafted from sourceDir.
+    QVector<Job> jobs;
+    IsoTreeScanner scanner;
+    scanner.setMaxThreads(pool.maxThreadCount());
+    scanner.scan(sourceDir, [&](const IsoTreeScanner::Entry &entry) {
+        if (!entry.isFile()) return;
+        before += entry.size;
+        const QString source = QFile::decodeName(entry.path);
+        bool keep = false;
+        const QString relative = QFile::decodeName(entry.path.mid(rootLength + 1));
+        for (QString path = relative; !keep && !path.isEmpty(); path = path.section('/', 0, -2))
+            keep = raw.contains(path);
+        if (keep || !isEligible(source, entry.size)) {
+            after += entry.size;
+            return;
+        }
+        Job job;
+        job.source = source;
+        job.target = QDir(workDir).filePath(QString::number(jobs.size()) + ".zf");
+        job.size = entry.size;
+        job.mtime = entry.mtime();
+        jobs.append(job);
+    });
+    copies = compress(jobs);
+
+    if (isCancelled()) {
+        if (error) *error = "Cancelled";
+        return false;
+    }
+    if (!scanner.errors().isEmpty() && error) *error = scanner.errors().first();
+    return scanner.errors().isEmpty();
+}
+
+void IsoZisofsCompressor::stageTree(IsoStagingArea &staging, const QString &isoDir, const QString &sourceDir,
+                                    const QHash<QString, QString> &copies) {
+    const QString root = QFile::decodeName(IsoTreeScanner::rootPath(sourceDir));
+    const QString prefix = root.endsWith('/') ? root : root + '/';
+    const QString base = IsoStagingArea::normalize(isoDir);
+    staging.add(base, root);
+    for (auto it = copies.constBegin(); it != copies.constEnd(); ++it) {
+        if (!it.key().startsWith(prefix)) continue;
+        staging.add((base == "/" ? QString() : base) + it.key().mid(prefix.size() - 1), it.value());
+    }
+}
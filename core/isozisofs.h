@@ -0,0 +1,161 @@
+#ifndef ISOZISOFS_H
+#define ISOZISOFS_H
+
+#include <QAtomicInteger>
+#include <QBitArray>
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+#include <functional>
+
+class IsoStagingArea;
+
+// zisofs, the compressed file format that Linux and libisofs read
+// transparently when a Rock Ridge ZF entry marks a file. The data starts
+// with a 16-byte header (magic, uncompressed size, header size, block size)
+// and a table of block offsets; each block is a zlib stream inflating to
+// 2^blockLog2 bytes (the last one shorter), and empty blocks stand for zeros.
+class IsoZisofs {
+public:
+    static const int DefaultBlockLog2 = 15;
+    static const int MinBlockLog2 = 15;
+    static const int MaxBlockLog2 = 17;
+    static const int HeaderSize = 16;
+
+    // Reads bytes of a file as stored in the image; returns the count or -1.
+    typedef std::function<qint64(qint64 offset, char *buf, qint64 len)> StoredReader;
+
+    // Writes source to target in zisofs format and sets storedSize to the
+    // size of the result. Files of 4 GiB and more can't be represented.
+    static bool compressFile(const QString &source, const QString &target, int blockLog2, int level,
+                             quint64 *storedSize = nullptr, QString *error = nullptr);
+    static bool hasMagic(const char *data, qint64 len);
+};
+
+// Inflates zisofs files on read, keeping recently inflated blocks in an LRU
+// cache shared by all files so small reads don't inflate a block each time.
+// Safe to use from several threads.
+class IsoZisofsDecoder {
+public:
+    explicit IsoZisofsDecoder(qint64 cacheBytes = qint64(4) << 20);
+
+    // Reads len bytes at offset of the uncompressed file. key tells files
+    // apart in the cache (their first LBA); size and blockLog2 come from the
+    // file's ZF entry. Returns the count, 0 at the end and -1 on errors.
+    qint64 read(quint32 key, quint64 size, int blockLog2, const IsoZisofs::StoredReader &stored,
+                qint64 offset, char *buf, qint64 len);
+    void clear();
+
+private:
+    Q_DISABLE_COPY(IsoZisofsDecoder)
+
+    bool inflateBlock(const IsoZisofs::StoredReader &stored, int headerSize, quint32 block, int expected,
+                      QByteArray &out);
+
+    QMutex mutex;
+    QCache<quint64, QByteArray> blocks;
+};
+
+// Compresses files to zisofs on a thread pool for builders that pick them
+// up by their magic (mkisofs -z, xorriso -as mkisofs -z, libisofs
+// iso_file_zf_by_magic()), like mkzftree does. Small files, files with an
+// excluded extension and files that wouldn't take fewer sectors are left
+// as they are.
+class IsoZisofsCompressor {
+public:
+    struct Options {
+        quint64 minSize = 4096;
+        // Lower case, without the dot; already compressed formats mostly.
+        QStringList skipExtensions{"7z", "bz2", "cab", "gz", "jpeg", "jpg", "lz", "lzma", "mkv", "mp3", "mp4",
+                                   "png", "rpm", "deb", "squashfs", "xz", "zip", "zst"};
+        int blockLog2 = IsoZisofs::DefaultBlockLog2;
+        int level = 6;
+    };
+
+    IsoZisofsCompressor();
+    ~IsoZisofsCompressor();
+
+    void setOptions(const Options &options) { opts = options; }
+    const Options &options() const { return opts; }
+    void setMaxThreads(int threads) { pool.setMaxThreadCount(qMax(1, threads)); }
+
+    bool isEligible(const QString &path, quint64 size) const;
+
+    // Compresses the eligible sources into workDir and returns source ->
+    // compressed file for those that got smaller.
+    QHash<QString, QString> compressFiles(const QStringList &sources, const QString &workDir);
+    // The same with the caller naming each copy: bit i is set when
+    // targets[i] holds a smaller copy of sources[i], and no file is left
+    // at the other targets. For callers that go through many files a batch
+    // at a time and keep their own table of what was compressed.
+    QBitArray compressFiles(const QStringList &sources, const QStringList &targets);
+    // The same for every eligible file below sourceDir. keepRaw lists files
+    // and directories relative to sourceDir that must stay readable as they
+    // are, like what a boot loader loads by itself. Nothing else is copied;
+    // stageTree() grafts the copies over the tree. False if part of the
+    // tree couldn't be read.
+    bool compressTree(const QString &sourceDir, const QString &workDir, QHash<QString, QString> &copies,
+                      const QStringList &keepRaw = QStringList(), QString *error = nullptr);
+    // sourceDir at isoDir, with the copies from compressTree() grafted over
+    // their originals.
+    static void stageTree(IsoStagingArea &staging, const QString &isoDir, const QString &sourceDir,
+                          const QHash<QString, QString> &copies);
+    // keepRaw for a bootable tree: the El Torito image and the usual boot
+    // loader directories, which are read without zisofs support.
+    static QStringList bootFiles(const QString &bootImage);
+
+    // Thread-safe, for whoever waits on another thread: cancel() stops this
+    // run and any later one, leaving unfinished files uncompressed; the
+    // bytes compressed so far out of all that will be.
+    void cancel() { stop.store(1); }
+    bool isCancelled() const { return stop.load() != 0; }
+    qint64 bytesDone() const { return done.load(); }
+    qint64 bytesTotal() const { return total.load(); }
+
+    // Over the last run: every file looked at, before and after.
+    quint64 bytesBefore() const { return before; }
+    quint64 bytesAfter() const { return after; }
+    int filesCompressed() const { return compressed; }
+    // Files that failed to compress and were left as they are.
+    QStringList errors() const { return failures; }
+
+private:
+    Q_DISABLE_COPY(IsoZisofsCompressor)
+
+    struct Job {
+        QString source;
+        QString target;
+        quint64 size = 0;
+        qint64 mtime = 0;
+        quint64 stored = 0;
+        int index = -1;
+        QString error;
+        bool ok = false;
+    };
+
+    class Worker;
+    friend class Worker;
+
+    void run(QVector<Job> &jobs);
+    QHash<QString, QString> compress(QVector<Job> &jobs);
+    static bool shrinks(const Job &job);
+
+    Options opts;
+    QThreadPool pool;
+    QAtomicInt nextJob;
+    QAtomicInt stop;
+    QAtomicInteger<qint64> done;
+    QAtomicInteger<qint64> total;
+    QVector<Job> *running = nullptr;
+    quint64 before = 0;
+    quint64 after = 0;
+    int compressed = 0;
+    QStringList failures;
+};
+
+#endif // ISOZISOFS_H
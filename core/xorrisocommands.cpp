@@ -0,0 +1,55 @@
+#include "xorrisocommands.h"
+#include "isoreproducible.h"
+
+#include <QFileInfo>
+#include <QRegularExpression>
+
+QStringList XorrisoCommands::extract(const QString &image, const QStringList &isoPaths, const QStringList &targets) {
+    QStringList args{"-osirrox", "on", "-indev", image};
+    for (int i = 0; i < isoPaths.size() && i < targets.size(); ++i)
+        args << "-extract" << isoPaths.at(i) << targets.at(i);
+    return args;
+}
+
+QStringList XorrisoCommands::compact(const QString &image, const QString &output) {
+    return QStringList{"-md5", "on", "-indev", image, "-outdev", output, "-boot_image", "any", "keep"}
+           + IsoReproducibleBuild::fromEnvironment().xorrisoArguments() + QStringList{"-commit"};
+}
+
+QStringList XorrisoCommands::list(const QString &image, const QString &isoDir) {
+    return {"-indev", image, "-find", isoDir};
+}
+
+QStringList XorrisoCommands::makeBootable(const QStringList &sources, const QString &bootImage, const QString &outputIso,
+                                          const QString &volumeId, const QString &isohybridMbr, bool zisofs) {
+    const QString bootName = QFileInfo(bootImage).fileName();
+    QStringList args{
+        "-as", "mkisofs",
+        "-o", outputIso,
+        "-b", bootName,
+        "-no-emul-boot", "-boot-load-size", "4", "-boot-info-table",
+        "-V", volumeId,
+        "-J", "-R", "--md5"
+    };
+    if (!isohybridMbr.isEmpty()) args << "-isohybrid-mbr" << isohybridMbr;
+    if (zisofs) args << "-z";
+    args << "-c" << "boot.cat"
+         << "-input-charset" << "utf-8"
+         << "-quiet"
+         << "-eltorito-boot" << bootName
+         << IsoReproducibleBuild::fromEnvironment().mkisofsArguments()
+         << sources;
+    return args;
+}
+
+const char *XorrisoCommands::traceCategory(const QStringList &args) {
+    if (args.contains("-extract") || args.contains("-osirrox")) return "extract";
+    if (args.contains("-commit") || args.contains("-outdev") || args.contains("-o")) return "write";
+    return "tool";
+}
+
+qint64 XorrisoCommands::parsePrintSize(const QString &line) {
+    static const QRegularExpression sizeLine("^Image size\\s*:\\s*(\\d+)s");
+    QRegularExpressionMatch m = sizeLine.match(line.trimmed());
+    return m.hasMatch() ? m.captured(1).toLongLong() : -1;
+}
@@ -0,0 +1,38 @@
+#ifndef XORRISOCOMMANDS_H
+#define XORRISOCOMMANDS_H
+
+#include <QStringList>
+
+// Argument lists for the one-shot xorriso runs shared by the frontends and
+// the command line tool. compact() and makeBootable() write reproducible
+// images when SOURCE_DATE_EPOCH is set (see IsoReproducibleBuild), and both
+// record MD5 tags for the session and its files for IsoVerifier.
+class XorrisoCommands {
+public:
+    // Copies isoPaths (files or trees) out of image, each to the target
+    // with the same index.
+    static QStringList extract(const QString &image, const QStringList &isoPaths, const QStringList &targets);
+    // Writes the current tree of image as a new single-session image, dropping
+    // the data superseded by later sessions. output must not exist yet.
+    static QStringList compact(const QString &image, const QString &output);
+    // Prints every path below isoDir, one per line.
+    static QStringList list(const QString &image, const QString &isoDir = "/");
+    // An El Torito image of sources: a directory, or the graft-point
+    // arguments from IsoStagingArea, plus any sort weights from
+    // IsoReproducibleBuild. bootImage is looked up relative to the image
+    // root; isohybridMbr may be empty. With zisofs, files compressed
+    // beforehand (IsoZisofsCompressor::compressTree) are marked for
+    // transparent decompression.
+    static QStringList makeBootable(const QStringList &sources, const QString &bootImage, const QString &outputIso,
+                                    const QString &volumeId = "BOOTISO", const QString &isohybridMbr = QString(),
+                                    bool zisofs = false);
+
+    // The IsoTrace category of a run of xorriso or a mkisofs-style tool:
+    // "write", "extract" or "tool".
+    static const char *traceCategory(const QStringList &args);
+
+    // Blocks reported by -print_size ("Image size   : 1234s"), -1 if line isn't that.
+    static qint64 parsePrintSize(const QString &line);
+};
+
+#endif // XORRISOCOMMANDS_H
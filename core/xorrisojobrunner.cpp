@@ -0,0 +1,156 @@
+#include "xorrisojobrunner.h"
+#include "xorrisocommands.h"
+
+#include <QRegularExpression>
+#include <QTimer>
+
+namespace {
+
+// "-pkt_output on" frames every line as "R:1: ..." / "I:0: ..." / "M:0: ...".
+const QRegularExpression packetPrefix("^[RIM]:[01]: ");
+// "Writing:   32768s   21.5%   fifo 100%  buf  50%   12.3xD"
+const QRegularExpression writingLine("Writing:\\s+(\\d+)s\\s+(\\d+(?:\\.\\d+)?)%");
+// "-as mkisofs" style " 21.50% done, estimate finish ..."
+const QRegularExpression doneLine("(\\d+(?:\\.\\d+)?)% done");
+
+} // namespace
+
+XorrisoJobRunner::XorrisoJobRunner(QObject *parent) : QObject(parent) {}
+
+XorrisoJobRunner::~XorrisoJobRunner() {
+    queue.clear();
+    if (proc) {
+        proc->disconnect(this);
+        proc->kill();
+        proc->waitForFinished(3000);
+        delete proc;
+    }
+}
+
+int XorrisoJobRunner::enqueue(const QStringList &args, const QString &label) {
+    Job job;
+    job.id = nextId++;
+    job.label = label;
+    job.args = args;
+    queue.enqueue(job);
+    if (!proc) QTimer::singleShot(0, this, &XorrisoJobRunner::startNext);
+    return job.id;
+}
+
+void XorrisoJobRunner::startNext() {
+    if (proc) return;
+    if (queue.isEmpty()) {
+        emit idle();
+        return;
+    }
+
+    current = queue.dequeue();
+    trace.reset(new IsoTrace::Phase(XorrisoCommands::traceCategory(current.args),
+                                    current.label.isEmpty() ? current.args.join(" ") : current.label));
+    cancelled = false;
+    lastPercent = -1;
+    outBuffer.clear();
+    errBuffer.clear();
+
+    proc = new QProcess(this);
+    connect(proc, &QProcess::readyReadStandardOutput, this, [this]() { readChannel(QProcess::StandardOutput); });
+    connect(proc, &QProcess::readyReadStandardError, this, [this]() { readChannel(QProcess::StandardError); });
+    connect(proc, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this,
+            [this](int exitCode, QProcess::ExitStatus status) {
+        drain(outBuffer, false, true);
+        drain(errBuffer, true, true);
+        finishJob(!cancelled && status == QProcess::NormalExit && exitCode == 0, exitCode);
+    });
+    connect(proc, &QProcess::errorOccurred, this, [this](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart) return;
+        emit outputLine(current.id, "Failed to start " + program + ": " + proc->errorString(), true);
+        finishJob(false, -1);
+    });
+
+    emit jobStarted(current.id, current.label, current.args);
+    timer.start();
+    proc->start(program, current.args);
+}
+
+void XorrisoJobRunner::readChannel(QProcess::ProcessChannel channel) {
+    if (!proc) return;
+    proc->setReadChannel(channel);
+    const bool isError = channel == QProcess::StandardError;
+    QByteArray &buffer = isError ? errBuffer : outBuffer;
+    buffer.append(proc->readAll());
+    drain(buffer, isError, false);
+}
+
+void XorrisoJobRunner::drain(QByteArray &buffer, bool isError, bool flush) {
+    int start = 0;
+    for (int i = 0; i < buffer.size(); ++i) {
+        // Progress updates may be terminated by a bare carriage return.
+        if (buffer.at(i) != '\n' && buffer.at(i) != '\r') continue;
+        if (i > start) {
+            QString line = QString::fromLocal8Bit(buffer.constData() + start, i - start);
+            line.remove(packetPrefix);
+            parseProgress(line);
+            emit outputLine(current.id, line, isError);
+        }
+        start = i + 1;
+    }
+    buffer.remove(0, start);
+    if (flush && !buffer.isEmpty()) {
+        QString line = QString::fromLocal8Bit(buffer);
+        line.remove(packetPrefix);
+        parseProgress(line);
+        emit outputLine(current.id, line, isError);
+        buffer.clear();
+    }
+}
+
+void XorrisoJobRunner::parseProgress(const QString &line) {
+    double percent = -1;
+    double bytesPerSecond = -1;
+    const double seconds = timer.elapsed() / 1000.0;
+
+    QRegularExpressionMatch m = writingLine.match(line);
+    if (m.hasMatch()) {
+        const double bytes = m.captured(1).toDouble() * 2048.0;
+        percent = m.captured(2).toDouble();
+        if (seconds > 0) bytesPerSecond = bytes / seconds;
+    } else {
+        m = doneLine.match(line);
+        if (!m.hasMatch()) return;
+        percent = m.captured(1).toDouble();
+    }
+    if (percent == lastPercent) return;
+    lastPercent = percent;
+
+    qint64 eta = -1;
+    if (percent > 0 && percent < 100) eta = qint64(seconds * (100.0 - percent) / percent);
+    else if (percent >= 100) eta = 0;
+    emit progress(current.id, percent, bytesPerSecond, eta);
+}
+
+void XorrisoJobRunner::finishJob(bool ok, int exitCode) {
+    if (!proc) return;
+    if (cancelled) emit outputLine(current.id, "Cancelled: " + (current.label.isEmpty() ? current.args.join(" ") : current.label), true);
+    proc->disconnect(this);
+    proc->deleteLater();
+    proc = nullptr;
+    trace.reset();
+    emit jobFinished(current.id, ok, exitCode);
+    startNext();
+}
+
+void XorrisoJobRunner::cancel() {
+    if (!proc || cancelled) return;
+    cancelled = true;
+    proc->terminate();
+    // xorriso normally stops cleanly on SIGTERM; don't wait forever if not.
+    QProcess *running = proc;
+    QTimer::singleShot(5000, running, [running]() {
+        if (running->state() != QProcess::NotRunning) running->kill();
+    });
+}
+
+void XorrisoJobRunner::cancelAll() {
+    queue.clear();
+    cancel();
+}
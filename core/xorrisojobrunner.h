@@ -0,0 +1,70 @@
+#ifndef XORRISOJOBRUNNER_H
+#define XORRISOJOBRUNNER_H
+
+#include <QObject>
+#include <QQueue>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QProcess>
+#include <QScopedPointer>
+
+#include "isotrace.h"
+
+// Runs queued xorriso invocations one after another without blocking the
+// event loop. Output is streamed line by line as it arrives and xorriso's
+// progress messages (plain or -pkt_output framed) are turned into a
+// percentage, throughput and ETA.
+class XorrisoJobRunner : public QObject {
+    Q_OBJECT
+
+public:
+    explicit XorrisoJobRunner(QObject *parent = nullptr);
+    ~XorrisoJobRunner() override;
+
+    void setProgram(const QString &program) { this->program = program; }
+
+    // Returns the job id reported by the signals below.
+    int enqueue(const QStringList &args, const QString &label = QString());
+    bool isBusy() const { return proc != nullptr; }
+    int pendingCount() const { return queue.size(); }
+    int currentJob() const { return proc ? current.id : -1; }
+
+public slots:
+    void cancel();
+    void cancelAll();
+
+signals:
+    void jobStarted(int id, const QString &label, const QStringList &args);
+    void outputLine(int id, const QString &line, bool isError);
+    // percent < 0 when unknown; bytesPerSecond/etaSeconds < 0 when unknown.
+    void progress(int id, double percent, double bytesPerSecond, qint64 etaSeconds);
+    void jobFinished(int id, bool ok, int exitCode);
+    void idle();
+
+private:
+    struct Job {
+        int id = -1;
+        QString label;
+        QStringList args;
+    };
+
+    void startNext();
+    void readChannel(QProcess::ProcessChannel channel);
+    void drain(QByteArray &buffer, bool isError, bool flush);
+    void parseProgress(const QString &line);
+    void finishJob(bool ok, int exitCode);
+
+    QString program = "xorriso";
+    QQueue<Job> queue;
+    Job current;
+    QProcess *proc = nullptr;
+    QByteArray outBuffer;
+    QByteArray errBuffer;
+    QElapsedTimer timer;
+    QScopedPointer<IsoTrace::Phase> trace;
+    double lastPercent = -1;
+    bool cancelled = false;
+    int nextId = 1;
+};
+
+#endif // XORRISOJOBRUNNER_H
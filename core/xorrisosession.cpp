@@ -0,0 +1,220 @@
+#include "xorrisosession.h"
+
+#include <QPair>
+
+#include <memory>
+#include <string.h>
+
+namespace {
+
+// Each dialog line ends by setting the mark to its request id; xorriso
+// prints the mark once the line is done, so a reply ends with its own id.
+// Nothing is printed before the first line, since no mark is set then.
+const char *const MarkPrefix = "QT_CDTOOLS_REPLY_";
+
+} // namespace
+
+XorrisoSession::XorrisoSession(QObject *parent) : QObject(parent) {}
+
+XorrisoSession::~XorrisoSession() {
+    // Nobody is left to hear about outstanding requests.
+    pending.clear();
+    stop();
+}
+
+QString XorrisoSession::quote(const QString &word) {
+    // Dialog lines are split like a shell line; close and reopen around quotes.
+    QString escaped = word;
+    escaped.replace("'", "'\"'\"'");
+    return "'" + escaped + "'";
+}
+
+bool XorrisoSession::start(const QString &image, bool writable) {
+    stop();
+    imagePath = image;
+    this->writable = writable;
+    restarts = 0;
+    restartWindow.start();
+    return launch();
+}
+
+bool XorrisoSession::launch() {
+    buffer.clear();
+    proc = new QProcess(this);
+    proc->setProcessChannelMode(QProcess::MergedChannels);
+    connect(proc, &QProcess::readyReadStandardOutput, this, &XorrisoSession::readOutput);
+    connect(proc, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, &XorrisoSession::handleExit);
+
+    proc->start(program, {"-abort_on", "NEVER",
+                          "-pkt_output", "on",
+                          "-use_readline", "off",
+                          "-iso_rr_pattern", "off",
+                          "-osirrox", "on",
+                          "-dialog", "on"});
+    if (!proc->waitForStarted(5000)) {
+        emit crashed("Failed to start " + program + ": " + proc->errorString());
+        proc->disconnect(this);
+        proc->deleteLater();
+        proc = nullptr;
+        return false;
+    }
+
+    send({writable ? "-dev" : "-indev", imagePath}, [this](const Reply &reply) {
+        if (reply.ok) emit ready();
+        else emit crashed("Failed to load " + imagePath + ": " + reply.info.join("\n"));
+    });
+    return true;
+}
+
+void XorrisoSession::stop() {
+    if (!proc) return;
+    stopping = true;
+    proc->disconnect(this);
+    if (proc->state() == QProcess::Running) {
+        // Never write anything that wasn't committed explicitly.
+        proc->write("-rollback_end\n");
+        if (!proc->waitForFinished(2000)) {
+            proc->kill();
+            proc->waitForFinished(1000);
+        }
+    }
+    // May be called from a reply callback, i.e. inside one of proc's signals.
+    proc->deleteLater();
+    proc = nullptr;
+    failPending("Session stopped");
+    stopping = false;
+}
+
+int XorrisoSession::send(const QStringList &commands, const Callback &callback) {
+    if (!isRunning()) {
+        if (callback) {
+            Reply reply;
+            reply.info << "xorriso session is not running";
+            callback(reply);
+        }
+        return -1;
+    }
+
+    Request request;
+    request.id = nextId++;
+    QStringList words;
+    for (const QString &command : commands) words << quote(command);
+    words << "-mark" << MarkPrefix + QString::number(request.id);
+
+    request.callback = callback;
+    request.reply.ok = true;
+    request.timer.start();
+    pending.enqueue(request);
+    proc->write(words.join(' ').toLocal8Bit() + '\n');
+    return request.id;
+}
+
+XorrisoSession::Reply XorrisoSession::execute(const QStringList &commands, int timeoutMs) {
+    // Shared so a late reply after a timeout has somewhere harmless to go.
+    auto state = std::make_shared<QPair<bool, Reply>>(false, Reply());
+    send(commands, [state](const Reply &reply) {
+        state->first = true;
+        state->second = reply;
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!state->first && isRunning() && timer.elapsed() < timeoutMs) {
+        // readyRead is emitted from inside the wait, which runs readOutput().
+        proc->waitForReadyRead(int(qMax<qint64>(1, timeoutMs - timer.elapsed())));
+    }
+    if (!state->first) state->second.info << "No reply from xorriso";
+    return state->second;
+}
+
+int XorrisoSession::listDirectory(const QString &isoDir, const Callback &callback) {
+    return send({"-lsl", isoDir}, callback);
+}
+
+int XorrisoSession::extract(const QString &isoPath, const QString &diskPath, const Callback &callback) {
+    return send({"-extract", isoPath, diskPath}, callback);
+}
+
+int XorrisoSession::remove(const QString &isoPath, const Callback &callback) {
+    return send({"-rm_r", isoPath, "--"}, callback);
+}
+
+int XorrisoSession::commit(const Callback &callback) {
+    return send({"-commit"}, callback);
+}
+
+void XorrisoSession::readOutput() {
+    if (!proc) return;
+    buffer.append(proc->readAllStandardOutput());
+    int start = 0;
+    for (int i = buffer.indexOf('\n'); i >= 0; i = buffer.indexOf('\n', start)) {
+        handleLine(buffer.mid(start, i - start));
+        start = i + 1;
+    }
+    buffer.remove(0, start);
+}
+
+void XorrisoSession::handleLine(const QByteArray &line) {
+    if (pending.isEmpty()) return;
+
+    // Packet lines look like "R:1: text"; anything unframed counts as info.
+    char channel = 'I';
+    QByteArray text = line;
+    if (line.size() >= 5 && line.at(1) == ':' && line.at(3) == ':' && line.at(4) == ' ') {
+        channel = line.at(0);
+        text = line.mid(5);
+    }
+
+    Request &request = pending.head();
+    if (channel == 'M') {
+        const QByteArray mark = text.trimmed();
+        if (!mark.startsWith(MarkPrefix)) return;
+        bool ok = false;
+        const int id = mark.mid(int(strlen(MarkPrefix))).toInt(&ok);
+        // A mark left over from an earlier line doesn't end anything.
+        if (!ok || id < request.id || id >= nextId) return;
+        // Lines are done in order, so any older ones lost their mark.
+        while (!pending.isEmpty() && pending.head().id <= id) {
+            Request done = pending.dequeue();
+            done.reply.elapsedUs = done.timer.nsecsElapsed() / 1000;
+            if (done.callback) done.callback(done.reply);
+        }
+    } else if (channel == 'R') {
+        request.reply.result << QString::fromLocal8Bit(text);
+    } else {
+        if (text.contains(" : SORRY : ") || text.contains(" : FAILURE : ") || text.contains(" : FATAL : "))
+            request.reply.ok = false;
+        request.reply.info << QString::fromLocal8Bit(text);
+    }
+}
+
+void XorrisoSession::failPending(const QString &reason) {
+    while (!pending.isEmpty()) {
+        Request request = pending.dequeue();
+        request.reply.ok = false;
+        request.reply.info << reason;
+        if (request.callback) request.callback(request.reply);
+    }
+}
+
+void XorrisoSession::handleExit() {
+    if (stopping || !proc) return;
+    readOutput();
+    if (!proc) return; // a reply callback stopped the session
+    const QString reason = QString("xorriso exited unexpectedly (code %1)").arg(proc->exitCode());
+    proc->disconnect(this);
+    proc->deleteLater();
+    proc = nullptr;
+    failPending(reason);
+    emit crashed(reason);
+
+    // Allow a few restarts per minute so a broken image can't spin forever.
+    if (restartWindow.elapsed() > 60000) {
+        restarts = 0;
+        restartWindow.restart();
+    }
+    if (restarts >= maxRestarts) return;
+    ++restarts;
+    emit restarted(restarts);
+    launch();
+}
@@ -0,0 +1,86 @@
+#ifndef XORRISOSESSION_H
+#define XORRISOSESSION_H
+
+#include <QObject>
+#include <QProcess>
+#include <QQueue>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <functional>
+
+// A long-lived "xorriso -dialog on" process with the image loaded once.
+// Each request is written as one dialog line; "-pkt_output on" frames the
+// replies and a "-mark" with the request id ending every line tells where
+// its reply ends, so listing a directory or extracting a file doesn't pay
+// for a fresh process and a fresh image load. If xorriso dies it is
+// restarted and the image is loaded again; requests that were in flight
+// fail.
+class XorrisoSession : public QObject {
+    Q_OBJECT
+
+public:
+    struct Reply {
+        bool ok = false;
+        QStringList result;   // "R" channel
+        QStringList info;     // "I" channel: notes, warnings, errors
+        qint64 elapsedUs = 0;
+    };
+    typedef std::function<void(const Reply &)> Callback;
+
+    explicit XorrisoSession(QObject *parent = nullptr);
+    ~XorrisoSession() override;
+
+    void setProgram(const QString &program) { this->program = program; }
+    void setMaxRestarts(int restarts) { maxRestarts = restarts; }
+
+    // writable loads the image with -dev so -rm and friends can be committed.
+    bool start(const QString &image, bool writable = false);
+    void stop();
+    bool isRunning() const { return proc && proc->state() == QProcess::Running; }
+    QString image() const { return imagePath; }
+
+    // Queues one dialog line made of the given xorriso commands.
+    int send(const QStringList &commands, const Callback &callback = Callback());
+    // Sends and waits for the reply without returning to the event loop.
+    Reply execute(const QStringList &commands, int timeoutMs = 60000);
+
+    int listDirectory(const QString &isoDir, const Callback &callback);
+    int extract(const QString &isoPath, const QString &diskPath, const Callback &callback);
+    int remove(const QString &isoPath, const Callback &callback);
+    int commit(const Callback &callback);
+
+    static QString quote(const QString &word);
+
+signals:
+    void ready();
+    void restarted(int attempt);
+    void crashed(const QString &reason);
+
+private:
+    struct Request {
+        int id;
+        Callback callback;
+        Reply reply;
+        QElapsedTimer timer;
+    };
+
+    bool launch();
+    void readOutput();
+    void handleLine(const QByteArray &line);
+    void handleExit();
+    void failPending(const QString &reason);
+
+    QString program = "xorriso";
+    QString imagePath;
+    bool writable = false;
+    bool stopping = false;
+    int maxRestarts = 3;
+    int restarts = 0;
+    QElapsedTimer restartWindow;
+    QProcess *proc = nullptr;
+    QByteArray buffer;
+    QQueue<Request> pending;
+    int nextId = 1;
+};
+
+#endif // XORRISOSESSION_H
@@ -0,0 +1,22 @@
+QT       += core
+QT       -= gui
+
+CONFIG += c++11 console link_pkgconfig
+CONFIG -= app_bundle
+
+TARGET = isomanager-fuse
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# libfuse 3 (Linux). Mounting goes through the setuid fusermount3 helper,
+# so no root is needed.
+PKGCONFIG += fuse3
+
+SOURCES += \
+    main.cpp
+
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
+
+include(../core/core.pri)
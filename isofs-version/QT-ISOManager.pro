@@ -16,9 +16,13 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    isoburnwriter.cpp \
+    isoimagebuilder.cpp \
     main.cpp
 
 HEADERS += \
+    isoburnwriter.h \
+    isoimagebuilder.h
 
 FORMS += \
 
@@ -29,6 +33,7 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 
 RESOURCES +=
 
+include(../core/core.pri)
 
 LIBS += -L/Users/macbook2015/Desktop/brew/lib -lisofs
 
@@ -0,0 +1,261 @@
+#include "isoburnwriter.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QThread>
+
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+namespace {
+
+const size_t BufferAlign = 4096;
+
+class FunctionThread : public QThread {
+public:
+    explicit FunctionThread(std::function<void()> function) : function(std::move(function)) {}
+
+protected:
+    void run() override { function(); }
+
+private:
+    std::function<void()> function;
+};
+
+bool libraryReady = false;
+
+void finishLibrary() {
+    if (libraryReady) iso_finish();
+    libraryReady = false;
+}
+
+} // namespace
+
+bool IsoBurnWriter::initLibrary(QString *error) {
+    if (libraryReady) return true;
+    const int ret = iso_init();
+    if (ret < 0) {
+        if (error) *error = QString("iso_init() failed (%1)").arg(ret);
+        return false;
+    }
+    libraryReady = true;
+    qAddPostRoutine(finishLibrary);
+    return true;
+}
+
+IsoBurnWriter::IsoBurnWriter(QObject *parent) : QObject(parent) {
+    progressTimer.setInterval(250);
+    connect(&progressTimer, &QTimer::timeout, this, &IsoBurnWriter::reportProgress);
+}
+
+IsoBurnWriter::~IsoBurnWriter() {
+    if (!isRunning()) return;
+    cancel();
+    reader->wait();
+    writer->wait();
+    // Nobody is listening any more; just release everything.
+    disconnect(reader, nullptr, this, nullptr);
+    disconnect(writer, nullptr, this, nullptr);
+    runningThreads = 1;
+    threadDone();
+}
+
+bool IsoBurnWriter::start(IsoImage *image, IsoWriteOpts *opts, const QString &outPath) {
+    if (isRunning()) return false;
+    error.clear();
+    if (!initLibrary(&error)) return false;
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+    if (directIo) flags |= O_DIRECT;
+#endif
+    fd = ::open(QFile::encodeName(outPath).constData(), flags, 0644);
+    if (fd < 0) {
+        error = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+#ifdef F_NOCACHE
+    if (directIo) ::fcntl(fd, F_NOCACHE, 1);
+#endif
+
+    const int ret = iso_image_create_burn_source(image, opts, &source);
+    if (ret < 0 || !source) {
+        error = QString("Failed to prepare the image (%1)").arg(ret);
+        source = nullptr;
+        ::close(fd);
+        fd = -1;
+        QFile::remove(outPath);
+        return false;
+    }
+
+    outputPath = outPath;
+    trace.reset(new IsoTrace::Phase("write", outPath));
+    total = qint64(source->get_size(source));
+    slots.resize(RingSlots);
+    fill.fill(0, RingSlots);
+    for (char *&slot : slots) {
+        if (::posix_memalign(reinterpret_cast<void **>(&slot), BufferAlign, ChunkSize) != 0) slot = nullptr;
+    }
+    head = tail = used = 0;
+    endOfData = false;
+    written.store(0);
+    cancelled.store(0);
+    failed.store(0);
+    if (slots.contains(nullptr)) fail("Out of memory");
+
+    reader = new FunctionThread([this]() { pump(); });
+    writer = new FunctionThread([this]() { drain(); });
+    runningThreads = 2;
+    connect(reader, &QThread::finished, this, &IsoBurnWriter::threadDone);
+    connect(writer, &QThread::finished, this, &IsoBurnWriter::threadDone);
+    clock.start();
+    progressTimer.start();
+    reader->start();
+    writer->start();
+    return true;
+}
+
+void IsoBurnWriter::cancel() {
+    if (!isRunning()) return;
+    cancelled.store(1);
+    // Stops libisofs' own writer thread so a blocked read returns.
+    if (source->version > 0 && source->cancel) source->cancel(source);
+    QMutexLocker lock(&mutex);
+    notEmpty.wakeAll();
+    notFull.wakeAll();
+}
+
+void IsoBurnWriter::fail(const QString &message) {
+    QMutexLocker lock(&mutex);
+    if (failed.testAndSetOrdered(0, 1)) error = message;
+    notEmpty.wakeAll();
+    notFull.wakeAll();
+}
+
+void IsoBurnWriter::pump() {
+    for (;;) {
+        char *buffer;
+        {
+            QMutexLocker lock(&mutex);
+            while (used == RingSlots && !cancelled.load() && !failed.load()) notFull.wait(&mutex);
+            if (cancelled.load() || failed.load()) break;
+            buffer = slots.at(tail);
+        }
+
+        // Fill a whole chunk so the writer always sees large writes.
+        int got = 0;
+        while (got < ChunkSize) {
+            const int n = source->version > 0 && source->read_xt
+                              ? source->read_xt(source, reinterpret_cast<unsigned char *>(buffer) + got, ChunkSize - got)
+                              : source->read(source, reinterpret_cast<unsigned char *>(buffer) + got, ChunkSize - got);
+            if (n < 0) {
+                if (!cancelled.load()) fail("libisofs failed while producing the image");
+                return;
+            }
+            if (n == 0) break;
+            got += n;
+        }
+
+        QMutexLocker lock(&mutex);
+        if (got > 0) {
+            fill[tail] = got;
+            tail = (tail + 1) % RingSlots;
+            ++used;
+        }
+        if (got < ChunkSize) endOfData = true;
+        notEmpty.wakeAll();
+        if (endOfData) break;
+    }
+
+    QMutexLocker lock(&mutex);
+    endOfData = true;
+    notEmpty.wakeAll();
+}
+
+bool IsoBurnWriter::writeAll(const char *data, qint64 len, qint64 offset) {
+    qint64 done = 0;
+    while (done < len) {
+        ssize_t n = ::pwrite(fd, data + done, size_t(len - done), off_t(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+#ifdef O_DIRECT
+            // The last chunk may not be a multiple of the device block size.
+            if (errno == EINVAL && (::fcntl(fd, F_GETFL) & O_DIRECT)) {
+                ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_DIRECT);
+                continue;
+            }
+#endif
+            fail(QString::fromLocal8Bit(strerror(errno)));
+            return false;
+        }
+        done += n;
+        written.fetchAndAddRelaxed(n);
+    }
+    return true;
+}
+
+void IsoBurnWriter::drain() {
+    qint64 offset = 0;
+    for (;;) {
+        char *buffer;
+        int len;
+        {
+            QMutexLocker lock(&mutex);
+            while (used == 0 && !endOfData && !cancelled.load() && !failed.load()) notEmpty.wait(&mutex);
+            if (cancelled.load() || failed.load() || used == 0) break;
+            buffer = slots.at(head);
+            len = fill.at(head);
+        }
+
+        if (!writeAll(buffer, len, offset)) break;
+        offset += len;
+
+        QMutexLocker lock(&mutex);
+        head = (head + 1) % RingSlots;
+        --used;
+        notFull.wakeAll();
+    }
+
+    if (!cancelled.load() && !failed.load() && ::fsync(fd) != 0)
+        fail(QString::fromLocal8Bit(strerror(errno)));
+    // Unblock the pump if we stopped early.
+    QMutexLocker lock(&mutex);
+    notFull.wakeAll();
+}
+
+void IsoBurnWriter::reportProgress() {
+    const qint64 done = written.load();
+    const double seconds = clock.elapsed() / 1000.0;
+    const double rate = seconds > 0.5 ? done / seconds : -1;
+    const qint64 eta = rate > 0 && total > 0 ? qint64((total - done) / rate) : -1;
+    emit progress(done, total, rate, eta);
+}
+
+void IsoBurnWriter::threadDone() {
+    if (--runningThreads > 0) return;
+    progressTimer.stop();
+    reportProgress();
+
+    source->free_data(source);
+    ::free(source);
+    source = nullptr;
+    ::close(fd);
+    fd = -1;
+    for (char *slot : qAsConst(slots)) ::free(slot);
+    slots.clear();
+    delete reader;
+    delete writer;
+    reader = writer = nullptr;
+
+    const bool ok = !cancelled.load() && !failed.load();
+    if (!ok) {
+        if (cancelled.load() && error.isEmpty()) error = "Cancelled";
+        QFile::remove(outputPath);
+    }
+    trace.reset();
+    emit finished(ok, error);
+}
@@ -0,0 +1,93 @@
+#ifndef ISOBURNWRITER_H
+#define ISOBURNWRITER_H
+
+#include <QObject>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QScopedPointer>
+
+#include "isotrace.h"
+
+extern "C" {
+    #include <libisofs/libisofs.h>
+}
+
+class QThread;
+
+// Writes an IsoImage through iso_image_create_burn_source() instead of one
+// opaque blocking call. A pump thread pulls fixed-size chunks (a multiple
+// of 2048 bytes) from the burn source into a ring buffer and a second
+// thread drains it to the output file with large sequential writes, so
+// the GUI thread only ever sees the progress signals.
+class IsoBurnWriter : public QObject {
+    Q_OBJECT
+
+public:
+    static const int ChunkSize = 512 * 2048;    // 1 MiB
+    static const int RingSlots = 16;
+
+    explicit IsoBurnWriter(QObject *parent = nullptr);
+    ~IsoBurnWriter() override;
+
+    // iso_init() once per process; iso_finish() runs when the application exits.
+    static bool initLibrary(QString *error = nullptr);
+
+    // Bypass the page cache for the output (O_DIRECT / F_NOCACHE) where supported.
+    void setDirectIo(bool on) { directIo = on; }
+
+    // The burn source keeps its own reference to image; opts may be freed
+    // once this returns.
+    bool start(IsoImage *image, IsoWriteOpts *opts, const QString &outPath);
+    bool isRunning() const { return source != nullptr; }
+    QString errorString() const { return error; }
+
+public slots:
+    void cancel();
+
+signals:
+    // bytesPerSecond/etaSeconds < 0 while unknown.
+    void progress(qint64 written, qint64 total, double bytesPerSecond, qint64 etaSeconds);
+    void finished(bool ok, const QString &error);
+
+private:
+    void pump();
+    void drain();
+    void fail(const QString &message);
+    void threadDone();
+    void reportProgress();
+    bool writeAll(const char *data, qint64 len, qint64 offset);
+
+    bool directIo = false;
+    QString outputPath;
+    QString error;
+    struct burn_source *source = nullptr;
+    int fd = -1;
+    qint64 total = 0;
+
+    // Ring buffer shared by the two threads, guarded by mutex.
+    QVector<char *> slots;
+    QVector<int> fill;
+    int head = 0;       // next slot to write out
+    int tail = 0;       // next slot to fill
+    int used = 0;
+    bool endOfData = false;
+    QMutex mutex;
+    QWaitCondition notEmpty;
+    QWaitCondition notFull;
+
+    QThread *reader = nullptr;
+    QThread *writer = nullptr;
+    int runningThreads = 0;
+    QAtomicInteger<qint64> written;
+    QAtomicInt cancelled;
+    QAtomicInt failed;
+    QElapsedTimer clock;
+    QTimer progressTimer;
+    QScopedPointer<IsoTrace::Phase> trace;
+};
+
+#endif // ISOBURNWRITER_H
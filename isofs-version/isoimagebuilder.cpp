@@ -0,0 +1,299 @@
+#include "isoimagebuilder.h"
+#include "isobuildtree.h"
+#include "isoreproducible.h"
+#include "isotrace.h"
+
+#include <QBitArray>
+#include <QFile>
+#include <QHash>
+#include <QThread>
+#include <QVector>
+
+#include <algorithm>
+
+#include <sys/stat.h>
+#include <time.h>
+
+const qint64 IsoImageBuilder::NodeBytes;
+const qint64 IsoImageBuilder::TableBytes;
+const qint64 IsoImageBuilder::BatchBytes;
+const int IsoImageBuilder::BatchFiles;
+
+qint64 IsoImageBuilder::estimatedMemory(const IsoBuildTree &tree) {
+    return tree.memoryUsed() + qint64(tree.nodeCount()) * (NodeBytes + TableBytes) + BatchBytes;
+}
+
+void IsoImageBuilder::progress(qint64 &done, qint64 &total) const {
+    switch (step()) {
+    case Hashing:
+        total = stepTotal.load();
+        done = qMin(total, stepDone.load() + dedup.bytesDone());
+        break;
+    case Compressing:
+        total = stepTotal.load();
+        done = qMin(total, stepDone.load() + compressor.bytesDone());
+        break;
+    case Adding:
+        done = added.load();
+        total = nodes.load();
+        break;
+    }
+}
+
+void IsoImageBuilder::cancel() {
+    stop.store(1);
+    dedup.cancel();
+    compressor.cancel();
+}
+
+bool IsoImageBuilder::build(const IsoBuildTree &tree, IsoImage **image, IsoWriteOpts **opts) {
+    *image = nullptr;
+    *opts = nullptr;
+    error.clear();
+    dedupBytes = zisofsBytes = 0;
+    current.store(Hashing);
+    added.store(0);
+    nodes.store(tree.nodeCount() - 1);
+
+    // Identical files are added from one source path; libisofs then
+    // writes a single extent for nodes with the same device and inode.
+    // Only sizes that come up more than once can have duplicates. Every
+    // table here is indexed or filled by node, TableBytes a node in all,
+    // and the deduplicator sees whole size groups, bigger ones split by
+    // hash, at most BatchFiles files at a time.
+    const quint64 NotAFile = ~quint64(0);
+    QVector<quint64> sizes(tree.nodeCount(), NotAFile);
+    QVector<IsoBuildTree::Node> bySize;
+    tree.walk([&](IsoBuildTree::Node node) {
+        struct stat st;
+        if (tree.isDirectory(node) || ::lstat(tree.sourcePath(node).constData(), &st) != 0 || !S_ISREG(st.st_mode))
+            return true;
+        sizes[int(node)] = quint64(st.st_size);
+        bySize.append(node);
+        return true;
+    });
+    // Stable, so each group stays in path order, which decides the copy
+    // that is kept.
+    std::stable_sort(bySize.begin(), bySize.end(), [&](IsoBuildTree::Node a, IsoBuildTree::Node b) {
+        return sizes.at(int(a)) < sizes.at(int(b));
+    });
+    // The end of the group of equal size that starts at first.
+    auto groupEnd = [&](int first) {
+        int end = first + 1;
+        while (end < bySize.size() && sizes.at(int(bySize.at(end))) == sizes.at(int(bySize.at(first)))) ++end;
+        return end;
+    };
+    qint64 candidateBytes = 0;
+    for (int first = 0, end; first < bySize.size(); first = end) {
+        end = groupEnd(first);
+        if (end - first > 1) candidateBytes += qint64(sizes.at(int(bySize.at(first)))) * (end - first);
+    }
+    stepDone.store(0);
+    stepTotal.store(candidateBytes);
+
+    QVector<IsoBuildTree::Node> canonical;
+    auto isKept = [&](IsoBuildTree::Node node) {
+        return canonical.isEmpty() || canonical.at(int(node)) == IsoBuildTree::NoNode;
+    };
+    auto file = [&](IsoBuildTree::Node node) {
+        return IsoDeduplicator::File{QString(), QFile::decodeName(tree.sourcePath(node)), sizes.at(int(node)), node};
+    };
+    QVector<IsoDeduplicator::File> batch;
+    qint64 batchBytes = 0;
+    // With carry, the files the batch kept stay in it for the next part of
+    // the same run, up to half a batch; beyond that they are hard links,
+    // which libisofs shares anyway, or hash collisions.
+    auto flushDedup = [&](bool carry) {
+        for (const IsoDeduplicator::Duplicate &d : dedup.run(batch)) {
+            if (canonical.isEmpty()) canonical.fill(IsoBuildTree::NoNode, tree.nodeCount());
+            canonical[int(d.tag)] = d.canonicalTag;
+        }
+        dedupBytes += dedup.bytesSaved();
+        stepDone.fetchAndAddOrdered(batchBytes);
+        batchBytes = 0;
+        QVector<IsoDeduplicator::File> keptFiles;
+        for (int i = 0; carry && i < batch.size() && keptFiles.size() < BatchFiles / 2; ++i)
+            if (isKept(batch.at(i).tag)) keptFiles << batch.at(i);
+        batch = keptFiles;
+    };
+    // A size group bigger than a batch is hashed a batch at a time, then
+    // split into runs of equal hash; a run still bigger than a batch goes
+    // through in parts.
+    auto dedupLargeGroup = [&](int first, int end) {
+        typedef QPair<quint64, IsoBuildTree::Node> Hashed;
+        QVector<Hashed> hashed;
+        hashed.reserve(end - first);
+        for (int from = first; from < end && !isCancelled(); from += BatchFiles) {
+            QVector<IsoDeduplicator::File> chunk;
+            qint64 chunkBytes = 0;
+            for (int i = from; i < qMin(end, from + BatchFiles); ++i) {
+                chunk << file(bySize.at(i));
+                chunkBytes += qint64(chunk.last().size);
+            }
+            QVector<bool> ok;
+            const QVector<quint64> hashes = dedup.hashFiles(chunk, &ok);
+            for (int i = 0; i < chunk.size(); ++i)
+                if (ok.at(i)) hashed << Hashed(hashes.at(i), chunk.at(i).tag);
+            stepDone.fetchAndAddOrdered(chunkBytes);
+        }
+        std::stable_sort(hashed.begin(), hashed.end(),
+                         [](const Hashed &a, const Hashed &b) { return a.first < b.first; });
+        for (int from = 0, to; from < hashed.size() && !isCancelled(); from = to) {
+            to = from + 1;
+            while (to < hashed.size() && hashed.at(to).first == hashed.at(from).first) ++to;
+            if (to - from < 2) continue;
+            if (!batch.isEmpty() && batch.size() + (to - from) > BatchFiles) flushDedup(false);
+            for (int i = from; i < to && !isCancelled(); ++i) {
+                if (batch.size() == BatchFiles) flushDedup(true);
+                batch << file(hashed.at(i).second);
+            }
+            if (to - from > BatchFiles && !isCancelled()) flushDedup(false);
+        }
+    };
+    dedup.holdCache(true);
+    for (int first = 0, end; first < bySize.size() && !isCancelled(); first = end) {
+        const quint64 size = sizes.at(int(bySize.at(first)));
+        end = groupEnd(first);
+        if (size > 0 && end - first > BatchFiles) {
+            dedupLargeGroup(first, end);
+        } else if (size > 0 && end - first > 1) {
+            if (!batch.isEmpty() && batch.size() + (end - first) > BatchFiles) flushDedup(false);
+            for (int i = first; i < end; ++i) batch << file(bySize.at(i));
+            batchBytes += qint64(size) * (end - first);
+        }
+    }
+    if (!batch.isEmpty() && !isCancelled()) flushDedup(false);
+    dedup.holdCache(false);
+    bySize.clear();
+    bySize.squeeze();
+    if (isCancelled()) {
+        error = "Cancelled";
+        return false;
+    }
+    // The node whose source a file is added from.
+    auto kept = [&](IsoBuildTree::Node node) { return isKept(node) ? node : canonical.at(int(node)); };
+
+    // Compressed copies are made up front on every core: libisofs lays
+    // out the whole image, and so needs each file's final size, before it
+    // writes a byte. It marks them with ZF entries by their magic. Each
+    // kept file's copy is named after its node, one bit a node says
+    // whether it got smaller.
+    QBitArray compressed;
+    auto copyPath = [&](IsoBuildTree::Node node) {
+        return QFile::encodeName(zisofsDir + '/' + QString::number(node) + ".zf");
+    };
+    if (zisofs) {
+        current.store(Compressing);
+        compressed.resize(tree.nodeCount());
+        qint64 keptBytes = 0;
+        for (int i = 0; i < sizes.size(); ++i)
+            if (sizes.at(i) != NotAFile && kept(IsoBuildTree::Node(i)) == IsoBuildTree::Node(i))
+                keptBytes += qint64(sizes.at(i));
+        stepDone.store(0);
+        stepTotal.store(keptBytes);
+        compressor.setMaxThreads(QThread::idealThreadCount());
+
+        QStringList sources, targets;
+        QVector<IsoBuildTree::Node> batchNodes;
+        auto flushZisofs = [&]() {
+            const QBitArray smaller = compressor.compressFiles(sources, targets);
+            for (int i = 0; i < batchNodes.size(); ++i)
+                if (smaller.testBit(i)) compressed.setBit(int(batchNodes.at(i)));
+            zisofsBytes += compressor.bytesBefore() - compressor.bytesAfter();
+            stepDone.fetchAndAddOrdered(batchBytes);
+            sources.clear();
+            targets.clear();
+            batchNodes.clear();
+            batchBytes = 0;
+        };
+        tree.walk([&](IsoBuildTree::Node node) {
+            if (isCancelled()) return false;
+            if (sizes.at(int(node)) == NotAFile || kept(node) != node) return true;
+            sources << QFile::decodeName(tree.sourcePath(node));
+            targets << QFile::decodeName(copyPath(node));
+            batchNodes << node;
+            batchBytes += qint64(sizes.at(int(node)));
+            if (batchNodes.size() == BatchFiles) flushZisofs();
+            return true;
+        });
+        if (!batchNodes.isEmpty() && !isCancelled()) flushZisofs();
+    }
+    sizes.clear();
+    sizes.squeeze();
+    if (isCancelled()) {
+        error = "Cancelled";
+        return false;
+    }
+    current.store(Adding);
+
+    if (iso_image_new(volumeId.toUtf8().constData(), image) < 0) {
+        error = "Failed to create the image";
+        return false;
+    }
+
+    // With SOURCE_DATE_EPOCH set, identical inputs give identical bytes:
+    // fixed dates and owners, and data placed in path order through
+    // descending sort weights (libisofs otherwise orders it by source
+    // inode number).
+    const IsoReproducibleBuild reproducible = IsoReproducibleBuild::fromEnvironment();
+
+    // One pass over the build tree in path order, parents first.
+    IsoTrace::Phase trace("stage", "libisofs tree");
+    QHash<IsoBuildTree::Node, IsoDir *> dirs;
+    dirs.insert(IsoBuildTree::Root, iso_image_get_root(*image));
+    int weight = tree.nodeCount();
+    qint64 fileNodes = 0;
+    tree.walk([&](IsoBuildTree::Node node) {
+        if (isCancelled()) {
+            error = "Cancelled";
+            return false;
+        }
+        added.ref();
+        IsoDir *dir = dirs.value(tree.parent(node));
+        if (!dir) return true;
+        const IsoBuildTree::Node from = kept(node);
+        const bool zf = !compressed.isEmpty() && compressed.testBit(int(from));
+        const QByteArray source = zf ? copyPath(from) : tree.sourcePath(from);
+
+        IsoNode *isoNode = nullptr;
+        int ret;
+        if (source.isEmpty())
+            ret = iso_tree_add_new_dir(dir, tree.name(node), reinterpret_cast<IsoDir **>(&isoNode));
+        else
+            ret = iso_tree_add_new_node(*image, dir, tree.name(node), source.constData(), &isoNode);
+        if (ret < 0) {
+            error = "Failed to read file: " + QFile::decodeName(source.isEmpty() ? QByteArray(tree.name(node)) : source);
+            return false;
+        }
+        const enum IsoNodeType type = iso_node_get_type(isoNode);
+        if (type == LIBISO_DIR) dirs.insert(node, reinterpret_cast<IsoDir *>(isoNode));
+        if (type == LIBISO_FILE && zf) iso_file_zf_by_magic(reinterpret_cast<IsoFile *>(isoNode), 0);
+        if (type == LIBISO_FILE && reproducible.isEnabled()) iso_node_set_sort_weight(isoNode, weight--);
+        if (type == LIBISO_FILE) ++fileNodes;
+        return true;
+    });
+    trace.addFiles(fileNodes);
+    if (!error.isEmpty()) {
+        iso_image_unref(*image);
+        *image = nullptr;
+        return false;
+    }
+
+    iso_write_opts_new(opts, 1);
+    iso_write_opts_set_joliet(*opts, 1);
+    // Session MD5 tags and one MD5 per file, as xorriso -md5 on.
+    iso_write_opts_set_record_md5(*opts, 1, 1);
+    if (reproducible.isEnabled()) {
+        const time_t when = time_t(reproducible.timestamp());
+        QByteArray uuid = reproducible.uuid().toLatin1();
+        iso_write_opts_set_pvd_times(*opts, when, when, 0, 0, uuid.data());
+        iso_write_opts_set_replace_timestamps(*opts, 2);
+        iso_write_opts_set_default_timestamp(*opts, when);
+        iso_write_opts_set_replace_mode(*opts, 0, 0, 2, 2);
+        iso_write_opts_set_default_uid(*opts, 0);
+        iso_write_opts_set_default_gid(*opts, 0);
+        iso_write_opts_set_always_gmt(*opts, 1);
+        iso_write_opts_set_sort_files(*opts, 1);
+    }
+    return true;
+}
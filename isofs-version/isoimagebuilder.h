@@ -0,0 +1,85 @@
+#ifndef ISOIMAGEBUILDER_H
+#define ISOIMAGEBUILDER_H
+
+#include <QAtomicInteger>
+#include <QString>
+
+#include "isodedup.h"
+#include "isozisofs.h"
+
+extern "C" {
+    #include <libisofs/libisofs.h>
+}
+
+class IsoBuildTree;
+
+// Turns an IsoBuildTree into a libisofs image and write options for
+// IsoBurnWriter. Identical files are stored once (IsoDeduplicator), files
+// can be compressed to zisofs beforehand, and the nodes are created in one
+// pass over the tree in path order. Shared by the frontend and the bench,
+// so what is measured is what the frontend builds.
+//
+// libisofs can't take its tree in pieces: every node stays in memory until
+// the image is written, about NodeBytes each on top of the build tree.
+// The dedup and zisofs passes add TableBytes a node for their tables, and
+// up to BatchBytes for the files they work on at a time. estimatedMemory()
+// says what that comes to; no budget can lower it.
+class IsoImageBuilder {
+public:
+    IsoImageBuilder() {}
+
+    static const qint64 NodeBytes = 320;
+    // Sizes, size and hash orders, duplicates, compressed copies and the
+    // hash cache entry, a node.
+    static const qint64 TableBytes = 120;
+    static const qint64 BatchBytes = qint64(16) << 20;
+    static const int BatchFiles = 16384;
+
+    // Compressed copies go to workDir, which must outlive the write.
+    void setZisofs(bool enabled, const QString &workDir) {
+        zisofs = enabled;
+        zisofsDir = workDir;
+    }
+    void setVolumeId(const QString &id) { volumeId = id; }
+
+    // Blocks, so the frontend runs it on a worker thread. On success the
+    // caller owns image and opts (iso_image_unref, iso_write_opts_free).
+    bool build(const IsoBuildTree &tree, IsoImage **image, IsoWriteOpts **opts);
+    QString errorString() const { return error; }
+
+    // What build() is doing, and how far it got: bytes for hashing and
+    // compressing, entries for the libisofs tree. These and cancel() may be
+    // called from any thread while it runs.
+    enum Step { Hashing, Compressing, Adding };
+    Step step() const { return Step(current.load()); }
+    void progress(qint64 &done, qint64 &total) const;
+    void cancel();
+    bool isCancelled() const { return stop.load() != 0; }
+
+    quint64 dedupSaved() const { return dedupBytes; }
+    quint64 zisofsSaved() const { return zisofsBytes; }
+
+    // The build tree, the tables the build keeps and the libisofs nodes,
+    // together.
+    static qint64 estimatedMemory(const IsoBuildTree &tree);
+
+private:
+    Q_DISABLE_COPY(IsoImageBuilder)
+
+    IsoDeduplicator dedup;
+    IsoZisofsCompressor compressor;
+    QAtomicInt current;
+    QAtomicInt stop;
+    QAtomicInteger<qint64> stepDone;
+    QAtomicInteger<qint64> stepTotal;
+    QAtomicInteger<qint64> added;
+    QAtomicInteger<qint64> nodes;
+    bool zisofs = false;
+    QString zisofsDir;
+    QString volumeId = "CustomISO";
+    QString error;
+    quint64 dedupBytes = 0;
+    quint64 zisofsBytes = 0;
+};
+
+#endif // ISOIMAGEBUILDER_H
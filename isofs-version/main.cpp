@@ -8,16 +8,68 @@
 #include <QProcess>
 #include <QDebug>
 #include <QDir>
+#include <QHBoxLayout>
+#include <QProgressBar>
+#include <QLabel>
+#include <QCheckBox>
+#include <QSpinBox>
+#include <QHash>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QTimer>
 
-extern "C" {
-    #include <libisofs/libisofs.h>
-}
+#include <functional>
+
+#include "isoburnwriter.h"
+#include "isobuildtree.h"
+#include "isoimagebuilder.h"
+#include "isoverifier.h"
+#include "isotrace.h"
+
+namespace {
+
+class Task : public QRunnable {
+public:
+    explicit Task(std::function<void()> function) : function(std::move(function)) {}
+    void run() override { function(); }
+
+private:
+    std::function<void()> function;
+};
+
+} // namespace
 
 class IsoManager : public QWidget {
     Q_OBJECT
 
     QListWidget *fileList;
-    QStringList addedFiles;
+    // What was added, by ISO path; trees stream into the build tree and are
+    // listed by their top directory only.
+    IsoBuildTree tree;
+    QHash<QString, QListWidgetItem *> listed;
+    QSpinBox *budgetBox;
+    QPushButton *btnSave;
+    QPushButton *btnCancel;
+    QCheckBox *directIoCheck;
+    QCheckBox *zisofsCheck;
+    QProgressBar *progressBar;
+    QLabel *progressLabel;
+    IsoBurnWriter *writer;
+    IsoVerifier *verifier;
+    QString outputPath;
+    quint64 dedupSaved = 0;
+    quint64 zisofsSaved = 0;
+    // Compressed copies, needed until the writer is done with them.
+    QScopedPointer<QTemporaryDir> zisofsDir;
+    // The image is built on buildPool; the tree and what changes it are
+    // left alone until it's done.
+    QScopedPointer<IsoImageBuilder> builder;
+    QThreadPool buildPool;
+    QTimer *buildTimer;
+    QList<QWidget *> treeControls;
 
 public:
     IsoManager(QWidget *parent = nullptr) : QWidget(parent) {
@@ -28,90 +80,285 @@ public:
         layout->addWidget(fileList);
 
         QPushButton *btnAdd = new QPushButton("Add File(s)", this);
+        QPushButton *btnAddFolder = new QPushButton("Add Folder", this);
         QPushButton *btnRemove = new QPushButton("Remove Selected", this);
-        QPushButton *btnSave = new QPushButton("Save ISO", this);
+        btnSave = new QPushButton("Save ISO", this);
+        directIoCheck = new QCheckBox("Bypass page cache (O_DIRECT)", this);
+        zisofsCheck = new QCheckBox("Compress files (zisofs)", this);
+
+        budgetBox = new QSpinBox(this);
+        budgetBox->setRange(0, 1 << 20);
+        budgetBox->setSuffix(" MB");
+        budgetBox->setSpecialValueText("Unlimited");
+        budgetBox->setValue(256);
+        tree.setMemoryBudget(qint64(budgetBox->value()) << 20);
+        QHBoxLayout *budgetLayout = new QHBoxLayout();
+        budgetLayout->addWidget(new QLabel("Memory budget:", this));
+        budgetLayout->addWidget(budgetBox, 1);
 
         layout->addWidget(btnAdd);
+        layout->addWidget(btnAddFolder);
         layout->addWidget(btnRemove);
+        layout->addWidget(directIoCheck);
+        layout->addWidget(zisofsCheck);
+        layout->addLayout(budgetLayout);
         layout->addWidget(btnSave);
 
+        QHBoxLayout *progressLayout = new QHBoxLayout();
+        progressBar = new QProgressBar(this);
+        progressBar->setRange(0, 1000);
+        progressBar->setValue(0);
+        progressLabel = new QLabel(this);
+        btnCancel = new QPushButton("Cancel", this);
+        btnCancel->setEnabled(false);
+        progressLayout->addWidget(progressBar, 1);
+        progressLayout->addWidget(progressLabel);
+        progressLayout->addWidget(btnCancel);
+        layout->addLayout(progressLayout);
+
+        treeControls << btnAdd << btnAddFolder << btnRemove << budgetBox << zisofsCheck;
+
+        writer = new IsoBurnWriter(this);
+        verifier = new IsoVerifier(this);
+        buildPool.setMaxThreadCount(1);
+        buildTimer = new QTimer(this);
+        buildTimer->setInterval(200);
+        connect(buildTimer, &QTimer::timeout, this, &IsoManager::showBuildProgress);
+
         connect(btnAdd, &QPushButton::clicked, this, &IsoManager::addFiles);
+        connect(btnAddFolder, &QPushButton::clicked, this, &IsoManager::addFolder);
+        connect(budgetBox, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), this,
+                [this](int mb) { tree.setMemoryBudget(qint64(mb) << 20); });
         connect(btnRemove, &QPushButton::clicked, this, &IsoManager::removeSelected);
         connect(btnSave, &QPushButton::clicked, this, &IsoManager::saveIso);
+        connect(btnCancel, &QPushButton::clicked, this, [this]() {
+            if (builder) builder->cancel();
+        });
+        connect(btnCancel, &QPushButton::clicked, writer, &IsoBurnWriter::cancel);
+        connect(btnCancel, &QPushButton::clicked, verifier, &IsoVerifier::cancel);
+        connect(writer, &IsoBurnWriter::progress, this, &IsoManager::showProgress);
+        connect(verifier, &IsoVerifier::progress, this, [this](qint64 done, qint64 total, double bytesPerSecond) {
+            showProgress(done, total, bytesPerSecond, -1);
+            progressLabel->setText("Checksums: " + progressLabel->text());
+        });
+        connect(writer, &IsoBurnWriter::finished, this, [this](bool ok, const QString &error) {
+            zisofsDir.reset();
+            // The image is read back once for its checksum manifests.
+            if (ok && verifier->start(outputPath)) return;
+            btnSave->setEnabled(true);
+            btnCancel->setEnabled(false);
+            if (ok) {
+                progressBar->setValue(progressBar->maximum());
+                QMessageBox::information(this, "Success", successMessage());
+            } else {
+                progressBar->setValue(0);
+                progressLabel->clear();
+                QMessageBox::critical(this, "Error", "Failed to write ISO: " + error);
+            }
+        });
+        connect(verifier, &IsoVerifier::finished, this, [this](bool ok) {
+            btnSave->setEnabled(true);
+            btnCancel->setEnabled(false);
+            progressBar->setValue(progressBar->maximum());
+            QString message = successMessage();
+            QString error;
+            if (ok && IsoVerifier::writeManifests(outputPath, verifier->result(), &error))
+                message += "\nChecksums written to " + QFileInfo(IsoVerifier::manifestPath(outputPath)).fileName() + ".";
+            else if (!verifier->result().cancelled)
+                message += "\nNo checksum manifest: " + (error.isEmpty() ? verifier->result().errors.value(0) : error);
+            QMessageBox::information(this, "Success", message);
+        });
+    }
+
+    ~IsoManager() {
+        if (builder) builder->cancel();
+        buildPool.waitForDone();
     }
 
 private slots:
+    // Files go to the root under their own name; adding another file of
+    // the same name replaces the first.
     void addFiles() {
         QStringList files = QFileDialog::getOpenFileNames(this, "Add files");
         for (const QString &file : files) {
-            if (!addedFiles.contains(file)) {
-                addedFiles << file;
-                fileList->addItem(file);
+            const QFileInfo fi(file);
+            const QString isoPath = "/" + fi.fileName();
+            if (tree.add(isoPath, fi.absoluteFilePath(), false) == IsoBuildTree::NoNode) {
+                QMessageBox::critical(this, "Error", tree.errorString());
+                return;
             }
+            showEntry(isoPath, file);
         }
     }
 
+    // Everything below the folder is streamed in as it is scanned.
+    void addFolder() {
+        const QString dir = QFileDialog::getExistingDirectory(this, "Add folder");
+        if (dir.isEmpty()) return;
+        const QString isoPath = "/" + QFileInfo(dir).fileName();
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+        const bool ok = tree.addTree(isoPath, dir);
+        QApplication::restoreOverrideCursor();
+        if (tree.find(isoPath) != IsoBuildTree::NoNode) showEntry(isoPath, dir);
+        if (!ok) QMessageBox::critical(this, "Error", "Not everything in the folder was added: " + tree.errorString());
+    }
+
+    void showEntry(const QString &isoPath, const QString &source) {
+        QListWidgetItem *item = listed.value(isoPath);
+        if (!item) {
+            item = new QListWidgetItem(fileList);
+            item->setData(Qt::UserRole, isoPath);
+            listed.insert(isoPath, item);
+        }
+        item->setText(source);
+    }
+
     void removeSelected() {
         QListWidgetItem *item = fileList->currentItem();
         if (!item) return;
-        QString path = item->text();
-        addedFiles.removeAll(path);
+        const QString isoPath = item->data(Qt::UserRole).toString();
+        tree.remove(isoPath);
+        listed.remove(isoPath);
         delete item;
     }
 
     void saveIso() {
-        if (addedFiles.isEmpty()) {
+        if (listed.isEmpty()) {
             QMessageBox::warning(this, "No Files", "No files to save.");
             return;
         }
 
+        // libisofs holds every entry until the image is written, on top of
+        // the build tree; it can't take them in pieces.
+        const qint64 budget = tree.memoryBudget();
+        const qint64 needed = IsoImageBuilder::estimatedMemory(tree);
+        if (budget > 0 && needed > budget
+            && QMessageBox::question(this, "Memory budget",
+                                     QString("libisofs keeps all %1 entries in memory while it writes, about %2 MB in "
+                                             "all, over the budget of %3 MB. Build anyway?")
+                                         .arg(tree.nodeCount() - 1).arg(needed >> 20).arg(budget >> 20))
+                   != QMessageBox::Yes)
+            return;
+
         QString isoPath = QFileDialog::getSaveFileName(this, "Save ISO", "", "*.iso");
         if (isoPath.isEmpty()) return;
 
-        IsoImage *image = nullptr;
-        IsoWriteOpts *opts = nullptr;
-        IsoNode *root = nullptr;
-        IsoFilesystem *fs = nullptr;
-
-        iso_init();
-        iso_image_new("CustomISO", &image);
-      //  iso_image_get_filesystem(image, &fs);
-        iso_image_get_root(image, &root);
-
-        for (const QString &filePath : addedFiles) {
-            QFileInfo fi(filePath);
-            QByteArray pathUtf8 = filePath.toUtf8();
-            QByteArray nameUtf8 = fi.fileName().toUtf8();
-
-            IsoNode *node;
-            int ret = iso_node_from_path(fs, pathUtf8.data(), &node);
-            if (ret < 0) {
-                QMessageBox::critical(this, "Error", "Failed to read file: " + filePath);
-                return;
-            }
-
-            iso_node_set_name(node, nameUtf8.data());
-            iso_dir_add_node(root, node);
+        QString error;
+        if (!IsoBurnWriter::initLibrary(&error)) {
+            QMessageBox::critical(this, "Error", error);
+            return;
         }
 
-        iso_write_opts_new(&opts, 1);
-        QFile isoFile(isoPath);
-        if (!isoFile.open(QIODevice::WriteOnly)) {
-            QMessageBox::critical(this, "Error", "Failed to create ISO file.");
-            return;
+        zisofsDir.reset();
+        builder.reset(new IsoImageBuilder);
+        if (zisofsCheck->isChecked()) {
+            zisofsDir.reset(new QTemporaryDir);
+            if (zisofsDir->isValid()) builder->setZisofs(true, zisofsDir->path());
         }
+        outputPath = isoPath;
+        setBuilding(true);
 
-        int fd = isoFile.handle();  // get raw POSIX file descriptor
-        int ret = iso_image_write(image, fd, opts);
-        if (ret < 0) {
-            QMessageBox::critical(this, "Error", "Failed to write ISO.");
-        } else {
-            QMessageBox::information(this, "Success", "ISO written successfully.");
+        // Hashing for duplicates, compressing and making the libisofs tree
+        // read every file, so they run off the GUI thread.
+        IsoManager *self = this;
+        IsoImageBuilder *b = builder.data();
+        const IsoBuildTree *t = &tree;
+        buildPool.start(new Task([self, b, t]() {
+            IsoImage *image = nullptr;
+            IsoWriteOpts *opts = nullptr;
+            const bool ok = b->build(*t, &image, &opts);
+            QMetaObject::invokeMethod(self, [self, ok, image, opts]() {
+                self->buildFinished(ok, image, opts);
+            }, Qt::QueuedConnection);
+        }));
+        buildTimer->start();
+    }
+
+private:
+    void buildFinished(bool ok, IsoImage *image, IsoWriteOpts *opts) {
+        buildTimer->stop();
+        const bool cancelled = builder->isCancelled();
+        const QString error = builder->errorString();
+        dedupSaved = builder->dedupSaved();
+        zisofsSaved = builder->zisofsSaved();
+        builder.reset();
+        if (ok && cancelled) {
+            iso_write_opts_free(opts);
+            iso_image_unref(image);
+            ok = false;
+        }
+        if (!ok) {
+            zisofsDir.reset();
+            setBuilding(false);
+            btnSave->setEnabled(true);
+            btnCancel->setEnabled(false);
+            progressBar->setValue(0);
+            progressLabel->clear();
+            if (!cancelled) QMessageBox::critical(this, "Error", error);
+            return;
         }
 
+        writer->setDirectIo(directIoCheck->isChecked());
+        const bool started = writer->start(image, opts, outputPath);
+        // The burn source holds what it needs from both from here on.
         iso_write_opts_free(opts);
         iso_image_unref(image);
-        iso_finish();
+        setBuilding(false);
+        if (!started) {
+            zisofsDir.reset();
+            btnSave->setEnabled(true);
+            btnCancel->setEnabled(false);
+            QMessageBox::critical(this, "Error", "Failed to write ISO: " + writer->errorString());
+            return;
+        }
+        progressBar->setValue(0);
+    }
+
+    // Save and Cancel are handed on to the writer and the verifier, which
+    // give them back when they finish.
+    void setBuilding(bool building) {
+        for (QWidget *w : qAsConst(treeControls)) w->setEnabled(!building);
+        if (building) {
+            btnSave->setEnabled(false);
+            btnCancel->setEnabled(true);
+            progressBar->setValue(0);
+        }
+    }
+
+    void showBuildProgress() {
+        if (!builder) return;
+        qint64 done = 0, total = 0;
+        builder->progress(done, total);
+        progressBar->setValue(total > 0 ? int(done * 1000 / total) : 0);
+        switch (builder->step()) {
+        case IsoImageBuilder::Hashing:
+            progressLabel->setText(QString("Finding duplicates  %1 / %2 MB").arg(done >> 20).arg(total >> 20));
+            break;
+        case IsoImageBuilder::Compressing:
+            progressLabel->setText(QString("Compressing  %1 / %2 MB").arg(done >> 20).arg(total >> 20));
+            break;
+        case IsoImageBuilder::Adding:
+            progressLabel->setText(QString("Adding  %1 / %2 entries").arg(done).arg(total));
+            break;
+        }
+    }
+
+    QString successMessage() const {
+        QString message = "ISO written successfully.";
+        if (dedupSaved > 0)
+            message += QString("\n%1 MB saved by storing identical files once.").arg(dedupSaved / (1024.0 * 1024.0), 0, 'f', 1);
+        if (zisofsSaved > 0)
+            message += QString("\n%1 MB saved by zisofs compression.").arg(zisofsSaved / (1024.0 * 1024.0), 0, 'f', 1);
+        return message;
+    }
+
+    void showProgress(qint64 written, qint64 total, double bytesPerSecond, qint64 etaSeconds) {
+        if (total > 0) progressBar->setValue(int(written * 1000 / total));
+        QStringList parts;
+        parts << QString("%1 / %2 MB").arg(written / (1024 * 1024)).arg(total / (1024 * 1024));
+        if (bytesPerSecond >= 0) parts << QString("%1 MB/s").arg(bytesPerSecond / (1024.0 * 1024.0), 0, 'f', 1);
+        if (etaSeconds >= 0) parts << QString("ETA %1:%2").arg(etaSeconds / 60).arg(etaSeconds % 60, 2, 10, QChar('0'));
+        progressLabel->setText(parts.join("  "));
     }
 };
 
@@ -119,6 +366,9 @@ private slots:
 
 int main(int argc, char *argv[]) {
     QApplication app(argc, argv);
+    IsoTrace::enableFromEnvironment();
+    // Once per process; IsoBurnWriter registers iso_finish() for exit.
+    IsoBurnWriter::initLibrary();
     IsoManager w;
     w.resize(500, 400);
     w.show();
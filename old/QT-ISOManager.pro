@@ -29,6 +29,7 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 
 RESOURCES +=
 
+include(../core/core.pri)
 
 LIBS += -L/Users/macbook2015/Desktop/brew/lib -lisofs
 
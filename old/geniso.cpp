@@ -1,7 +1,7 @@
 #include <QApplication>
 #include <QFileDialog>
 #include <QVBoxLayout>
-#include <QTreeWidget>
+#include <QTreeView>
 #include <QPushButton>
 #include <QMessageBox>
 #include <QProcess>
@@ -12,13 +12,32 @@
 #include <QDropEvent>
 #include <QTemporaryDir>
  
+#include "iso9660reader.h"
+#include "isocatalog.h"
+#include "isochangeset.h"
+#include "isotreemodel.h"
+#include "isotreesources.h"
+#include "isostagingarea.h"
+#include "isodedup.h"
+#include "isoverifier.h"
+#include "isotrace.h"
+ 
 class IsoManager : public QWidget {
     Q_OBJECT
  
-    QTreeWidget *tree;
+    QTreeView *tree;
+    IsoTreeModel *model;
     QPushButton *btnAdd, *btnRemove, *btnNew, *btnOpen, *btnSave, *btnAddFolder;
-    QTemporaryDir tempDir;
+    QTemporaryDir tempDir;           // only for images the native reader can't parse
+    IsoStagingArea staging;          // a new image, or one unpacked into tempDir
+    IsoStagingSource stagingSource{&staging};
     QString isoPath;
+    // An opened image is browsed through its directory records and edited
+    // as a change list; nothing is unpacked.
+    Iso9660Reader reader;
+    IsoCatalog catalog;
+    IsoReaderSource readerSource{&reader, &catalog};
+    IsoChangeSet changes;
  
 public:
     IsoManager(QWidget *parent = nullptr) : QWidget(parent) {
@@ -26,8 +45,11 @@ public:
         setAcceptDrops(true);
  
         QVBoxLayout *layout = new QVBoxLayout(this);
-        tree = new QTreeWidget(this);
-        tree->setHeaderLabels({"ISO Contents"});
+        model = new IsoTreeModel(this);
+        model->setHeaderLabel("ISO Contents");
+        model->setIcons(style()->standardIcon(QStyle::SP_DirIcon), style()->standardIcon(QStyle::SP_FileIcon));
+        tree = new QTreeView(this);
+        tree->setModel(model);
         tree->setSelectionMode(QAbstractItemView::SingleSelection);
         layout->addWidget(tree);
  
@@ -66,14 +88,9 @@ protected:
         for (const QUrl &url : event->mimeData()->urls()) {
             QString localPath = url.toLocalFile();
             QFileInfo info(localPath);
-            QString destPath = tempDir.path() + "/" + info.fileName();
-            if (info.isDir()) {
-                QDir().mkpath(destPath);
-            } else {
-                QFile::copy(localPath, destPath);
-            }
+            if (info.exists()) stage("/" + info.fileName(), localPath);
         }
-        refreshTree();
+        if (!reader.isOpen()) refreshTree();
     }
  
 private slots:
@@ -81,35 +98,41 @@ private slots:
         QStringList files = QFileDialog::getOpenFileNames(this, "Select File(s)");
         for (const QString &file : files) {
             QFileInfo fi(file);
-            QFile::copy(file, tempDir.path() + "/" + fi.fileName());
+            stage("/" + fi.fileName(), file);
         }
-        refreshTree();
+        if (!reader.isOpen()) refreshTree();
     }
  
     void addFolder() {
         bool ok;
         QString name = QInputDialog::getText(this, "New Folder", "Folder Name:", QLineEdit::Normal, "", &ok);
         if (ok && !name.isEmpty()) {
-            QDir dir(tempDir.path());
-            dir.mkpath(name);
-            refreshTree();
+            if (reader.isOpen()) {
+                const int from = changes.size();
+                changes.addDirectory(name);
+                changes.applyTo(model, from);
+            } else {
+                staging.addDirectory(name);
+                refreshTree();
+            }
         }
     }
  
     void removeSelected() {
-        QTreeWidgetItem *item = tree->currentItem();
-        if (!item) return;
-        QString fullPath = tempDir.path() + "/" + item->data(0, Qt::UserRole).toString();
-        QFileInfo info(fullPath);
-        if (info.isDir()) {
-            QDir(fullPath).removeRecursively();
+        QModelIndex item = tree->currentIndex();
+        if (!item.isValid()) return;
+        // Only the staging entry goes; the source on disk is left alone.
+        if (reader.isOpen()) {
+            changes.remove(model->path(item));
         } else {
-            QFile::remove(fullPath);
+            staging.remove(model->path(item));
         }
-        delete item;
+        model->removeIndex(item);
     }
  
     void newIso() {
+        closeImage();
+        staging.clear();
         tempDir.remove();  // auto-cleans
         refreshTree();
         QMessageBox::information(this, "New ISO", "New ISO project started.");
@@ -118,8 +141,18 @@ private slots:
     void openIso() {
         QString file = QFileDialog::getOpenFileName(this, "Open ISO File", "", "*.iso");
         if (file.isEmpty()) return;
+        closeImage();
+        staging.clear();
         isoPath = file;
         tempDir.remove();
+        if (reader.open(isoPath)) {
+            // Directory records only, and from the cached catalog if this
+            // image was opened before.
+            if (!catalog.load(isoPath)) IsoCatalog::buildInBackground(isoPath);
+            refreshTree();
+            return;
+        }
+        // Not something the native reader understands (UDF-only, damaged...).
         QProcess p;
         QString command = QString("7z x \"%1\" -o\"%2\" -y").arg(isoPath, tempDir.path());
         p.start(command);
@@ -127,72 +160,120 @@ private slots:
             QMessageBox::critical(this, "Error", "Failed to extract ISO. Ensure 7z is installed.");
             return;
         }
+        staging.add("/", tempDir.path());
         refreshTree();
     }
  
     void saveIso() {
         QString outFile = QFileDialog::getSaveFileName(this, "Save ISO", "", "*.iso");
         if (outFile.isEmpty()) return;
+        if (reader.isOpen()) {
+            saveEditedImage(outFile);
+            return;
+        }
  
         QProcess p;
         QStringList args = {
             "-o", outFile,
-            "-J", "-R", "-V", "MyISO",
-            "-graft-points"
+            "-J", "-R", "-V", "MyISO"
         };
- 
-        QStringList graftArgs;
-        QDir base(tempDir.path());
-        QStringList files = listRecursive(tempDir.path(), base);
-        for (const QString &f : files) {
-            graftArgs << QString("%1=%2").arg(f, tempDir.path() + "/" + f);
+        // Identical files are grafted from one source so genisoimage, which
+        // shares data between hard links, writes them once.
+        IsoStagingArea build = staging;
+        IsoDeduplicator dedup;
+        IsoDeduplicator::apply(build, dedup.run(IsoDeduplicator::stagedFiles(build)));
+        // Graft points and exclusions only, passed as list files so large
+        // trees don't run into ARG_MAX; the data is read where it lives.
+        QTemporaryDir lists;
+        QStringList listArgs;
+        QString error;
+        if (!lists.isValid() || !build.writePathLists(lists.path(), listArgs, &error)) {
+            QMessageBox::critical(this, "Error", "Could not write the path list. " + error);
+            return;
         }
- 
-        args.append(graftArgs);
+        args.append(listArgs);
+        IsoTrace::Phase trace("write", "genisoimage");
         p.start("genisoimage", args);
-        if (!p.waitForFinished() || p.exitCode() != 0) {
+        const bool built = p.waitForFinished(-1) && p.exitCode() == 0;
+        trace.end();
+        if (!built) {
             QMessageBox::critical(this, "Error", "ISO creation failed. Is genisoimage installed?");
         } else {
-            QMessageBox::information(this, "Done", "ISO saved successfully.");
+            QString message = "ISO saved successfully.";
+            if (dedup.bytesSaved() > 0)
+                message += QString("\n%1 MB saved by storing identical files once.").arg(dedup.bytesSaved() / (1024.0 * 1024.0), 0, 'f', 1);
+            reportWithManifests("Done", message, outFile);
         }
     }
  
-    void refreshTree() {
-        tree->clear();
-        addToTree(tempDir.path(), nullptr);
+    // xorriso copies unchanged files from the extents of the open image into
+    // the new one and reads only added or replaced files from disk, so the
+    // only scratch space is the output itself.
+    void saveEditedImage(const QString &outFile) {
+        if (QFileInfo(outFile).absoluteFilePath() == QFileInfo(isoPath).absoluteFilePath()) {
+            QMessageBox::warning(this, "Save ISO", "The open image is read while saving; choose another file.");
+            return;
+        }
+        QFile::remove(outFile);
+        IsoTrace::Phase trace("write", "xorriso");
+        QProcess p;
+        p.start("xorriso", QStringList{"-joliet", "on"} + changes.xorrisoArguments(isoPath, outFile));
+        const bool built = p.waitForFinished(-1) && p.exitCode() == 0;
+        trace.end();
+        if (!built) {
+            QMessageBox::critical(this, "Error", "ISO creation failed. Is xorriso installed?\n\n"
+                                  + QString::fromLocal8Bit(p.readAllStandardError()));
+        } else {
+            reportWithManifests("Done", "ISO saved successfully.", outFile);
+        }
     }
  
-    void addToTree(const QString &path, QTreeWidgetItem *parent) {
-        QDir dir(path);
-        QFileInfoList entries = dir.entryInfoList(QDir::NoDotAndDotDot | QDir::AllEntries);
-        for (const QFileInfo &info : entries) {
-            QTreeWidgetItem *item = new QTreeWidgetItem();
-            item->setText(0, info.fileName());
-            item->setData(0, Qt::UserRole, QDir(tempDir.path()).relativeFilePath(info.filePath()));
-            if (info.isDir()) {
-                item->setIcon(0, style()->standardIcon(QStyle::SP_DirIcon));
-                addToTree(info.filePath(), item);
-            } else {
-                item->setIcon(0, style()->standardIcon(QStyle::SP_FileIcon));
-            }
-            if (parent) parent->addChild(item);
-            else tree->addTopLevelItem(item);
+    // Reads the new image back in the background for its sha256sum
+    // manifests, then shows message with how that went.
+    void reportWithManifests(const QString &title, const QString &message, const QString &image) {
+        IsoVerifier *verifier = new IsoVerifier(this);
+        if (!verifier->start(image)) {
+            QMessageBox::information(this, title, message + "\nNo checksum manifest: " + verifier->result().errors.value(0));
+            delete verifier;
+            return;
         }
+        connect(verifier, &IsoVerifier::finished, this, [this, verifier, title, message, image](bool ok) {
+            QString error = verifier->result().errors.value(0);
+            QString note = "\nNo checksum manifest: ";
+            if (ok && IsoVerifier::writeManifests(image, verifier->result(), &error))
+                note = "\nChecksums written to " + QFileInfo(IsoVerifier::manifestPath(image)).fileName() + ".";
+            else
+                note += error.isEmpty() ? QString("cancelled") : error;
+            verifier->deleteLater();
+            QMessageBox::information(this, title, message + note);
+        });
     }
  
-    QStringList listRecursive(const QString &root, const QDir &base) {
-        QStringList out;
-        QFileInfoList files = QDir(root).entryInfoList(QDir::NoDotAndDotDot | QDir::AllEntries);
-        for (const QFileInfo &info : files) {
-            QString relPath = base.relativeFilePath(info.filePath());
-            if (info.isDir()) {
-                out << relPath;
-                out += listRecursive(info.filePath(), base);
-            } else {
-                out << relPath;
-            }
+    void stage(const QString &target, const QString &sourcePath) {
+        if (reader.isOpen()) {
+            const int from = changes.size();
+            changes.add(target, sourcePath);
+            changes.applyTo(model, from);
+        } else {
+            staging.add(target, sourcePath);
+        }
+    }
+ 
+    void closeImage() {
+        changes.clear();
+        catalog.close();
+        reader.close();
+        isoPath.clear();
+    }
+ 
+    void refreshTree() {
+        // Only the top level is listed here; subdirectories load on expand.
+        if (reader.isOpen()) {
+            model->setSource(&readerSource);
+            changes.applyTo(model);
+        } else {
+            model->setSource(&stagingSource);
         }
-        return out;
     }
 };
  
@@ -200,6 +281,7 @@ private slots:
  
 int main(int argc, char *argv[]) {
     QApplication app(argc, argv);
+    IsoTrace::enableFromEnvironment();
     IsoManager win;
     win.resize(600, 500);
     win.show();
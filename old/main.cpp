@@ -5,7 +5,6 @@
 #include <QListWidget>
 #include <QPushButton>
 #include <QFileDialog>
-#include <QTemporaryDir>
 #include <QDir>
 #include <QFileInfo>
 #include <QMessageBox>
@@ -15,6 +14,13 @@
 #include <QMimeData>
 #include <QDropEvent>
 #include <QDebug>
+#include <QTemporaryDir>
+
+#include "isostagingarea.h"
+#include "isodedup.h"
+#include "isoreproducible.h"
+#include "isoverifier.h"
+#include "isotrace.h"
 
 class IsoManager : public QWidget {
     Q_OBJECT
@@ -26,7 +32,8 @@ class IsoManager : public QWidget {
     QPushButton *btnCreateIso;
     QLineEdit *labelInput;
 
-    QTemporaryDir tempDir;
+    // Added files and folders stay where they are; mkisofs gets graft points.
+    IsoStagingArea staging;
 
 public:
     IsoManager(QWidget *parent = nullptr) : QWidget(parent) {
@@ -72,11 +79,7 @@ protected:
             QString localPath = url.toLocalFile();
             QFileInfo fi(localPath);
             if (fi.exists()) {
-                if (fi.isDir()) {
-                    copyFolderRecursively(localPath, tempDir.path() + "/" + fi.fileName());
-                } else {
-                    QFile::copy(localPath, tempDir.path() + "/" + fi.fileName());
-                }
+                staging.add("/" + fi.fileName(), localPath);
                 fileList->addItem(localPath);
             }
         }
@@ -87,9 +90,7 @@ private slots:
         QStringList files = QFileDialog::getOpenFileNames(this, "Add Files");
         for (const QString &file : files) {
             QFileInfo fi(file);
-            QString destPath = tempDir.path() + "/" + fi.fileName();
-            if (QFile::exists(destPath)) QFile::remove(destPath);
-            QFile::copy(file, destPath);
+            staging.add("/" + fi.fileName(), file);
             fileList->addItem(file);
         }
     }
@@ -98,8 +99,7 @@ private slots:
         QString folder = QFileDialog::getExistingDirectory(this, "Select Folder");
         if (!folder.isEmpty()) {
             QFileInfo fi(folder);
-            QString dest = tempDir.path() + "/" + fi.fileName();
-            copyFolderRecursively(folder, dest);
+            staging.add("/" + fi.fileName(), folder);
             fileList->addItem(folder);
         }
     }
@@ -108,12 +108,7 @@ private slots:
         QListWidgetItem *item = fileList->takeItem(fileList->currentRow());
         if (!item) return;
         QFileInfo fi(item->text());
-        QString target = tempDir.path() + "/" + fi.fileName();
-        if (QFileInfo(target).isDir()) {
-            QDir(target).removeRecursively();
-        } else {
-            QFile::remove(target);
-        }
+        staging.remove("/" + fi.fileName());
         delete item;
     }
 
@@ -130,39 +125,76 @@ private slots:
         QStringList args;
         args << "-o" << isoPath;
         if (!label.isEmpty()) args << "-V" << label;
-        args << "-J" << "-R" << ".";
+        // Identical files are grafted from one source; mkisofs stores data
+        // shared between hard links once.
+        IsoStagingArea build = staging;
+        IsoDeduplicator dedup;
+        IsoDeduplicator::apply(build, dedup.run(IsoDeduplicator::stagedFiles(build)));
+        // The graft points go to list files; one argument per entry would hit
+        // ARG_MAX on large trees.
+        QTemporaryDir lists;
+        QStringList listArgs;
+        QString error;
+        if (!lists.isValid() || !build.writePathLists(lists.path(), listArgs, &error)) {
+            QMessageBox::critical(this, "mkisofs failed", "Could not write the path list. " + error);
+            return;
+        }
+        args << "-J" << "-R" << listArgs;
+
+        // mkisofs stamps the volume with the current time and has no way to
+        // pin it, so reproducible builds (SOURCE_DATE_EPOCH set) go through
+        // xorriso's mkisofs emulation instead.
+        QString program = "mkisofs";
+        const IsoReproducibleBuild reproducible = IsoReproducibleBuild::fromEnvironment();
+        if (reproducible.isEnabled()) {
+            program = "xorriso";
+            args = QStringList{"-as", "mkisofs", "--md5"} + args + reproducible.mkisofsArguments();
+            if (!reproducible.writeSortWeights(build, lists.path(), args, &error)) {
+                QMessageBox::critical(this, "mkisofs failed", "Could not write the sort weights. " + error);
+                return;
+            }
+        }
 
+        IsoTrace::Phase trace("write", program);
         QProcess proc;
-        proc.setWorkingDirectory(tempDir.path());
-        proc.start("mkisofs", args);
-        proc.waitForFinished();
+        proc.start(program, args);
+        proc.waitForFinished(-1);
+        trace.end();
 
         QString stdOut = proc.readAllStandardOutput();
         QString stdErr = proc.readAllStandardError();
 
         if (proc.exitCode() == 0) {
-            QMessageBox::information(this, "Success", "ISO created successfully.");
+            QString message = "ISO created successfully.";
+            if (dedup.bytesSaved() > 0)
+                message += QString("\n%1 MB saved by storing identical files once.").arg(dedup.bytesSaved() / (1024.0 * 1024.0), 0, 'f', 1);
+            reportWithManifests("Success", message, isoPath);
         } else {
-            QMessageBox::critical(this, "mkisofs failed",
-                "Command: mkisofs " + args.join(" ") + "\n\nError:\n" + stdErr + "\nOutput:\n" + stdOut);
+            QMessageBox::critical(this, program + " failed",
+                "Command: " + program + " " + args.join(" ") + "\n\nError:\n" + stdErr + "\nOutput:\n" + stdOut);
         }
     }
 
-
 private:
-    void copyFolderRecursively(const QString &srcPath, const QString &destPath) {
-        QDir srcDir(srcPath);
-        QDir destDir;
-        destDir.mkpath(destPath);
-        for (const QFileInfo &entry : srcDir.entryInfoList(QDir::NoDotAndDotDot | QDir::AllEntries)) {
-            QString src = entry.absoluteFilePath();
-            QString dest = destPath + "/" + entry.fileName();
-            if (entry.isDir()) {
-                copyFolderRecursively(src, dest);
-            } else {
-                QFile::copy(src, dest);
-            }
+    // Reads the new image back in the background for its sha256sum
+    // manifests, then shows message with how that went.
+    void reportWithManifests(const QString &title, const QString &message, const QString &image) {
+        IsoVerifier *verifier = new IsoVerifier(this);
+        if (!verifier->start(image)) {
+            QMessageBox::information(this, title, message + "\nNo checksum manifest: " + verifier->result().errors.value(0));
+            delete verifier;
+            return;
         }
+        connect(verifier, &IsoVerifier::finished, this, [this, verifier, title, message, image](bool ok) {
+            QString error = verifier->result().errors.value(0);
+            QString note = "\nNo checksum manifest: ";
+            if (ok && IsoVerifier::writeManifests(image, verifier->result(), &error))
+                note = "\nChecksums written to " + QFileInfo(IsoVerifier::manifestPath(image)).fileName() + ".";
+            else
+                note += error.isEmpty() ? QString("cancelled") : error;
+            verifier->deleteLater();
+            QMessageBox::information(this, title, message + note);
+        });
     }
 };
 
@@ -170,6 +202,7 @@ private:
 
 int main(int argc, char *argv[]) {
     QApplication app(argc, argv);
+    IsoTrace::enableFromEnvironment();
     IsoManager w;
     w.resize(640, 480);
     w.show();
@@ -1,13 +1,13 @@
 #include <QApplication>
 #include <QMainWindow>
-#include <QTreeWidget>
+#include <QTreeView>
 #include <QPushButton>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
+#include <QFile>
 #include <QFileDialog>
 #include <QInputDialog>
 #include <QMessageBox>
-#include <QProcess>
 #include <QLabel>
 #include <QTextEdit>
 #include <QDragEnterEvent>
@@ -15,7 +15,50 @@
 #include <QDropEvent>
 #include <QDir>
 #include <QFileInfo>
+#include <QHash>
 #include <QSplitter>
+#include <QProgressBar>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QTimer>
+#include <QDockWidget>
+#include <QTableView>
+#include <QHeaderView>
+
+#include <functional>
+#include <stdio.h>
+
+#include "iso9660reader.h"
+#include "isocatalog.h"
+#include "isotreemodel.h"
+#include "isotreesources.h"
+#include "isoverifier.h"
+#include "isochangeset.h"
+#include "isostagingarea.h"
+#include "isoextractor.h"
+#include "isoreproducible.h"
+#include "isozisofs.h"
+#include "xorrisocommands.h"
+#include "xorrisojobrunner.h"
+#include "xorrisosession.h"
+#include "isotrace.h"
+#include "isotracemodel.h"
+
+namespace {
+
+class Task : public QRunnable {
+public:
+    explicit Task(std::function<void()> function) : function(std::move(function)) {}
+    void run() override { function(); }
+
+private:
+    std::function<void()> function;
+};
+
+} // namespace
 
 class XorrisoIsoManager : public QMainWindow {
     Q_OBJECT
@@ -32,17 +75,32 @@ public:
         QPushButton *extractBtn = new QPushButton("Extract");
         QPushButton *addBtn = new QPushButton("Add");
         QPushButton *deleteBtn = new QPushButton("Delete");
+        QPushButton *renameBtn = new QPushButton("Rename");
+        applyBtn = new QPushButton("Append Session");
+        applyBtn->setEnabled(false);
         QPushButton *rebuildBtn = new QPushButton("Rebuild ISO");
+        QPushButton *compactBtn = new QPushButton("Compact ISO");
         QPushButton *bootBtn = new QPushButton("Make Bootable ISO");
+        QPushButton *verifyBtn = new QPushButton("Verify ISO");
+        QPushButton *statsBtn = new QPushButton("Stats");
+        statsBtn->setCheckable(true);
         topLayout->addWidget(openBtn);
         topLayout->addWidget(extractBtn);
         topLayout->addWidget(addBtn);
         topLayout->addWidget(deleteBtn);
+        topLayout->addWidget(renameBtn);
+        topLayout->addWidget(applyBtn);
         topLayout->addWidget(rebuildBtn);
+        topLayout->addWidget(compactBtn);
         topLayout->addWidget(bootBtn);
+        topLayout->addWidget(verifyBtn);
+        topLayout->addWidget(statsBtn);
 
-        tree = new QTreeWidget();
-        tree->setHeaderLabel("ISO Contents");
+        model = new IsoTreeModel(this);
+        model->setHeaderLabel("ISO Contents");
+        tree = new QTreeView();
+        tree->setModel(model);
+        tree->setSelectionMode(QAbstractItemView::ExtendedSelection);
 
         output = new QTextEdit();
         output->setReadOnly(true);
@@ -53,8 +111,20 @@ public:
         splitter->setStretchFactor(0, 3);
         splitter->setStretchFactor(1, 1);
 
+        QHBoxLayout *progressLayout = new QHBoxLayout();
+        progressBar = new QProgressBar();
+        progressBar->setRange(0, 100);
+        progressBar->setValue(0);
+        progressLabel = new QLabel();
+        cancelBtn = new QPushButton("Cancel");
+        cancelBtn->setEnabled(false);
+        progressLayout->addWidget(progressBar, 1);
+        progressLayout->addWidget(progressLabel);
+        progressLayout->addWidget(cancelBtn);
+
         mainLayout->addLayout(topLayout);
         mainLayout->addWidget(splitter);
+        mainLayout->addLayout(progressLayout);
 
         setCentralWidget(central);
         resize(800, 600);
@@ -63,8 +133,153 @@ public:
         connect(extractBtn, &QPushButton::clicked, this, &XorrisoIsoManager::extractFile);
         connect(addBtn, &QPushButton::clicked, this, &XorrisoIsoManager::addFile);
         connect(deleteBtn, &QPushButton::clicked, this, &XorrisoIsoManager::deleteFile);
+        connect(renameBtn, &QPushButton::clicked, this, &XorrisoIsoManager::renameFile);
+        connect(applyBtn, &QPushButton::clicked, this, &XorrisoIsoManager::applyChanges);
         connect(rebuildBtn, &QPushButton::clicked, this, &XorrisoIsoManager::rebuildIso);
+        connect(compactBtn, &QPushButton::clicked, this, &XorrisoIsoManager::compactIso);
         connect(bootBtn, &QPushButton::clicked, this, &XorrisoIsoManager::makeBootableIso);
+        connect(verifyBtn, &QPushButton::clicked, this, [this]() {
+            if (!isoPath.isEmpty()) checkImage(isoPath, false);
+        });
+
+        // Per-phase counters; tracing starts when the panel is first shown.
+        QDockWidget *stats = new QDockWidget("Stats", this);
+        QWidget *statsWidget = new QWidget(stats);
+        QVBoxLayout *statsLayout = new QVBoxLayout(statsWidget);
+        QTableView *statsView = new QTableView();
+        statsView->setModel(new IsoTraceModel(statsView));
+        statsView->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
+        statsView->verticalHeader()->hide();
+        QHBoxLayout *statsButtons = new QHBoxLayout();
+        QPushButton *jsonBtn = new QPushButton("Export JSON");
+        QPushButton *chromeBtn = new QPushButton("Export Chrome Trace");
+        QPushButton *clearBtn = new QPushButton("Clear");
+        statsButtons->addWidget(jsonBtn);
+        statsButtons->addWidget(chromeBtn);
+        statsButtons->addStretch();
+        statsButtons->addWidget(clearBtn);
+        statsLayout->addWidget(statsView);
+        statsLayout->addLayout(statsButtons);
+        stats->setWidget(statsWidget);
+        stats->hide();
+        addDockWidget(Qt::BottomDockWidgetArea, stats);
+        connect(statsBtn, &QPushButton::toggled, stats, &QDockWidget::setVisible);
+        connect(stats, &QDockWidget::visibilityChanged, this, [statsBtn, stats](bool) {
+            statsBtn->setChecked(!stats->isHidden());
+            if (!stats->isHidden()) IsoTrace::setEnabled(true);
+        });
+        connect(jsonBtn, &QPushButton::clicked, this, [this]() { exportTrace("stats.json", IsoTrace::toJson()); });
+        connect(chromeBtn, &QPushButton::clicked, this, [this]() {
+            exportTrace("trace.json", IsoTrace::toChromeTrace());
+        });
+        connect(clearBtn, &QPushButton::clicked, this, []() { IsoTrace::clear(); });
+
+        jobs = new XorrisoJobRunner(this);
+        connect(cancelBtn, &QPushButton::clicked, jobs, &XorrisoJobRunner::cancelAll);
+        connect(cancelBtn, &QPushButton::clicked, this, [this]() {
+            if (bootCompressor) bootCompressor->cancel();
+        });
+        bootPool.setMaxThreadCount(1);
+        bootTimer = new QTimer(this);
+        bootTimer->setInterval(200);
+        connect(bootTimer, &QTimer::timeout, this, [this]() {
+            if (!bootCompressor || bootCompressor->bytesTotal() == 0) return;
+            const qint64 done = bootCompressor->bytesDone(), total = bootCompressor->bytesTotal();
+            progressBar->setRange(0, 1000);
+            progressBar->setValue(total > 0 ? int(done * 1000 / total) : 0);
+            progressLabel->setText(QString("Compressing  %1 / %2 MB").arg(done >> 20).arg(total >> 20));
+        });
+        connect(jobs, &XorrisoJobRunner::jobStarted, this, [this](int, const QString &, const QStringList &args) {
+            output->append(">>> " + args.join(" "));
+            progressBar->setRange(0, 0); // busy until xorriso reports a percentage
+            progressLabel->clear();
+            cancelBtn->setEnabled(true);
+        });
+        connect(jobs, &XorrisoJobRunner::outputLine, this, [this](int id, const QString &line, bool) {
+            output->append(line);
+            if (id == estimateJob && XorrisoCommands::parsePrintSize(line) >= 0)
+                estimateBlocks = XorrisoCommands::parsePrintSize(line);
+        });
+        connect(jobs, &XorrisoJobRunner::progress, this, &XorrisoIsoManager::showProgress);
+        connect(jobs, &XorrisoJobRunner::jobFinished, this, [this](int id, bool ok, int exitCode) {
+            if (!ok) output->append(QString("xorriso failed (exit code %1)").arg(exitCode));
+            const QString built = manifestJobs.take(id);
+            if (ok && !built.isEmpty()) checkImage(built, true);
+            if (id == estimateJob) {
+                estimateJob = -1;
+                confirmAppend(ok);
+                return;
+            }
+            if (id == compactJob) {
+                compactJob = -1;
+                finishCompaction(ok);
+                return;
+            }
+            if (id == bootJob) {
+                bootJob = -1;
+                bootTree.reset();
+                return;
+            }
+            if (id != applyJob) return;
+            applyJob = -1;
+            // The session was stopped so the commit could take the image.
+            session.start(isoPath);
+            // The reader and catalog still describe the old session; reopen
+            // on whatever the image now holds. Failed edits stay pending.
+            if (ok) changes.clear();
+            reloadWhenIdle = true;
+            updateApplyButton();
+        });
+        verifier = new IsoVerifier(this);
+        connect(cancelBtn, &QPushButton::clicked, verifier, &IsoVerifier::cancel);
+        connect(verifier, &IsoVerifier::progress, this, [this](qint64 done, qint64 total, double bytesPerSecond) {
+            // Not through showProgress(): read rates say nothing about writes.
+            progressBar->setRange(0, 1000);
+            progressBar->setValue(total > 0 ? int(done * 1000 / total) : 1000);
+            progressLabel->setText(QString("Checking  %1 MB/s").arg(qMax(0.0, bytesPerSecond) / (1024.0 * 1024.0), 0, 'f', 1));
+        });
+        connect(verifier, &IsoVerifier::finished, this, &XorrisoIsoManager::checkFinished);
+        extractor = new IsoExtractor(this);
+        connect(cancelBtn, &QPushButton::clicked, extractor, &IsoExtractor::cancel);
+        connect(extractor, &IsoExtractor::progress, this,
+                [this](qint64 done, qint64 total, int filesDone, int filesTotal, double bytesPerSecond) {
+            const double percent = total > 0 ? done * 100.0 / total : 100.0;
+            const qint64 eta = bytesPerSecond > 0 ? qint64((total - done) / bytesPerSecond) : -1;
+            showProgress(-1, percent, bytesPerSecond, eta);
+            progressLabel->setText(QString("%1/%2 files  ").arg(filesDone).arg(filesTotal) + progressLabel->text());
+        });
+        connect(extractor, &IsoExtractor::fileFinished, this, [this](const QString &target, bool ok, const QString &error) {
+            if (!ok) output->append("Failed to extract " + target + ": " + error);
+        });
+        connect(extractor, &IsoExtractor::finished, this, [this](int failures, bool cancelled) {
+            output->append(cancelled ? QString("Extraction cancelled")
+                                     : QString("Extraction finished, %1 failure(s)").arg(failures));
+            progressBar->setRange(0, 100);
+            progressBar->setValue(0);
+            progressLabel->clear();
+            cancelBtn->setEnabled(jobs->isBusy());
+        });
+        connect(&session, &XorrisoSession::crashed, this, [this](const QString &reason) {
+            output->append("xorriso session: " + reason);
+        });
+        connect(&session, &XorrisoSession::restarted, this, [this](int attempt) {
+            output->append(QString("xorriso session restarted (attempt %1)").arg(attempt));
+        });
+        connect(jobs, &XorrisoJobRunner::idle, this, [this]() {
+            progressBar->setRange(0, 100);
+            progressBar->setValue(0);
+            progressLabel->clear();
+            cancelBtn->setEnabled(false);
+            if (reloadWhenIdle) {
+                reloadWhenIdle = false;
+                loadIso();
+            }
+        });
+    }
+
+    ~XorrisoIsoManager() {
+        if (bootCompressor) bootCompressor->cancel();
+        bootPool.waitForDone();
     }
 
 protected:
@@ -80,99 +295,319 @@ protected:
     }
 
 private:
-    QTreeWidget *tree;
+    QTreeView *tree;
+    IsoTreeModel *model;
     QTextEdit *output;
+    QProgressBar *progressBar;
+    QLabel *progressLabel;
+    QPushButton *cancelBtn;
+    QPushButton *applyBtn;
+    IsoChangeSet changes;
+    int applyJob = -1;
+    int estimateJob = -1;
+    qint64 estimateBlocks = -1;
+    int compactJob = -1;
+    QString compactTemp;
+    int bootJob = -1;
+    QString compactOutput;
+    // Images written by a job, checksummed once it succeeds.
+    QHash<int, QString> manifestJobs;
+    IsoVerifier *verifier;
+    QVector<QPair<QString, bool>> checks;   // image, write its manifest
+    QScopedPointer<QTemporaryDir> bootTree;   // compressed copies and lists for a boot image
+    // Compresses a boot tree or writes its sort weights on bootPool before
+    // its job is queued.
+    QScopedPointer<IsoZisofsCompressor> bootCompressor;
+    QThreadPool bootPool;
+    QTimer *bootTimer;
+    double lastWriteRate = -1;
+    XorrisoJobRunner *jobs;
+    IsoExtractor *extractor;
+    bool reloadWhenIdle = false;
     QString isoPath;
     QStringList pendingFiles;
+    Iso9660Reader reader;
+    IsoCatalog catalog;
+    IsoReaderSource readerSource{&reader, &catalog};
+    XorrisoSession session;
+    XorrisoSessionSource sessionSource{&session};
 
     void runXorriso(const QStringList &args) {
-        QProcess proc;
-        proc.start("xorriso", args);
-        proc.waitForFinished(-1);
-        output->append(">>> " + args.join(" "));
-        output->append(proc.readAllStandardOutput());
-        output->append(proc.readAllStandardError());
+        jobs->enqueue(args);
+    }
+
+    void showProgress(int, double percent, double bytesPerSecond, qint64 etaSeconds) {
+        if (percent < 0) return;
+        if (bytesPerSecond > 0) lastWriteRate = bytesPerSecond;
+        progressBar->setRange(0, 1000);
+        progressBar->setValue(int(percent * 10));
+        QStringList parts;
+        if (bytesPerSecond >= 0) parts << QString("%1 MB/s").arg(bytesPerSecond / (1024.0 * 1024.0), 0, 'f', 1);
+        if (etaSeconds >= 0) parts << QString("ETA %1:%2").arg(etaSeconds / 60).arg(etaSeconds % 60, 2, 10, QChar('0'));
+        progressLabel->setText(parts.join("  "));
     }
 
     void openIso() {
-        isoPath = QFileDialog::getOpenFileName(this, "Open ISO", "", "*.iso");
+        QString file = QFileDialog::getOpenFileName(this, "Open ISO", "", "*.iso");
+        if (file.isEmpty()) return;
+        isoPath = file;
+        loadIso();
+    }
+
+    void loadIso() {
         if (isoPath.isEmpty()) return;
-        tree->clear();
-        QProcess proc;
-        proc.start("xorriso", {"-indev", isoPath, "-ls_r", "/"});
-        proc.waitForFinished();
-        QStringList lines = QString(proc.readAllStandardOutput()).split('\n');
-        for (const QString &line : lines) {
-            if (line.startsWith("/")) addPathToTree(line);
-        }
-    }
-
-    void addPathToTree(const QString &path) {
-        QStringList parts = path.split("/", QString::SkipEmptyParts);
-        QTreeWidgetItem *parent = nullptr;
-        for (const QString &part : parts) {
-            QTreeWidgetItem *item = nullptr;
-            if (!parent) {
-                for (int i = 0; i < tree->topLevelItemCount(); ++i) {
-                    if (tree->topLevelItem(i)->text(0) == part) {
-                        item = tree->topLevelItem(i);
-                        break;
-                    }
-                }
-                if (!item) {
-                    item = new QTreeWidgetItem(QStringList(part));
-                    tree->addTopLevelItem(item);
-                }
-            } else {
-                bool found = false;
-                for (int i = 0; i < parent->childCount(); ++i) {
-                    if (parent->child(i)->text(0) == part) {
-                        item = parent->child(i);
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found) {
-                    item = new QTreeWidgetItem(QStringList(part));
-                    parent->addChild(item);
-                }
-            }
-            parent = item;
+        model->clear();
+        // One xorriso stays up with the image loaded for extraction and
+        // for listing images the native reader can't parse.
+        if (!session.start(isoPath)) output->append("Could not start a persistent xorriso session");
+
+        if (reader.open(isoPath)) {
+            // Directories are read from the image only as they get expanded,
+            // or from the cached catalog if this image was opened before.
+            if (!catalog.load(isoPath)) IsoCatalog::buildInBackground(isoPath);
+            model->setSource(&readerSource);
+        } else {
+            // Not something the native reader understands (UDF-only, damaged...).
+            catalog.close();
+            output->append("Native reader: " + reader.errorString() + ", listing through xorriso -lsl");
+            model->setSource(&sessionSource);
         }
+        changes.applyTo(model);
     }
 
     void extractFile() {
-        if (!tree->currentItem()) return;
-        QString isoItem = getFullPath(tree->currentItem());
+        const QModelIndexList selected = tree->selectionModel()->selectedRows();
+        if (selected.isEmpty() || extractor->isRunning()) return;
         QString outDir = QFileDialog::getExistingDirectory(this, "Select extraction directory");
-        if (!outDir.isEmpty()) {
-            runXorriso({"-osirrox", "on", "-indev", isoPath, "-extract", isoItem, outDir});
+        if (outDir.isEmpty()) return;
+
+        if (reader.isOpen()) {
+            // Everything in one parallel pass, read in image order.
+            for (const QModelIndex &index : selected) {
+                const QString isoItem = model->path(index);
+                const QString target = QDir(outDir).filePath(QFileInfo(isoItem).fileName());
+                const QString staged = changes.addedSource(isoItem);
+                const int n = staged.isEmpty() ? extractor->addFromImage(&reader, isoItem, target)
+                                               : extractor->addFromFile(staged, target);
+                if (n < 0) output->append("Not in the image yet: " + isoItem);
+            }
+            output->append(QString("Extracting %1 file(s), %2 MB")
+                           .arg(extractor->fileCount()).arg(extractor->totalBytes() / (1024.0 * 1024.0), 0, 'f', 1));
+            if (extractor->start()) {
+                progressBar->setRange(0, 1000);
+                cancelBtn->setEnabled(true);
+            } else {
+                extractor->clear();
+            }
+            return;
+        }
+
+        for (const QModelIndex &index : selected) {
+            const QString isoItem = model->path(index);
+            // -extract maps the ISO object onto the disk path itself.
+            const QString target = QDir(outDir).filePath(QFileInfo(isoItem).fileName());
+            if (!session.isRunning()) {
+                runXorriso(XorrisoCommands::extract(isoPath, {isoItem}, {target}));
+                continue;
+            }
+            output->append(">>> -extract " + isoItem + " " + target);
+            session.extract(isoItem, target, [this](const XorrisoSession::Reply &reply) {
+                for (const QString &line : reply.info) output->append(line);
+                output->append(QString("%1 in %2 ms").arg(reply.ok ? "Extracted" : "Extraction failed")
+                                                      .arg(reply.elapsedUs / 1000.0, 0, 'f', 1));
+            });
         }
     }
 
+    // Edits are only staged here; Apply Changes writes them all in one session.
     void addFile() {
         if (isoPath.isEmpty() || pendingFiles.isEmpty()) return;
         for (const QString &file : pendingFiles) {
             QString isoTarget = QInputDialog::getText(this, "Target Path", "Enter target path in ISO for: " + file);
             if (!isoTarget.isEmpty()) {
-                runXorriso({"-dev", isoPath, "-update", "once", file, isoTarget});
+                const int from = changes.size();
+                changes.add(isoTarget, file);
+                changes.applyTo(model, from);
             }
         }
         pendingFiles.clear();
-        openIso(); // refresh
+        updateApplyButton();
     }
 
     void deleteFile() {
-        if (!tree->currentItem()) return;
-        QString isoItem = getFullPath(tree->currentItem());
-        runXorriso({"-dev", isoPath, "-rm", isoItem});
-        openIso(); // refresh
+        QModelIndex current = tree->currentIndex();
+        if (!current.isValid()) return;
+        changes.remove(model->path(current));
+        model->removeIndex(current);
+        updateApplyButton();
+    }
+
+    void renameFile() {
+        QModelIndex current = tree->currentIndex();
+        if (!current.isValid()) return;
+        const QString from = model->path(current);
+        bool ok;
+        QString to = QInputDialog::getText(this, "Rename", "New path in ISO for: " + from,
+                                           QLineEdit::Normal, from, &ok);
+        if (!ok || to.isEmpty() || IsoChangeSet::normalize(to) == from) return;
+        const int start = changes.size();
+        changes.rename(from, to);
+        changes.applyTo(model, start);
+        updateApplyButton();
+    }
+
+    // Appending a session writes only new or changed file data plus a fresh
+    // directory tree; xorriso says how big that will be before we commit.
+    void applyChanges() {
+        if (isoPath.isEmpty() || changes.isEmpty() || applyJob >= 0 || estimateJob >= 0) return;
+        // -dev wants the image to itself.
+        session.stop();
+        estimateBlocks = -1;
+        estimateJob = jobs->enqueue(changes.estimateArguments(isoPath), "Estimate session size");
+        applyBtn->setEnabled(false);
+    }
+
+    void confirmAppend(bool ok) {
+        if (!ok || estimateBlocks < 0) {
+            output->append("Could not estimate the size of the new session");
+            session.start(isoPath);
+            updateApplyButton();
+            return;
+        }
+
+        const double bytes = estimateBlocks * 2048.0;
+        // Assume a local disk until a real write rate has been seen.
+        const double rate = lastWriteRate > 0 ? lastWriteRate : 100.0 * 1024 * 1024;
+        const double imageBytes = QFileInfo(isoPath).size();
+        const QString text = QString("Append a session with %1 staged change(s) to %2?\n\n"
+                                     "New session: %3 MB (%4% of the current image)\n"
+                                     "Estimated time: %5 s")
+                                 .arg(changes.size()).arg(QFileInfo(isoPath).fileName())
+                                 .arg(bytes / (1024.0 * 1024.0), 0, 'f', 1)
+                                 .arg(imageBytes > 0 ? bytes * 100.0 / imageBytes : 0.0, 0, 'f', 1)
+                                 .arg(qMax(1.0, bytes / rate), 0, 'f', 0);
+        if (QMessageBox::question(this, "Append Session", text) != QMessageBox::Yes) {
+            session.start(isoPath);
+            updateApplyButton();
+            return;
+        }
+
+        output->append(QString("Appending %1 staged change(s) as one session").arg(changes.size()));
+        applyJob = jobs->enqueue(changes.xorrisoArguments(isoPath), "Append session");
+        manifestJobs.insert(applyJob, isoPath);
+    }
+
+    void updateApplyButton() {
+        applyBtn->setEnabled(!changes.isEmpty() && applyJob < 0 && estimateJob < 0);
+        applyBtn->setText(changes.isEmpty() ? QString("Append Session")
+                                            : QString("Append Session (%1)").arg(changes.size()));
+    }
+
+    // Folds all sessions into a single-session image, dropping data that
+    // later sessions replaced. Staged changes are not included.
+    void compactIso() {
+        if (isoPath.isEmpty() || compactJob >= 0) return;
+        const QFileInfo fi(isoPath);
+        QString outFile = QFileDialog::getSaveFileName(this, "Save Compacted ISO",
+                                                       fi.dir().filePath(fi.completeBaseName() + "-compact.iso"));
+        if (outFile.isEmpty()) return;
+
+        compactTemp.clear();
+        if (QFileInfo(outFile).absoluteFilePath() == fi.absoluteFilePath()) {
+            // In place: write next to it and swap once xorriso succeeded.
+            compactTemp = isoPath + ".compact";
+            outFile = compactTemp;
+        }
+        QFile::remove(outFile);
+        compactOutput = outFile;
+        compactJob = jobs->enqueue(XorrisoCommands::compact(isoPath, outFile), "Compact");
+    }
+
+    void finishCompaction(bool ok) {
+        if (compactTemp.isEmpty()) {
+            if (ok) checkImage(compactOutput, true);
+            return;
+        }
+        if (!ok) {
+            QFile::remove(compactTemp);
+            return;
+        }
+        session.stop();
+        catalog.close();
+        reader.close();
+        // The temporary image sits next to the original, so this replaces it
+        // in one step; there is never a moment without either.
+        if (::rename(QFile::encodeName(compactTemp).constData(), QFile::encodeName(isoPath).constData()) == 0) {
+            output->append("Compacted " + isoPath);
+            checkImage(isoPath, true);
+        } else {
+            output->append("Could not replace " + isoPath + "; the compacted image is " + compactTemp);
+            checkImage(compactTemp, true);
+        }
+        reloadWhenIdle = true;
+    }
+
+    // Reads an image back once: after a build its checksums go into the
+    // manifests next to it, otherwise they are compared with those. MD5
+    // tags are checked either way.
+    void checkImage(const QString &path, bool writeManifest) {
+        checks.append(qMakePair(path, writeManifest));
+        if (checks.size() == 1) nextCheck();
+    }
+
+    void nextCheck() {
+        while (!checks.isEmpty() && !verifier->start(checks.first().first)) {
+            output->append(checks.first().first + ": " + verifier->result().errors.value(0));
+            checks.removeFirst();
+        }
+        cancelBtn->setEnabled(!checks.isEmpty() || jobs->isBusy());
+    }
+
+    void checkFinished() {
+        const QPair<QString, bool> check = checks.takeFirst();
+        const IsoVerifier::Result &result = verifier->result();
+        const QString name = QFileInfo(check.first).fileName();
+        int tags = 0;
+        for (const IsoVerifier::Tag &tag : result.tags) tags += tag.checked;
+        output->append(QString("%1: %2 MB read in %3 s (%4 MB/s), %5 file(s), %6 MD5 tag(s) checked")
+                           .arg(name).arg(result.bytes / 1048576.0, 0, 'f', 1).arg(result.seconds, 0, 'f', 1)
+                           .arg(result.bytes / 1048576.0 / qMax(result.seconds, 1e-9), 0, 'f', 1)
+                           .arg(result.files.size()).arg(tags));
+        QStringList problems = result.errors;
+        QString error;
+        if (result.cancelled) {
+            output->append(name + ": check cancelled");
+        } else if (check.second) {
+            if (result.ok() && IsoVerifier::writeManifests(check.first, result, &error))
+                output->append(name + ": checksums written to " + QFileInfo(IsoVerifier::manifestPath(check.first)).fileName());
+            else if (!error.isEmpty())
+                problems << error;
+        } else if (QFile::exists(IsoVerifier::manifestPath(check.first))) {
+            problems += IsoVerifier::compareWithManifests(check.first, result, &error);
+            if (!error.isEmpty()) problems << error;
+            else if (problems.isEmpty()) output->append(name + ": matches its checksum manifest");
+        } else {
+            output->append(name + ": no checksum manifest; image SHA-256 " + QString::fromLatin1(result.imageSha256));
+        }
+        for (const QString &problem : qAsConst(problems)) output->append("FAILED: " + problem);
+        nextCheck();
+    }
+
+    void exportTrace(const QString &name, const QByteArray &data) {
+        QString path = QFileDialog::getSaveFileName(this, "Export Stats", name);
+        if (path.isEmpty()) return;
+        QFile file(path);
+        if (file.open(QIODevice::WriteOnly) && file.write(data) == data.size())
+            output->append("Stats written to " + path);
+        else
+            output->append(path + ": " + file.errorString());
     }
 
     void rebuildIso() {
         QString outFile = QFileDialog::getSaveFileName(this, "Save Rebuilt ISO", "rebuilt.iso");
         if (!outFile.isEmpty()) {
-            runXorriso({"-indev", isoPath, "-outdev", outFile, "-commit"});
+            // Staged edits go into the new image; the open one is left as is.
+            manifestJobs.insert(jobs->enqueue(changes.xorrisoArguments(isoPath, outFile)), outFile);
         }
     }
 
@@ -180,31 +615,88 @@ private:
         QString isoDir = QFileDialog::getExistingDirectory(this, "Select ISO directory with boot files");
         QString bootImg = QFileDialog::getOpenFileName(this, "Select El Torito Boot Image (e.g. isolinux.bin)");
         QString outputIso = QFileDialog::getSaveFileName(this, "Save Bootable ISO", "bootable.iso");
-        if (!isoDir.isEmpty() && !bootImg.isEmpty() && !outputIso.isEmpty()) {
-            runXorriso({
-                "-as", "mkisofs",
-                "-o", outputIso,
-                "-b", QFileInfo(bootImg).fileName(),
-                "-no-emul-boot", "-boot-load-size", "4", "-boot-info-table",
-                "-V", "BOOTISO",
-                "-J", "-R",
-                "-isohybrid-mbr", bootImg,
-                "-c", "boot.cat",
-                "-input-charset", "utf-8",
-                "-quiet",
-                "-eltorito-boot", QFileInfo(bootImg).fileName(),
-                isoDir
-            });
+        if (isoDir.isEmpty() || bootImg.isEmpty() || outputIso.isEmpty()) return;
+        if (bootCompressor) {
+            output->append("A boot tree is still being compressed");
+            return;
         }
+        const bool compress = bootJob < 0
+            && QMessageBox::question(this, "Make Bootable ISO",
+                                     "Compress files with zisofs? Linux reads them transparently; the boot "
+                                     "loader's own files are left uncompressed.") == QMessageBox::Yes;
+        // Reproducible images need sort weights, which come from a scan of
+        // the tree.
+        const IsoReproducibleBuild reproducible = IsoReproducibleBuild::fromEnvironment();
+        if (!compress && !reproducible.isEnabled()) {
+            enqueueBootable(QStringList{isoDir}, bootImg, outputIso, false);
+            return;
+        }
+
+        // Only the compressed copies and the lists go to bootTree; the
+        // copies are grafted over isoDir. Compressing and scanning read the
+        // whole tree, so they run off the GUI thread.
+        bootTree.reset(new QTemporaryDir);
+        if (!bootTree->isValid()) {
+            output->append("Make bootable: " + bootTree->errorString());
+            bootTree.reset();
+            return;
+        }
+        bootCompressor.reset(new IsoZisofsCompressor);
+        bootCompressor->setMaxThreads(QThread::idealThreadCount());
+        XorrisoIsoManager *self = this;
+        IsoZisofsCompressor *compressor = bootCompressor.data();
+        const QString workDir = bootTree->path();
+        bootPool.start(new Task([self, compressor, isoDir, workDir, bootImg, outputIso, compress, reproducible]() {
+            QHash<QString, QString> copies;
+            IsoStagingArea staging;
+            QStringList sources{isoDir};
+            QString error;
+            bool ok = true;
+            if (compress) {
+                ok = compressor->compressTree(isoDir, workDir, copies, IsoZisofsCompressor::bootFiles(bootImg), &error);
+                if (ok) {
+                    IsoZisofsCompressor::stageTree(staging, "/", isoDir, copies);
+                    ok = staging.writePathLists(workDir, sources, &error);
+                }
+            } else {
+                staging.add("/", isoDir);
+            }
+            ok = ok && reproducible.writeSortWeights(staging, workDir, sources, &error);
+            QMetaObject::invokeMethod(self, [self, ok, error, sources, bootImg, outputIso, compress]() {
+                self->bootTreePrepared(ok, error, sources, bootImg, outputIso, compress);
+            }, Qt::QueuedConnection);
+        }));
+        progressBar->setRange(0, 1000);
+        progressBar->setValue(0);
+        cancelBtn->setEnabled(true);
+        bootTimer->start();
     }
 
-    QString getFullPath(QTreeWidgetItem *item) {
-        QStringList parts;
-        while (item) {
-            parts.prepend(item->text(0));
-            item = item->parent();
+    void bootTreePrepared(bool ok, const QString &error, const QStringList &sources, const QString &bootImg,
+                            const QString &outputIso, bool compress) {
+        bootTimer->stop();
+        progressBar->setRange(0, 100);
+        progressBar->setValue(0);
+        progressLabel->clear();
+        cancelBtn->setEnabled(jobs->isBusy());
+        QScopedPointer<IsoZisofsCompressor> compressor(bootCompressor.take());
+        if (!ok) {
+            output->append((compress ? "zisofs: " : "Make bootable: ") + error);
+            bootTree.reset();
+            return;
         }
-        return "/" + parts.join("/");
+        if (compress)
+            output->append(QString("zisofs: %1 file(s) compressed, %2 MB -> %3 MB")
+                               .arg(compressor->filesCompressed())
+                               .arg(compressor->bytesBefore() / 1048576.0, 0, 'f', 1)
+                               .arg(compressor->bytesAfter() / 1048576.0, 0, 'f', 1));
+        enqueueBootable(sources, bootImg, outputIso, compress);
+    }
+
+    void enqueueBootable(const QStringList &sources, const QString &bootImg, const QString &outputIso, bool compress) {
+        bootJob = jobs->enqueue(XorrisoCommands::makeBootable(sources, bootImg, outputIso, "BOOTISO", bootImg, compress),
+                                "Make bootable");
+        manifestJobs.insert(bootJob, outputIso);
     }
 };
 
@@ -212,6 +704,7 @@ private:
 
 int main(int argc, char *argv[]) {
     QApplication app(argc, argv);
+    IsoTrace::enableFromEnvironment();
     XorrisoIsoManager win;
     win.setWindowTitle("Xorriso ISO Manager");
     win.show();